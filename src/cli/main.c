@@ -35,6 +35,7 @@
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/points.h"
+#include "common/readahead.h"
 #include "config.h"
 #include "control/conf.h"
 #include "develop/imageop.h"
@@ -772,9 +773,11 @@ int main(int argc, char *arg[])
   // TODO: add a callback to set the bpp without going through the config
 
   int num = 1, res = 0;
+  dt_imageio_export_batch_begin();
   for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
   {
     const int id = GPOINTER_TO_INT(iter->data);
+    dt_readahead_images(g_list_next(iter));
     // TODO: have a parameter in command line to get the export presets
     dt_export_metadata_t metadata;
     metadata.flags = dt_lib_export_metadata_default_flags();
@@ -783,6 +786,7 @@ int main(int argc, char *arg[])
                       icc_type, icc_filename, icc_intent, &metadata) != 0)
       res = 1;
   }
+  dt_imageio_export_batch_end();
 
   // cleanup time
   if(storage->finalize_store) storage->finalize_store(storage, sdata);
@@ -0,0 +1,264 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/analysis_cache.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "control/conf.h"
+
+// the blobs are tiny, this is plenty for all images of a session
+#define ANALYSIS_CACHE_MAX_SIZE ((size_t)4 << 20)
+
+typedef struct _entry_t
+{
+  dt_hash_t key;    // combines imgid, name and hash, used by the hashtable
+  dt_hash_t hash;
+  dt_imgid_t imgid;
+  gchar *name;
+  uint64_t used;
+  size_t size;
+  uint8_t data[];
+} _entry_t;
+
+static dt_hash_t _key(const dt_imgid_t imgid, const char *name, const dt_hash_t hash)
+{
+  dt_hash_t key = dt_hash(DT_INITHASH, &imgid, sizeof(imgid));
+  key = dt_hash(key, name, strlen(name));
+  return dt_hash(key, &hash, sizeof(hash));
+}
+
+static inline size_t _entry_size(const size_t size)
+{
+  return sizeof(_entry_t) + size;
+}
+
+static void _entry_free(gpointer data)
+{
+  _entry_t *entry = data;
+  g_free(entry->name);
+  g_free(entry);
+}
+
+static _entry_t *_lookup(dt_analysis_cache_t *cache,
+                         const dt_imgid_t imgid,
+                         const char *name,
+                         const dt_hash_t hash)
+{
+  const dt_hash_t key = _key(imgid, name, hash);
+  _entry_t *entry = g_hash_table_lookup(cache->entries, &key);
+  if(entry && entry->imgid == imgid && entry->hash == hash && !strcmp(entry->name, name))
+    return entry;
+  return NULL;
+}
+
+// drop the least recently used entries, called with the lock held
+static void _evict(dt_analysis_cache_t *cache)
+{
+  while(cache->size > cache->max_size)
+  {
+    _entry_t *oldest = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, cache->entries);
+    while(g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      _entry_t *entry = value;
+      if(!oldest || entry->used < oldest->used) oldest = entry;
+    }
+    if(!oldest) break;
+    cache->size -= _entry_size(oldest->size);
+    cache->evictions++;
+    g_hash_table_remove(cache->entries, &oldest->key);
+  }
+}
+
+// insert into memory, returns FALSE if the same blob was already there
+static gboolean _insert(dt_analysis_cache_t *cache,
+                        const dt_imgid_t imgid,
+                        const char *name,
+                        const dt_hash_t hash,
+                        const void *data,
+                        const size_t size)
+{
+  _entry_t *old = _lookup(cache, imgid, name, hash);
+  if(old && old->size == size && !memcmp(old->data, data, size))
+  {
+    old->used = ++cache->tick;
+    return FALSE;
+  }
+  if(old)
+  {
+    cache->size -= _entry_size(old->size);
+    g_hash_table_remove(cache->entries, &old->key);
+  }
+
+  _entry_t *entry = g_malloc(_entry_size(size));
+  entry->key = _key(imgid, name, hash);
+  entry->hash = hash;
+  entry->imgid = imgid;
+  entry->name = g_strdup(name);
+  entry->used = ++cache->tick;
+  entry->size = size;
+  memcpy(entry->data, data, size);
+  g_hash_table_replace(cache->entries, &entry->key, entry);
+  cache->size += _entry_size(size);
+  _evict(cache);
+  return TRUE;
+}
+
+static gboolean _db_read(const dt_imgid_t imgid,
+                         const char *name,
+                         const dt_hash_t hash,
+                         void *data,
+                         const size_t size)
+{
+  gboolean found = FALSE;
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT hash, data"
+                              " FROM main.analysis_cache"
+                              " WHERE imgid = ?1 AND name = ?2",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, name, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) == SQLITE_ROW
+     && (dt_hash_t)sqlite3_column_int64(stmt, 0) == hash
+     && (size_t)sqlite3_column_bytes(stmt, 1) == size)
+  {
+    memcpy(data, sqlite3_column_blob(stmt, 1), size);
+    found = TRUE;
+  }
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+static void _db_write(const dt_imgid_t imgid,
+                      const char *name,
+                      const dt_hash_t hash,
+                      const void *data,
+                      const size_t size)
+{
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT OR REPLACE INTO main.analysis_cache"
+                              " (imgid, name, hash, data)"
+                              " VALUES (?1, ?2, ?3, ?4)",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, name, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT64(stmt, 3, (sqlite3_int64)hash);
+  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 4, data, (int)size, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+void dt_analysis_cache_init(dt_analysis_cache_t *cache)
+{
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  cache->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, _entry_free);
+  cache->max_size = ANALYSIS_CACHE_MAX_SIZE;
+  cache->persistent = dt_conf_get_bool("analysis_cache_persistent");
+}
+
+void dt_analysis_cache_cleanup(dt_analysis_cache_t *cache)
+{
+  dt_analysis_cache_print_stats(cache);
+  g_hash_table_destroy(cache->entries);
+  cache->entries = NULL;
+  dt_pthread_mutex_destroy(&cache->lock);
+}
+
+gboolean dt_analysis_cache_get(const dt_imgid_t imgid,
+                               const char *name,
+                               const dt_hash_t hash,
+                               void *data,
+                               const size_t size)
+{
+  dt_analysis_cache_t *cache = darktable.analysis_cache;
+  if(!cache) return FALSE;
+
+  dt_pthread_mutex_lock(&cache->lock);
+  _entry_t *entry = _lookup(cache, imgid, name, hash);
+  const gboolean hit = entry && entry->size == size;
+  if(hit)
+  {
+    memcpy(data, entry->data, size);
+    entry->used = ++cache->tick;
+    cache->hits++;
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+  if(hit) return TRUE;
+
+  const gboolean stored = cache->persistent
+                          && dt_is_valid_imgid(imgid)
+                          && _db_read(imgid, name, hash, data, size);
+
+  dt_pthread_mutex_lock(&cache->lock);
+  if(stored)
+  {
+    _insert(cache, imgid, name, hash, data, size);
+    cache->db_hits++;
+  }
+  else
+    cache->misses++;
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  return stored;
+}
+
+void dt_analysis_cache_put(const dt_imgid_t imgid,
+                           const char *name,
+                           const dt_hash_t hash,
+                           const void *data,
+                           const size_t size)
+{
+  dt_analysis_cache_t *cache = darktable.analysis_cache;
+  if(!cache) return;
+
+  dt_pthread_mutex_lock(&cache->lock);
+  const gboolean changed = _insert(cache, imgid, name, hash, data, size);
+  if(changed) cache->stores++;
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  if(changed && cache->persistent && dt_is_valid_imgid(imgid))
+    _db_write(imgid, name, hash, data, size);
+}
+
+void dt_analysis_cache_print_stats(const dt_analysis_cache_t *cache)
+{
+  const uint64_t lookups = cache->hits + cache->db_hits + cache->misses;
+  dt_print(DT_DEBUG_PERF,
+           "[analysis cache] %" PRIu64 " lookups, %.1f%% hits (%" PRIu64 " from library),"
+           " %" PRIu64 " stored, %" PRIu64 " evicted, %u entries, %zu bytes%s\n",
+           lookups, lookups ? 100.0 * (cache->hits + cache->db_hits) / lookups : 0.0,
+           cache->db_hits, cache->stores, cache->evictions,
+           cache->entries ? g_hash_table_size(cache->entries) : 0, cache->size,
+           cache->persistent ? ", persistent" : "");
+}
+
+#undef ANALYSIS_CACHE_MAX_SIZE
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
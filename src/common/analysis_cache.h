@@ -0,0 +1,82 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/darktable.h"
+
+/*
+ * Cache for statistics that modules compute from the whole image.
+ *
+ * Some modules analyse the complete input before they can process anything,
+ * e.g. the chrominance correction of the opposed highlights reconstruction.
+ * The result only depends on the image and a few parameters, so it is kept
+ * here, keyed by the image, a name chosen by the module and a hash of
+ * everything the result depends on. All pipes share the entries.
+ *
+ * Entries are small blobs, the least recently used ones are dropped when the
+ * cache grows beyond its size limit. If `analysis_cache_persistent` is set,
+ * entries are also written to the library so they survive a restart; there
+ * is one row per image and name, the hash decides whether it is still valid.
+ * Modules must include a version of their algorithm into the hash if the
+ * blob layout or the maths change.
+ */
+
+typedef struct dt_analysis_cache_t
+{
+  dt_pthread_mutex_t lock;
+  GHashTable *entries;
+  size_t size;
+  size_t max_size;
+  uint64_t tick;
+  gboolean persistent;
+
+  // statistics
+  uint64_t hits;
+  uint64_t db_hits;
+  uint64_t misses;
+  uint64_t stores;
+  uint64_t evictions;
+} dt_analysis_cache_t;
+
+void dt_analysis_cache_init(dt_analysis_cache_t *cache);
+void dt_analysis_cache_cleanup(dt_analysis_cache_t *cache);
+
+/** copy the blob stored for imgid, name and hash into data.
+ *  returns FALSE if there is no such entry or it has a different size. */
+gboolean dt_analysis_cache_get(const dt_imgid_t imgid,
+                               const char *name,
+                               const dt_hash_t hash,
+                               void *data,
+                               const size_t size);
+
+/** store a copy of data for imgid, name and hash. the library only keeps the latest one per imgid and name */
+void dt_analysis_cache_put(const dt_imgid_t imgid,
+                           const char *name,
+                           const dt_hash_t hash,
+                           const void *data,
+                           const size_t size);
+
+/** print hit rates, with -d perf */
+void dt_analysis_cache_print_stats(const dt_analysis_cache_t *cache);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
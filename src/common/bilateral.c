@@ -1,6 +1,6 @@
 /*
     This file is part of darktable,
-    Copyright (C) 2016-2023 darktable developers.
+    Copyright (C) 2016-2024 darktable developers.
 
     darktable is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -27,6 +27,7 @@
 #include "common/bilateral.h"
 #include "common/darktable.h" // for CLAMPS, dt_alloc_align, dt_free_align
 #include "develop/imageop.h"
+#include "develop/pixelpipe_cache.h"
 #include <glib.h>             // for MIN, MAX
 #include <math.h>             // for roundf
 #include <stdlib.h>           // for size_t, free, malloc, NULL
@@ -135,39 +136,80 @@ size_t dt_bilateral_singlebuffer_size2(const int width,
 }
 #endif /* !HAVE_OPENCL */
 
-static size_t image_to_grid(const dt_bilateral_t *const b,
-                            const int i,
-                            const int j,
-                            const float L,
-                            float *xf,
-                            float *yf,
-                            float *zf)
+// number of pixels or grid values handled as one vector run
+#define DT_COMMON_BILATERAL_RUN 64
+#define DT_COMMON_BILATERAL_BLUR_RUN 256
+
+// grids of the darkroom pipes up to this size are kept for the next run
+#define DT_COMMON_BILATERAL_MAX_CACHED ((size_t)64 << 20)
+
+// grid coordinates of a run of n pixels of one image row starting at column i0: the
+// index of the lower grid point relative to the grid row and the fractions along x
+// and z.  The loop is free of dependencies, so it vectorizes, and the scatter or
+// gather using the results only has to do the memory accesses.
+__DT_CLONE_TARGETS__
+static void _grid_run(const dt_bilateral_t *const b,
+                      const float *const in,
+                      const int i0,
+                      const int n,
+                      int *const restrict gi,
+                      float *const restrict xf,
+                      float *const restrict zf)
 {
-  float x = CLAMPS(i * b->sigma_s_inv, 0, b->size_x - 1);
-  float y = CLAMPS(j * b->sigma_s_inv, 0, b->size_y - 1);
-  float z = CLAMPS(L * b->sigma_r_inv, 0, b->size_z - 1);
-  const int xi = MIN((int)x, b->size_x - 2);
-  const int yi = MIN((int)y, b->size_y - 2);
-  const int zi = MIN((int)z, b->size_z - 2);
-  *xf = x - xi;
-  *yf = y - yi;
-  *zf = z - zi;
-  return ((xi + yi * b->size_x) * b->size_z) + zi;
+  const float sigma_s_inv = b->sigma_s_inv;
+  const float sigma_r_inv = b->sigma_r_inv;
+  const float xmax = b->size_x - 1;
+  const float zmax = b->size_z - 1;
+  const int xlast = b->size_x - 2;
+  const int zlast = b->size_z - 2;
+  const int ox = b->size_z;
+
+  DT_OMP_SIMD()
+  for(int k = 0; k < n; k++)
+  {
+    const float x = CLAMPS((i0 + k) * sigma_s_inv, 0, xmax);
+    const float z = CLAMPS(in[4 * k] * sigma_r_inv, 0, zmax);
+    const int xi = MIN((int)x, xlast);
+    const int zi = MIN((int)z, zlast);
+    xf[k] = x - xi;
+    zf[k] = z - zi;
+    gi[k] = xi * ox + zi;
+  }
 }
 
-static size_t image_to_relgrid(const dt_bilateral_t *const b,
-                               const int i,
-                               const float L,
-                               float *xf,
-                               float *zf)
+// trilinear lookup of a run of n pixels in the grid row starting at row, with the
+// fraction yf along y, scaled by norm
+__DT_CLONE_TARGETS__
+static void _slice_run(const dt_bilateral_t *const b,
+                       const float *const row,
+                       const float yf,
+                       const float norm,
+                       const float *const in,
+                       const int i0,
+                       const int n,
+                       float *const restrict detail)
 {
-  float x = CLAMPS(i * b->sigma_s_inv, 0, b->size_x - 1);
-  float z = CLAMPS(L * b->sigma_r_inv, 0, b->size_z - 1);
-  const int xi = MIN((int)x, b->size_x - 2);
-  const int zi = MIN((int)z, b->size_z - 2);
-  *xf = x - xi;
-  *zf = z - zi;
-  return (xi * b->size_z) + zi;
+  const int ox = b->size_z;
+  const int oy = b->size_x * b->size_z;
+  const int oz = 1;
+  int gi[DT_COMMON_BILATERAL_RUN];
+  float xf[DT_COMMON_BILATERAL_RUN];
+  float zf[DT_COMMON_BILATERAL_RUN];
+  _grid_run(b, in, i0, n, gi, xf, zf);
+
+  DT_OMP_SIMD()
+  for(int k = 0; k < n; k++)
+  {
+    const float *const g = row + gi[k];
+    detail[k] = norm * (g[0] * (1.0f - xf[k]) * (1.0f - yf) * (1.0f - zf[k])
+                        + g[ox] * (xf[k]) * (1.0f - yf) * (1.0f - zf[k])
+                        + g[oy] * (1.0f - xf[k]) * (yf) * (1.0f - zf[k])
+                        + g[ox + oy] * (xf[k]) * (yf) * (1.0f - zf[k])
+                        + g[oz] * (1.0f - xf[k]) * (1.0f - yf) * (zf[k])
+                        + g[ox + oz] * (xf[k]) * (1.0f - yf) * (zf[k])
+                        + g[oy + oz] * (1.0f - xf[k]) * (yf) * (zf[k])
+                        + g[ox + oy + oz] * (xf[k]) * (yf) * (zf[k]));
+  }
 }
 
 dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
@@ -183,6 +225,7 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   b->numslices = dt_get_num_threads();
   b->sliceheight = (height + b->numslices - 1) / b->numslices;
   b->slicerows = (b->size_y + b->numslices - 1) / b->numslices + 2;
+  b->hash = 0;
   b->buf = dt_calloc_align_float(b->size_x * b->size_z * b->numslices * b->slicerows);
   if(!b->buf)
   {
@@ -222,7 +265,7 @@ void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in)
     oz + oy + ox
   };
 
-  DT_OMP_FOR()  
+  DT_OMP_FOR()
   for(int slice = 0; slice < b->numslices; slice++)
   {
     const int firstrow = slice * b->sliceheight;
@@ -231,6 +274,9 @@ void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in)
     // splats, and subtract that from the first row the current thread
     // should use to get an offset
     const int slice_offset = slice * b->slicerows - (int)(firstrow * b->sigma_s_inv);
+    int gi[DT_COMMON_BILATERAL_RUN];
+    float xf[DT_COMMON_BILATERAL_RUN];
+    float zf[DT_COMMON_BILATERAL_RUN];
     // now iterate over the rows of the current horizontal slice
     for(int j = firstrow; j < lastrow; j++)
     {
@@ -238,27 +284,31 @@ void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in)
       const int yi = MIN((int)y, b->size_y - 2);
       const float yf = y - yi;
       const size_t base = (size_t)(yi + slice_offset) * oy;
-      for(int i = 0; i < b->width; i++)
+      for(int i0 = 0; i0 < b->width; i0 += DT_COMMON_BILATERAL_RUN)
       {
-        size_t index = 4 * (j * b->width + i);
-        float xf, zf;
-        const float L = in[index];
-        // nearest neighbour splatting:
-        const size_t grid_index = base + image_to_relgrid(b, i, L, &xf, &zf);
-        // sum up payload here
-        const dt_aligned_pixel_t contrib =
-        {
-          // precompute the contributions along the first two dimensions:
-          (1.0f - xf) * (1.0f - yf) * 100.0f / sigma_s,
-          xf * (1.0f - yf) * 100.0f / sigma_s,
-          (1.0f - xf) * yf * 100.0f / sigma_s,
-          xf * yf * 100.0f / sigma_s
-        };
-        DT_OMP_SIMD(aligned(buf:64))
-        for(int k = 0; k < 4; k++)
+        const int n = MIN(DT_COMMON_BILATERAL_RUN, b->width - i0);
+        _grid_run(b, in + 4 * ((size_t)j * b->width + i0), i0, n, gi, xf, zf);
+        // neighbouring pixels mostly hit the same grid points, so the
+        // scatter has to stay serial
+        for(int k = 0; k < n; k++)
         {
-          buf[grid_index + offsets[k]] += (contrib[k] * (1.0f - zf));
-          buf[grid_index + offsets[k+4]] += (contrib[k] * zf);
+          // nearest neighbour splatting:
+          const size_t grid_index = base + gi[k];
+          // sum up payload here
+          const dt_aligned_pixel_t contrib =
+          {
+            // precompute the contributions along the first two dimensions:
+            (1.0f - xf[k]) * (1.0f - yf) * 100.0f / sigma_s,
+            xf[k] * (1.0f - yf) * 100.0f / sigma_s,
+            (1.0f - xf[k]) * yf * 100.0f / sigma_s,
+            xf[k] * yf * 100.0f / sigma_s
+          };
+          DT_OMP_SIMD(aligned(buf:64))
+          for(int c = 0; c < 4; c++)
+          {
+            buf[grid_index + offsets[c]] += (contrib[c] * (1.0f - zf[k]));
+            buf[grid_index + offsets[c+4]] += (contrib[c] * zf[k]);
+          }
         }
       }
     }
@@ -330,52 +380,78 @@ static void blur_line_z(float *buf,
   }
 }
 
-DT_OMP_DECLARE_SIMD(aligned(buf:64))
-static void blur_line(float *buf,
-                      const int offset1,
-                      const int offset2,
-                      const int offset3,
-                      const int size1,
-                      const int size2,
-                      const int size3)
+// 1 4 6 4 1 gaussian along an axis with n grid points, stride apart, for a run of
+// len neighbouring values.  All values of the run are filtered together, so the
+// loops vectorize and read the grid in memory order instead of striding through it
+// one line at a time.
+__DT_CLONE_TARGETS__
+static void _blur_run(float *const buf,
+                      const size_t stride,
+                      const int n,
+                      const int len)
 {
   const float w0 = 6.f / 16.f;
   const float w1 = 4.f / 16.f;
   const float w2 = 1.f / 16.f;
-  DT_OMP_FOR()
-  for(int k = 0; k < size1; k++)
+  // unfiltered values one and two grid points back, zero outside of the grid
+  float DT_ALIGNED_ARRAY prev1[DT_COMMON_BILATERAL_BLUR_RUN] = { 0.0f };
+  float DT_ALIGNED_ARRAY prev2[DT_COMMON_BILATERAL_BLUR_RUN] = { 0.0f };
+
+  for(int i = 0; i < n; i++)
   {
-    size_t index = (size_t)k * offset1;
-    for(int j = 0; j < size2; j++)
+    float *const restrict row = buf + i * stride;
+    const float *const restrict next1 = row + stride;
+    const float *const restrict next2 = row + 2 * stride;
+    if(i + 2 < n)
     {
-      float tmp1 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * buf[index + offset3]
-        + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp1)
-        + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      for(int i = 2; i < size3 - 2; i++)
+      DT_OMP_SIMD()
+      for(int c = 0; c < len; c++)
       {
-        const float tmp3 = buf[index];
-        buf[index]
-            = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2)
-          + w2 * (buf[index + 2 * offset3] + tmp1);
-        index += offset3;
-        tmp1 = tmp2;
-        tmp2 = tmp3;
+        const float v = row[c];
+        row[c] = v * w0 + w1 * (next1[c] + prev1[c]) + w2 * (next2[c] + prev2[c]);
+        prev2[c] = prev1[c];
+        prev1[c] = v;
       }
-      const float tmp3 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2) + w2 * tmp1;
-      index += offset3;
-      buf[index] = buf[index] * w0 + w1 * tmp3 + w2 * tmp2;
-      index += offset3;
-      index += offset2 - offset3 * size3;
+    }
+    else if(i + 1 < n)
+    {
+      DT_OMP_SIMD()
+      for(int c = 0; c < len; c++)
+      {
+        const float v = row[c];
+        row[c] = v * w0 + w1 * (next1[c] + prev1[c]) + w2 * prev2[c];
+        prev2[c] = prev1[c];
+        prev1[c] = v;
+      }
+    }
+    else
+    {
+      DT_OMP_SIMD()
+      for(int c = 0; c < len; c++)
+        row[c] = row[c] * w0 + w1 * prev1[c] + w2 * prev2[c];
     }
   }
 }
 
+// blur along the axis with n points, stride apart, for each of the planes of len
+// contiguous values, split into runs that are spread over the threads
+static void _blur_axis(float *const buf,
+                       const int planes,
+                       const size_t plane_stride,
+                       const size_t stride,
+                       const int n,
+                       const int len)
+{
+  const int runs = (len + DT_COMMON_BILATERAL_BLUR_RUN - 1) / DT_COMMON_BILATERAL_BLUR_RUN;
+  DT_OMP_FOR(collapse(2))
+  for(int p = 0; p < planes; p++)
+    for(int r = 0; r < runs; r++)
+    {
+      const int start = r * DT_COMMON_BILATERAL_BLUR_RUN;
+      _blur_run(buf + p * plane_stride + start, stride, n,
+                MIN(DT_COMMON_BILATERAL_BLUR_RUN, len - start));
+    }
+}
 
 void dt_bilateral_blur(const dt_bilateral_t *b)
 {
@@ -385,14 +461,56 @@ void dt_bilateral_blur(const dt_bilateral_t *b)
   const int ox = b->size_z;
   const int oy = b->size_x * b->size_z;
   const int oz = 1;
-  // gaussian up to 3 sigma
-  blur_line(b->buf, oz, oy, ox, b->size_z, b->size_y, b->size_x);
-  // gaussian up to 3 sigma
-  blur_line(b->buf, oz, ox, oy, b->size_z, b->size_x, b->size_y);
+  // gaussian up to 3 sigma along x, the z values of a grid point are contiguous
+  _blur_axis(b->buf, b->size_y, oy, ox, b->size_x, b->size_z);
+  // gaussian up to 3 sigma along y, the whole x-z plane is contiguous
+  _blur_axis(b->buf, 1, 0, oy, b->size_y, oy);
   // -2 derivative of the gaussian up to 3 sigma: x*exp(-x*x)
   blur_line_z(b->buf, ox, oy, oz, b->size_x, b->size_y, b->size_z);
 }
 
+dt_bilateral_t *dt_bilateral_init_cached(dt_bilateral_t **cache,
+                                         struct dt_dev_pixelpipe_iop_t *piece,
+                                         const float *const in,
+                                         const struct dt_iop_roi_t *const roi,
+                                         const float sigma_s,
+                                         const float sigma_r)
+{
+  // only the darkroom pipes run the same input again with other module parameters
+  const gboolean keep = (piece->pipe->type & DT_DEV_PIXELPIPE_SCREEN) != 0;
+  dt_hash_t hash = DT_INITHASH;
+  if(keep)
+  {
+    // the cache key of our input buffer, see dt_dev_pixelpipe_process_rec()
+    const int position = g_list_index(piece->pipe->nodes, piece);
+    hash = dt_dev_pixelpipe_cache_hash(piece->pipe->image.id, roi, piece->pipe, position);
+    const float sigma[2] = { sigma_s, sigma_r };
+    hash = dt_hash(hash, sigma, sizeof(sigma));
+    dt_bilateral_t *b = *cache;
+    if(b && b->hash == hash && b->width == roi->width && b->height == roi->height)
+    {
+      dt_print_pipe(DT_DEBUG_PERF, "bilateral grid", piece->pipe, piece->module,
+                    DT_DEVICE_CPU, roi, NULL, "reused [%zu %zu %zu]\n",
+                    b->size_x, b->size_y, b->size_z);
+      return b;
+    }
+  }
+  dt_bilateral_free(*cache);
+  *cache = NULL;
+
+  dt_bilateral_t *b = dt_bilateral_init(roi->width, roi->height, sigma_s, sigma_r);
+  if(!b) return NULL;
+  dt_bilateral_splat(b, in);
+  dt_bilateral_blur(b);
+
+  const size_t bytes = sizeof(float) * b->size_x * b->size_z * b->numslices * b->slicerows;
+  if(keep && bytes <= DT_COMMON_BILATERAL_MAX_CACHED)
+  {
+    b->hash = hash;
+    *cache = b;
+  }
+  return b;
+}
 
 DT_OMP_DECLARE_SIMD(aligned(out, in :64))
 void dt_bilateral_slice(const dt_bilateral_t *const b,
@@ -402,36 +520,32 @@ void dt_bilateral_slice(const dt_bilateral_t *const b,
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = b->size_z;
   const int oy = b->size_x * b->size_z;
-  const int oz = 1;
   float *const buf = b->buf;
   const int width = b->width;
   const int height = b->height;
 
   if(!buf) return;
-  DT_OMP_FOR(collapse(2))
+  DT_OMP_FOR()
   for(int j = 0; j < height; j++)
   {
-    for(int i = 0; i < width; i++)
+    const float y = CLAMPS(j * b->sigma_s_inv, 0, b->size_y - 1);
+    const int yi = MIN((int)y, b->size_y - 2);
+    const float yf = y - yi;
+    const float *const row = buf + (size_t)yi * oy;
+    float DT_ALIGNED_ARRAY Ldetail[DT_COMMON_BILATERAL_RUN];
+    for(int i0 = 0; i0 < width; i0 += DT_COMMON_BILATERAL_RUN)
     {
-      size_t index = 4 * (j * width + i);
-      float xf, yf, zf;
-      const float L = in[index];
+      const int n = MIN(DT_COMMON_BILATERAL_RUN, width - i0);
+      const size_t index = 4 * ((size_t)j * width + i0);
       // trilinear lookup:
-      const size_t gi = image_to_grid(b, i, j, L, &xf, &yf, &zf);
-      const float Lout = fmaxf( 0.0f, L
-                         + norm * (buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                   + buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                   + buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                   + buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                   + buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                   + buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                   + buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                   + buf[gi + ox + oy + oz] * (xf) * (yf) * (zf)));
-      // copy color and mask, then update L
-      copy_pixel(out + index, in + index);
-      out[index] = Lout;
+      _slice_run(b, row, yf, norm, in + index, i0, n, Ldetail);
+      for(int k = 0; k < n; k++)
+      {
+        // copy color and mask, then update L
+        copy_pixel(out + index + 4 * k, in + index + 4 * k);
+        out[index + 4 * k] = fmaxf(0.0f, in[index + 4 * k] + Ldetail[k]);
+      }
     }
   }
 }
@@ -444,33 +558,28 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b,
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = b->size_z;
   const int oy = b->size_x * b->size_z;
-  const int oz = 1;
   float *const buf = b->buf;
   const int width = b->width;
   const int height = b->height;
 
   if(!buf) return;
-  DT_OMP_FOR(collapse(2))
+  DT_OMP_FOR()
   for(int j = 0; j < height; j++)
   {
-    for(int i = 0; i < width; i++)
+    const float y = CLAMPS(j * b->sigma_s_inv, 0, b->size_y - 1);
+    const int yi = MIN((int)y, b->size_y - 2);
+    const float yf = y - yi;
+    const float *const row = buf + (size_t)yi * oy;
+    float DT_ALIGNED_ARRAY Ldetail[DT_COMMON_BILATERAL_RUN];
+    for(int i0 = 0; i0 < width; i0 += DT_COMMON_BILATERAL_RUN)
     {
-      size_t index = 4 * (j * width + i);
-      float xf, yf, zf;
-      const float L = in[index];
+      const int n = MIN(DT_COMMON_BILATERAL_RUN, width - i0);
+      const size_t index = 4 * ((size_t)j * width + i0);
       // trilinear lookup:
-      const size_t gi = image_to_grid(b, i, j, L, &xf, &yf, &zf);
-      const float Lout = norm * (buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                 + buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                 + buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                 + buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                 + buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                 + buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                 + buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                 + buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
-      out[index] = MAX(0.0f, out[index] + Lout);
+      _slice_run(b, row, yf, norm, in + index, i0, n, Ldetail);
+      for(int k = 0; k < n; k++)
+        out[index + 4 * k] = MAX(0.0f, out[index + 4 * k] + Ldetail[k]);
     }
   }
 }
@@ -484,6 +593,9 @@ void dt_bilateral_free(dt_bilateral_t *b)
 
 #undef DT_COMMON_BILATERAL_MAX_RES_S
 #undef DT_COMMON_BILATERAL_MAX_RES_R
+#undef DT_COMMON_BILATERAL_RUN
+#undef DT_COMMON_BILATERAL_BLUR_RUN
+#undef DT_COMMON_BILATERAL_MAX_CACHED
 
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
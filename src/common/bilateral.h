@@ -1,6 +1,6 @@
 /*
     This file is part of darktable,
-    Copyright (C) 2012-2023 darktable developers.
+    Copyright (C) 2012-2024 darktable developers.
 
     darktable is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -19,6 +19,10 @@
 #pragma once
 
 #include <stddef.h> // for size_t
+#include <stdint.h> // for uint64_t
+
+struct dt_dev_pixelpipe_iop_t;
+struct dt_iop_roi_t;
 
 typedef struct dt_bilateral_t
 {
@@ -27,6 +31,7 @@ typedef struct dt_bilateral_t
   int numslices, sliceheight, slicerows; //height--in input image, rows--in grid
   float sigma_s, sigma_r;
   float sigma_s_inv, sigma_r_inv;  // reciprocals of sigma_s and sigma_r to avoid divisions
+  uint64_t hash;                   // input and sigmas of a grid kept by dt_bilateral_init_cached()
   float *buf __attribute__((aligned(64)));
 } __attribute__((packed)) dt_bilateral_t;
 
@@ -58,6 +63,17 @@ dt_bilateral_t *dt_bilateral_init(const int width,      // width of input image
                                   const float sigma_s,  // spatial sigma (blur pixel coords)
                                   const float sigma_r); // range sigma (blur luma values)
 
+/** splatted and blurred grid of the input of piece, ready for slicing. The darkroom pipes keep
+ * the grid in *cache and return it again as long as the input and sigmas don't change, so
+ * parameters only used for slicing don't need a new grid. Free the result with
+ * dt_bilateral_free() if it is not *cache, *cache itself in cleanup_pipe(). */
+dt_bilateral_t *dt_bilateral_init_cached(dt_bilateral_t **cache,
+                                         struct dt_dev_pixelpipe_iop_t *piece,
+                                         const float *const in,
+                                         const struct dt_iop_roi_t *const roi,
+                                         const float sigma_s,
+                                         const float sigma_r);
+
 void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in);
 
 void dt_bilateral_blur(const dt_bilateral_t *b);
@@ -0,0 +1,372 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/buffer_pool.h"
+#include "common/darktable.h"
+
+#include <math.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// blocks start on a huge page boundary
+#define DT_BUFFER_POOL_ALIGN ((size_t)2 << 20)
+#define DT_BUFFER_POOL_CLASSES 96
+// seconds an idle block is kept
+#ifndef DT_BUFFER_POOL_MAX_IDLE
+#define DT_BUFFER_POOL_MAX_IDLE 10.0
+#endif
+
+typedef struct dt_buffer_pool_block_t
+{
+  void *mem;
+  struct dt_buffer_pool_block_t *next; // in the free list of its class
+  size_t size;
+  int cls;
+  double freed;
+} dt_buffer_pool_block_t;
+
+// the block a thread freed last, reused by that thread without taking the lock.
+// other threads only ever take the block out, when trimming.
+typedef struct dt_buffer_pool_slot_t
+{
+  dt_buffer_pool_block_t *block;
+} dt_buffer_pool_slot_t;
+
+static GMutex _lock;
+static GHashTable *_blocks = NULL; // mem -> block, for all blocks of the pool
+static GList *_slots = NULL;       // of all threads
+static dt_buffer_pool_block_t *_free_list[DT_BUFFER_POOL_CLASSES] = { NULL };
+
+// gives idle blocks back after DT_BUFFER_POOL_MAX_IDLE
+static GThread *_reaper = NULL;
+static GCond _reaper_cond;
+static gboolean _closed = FALSE;
+
+// statistics, updated atomically
+static gsize _idle_bytes = 0;
+static gsize _live_bytes = 0;
+static gsize _reused = 0;
+static gsize _reused_bytes = 0;
+static gsize _allocated = 0;
+static gsize _allocated_bytes = 0;
+
+static inline void _count(gsize *counter, const gssize value)
+{
+  g_atomic_pointer_add(counter, value);
+}
+
+static inline gsize _get(gsize *counter)
+{
+  return (gsize)g_atomic_pointer_get(counter);
+}
+
+static size_t _class_size(const int cls)
+{
+  // four classes per octave, rounded up to whole huge pages
+  const double size = (double)DT_BUFFER_POOL_MIN_SIZE * exp2(cls / 4.0);
+  return dt_round_size((size_t)size, DT_BUFFER_POOL_ALIGN);
+}
+
+static int _class_of(const size_t size)
+{
+  int cls = MAX(0, (int)ceil(4.0 * log2((double)size / DT_BUFFER_POOL_MIN_SIZE)));
+  // the class sizes are rounded up, a smaller class may fit already
+  while(cls > 0 && _class_size(cls - 1) >= size) cls--;
+  while(cls < DT_BUFFER_POOL_CLASSES && _class_size(cls) < size) cls++;
+  return cls;
+}
+
+// the resources aren't known during early startup, don't keep anything then
+static inline gboolean _resources_known(void)
+{
+  return darktable.dtresources.total_memory > 0;
+}
+
+static size_t _cap(void)
+{
+  return _resources_known() ? dt_get_available_mem() / 4 : 0;
+}
+
+// must be called with the lock held
+static void _block_release(dt_buffer_pool_block_t *b)
+{
+  g_hash_table_remove(_blocks, b->mem);
+#ifdef _WIN32
+  _aligned_free(b->mem);
+#else
+  free(b->mem);
+#endif
+  g_free(b);
+}
+
+// must be called with the lock held
+static void _to_free_list(dt_buffer_pool_block_t *b)
+{
+  b->next = _free_list[b->cls];
+  _free_list[b->cls] = b;
+}
+
+static dt_buffer_pool_block_t *_slot_take(dt_buffer_pool_slot_t *slot,
+                                          dt_buffer_pool_block_t *b)
+{
+  return b && g_atomic_pointer_compare_and_exchange(&slot->block, b, NULL) ? b : NULL;
+}
+
+// must be called with the lock held. gives back the idle blocks freed before
+// the given time, all of them for INFINITY, from the lists of all classes and
+// the slots of all threads
+static void _expire(const double before)
+{
+  for(int cls = 0; cls < DT_BUFFER_POOL_CLASSES; cls++)
+  {
+    for(dt_buffer_pool_block_t **b = &_free_list[cls]; *b;)
+    {
+      if((*b)->freed < before)
+      {
+        dt_buffer_pool_block_t *old = *b;
+        *b = old->next;
+        _count(&_idle_bytes, -(gssize)old->size);
+        _block_release(old);
+      }
+      else
+        b = &(*b)->next;
+    }
+  }
+
+  for(GList *l = _slots; l; l = g_list_next(l))
+  {
+    dt_buffer_pool_slot_t *slot = l->data;
+    dt_buffer_pool_block_t *b = g_atomic_pointer_get(&slot->block);
+    if(b && b->freed < before && _slot_take(slot, b))
+    {
+      _count(&_idle_bytes, -(gssize)b->size);
+      _block_release(b);
+    }
+  }
+}
+
+// must be called with the lock held. gives back idle blocks, the largest first,
+// until size more bytes fit into the memory darktable may use
+static void _make_room(const size_t size)
+{
+  if(!_resources_known()) return;
+  const size_t budget = dt_get_available_mem();
+
+  for(GList *l = _slots; l && _get(&_live_bytes) + _get(&_idle_bytes) + size > budget;
+      l = g_list_next(l))
+  {
+    dt_buffer_pool_slot_t *slot = l->data;
+    dt_buffer_pool_block_t *b = _slot_take(slot, g_atomic_pointer_get(&slot->block));
+    if(b) _to_free_list(b);
+  }
+
+  for(int cls = DT_BUFFER_POOL_CLASSES - 1;
+      cls >= 0 && _get(&_live_bytes) + _get(&_idle_bytes) + size > budget;
+      cls--)
+  {
+    while(_free_list[cls] && _get(&_live_bytes) + _get(&_idle_bytes) + size > budget)
+    {
+      dt_buffer_pool_block_t *old = _free_list[cls];
+      _free_list[cls] = old->next;
+      _count(&_idle_bytes, -(gssize)old->size);
+      _block_release(old);
+    }
+  }
+}
+
+static gpointer _reaper_run(gpointer data)
+{
+  g_mutex_lock(&_lock);
+  while(!_closed)
+  {
+    const gint64 end = g_get_monotonic_time() + DT_BUFFER_POOL_MAX_IDLE / 2 * G_USEC_PER_SEC;
+    g_cond_wait_until(&_reaper_cond, &_lock, end);
+    _expire(dt_get_wtime() - DT_BUFFER_POOL_MAX_IDLE);
+  }
+  g_mutex_unlock(&_lock);
+  return NULL;
+}
+
+// the slot goes with its thread, its block to the shared lists
+static void _slot_release(gpointer data)
+{
+  dt_buffer_pool_slot_t *slot = data;
+  g_mutex_lock(&_lock);
+  _slots = g_list_remove(_slots, slot);
+  if(slot->block) _to_free_list(slot->block);
+  g_mutex_unlock(&_lock);
+  g_free(slot);
+}
+
+static GPrivate _slot = G_PRIVATE_INIT(_slot_release);
+
+static dt_buffer_pool_slot_t *_get_slot(void)
+{
+  dt_buffer_pool_slot_t *slot = g_private_get(&_slot);
+  if(!slot)
+  {
+    slot = g_new0(dt_buffer_pool_slot_t, 1);
+    g_mutex_lock(&_lock);
+    _slots = g_list_prepend(_slots, slot);
+    g_mutex_unlock(&_lock);
+    g_private_set(&_slot, slot);
+  }
+  return slot;
+}
+
+static dt_buffer_pool_block_t *_block_of(void *mem)
+{
+  // the blocks start on a huge page boundary, don't bother with anything else
+  if(!mem || ((uintptr_t)mem & (DT_BUFFER_POOL_ALIGN - 1))) return NULL;
+  g_mutex_lock(&_lock);
+  dt_buffer_pool_block_t *b = _blocks ? g_hash_table_lookup(_blocks, mem) : NULL;
+  g_mutex_unlock(&_lock);
+  return b;
+}
+
+void *dt_buffer_pool_alloc(const size_t size)
+{
+  if(size < DT_BUFFER_POOL_MIN_SIZE) return NULL;
+  const int cls = _class_of(size);
+  if(cls >= DT_BUFFER_POOL_CLASSES) return NULL;
+
+  dt_buffer_pool_slot_t *slot = _get_slot();
+  dt_buffer_pool_block_t *b = g_atomic_pointer_get(&slot->block);
+  b = b && b->cls == cls ? _slot_take(slot, b) : NULL;
+  if(!b)
+  {
+    g_mutex_lock(&_lock);
+    b = _free_list[cls];
+    if(b)
+      _free_list[cls] = b->next;
+    else
+      _make_room(_class_size(cls));
+    g_mutex_unlock(&_lock);
+  }
+
+  if(b)
+  {
+    _count(&_idle_bytes, -(gssize)b->size);
+    _count(&_live_bytes, b->size);
+    _count(&_reused, 1);
+    _count(&_reused_bytes, b->size);
+    return b->mem;
+  }
+
+  const size_t block_size = _class_size(cls);
+  void *mem = NULL;
+#ifdef _WIN32
+  mem = _aligned_malloc(block_size, DT_BUFFER_POOL_ALIGN);
+#else
+  if(posix_memalign(&mem, DT_BUFFER_POOL_ALIGN, block_size)) mem = NULL;
+#endif
+  if(!mem) return NULL;
+#ifdef MADV_HUGEPAGE
+  madvise(mem, block_size, MADV_HUGEPAGE);
+#endif
+
+  b = g_new0(dt_buffer_pool_block_t, 1);
+  b->mem = mem;
+  b->size = block_size;
+  b->cls = cls;
+
+  g_mutex_lock(&_lock);
+  if(!_blocks) _blocks = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_hash_table_insert(_blocks, mem, b);
+  g_mutex_unlock(&_lock);
+
+  _count(&_live_bytes, block_size);
+  _count(&_allocated, 1);
+  _count(&_allocated_bytes, block_size);
+  return mem;
+}
+
+gboolean dt_buffer_pool_free(void *mem)
+{
+  dt_buffer_pool_block_t *b = _block_of(mem);
+  if(!b) return FALSE;
+
+  _count(&_live_bytes, -(gssize)b->size);
+  if(g_atomic_int_get(&_closed) || _get(&_idle_bytes) + b->size > _cap())
+  {
+    g_mutex_lock(&_lock);
+    _block_release(b);
+    g_mutex_unlock(&_lock);
+    return TRUE;
+  }
+
+  if(!g_atomic_pointer_get(&_reaper))
+  {
+    g_mutex_lock(&_lock);
+    if(!_reaper && !_closed) _reaper = g_thread_new("buffer pool", _reaper_run, NULL);
+    g_mutex_unlock(&_lock);
+  }
+
+  b->freed = dt_get_wtime();
+  _count(&_idle_bytes, b->size);
+
+  // only this thread puts blocks into its slot, others may have taken the old one
+  dt_buffer_pool_slot_t *slot = _get_slot();
+  dt_buffer_pool_block_t *old = g_atomic_pointer_get(&slot->block);
+  while(!g_atomic_pointer_compare_and_exchange(&slot->block, old, b))
+    old = g_atomic_pointer_get(&slot->block);
+  if(old)
+  {
+    g_mutex_lock(&_lock);
+    _to_free_list(old);
+    g_mutex_unlock(&_lock);
+  }
+  return TRUE;
+}
+
+void dt_buffer_pool_trim(void)
+{
+  g_mutex_lock(&_lock);
+  _expire(INFINITY);
+  g_mutex_unlock(&_lock);
+}
+
+void dt_buffer_pool_cleanup(void)
+{
+  g_mutex_lock(&_lock);
+  g_atomic_int_set(&_closed, TRUE);
+  g_cond_signal(&_reaper_cond);
+  GThread *reaper = _reaper;
+  _reaper = NULL;
+  g_mutex_unlock(&_lock);
+
+  if(reaper) g_thread_join(reaper);
+  dt_buffer_pool_trim();
+}
+
+void dt_buffer_pool_print_stats(void)
+{
+  const gsize reused_bytes = _get(&_reused_bytes);
+  dt_print(DT_DEBUG_MEMORY,
+           "[memory] buffer pool: %zu MB idle, %zu buffers reused (%zu MB, %zu page faults avoided),"
+           " %zu buffers allocated (%zu MB)\n",
+           _get(&_idle_bytes) >> 20, _get(&_reused), reused_bytes >> 20, reused_bytes / 4096,
+           _get(&_allocated), _get(&_allocated_bytes) >> 20);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
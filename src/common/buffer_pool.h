@@ -0,0 +1,61 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Pool of large pixel buffers behind dt_alloc_aligned().
+ *
+ * Modules allocate image sized temporaries for every pipe run and free them
+ * right after, so the same few sizes are requested over and over. Instead of
+ * handing them back to the kernel, which has to fault in and zero fresh pages
+ * for the next run, freed buffers are kept in size classes (four per octave)
+ * and reused. The blocks are backed by transparent huge pages where
+ * available. Every thread keeps the block it freed last for itself, the
+ * others are shared. Idle blocks are capped to a quarter of the memory
+ * darktable may use and given back by a background thread after some
+ * seconds without use. They count against that memory too: before a fresh
+ * block would exceed it, idle blocks are given back first.
+ */
+
+// smaller allocations go to malloc directly
+#define DT_BUFFER_POOL_MIN_SIZE ((size_t)8 << 20)
+
+/** allocate at least size bytes aligned to DT_CACHELINE_BYTES from the pool.
+ *  returns NULL if size is too small for the pool or the allocation failed. */
+void *dt_buffer_pool_alloc(const size_t size);
+
+/** give a block back to the pool, returns FALSE if mem wasn't allocated by the pool */
+gboolean dt_buffer_pool_free(void *mem);
+
+/** release all idle blocks, including the ones kept by other threads */
+void dt_buffer_pool_trim(void);
+
+/** stop the background thread and release all idle blocks, called on shutdown */
+void dt_buffer_pool_cleanup(void);
+
+/** print statistics, used by dt_print_mem_usage() */
+void dt_buffer_pool_print_stats(void);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
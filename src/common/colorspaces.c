@@ -18,6 +18,7 @@
 
 #include "common/colorspaces_inline_conversions.h"
 #include "common/colorspaces.h"
+#include "common/colorspaces_lut3d.h"
 #include "common/colormatrices.c"
 #include "common/darktable.h"
 #include "common/debug.h"
@@ -1402,6 +1403,7 @@ dt_colorspaces_t *dt_colorspaces_init()
                                   &Rec709_Primaries_Prequantized);
 
   pthread_rwlock_init(&res->xprofile_lock, NULL);
+  dt_pthread_mutex_init(&res->lut3d_lock, NULL);
 
   int in_pos = -1,
       out_pos = -1,
@@ -1717,6 +1719,9 @@ void dt_colorspaces_cleanup(dt_colorspaces_t *self)
   }
   g_list_free_full(self->profiles, free);
 
+  dt_colorspaces_lut3d_cleanup(self);
+  dt_pthread_mutex_destroy(&self->lut3d_lock);
+
   pthread_rwlock_destroy(&self->xprofile_lock);
   g_free(self->colord_profile_file);
   g_free(self->xprofile_data);
@@ -188,6 +188,10 @@ typedef struct dt_colorspaces_t
   cmsHTRANSFORM transform_srgb_to_display, transform_adobe_rgb_to_display;
   cmsHTRANSFORM transform_srgb_to_display2, transform_adobe_rgb_to_display2;
 
+  // baked lcms transforms shared by all pipes, see common/colorspaces_lut3d.h
+  dt_pthread_mutex_t lut3d_lock;
+  GList *lut3d_cache;
+
 } dt_colorspaces_t;
 
 typedef struct dt_colorspaces_color_profile_t
@@ -0,0 +1,393 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/colorspaces_lut3d.h"
+#include "common/darktable.h"
+
+// number of LUTs kept around once no pipe uses them anymore
+#define DT_COLORSPACES_LUT3D_CACHED 8
+// probe grid used to measure the error against the exact transform
+#define DT_COLORSPACES_LUT3D_PROBES 16
+// pixels outside of the LUT domain are collected and transformed in batches
+#define DT_COLORSPACES_LUT3D_BATCH 128
+
+dt_hash_t dt_colorspaces_lut3d_hash_profile(dt_hash_t hash, cmsHPROFILE profile)
+{
+  if(!profile) return dt_hash(hash, "none", 4);
+
+  cmsUInt32Number size = 0;
+  if(!cmsSaveProfileToMem(profile, NULL, &size) || size == 0)
+    return dt_hash(hash, &profile, sizeof(profile));
+
+  uint8_t *buf = g_malloc(size);
+  if(cmsSaveProfileToMem(profile, buf, &size))
+    hash = dt_hash(hash, buf, size);
+  else
+    hash = dt_hash(hash, &profile, sizeof(profile));
+  g_free(buf);
+  return hash;
+}
+
+static inline float _shape(const dt_colorspaces_lut3d_shaper_t shaper, const float t)
+{
+  return shaper == DT_COLORSPACES_LUT3D_SHAPER_CBRT ? cbrtf(t) : t;
+}
+
+static inline float _unshape(const dt_colorspaces_lut3d_shaper_t shaper, const float u)
+{
+  return shaper == DT_COLORSPACES_LUT3D_SHAPER_CBRT ? u * u * u : u;
+}
+
+// u holds the shaped coordinates in [0,1]
+static inline void _tetrahedral(const float *const restrict clut,
+                                const int level,
+                                const dt_aligned_pixel_t u,
+                                dt_aligned_pixel_t out)
+{
+  const size_t sr = 4;
+  const size_t sg = sr * level;
+  const size_t sb = sg * level;
+
+  float f[3];
+  int i[3];
+  for(int c = 0; c < 3; c++)
+  {
+    const float x = u[c] * (float)(level - 1);
+    i[c] = CLAMP((int)x, 0, level - 2);
+    f[c] = x - i[c];
+  }
+
+  const float *const p = clut + i[0] * sr + i[1] * sg + i[2] * sb;
+
+  // same split of the cube as correct_pixel_tetrahedral() in iop/lut3d.c
+  size_t o1, o2;
+  float w0, w1, w2, w3;
+  if(f[0] > f[1])
+  {
+    if(f[1] > f[2])
+    {
+      o1 = sr; o2 = sr + sg;
+      w0 = 1.0f - f[0]; w1 = f[0] - f[1]; w2 = f[1] - f[2]; w3 = f[2];
+    }
+    else if(f[0] > f[2])
+    {
+      o1 = sr; o2 = sr + sb;
+      w0 = 1.0f - f[0]; w1 = f[0] - f[2]; w2 = f[2] - f[1]; w3 = f[1];
+    }
+    else
+    {
+      o1 = sb; o2 = sb + sr;
+      w0 = 1.0f - f[2]; w1 = f[2] - f[0]; w2 = f[0] - f[1]; w3 = f[1];
+    }
+  }
+  else
+  {
+    if(f[2] > f[1])
+    {
+      o1 = sb; o2 = sb + sg;
+      w0 = 1.0f - f[2]; w1 = f[2] - f[1]; w2 = f[1] - f[0]; w3 = f[0];
+    }
+    else if(f[2] > f[0])
+    {
+      o1 = sg; o2 = sg + sb;
+      w0 = 1.0f - f[1]; w1 = f[1] - f[2]; w2 = f[2] - f[0]; w3 = f[0];
+    }
+    else
+    {
+      o1 = sg; o2 = sg + sr;
+      w0 = 1.0f - f[1]; w1 = f[1] - f[0]; w2 = f[0] - f[2]; w3 = f[2];
+    }
+  }
+  const size_t o3 = sr + sg + sb;
+
+  // nodes are padded to four floats so this is one vector fma chain
+  for_four_channels(c)
+    out[c] = w0 * p[c] + w1 * p[o1 + c] + w2 * p[o2 + c] + w3 * p[o3 + c];
+}
+
+// returns FALSE if the pixel is outside of the domain (or NaN)
+static inline gboolean _normalize(const dt_colorspaces_lut3d_t *const lut,
+                                  const float *const in,
+                                  dt_aligned_pixel_t u)
+{
+  for(int c = 0; c < 3; c++)
+  {
+    const float t = (in[c] - lut->domain_min[c]) * lut->domain_inv_range[c];
+    if(!(t >= 0.0f && t <= 1.0f)) return FALSE;
+    u[c] = _shape(lut->shaper, t);
+  }
+  u[3] = 0.0f;
+  return TRUE;
+}
+
+static void _bake(dt_colorspaces_lut3d_t *lut,
+                  const dt_aligned_pixel_t domain_min,
+                  const dt_aligned_pixel_t domain_max,
+                  dt_colorspaces_lut3d_eval_t eval,
+                  void *data)
+{
+  const int level = lut->level;
+  const size_t plane = (size_t)level * level;
+  float *const restrict samples = dt_alloc_align_float(4 * plane * level);
+  lut->clut = dt_alloc_align_float(4 * plane * level);
+  if(!samples || !lut->clut)
+  {
+    dt_free_align(samples);
+    dt_free_align(lut->clut);
+    lut->clut = NULL;
+    return;
+  }
+
+  const float step = 1.0f / (float)(level - 1);
+  DT_OMP_FOR()
+  for(int b = 0; b < level; b++)
+  {
+    for(int g = 0; g < level; g++)
+      for(int r = 0; r < level; r++)
+      {
+        const int idx[3] = { r, g, b };
+        float *const s = samples + 4 * (b * plane + (size_t)g * level + r);
+        for(int c = 0; c < 3; c++)
+          s[c] = domain_min[c]
+            + _unshape(lut->shaper, idx[c] * step) * (domain_max[c] - domain_min[c]);
+        s[3] = 0.0f;
+      }
+    // one blue plane per call keeps the lcms calls large
+    eval(samples + 4 * b * plane, lut->clut + 4 * b * plane, plane, data);
+    for(size_t k = 0; k < plane; k++)
+      lut->clut[4 * (b * plane + k) + 3] = 0.0f;
+  }
+  dt_free_align(samples);
+
+  // measure the error in the middle of LUT cells spread over the domain,
+  // the points furthest away from the nodes
+  const int np = DT_COLORSPACES_LUT3D_PROBES;
+  const size_t nprobes = (size_t)np * np * np;
+  float *const restrict probes = dt_alloc_align_float(4 * nprobes);
+  float *const restrict exact = dt_alloc_align_float(4 * nprobes);
+  if(!probes || !exact)
+  {
+    dt_free_align(probes);
+    dt_free_align(exact);
+    lut->max_error = INFINITY;
+    return;
+  }
+
+  for(size_t k = 0; k < nprobes; k++)
+  {
+    const int idx[3] = { k % np, (k / np) % np, k / (np * np) };
+    for(int c = 0; c < 3; c++)
+    {
+      const int cell = idx[c] * (level - 1) / np;
+      probes[4 * k + c] = domain_min[c]
+        + _unshape(lut->shaper, (cell + 0.5f) * step) * (domain_max[c] - domain_min[c]);
+    }
+    probes[4 * k + 3] = 0.0f;
+  }
+  eval(probes, exact, nprobes, data);
+
+  float max_error = 0.0f;
+  DT_OMP_FOR(reduction(max: max_error))
+  for(size_t k = 0; k < nprobes; k++)
+  {
+    dt_aligned_pixel_t u, approx;
+    if(!_normalize(lut, probes + 4 * k, u)) continue;
+    _tetrahedral(lut->clut, level, u, approx);
+    const float d0 = approx[0] - exact[4 * k + 0];
+    const float d1 = approx[1] - exact[4 * k + 1];
+    const float d2 = approx[2] - exact[4 * k + 2];
+    const float err = sqrtf(d0 * d0 + d1 * d1 + d2 * d2);
+    // a NaN from lcms counts as failure
+    max_error = fmaxf(max_error, isnan(err) ? INFINITY : err);
+  }
+  lut->max_error = max_error;
+
+  dt_free_align(probes);
+  dt_free_align(exact);
+}
+
+static void _lut_free(dt_colorspaces_lut3d_t *lut)
+{
+  if(!lut) return;
+  dt_free_align(lut->clut);
+  free(lut);
+}
+
+static void _evict_unused(dt_colorspaces_t *self)
+{
+  // the list is ordered by last use, drop unused LUTs from the tail
+  guint length = g_list_length(self->lut3d_cache);
+  GList *iter = g_list_last(self->lut3d_cache);
+  while(iter && length > DT_COLORSPACES_LUT3D_CACHED)
+  {
+    GList *prev = g_list_previous(iter);
+    dt_colorspaces_lut3d_t *lut = iter->data;
+    if(lut->refcount == 0)
+    {
+      self->lut3d_cache = g_list_delete_link(self->lut3d_cache, iter);
+      _lut_free(lut);
+      length--;
+    }
+    iter = prev;
+  }
+}
+
+dt_colorspaces_lut3d_t *dt_colorspaces_lut3d_get(const dt_hash_t hash,
+                                                 const dt_aligned_pixel_t domain_min,
+                                                 const dt_aligned_pixel_t domain_max,
+                                                 const dt_colorspaces_lut3d_shaper_t shaper,
+                                                 const float tolerance,
+                                                 dt_colorspaces_lut3d_eval_t eval,
+                                                 void *data)
+{
+  dt_colorspaces_t *self = darktable.color_profiles;
+
+  dt_hash_t key = dt_hash(hash, domain_min, sizeof(dt_aligned_pixel_t));
+  key = dt_hash(key, domain_max, sizeof(dt_aligned_pixel_t));
+  key = dt_hash(key, &shaper, sizeof(shaper));
+
+  // the lock is kept while baking so concurrent pipes don't bake the same LUT twice
+  dt_pthread_mutex_lock(&self->lut3d_lock);
+
+  dt_colorspaces_lut3d_t *lut = NULL;
+  for(GList *iter = self->lut3d_cache; iter; iter = g_list_next(iter))
+  {
+    dt_colorspaces_lut3d_t *cached = iter->data;
+    if(cached->hash == key)
+    {
+      lut = cached;
+      self->lut3d_cache = g_list_delete_link(self->lut3d_cache, iter);
+      break;
+    }
+  }
+
+  if(!lut)
+  {
+    lut = calloc(1, sizeof(dt_colorspaces_lut3d_t));
+    lut->hash = key;
+    lut->level = DT_COLORSPACES_LUT3D_LEVEL;
+    lut->shaper = shaper;
+    for(int c = 0; c < 3; c++)
+    {
+      lut->domain_min[c] = domain_min[c];
+      lut->domain_inv_range[c] = 1.0f / (domain_max[c] - domain_min[c]);
+    }
+
+    const double start = dt_get_wtime();
+    _bake(lut, domain_min, domain_max, eval, data);
+    dt_print(DT_DEBUG_PERF | DT_DEBUG_PARAMS,
+             "[colorspaces lut3d] baked %d^3 LUT %" PRIx64 " in %.3fs, max error %.4f (tolerance %.4f)\n",
+             lut->level, key, dt_get_wtime() - start, lut->max_error, tolerance);
+
+    // keep failed LUTs as markers so we don't try to bake them again
+    if(!lut->clut || !(lut->max_error <= tolerance))
+    {
+      dt_free_align(lut->clut);
+      lut->clut = NULL;
+    }
+  }
+
+  self->lut3d_cache = g_list_prepend(self->lut3d_cache, lut);
+  if(lut->clut && lut->max_error <= tolerance)
+    lut->refcount++;
+  else
+    lut = NULL;
+
+  _evict_unused(self);
+  dt_pthread_mutex_unlock(&self->lut3d_lock);
+  return lut;
+}
+
+void dt_colorspaces_lut3d_release(dt_colorspaces_lut3d_t *lut)
+{
+  if(!lut) return;
+  dt_colorspaces_t *self = darktable.color_profiles;
+  dt_pthread_mutex_lock(&self->lut3d_lock);
+  lut->refcount--;
+  _evict_unused(self);
+  dt_pthread_mutex_unlock(&self->lut3d_lock);
+}
+
+static void _eval_fallback(dt_aligned_pixel_t *const fallback_in,
+                           dt_aligned_pixel_t *const fallback_out,
+                           const size_t *const fallback_idx,
+                           const size_t nfallback,
+                           float *const out,
+                           dt_colorspaces_lut3d_eval_t eval,
+                           void *data)
+{
+  eval(&fallback_in[0][0], &fallback_out[0][0], nfallback, data);
+  for(size_t j = 0; j < nfallback; j++)
+  {
+    // lcms doesn't touch the alpha channel
+    fallback_out[j][3] = fallback_in[j][3];
+    copy_pixel(out + 4 * fallback_idx[j], fallback_out[j]);
+  }
+}
+
+void dt_colorspaces_lut3d_apply(const dt_colorspaces_lut3d_t *const lut,
+                                const float *const in,
+                                float *const out,
+                                const size_t npixels,
+                                dt_colorspaces_lut3d_eval_t eval,
+                                void *data)
+{
+  dt_aligned_pixel_t fallback_in[DT_COLORSPACES_LUT3D_BATCH];
+  dt_aligned_pixel_t fallback_out[DT_COLORSPACES_LUT3D_BATCH];
+  size_t fallback_idx[DT_COLORSPACES_LUT3D_BATCH];
+  size_t nfallback = 0;
+
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const float *const pin = in + 4 * k;
+    dt_aligned_pixel_t u;
+    if(!_normalize(lut, pin, u))
+    {
+      copy_pixel(fallback_in[nfallback], pin);
+      fallback_idx[nfallback++] = k;
+      if(nfallback == DT_COLORSPACES_LUT3D_BATCH)
+      {
+        _eval_fallback(fallback_in, fallback_out, fallback_idx, nfallback, out, eval, data);
+        nfallback = 0;
+      }
+      continue;
+    }
+    const float alpha = pin[3];
+    dt_aligned_pixel_t res;
+    _tetrahedral(lut->clut, lut->level, u, res);
+    res[3] = alpha;
+    copy_pixel(out + 4 * k, res);
+  }
+
+  if(nfallback)
+    _eval_fallback(fallback_in, fallback_out, fallback_idx, nfallback, out, eval, data);
+}
+
+void dt_colorspaces_lut3d_cleanup(dt_colorspaces_t *self)
+{
+  dt_pthread_mutex_lock(&self->lut3d_lock);
+  g_list_free_full(self->lut3d_cache, (GDestroyNotify)_lut_free);
+  self->lut3d_cache = NULL;
+  dt_pthread_mutex_unlock(&self->lut3d_lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
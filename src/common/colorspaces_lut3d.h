@@ -0,0 +1,96 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/colorspaces.h"
+
+/*
+ * Baked 3D LUTs for lcms transforms.
+ *
+ * Transforms that can't be expressed as matrix + curves (LUT based camera or
+ * printer profiles, softproofing) are sampled once into a 3D LUT and applied
+ * with tetrahedral interpolation. The LUTs are shared by all pipes through a
+ * small cache keyed by a hash of the profiles, intent and flags.
+ *
+ * Accuracy: after baking, the LUT is compared against the exact transform in
+ * the centres of 16x16x16 LUT cells spread over the domain, the points
+ * furthest away from the LUT nodes. If the largest euclidean deviation of the
+ * first three output channels exceeds the tolerance given by the caller the
+ * LUT is discarded and the caller has to keep using lcms. Pixels outside of the LUT domain are
+ * always computed by the exact transform.
+ */
+
+// samples per axis of a baked LUT
+#define DT_COLORSPACES_LUT3D_LEVEL 65
+
+typedef enum dt_colorspaces_lut3d_shaper_t
+{
+  DT_COLORSPACES_LUT3D_SHAPER_LINEAR = 0, // perceptual input like Lab
+  DT_COLORSPACES_LUT3D_SHAPER_CBRT = 1    // linear RGB input, more nodes in the shadows
+} dt_colorspaces_lut3d_shaper_t;
+
+// exact transform of npixels 4-channel pixels, used for baking and out-of-domain pixels
+typedef void (*dt_colorspaces_lut3d_eval_t)(const float *const in,
+                                            float *const out,
+                                            const size_t npixels,
+                                            void *data);
+
+typedef struct dt_colorspaces_lut3d_t
+{
+  dt_hash_t hash;
+  int level;
+  dt_colorspaces_lut3d_shaper_t shaper;
+  dt_aligned_pixel_t domain_min;
+  dt_aligned_pixel_t domain_inv_range;
+  float max_error;
+  float *clut; // level^3 nodes of 4 floats, red varies fastest
+  int refcount;
+} dt_colorspaces_lut3d_t;
+
+/** hash the content of a profile, to be used when building lut keys */
+dt_hash_t dt_colorspaces_lut3d_hash_profile(dt_hash_t hash, cmsHPROFILE profile);
+
+/** get a LUT for the given key from the cache, bake it with eval if it is not cached yet.
+ *  returns NULL if the LUT doesn't meet the tolerance. release with dt_colorspaces_lut3d_release(). */
+dt_colorspaces_lut3d_t *dt_colorspaces_lut3d_get(const dt_hash_t hash,
+                                                 const dt_aligned_pixel_t domain_min,
+                                                 const dt_aligned_pixel_t domain_max,
+                                                 const dt_colorspaces_lut3d_shaper_t shaper,
+                                                 const float tolerance,
+                                                 dt_colorspaces_lut3d_eval_t eval,
+                                                 void *data);
+
+void dt_colorspaces_lut3d_release(dt_colorspaces_lut3d_t *lut);
+
+/** transform npixels, in may be equal to out. pixels outside of the domain go through eval. */
+void dt_colorspaces_lut3d_apply(const dt_colorspaces_lut3d_t *const lut,
+                                const float *const in,
+                                float *const out,
+                                const size_t npixels,
+                                dt_colorspaces_lut3d_eval_t eval,
+                                void *data);
+
+/** drop all cached LUTs, called on shutdown */
+void dt_colorspaces_lut3d_cleanup(dt_colorspaces_t *self);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
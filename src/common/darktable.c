@@ -42,6 +42,7 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/action.h"
+#include "common/analysis_cache.h"
 #include "common/file_location.h"
 #include "common/film.h"
 #include "common/grealpath.h"
@@ -53,6 +54,8 @@
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
+#include "common/buffer_pool.h"
+#include "common/readahead.h"
 #include "common/resource_limits.h"
 #include "common/undo.h"
 #include "common/gimp.h"
@@ -719,6 +722,42 @@ static dt_job_t *_detect_opencl_job_create(gboolean exclude_opencl)
   return job;
 }
 
+// without gui there is no job queue, darktable-cli detects the devices in a thread
+// of its own while the modules are loaded. kernels are only built on first use.
+static gpointer _detect_opencl_thread(gpointer data)
+{
+  const int flags = GPOINTER_TO_INT(data);
+  dt_opencl_init(darktable.opencl, flags & 1, flags & 2);
+  return NULL;
+}
+
+// the icc files are read while the library is opened
+static gpointer _load_color_profiles_thread(gpointer data)
+{
+  darktable.color_profiles = dt_colorspaces_init();
+  return NULL;
+}
+
+// the json files are only needed when module instances are created
+static gpointer _load_presets_thread(gpointer data)
+{
+  dt_wb_presets_init(NULL);
+  darktable.noiseprofile_parser = dt_noiseprofile_init((const char *)data);
+  return NULL;
+}
+
+static void _join_startup_thread(GThread **thread)
+{
+  if(*thread) g_thread_join(*thread);
+  *thread = NULL;
+}
+
+// time spent in one part of dt_init(), with -d perf
+static void _startup_step(double *step_wtime, const char *step)
+{
+  dt_print(DT_DEBUG_PERF, "[dt_init] %-20s %.3f secs\n", step, dt_get_lap_time(step_wtime));
+}
+
 static int32_t _backthumbs_job_run(dt_job_t *job)
 {
   dt_update_thumbs_thread(dt_control_job_get_params(job));
@@ -880,6 +919,10 @@ char *version = g_strdup_printf(
 int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load_data, lua_State *L)
 {
   double start_wtime = dt_get_wtime();
+  double step_wtime = start_wtime;
+  GThread *opencl_thread = NULL;
+  GThread *presets_thread = NULL;
+  GThread *profiles_thread = NULL;
 
 #ifndef _WIN32
   if(getuid() == 0 || geteuid() == 0)
@@ -1476,6 +1519,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_conf_init(darktable.conf, darktablerc, config_override);
 
   g_slist_free_full(config_override, g_free);
+  _startup_step(&step_wtime, "configuration");
 
   const int last_configure_version =
     dt_conf_get_int("performance_configuration_version_completed");
@@ -1501,8 +1545,9 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // detect cpu features and decide which codepaths to enable
   dt_codepaths_init();
 
-  // get the list of color profiles
-  darktable.color_profiles = dt_colorspaces_init();
+  // get the list of color profiles, nothing needs them before the library is open.
+  // the database stays on this thread as it might ask the user.
+  profiles_thread = g_thread_new("color profiles", _load_color_profiles_thread, NULL);
 
   // initialize datetime data
   dt_datetime_init();
@@ -1514,6 +1559,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   {
     dt_print(DT_DEBUG_ALWAYS, "ERROR : cannot open database\n");
     darktable_splash_screen_destroy();
+    _join_startup_thread(&profiles_thread);
     return 1;
   }
   else if(!dt_database_get_lock_acquired(darktable.db))
@@ -1550,6 +1596,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     if(!image_loaded_elsewhere) dt_database_show_error(darktable.db);
 
     dt_print(DT_DEBUG_ALWAYS, "ERROR: can't acquire database lock, aborting.\n");
+    _join_startup_thread(&profiles_thread);
     return 1;
   }
 
@@ -1558,6 +1605,10 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   // init darktable tags table
   dt_set_darktable_tags();
+  _startup_step(&step_wtime, "library");
+
+  _join_startup_thread(&profiles_thread);
+  _startup_step(&step_wtime, "color profiles (waiting)");
 
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
@@ -1692,21 +1743,23 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   heif_init(NULL);
 #endif
 
+  _startup_step(&step_wtime, "image libraries");
+
   darktable_splash_screen_set_progress(_("starting OpenCL"));
   darktable.opencl = (dt_opencl_t *)calloc(1, sizeof(dt_opencl_t));
   if(init_gui)
     dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG,
                        _detect_opencl_job_create(exclude_opencl));
   else
-    dt_opencl_init(darktable.opencl, exclude_opencl, print_statistics);
+    opencl_thread = g_thread_new("opencl detect", _detect_opencl_thread,
+                                 GINT_TO_POINTER((exclude_opencl ? 1 : 0)
+                                                 | (print_statistics ? 2 : 0)));
 
   darktable.points = (dt_points_t *)calloc(1, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
-  dt_wb_presets_init(NULL);
-
   darktable_splash_screen_set_progress(_("loading noise profiles"));
-  darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
+  presets_thread = g_thread_new("load presets", _load_presets_thread, noiseprofiles_from_command);
 
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
@@ -1716,6 +1769,10 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
 
+  darktable.analysis_cache = (dt_analysis_cache_t *)calloc(1, sizeof(dt_analysis_cache_t));
+  dt_analysis_cache_init(darktable.analysis_cache);
+  _startup_step(&step_wtime, "caches");
+
   // set up memory.darktable_iop_names table
   dt_iop_set_darktable_iop_table();
 
@@ -1747,9 +1804,11 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     {
       dt_print(DT_DEBUG_ALWAYS, "[dt_init] ERROR: can't init gui, aborting.\n");
       darktable_splash_screen_destroy();
+      _join_startup_thread(&presets_thread);
       return 1;
     }
     dt_bauhaus_init();
+    _startup_step(&step_wtime, "gui");
   }
   else
     darktable.gui = NULL;
@@ -1763,8 +1822,11 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   {
     dt_print(DT_DEBUG_ALWAYS, "[dt_init] ERROR: can't init develop system, aborting.\n");
     darktable_splash_screen_destroy();
+    _join_startup_thread(&presets_thread);
+    _join_startup_thread(&opencl_thread);
     return 1;
   }
+  _startup_step(&step_wtime, "views");
 
   darktable_splash_screen_set_progress(_("loading processing modules"));
   darktable.imageio = (dt_imageio_t *)calloc(1, sizeof(dt_imageio_t));
@@ -1774,8 +1836,16 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.iop_order_list = dt_ioppr_get_iop_order_list(0, FALSE);
   // load iop order rules
   darktable.iop_order_rules = dt_ioppr_get_iop_order_rules();
+  // module instances need the noise profiles and white balance presets
+  _join_startup_thread(&presets_thread);
+  _startup_step(&step_wtime, "presets (waiting)");
+
   // load the darkroom mode plugins once:
   dt_iop_load_modules_so();
+  _startup_step(&step_wtime, "processing modules");
+
+  _join_startup_thread(&opencl_thread);
+  _startup_step(&step_wtime, "opencl (waiting)");
   // check if all modules have a iop order assigned
   if(dt_ioppr_check_so_iop_order(darktable.iop, darktable.iop_order_list))
   {
@@ -1825,6 +1895,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     gtk_widget_show_all(dt_ui_main_window(darktable.gui->ui));
     // give Gtk a chance to actually process the resizing
     dt_gui_process_events();
+    _startup_step(&step_wtime, "utility modules");
   }
 
   dt_print(DT_DEBUG_MEMORY, "[memory] after successful startup\n");
@@ -1914,7 +1985,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     gtk_window_deiconify(GTK_WINDOW(dt_ui_main_window(darktable.gui->ui)));
   }
 
-  dt_print(DT_DEBUG_CONTROL,
+  _startup_step(&step_wtime, "finishing");
+  dt_print(DT_DEBUG_CONTROL | DT_DEBUG_PERF,
            "[dt_init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
   return 0;
 }
@@ -2026,12 +2098,16 @@ void dt_cleanup()
   // we can no longer call dt_gui_process_events after this point, as that will cause a segfault
   // if some delayed event fires
 
+  dt_readahead_cleanup();
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
   darktable.image_cache = NULL;
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
   darktable.mipmap_cache = NULL;
+  dt_analysis_cache_cleanup(darktable.analysis_cache);
+  free(darktable.analysis_cache);
+  darktable.analysis_cache = NULL;
   if(init_gui)
   {
     dt_imageio_cleanup(darktable.imageio);
@@ -2138,6 +2214,7 @@ void dt_cleanup()
   dt_pthread_mutex_destroy(&(darktable.readFile_mutex));
 
   dt_exif_cleanup();
+  dt_buffer_pool_cleanup();
 
   if(init_gui)
     darktable_exit_screen_destroy();
@@ -2172,6 +2249,13 @@ void dt_print_nts_ext(const char *msg, ...)
 
 void *dt_alloc_aligned(const size_t size)
 {
+  // image sized buffers are recycled
+  if(size >= DT_BUFFER_POOL_MIN_SIZE)
+  {
+    void *mem = dt_buffer_pool_alloc(size);
+    if(mem) return mem;
+  }
+
   const size_t alignment = DT_CACHELINE_BYTES;
   const size_t aligned_size = dt_round_size(size, alignment);
 #if defined(__FreeBSD_version) && __FreeBSD_version < 700013
@@ -2200,14 +2284,12 @@ size_t dt_round_size(const size_t size, const size_t alignment)
   return ((size % alignment) == 0) ? size : ((size - 1) / alignment + 1) * alignment;
 }
 
-#ifdef _WIN32
 void dt_free_align(void *mem)
 {
+  if(dt_buffer_pool_free(mem)) return;
+#if defined(_WIN32)
   _aligned_free(mem);
-}
 #elif defined(_DEBUG)
-void dt_free_align(void *mem)
-{
   // on a debug build, we deliberately offset the returned pointer
   // from dt_alloc_align, so eliminate the offset
   if(mem)
@@ -2215,8 +2297,10 @@ void dt_free_align(void *mem)
     short offset = ((short*)mem)[-1];
     free(((char*)mem)-offset);
   }
-}
+#else
+  free(mem);
 #endif
+}
 
 void dt_show_times(const dt_times_t *start, const char *prefix)
 {
@@ -2293,6 +2377,27 @@ size_t dt_get_singlebuffer_mem()
   return MAX(2lu * 1024lu * 1024lu, total_mem / 1024lu * fraction);
 }
 
+size_t dt_get_l2_cache_size()
+{
+  static gsize l2_size = 0;
+  if(g_once_init_enter(&l2_size))
+  {
+    int64_t size = 0;
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#elif defined(__APPLE__)
+    size_t length = sizeof(size);
+    if(sysctlbyname("hw.l2cachesize", &size, &length, NULL, 0)) size = 0;
+#endif
+    // unknown here or not reported (as in some virtual machines),
+    // assume the per core L2 cache of current desktop CPUs
+    if(size <= 0) size = 1024 * 1024;
+    dt_print(DT_DEBUG_DEV, "[dt_get_l2_cache_size] %" PRId64 " KiB\n", size / 1024);
+    g_once_init_leave(&l2_size, (gsize)size);
+  }
+  return l2_size;
+}
+
 void dt_configure_runtime_performance(const int old, char *info)
 {
   const size_t threads = dt_get_num_procs();
@@ -2486,6 +2591,8 @@ void dt_print_mem_usage()
 {
   if(!(darktable.unmuted & DT_DEBUG_MEMORY))
     return;
+
+  dt_buffer_pool_print_stats();
 #if defined(__linux__)
   char *line = NULL;
   size_t len = 128;
@@ -274,6 +274,7 @@ struct dt_control_t;
 struct dt_develop_t;
 struct dt_mipmap_cache_t;
 struct dt_image_cache_t;
+struct dt_analysis_cache_t;
 struct dt_lib_t;
 struct dt_conf_t;
 struct dt_points_t;
@@ -377,6 +378,7 @@ typedef struct darktable_t
   struct dt_gui_gtk_t *gui;
   struct dt_mipmap_cache_t *mipmap_cache;
   struct dt_image_cache_t *image_cache;
+  struct dt_analysis_cache_t *analysis_cache;
   struct dt_bauhaus_t *bauhaus;
   const struct dt_database_t *db;
   const struct dt_pwstorage_t *pwstorage;
@@ -463,6 +465,8 @@ void dt_print_nts_ext(const char *msg, ...)
 int dt_worker_threads();
 size_t dt_get_available_mem();
 size_t dt_get_singlebuffer_mem();
+// size of the L2 cache of a core in bytes, for sizing tiles of the processing code
+size_t dt_get_l2_cache_size();
 
 void dt_dump_pfm_file(const char *pipe,
                       const void *data,
@@ -553,17 +557,10 @@ static inline gboolean dt_check_aligned(void *addr)
 
 size_t dt_round_size(const size_t size, const size_t alignment);
 
-#ifdef _WIN32
-void dt_free_align(void *mem);
-#define dt_free_align_ptr dt_free_align
-#elif _DEBUG // debug build makes sure that we get a crash on using
-             // plain free() on an aligned allocation
+// a debug build makes sure that we get a crash on using plain free()
+// on an aligned allocation. large buffers go back to the buffer pool.
 void dt_free_align(void *mem);
 #define dt_free_align_ptr dt_free_align
-#else
-#define dt_free_align(A) free(A)
-#define dt_free_align_ptr free
-#endif
 
 static inline void dt_lock_image(const dt_imgid_t imgid)
   ACQUIRE(darktable.db_image[imgid & (DT_IMAGE_DBLOCKS-1)])
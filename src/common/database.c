@@ -48,7 +48,7 @@
 
 // whenever _create_*_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_*_schema_step()!
-#define CURRENT_DATABASE_VERSION_LIBRARY 55
+#define CURRENT_DATABASE_VERSION_LIBRARY 56
 #define CURRENT_DATABASE_VERSION_DATA    10
 
 #define USE_NESTED_TRANSACTIONS
@@ -2912,6 +2912,17 @@ static int _upgrade_library_schema_step(dt_database_t *db, int version)
 
     new_version = 55;
   }
+  else if(version == 55)
+  {
+    TRY_EXEC("CREATE TABLE analysis_cache"
+             " (imgid INTEGER, name VARCHAR, hash INTEGER, data BLOB,"
+             "  PRIMARY KEY (imgid, name),"
+             "  FOREIGN KEY(imgid) REFERENCES images(id)"
+             "    ON UPDATE CASCADE ON DELETE CASCADE)",
+             "[init] can't create table analysis_cache\n");
+
+    new_version = 56;
+  }
   else
     new_version = version; // should be the fallback so that calling code sees that we are in an infinite loop
 
@@ -3433,6 +3444,15 @@ static void _create_library_schema(dt_database_t *db)
      "    ON UPDATE CASCADE ON DELETE CASCADE)",
      NULL, NULL, NULL);
 
+  sqlite3_exec
+    (db->handle,
+     "CREATE TABLE analysis_cache"
+     " (imgid INTEGER, name VARCHAR, hash INTEGER, data BLOB,"
+     "  PRIMARY KEY (imgid, name),"
+     "  FOREIGN KEY(imgid) REFERENCES images(id)"
+     "    ON UPDATE CASCADE ON DELETE CASCADE)",
+     NULL, NULL, NULL);
+
   // Some triggers to remove possible dangling refs in makers/models/lens/cameras
   sqlite3_exec
     (db->handle,
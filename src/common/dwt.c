@@ -109,111 +109,147 @@ static void dwt_get_image_layer(float *const layer, dwt_params_t *const p)
     dt_iop_image_copy_by_size(p->image, layer, p->width, p->height, p->ch);
 }
 
-// first, "vertical" pass of wavelet decomposition
-static void dwt_decompose_vert(float *const restrict out, const float *const restrict in,
-                               const size_t height, const size_t width, const size_t lev)
+/* The decomposition of one scale runs in a single pass over the rows: the
+ * vertical sum of a row goes into a per-thread buffer and the horizontal pass
+ * follows on it directly. Each thread takes a block of a chain of rows 'vscale'
+ * apart, so two of the three input rows of the vertical sum are still in cache
+ * from the previous row of the chain. An input row may only be overwritten once
+ * all rows reading it are done, that is the row 'vscale' below in the same
+ * block. Rows read from another block or through the reflection at the top and
+ * bottom border are finished after all blocks. */
+
+// rows of a chain filtered by one thread
+#define DWT_CHAIN_BLOCK 32
+
+// filters one row into the coarse scale, vsum is the per-thread row buffer
+typedef void(_dwt_row_func)(void *data, float *const vsum, const size_t row,
+                            const size_t above, const size_t below);
+// updates an input row once no other row reads it anymore
+typedef void(_dwt_finish_func)(void *data, const size_t row);
+
+static void _dwt_decompose_rows(void *data,
+                                _dwt_row_func row_func,
+                                _dwt_finish_func finish_func,
+                                float *const vsum,
+                                const size_t padded_size,
+                                uint8_t *const finished,
+                                const int height,
+                                const int vscale)
 {
-  const size_t vscale = MIN(1 << lev, height-1);
-  DT_OMP_FOR()
-  for(int rowid = 0; rowid < height ; rowid++)
+  const int step = MAX(vscale, 1);
+  const int chain_length = (height + step - 1) / step;
+  const int blocks = (chain_length + DWT_CHAIN_BLOCK - 1) / DWT_CHAIN_BLOCK;
+  memset(finished, 0, height);
+
+  DT_OMP_FOR(collapse(2))
+  for(int chain = 0; chain < step; chain++)
   {
-    const size_t row = dwt_interleave_rows(rowid,height,vscale);
-    // perform a weighted sum of the current pixel row with the rows 'scale' pixels above and below
-    // if either of those is beyond the edge of the image, we use reflection to get a value for averaging,
-    // i.e. we move as many rows in from the edge as we would have been beyond the edge
-    // for the top edge, this means we can simply use the absolute value of row-vscale; for the bottom edge,
-    //   we need to reflect around height
-    const size_t rowstart = (size_t)4 * row * width;
-    const size_t above_row = (row > vscale) ? row - vscale : vscale - row;
-    const size_t below_row = (row + vscale < height) ? (row + vscale) : 2*(height-1) - (row + vscale);
-    const float* const restrict center = in + rowstart;
-    const float* const restrict above = in + 4 * above_row * width;
-    const float* const restrict below = in + 4 * below_row * width;
-    float* const restrict temprow = out + rowstart;
-    for(size_t col = 0; col < 4*width; col += 4)
+    for(int block = 0; block < blocks; block++)
     {
-      for_each_channel(c,aligned(center, above, below, temprow : 16))
+      const int first = chain + block * DWT_CHAIN_BLOCK * step;
+      if(first >= height) continue;
+      float *const restrict vrow = dt_get_perthread(vsum, padded_size);
+
+      for(int i = 0, row = first; i < DWT_CHAIN_BLOCK && row < height; i++, row += step)
       {
-        temprow[col + c] = 2.f * center[col+c] + above[col+c] + below[col+c];
+        // if either neighbour is beyond the edge of the image, we use reflection to get a value for
+        // averaging, i.e. we move as many rows in from the edge as we would have been beyond the edge
+        const int above = (row > vscale) ? row - vscale : vscale - row;
+        const int below = (row + vscale < height) ? row + vscale : 2 * (height - 1) - (row + vscale);
+        row_func(data, vrow, row, above, below);
+
+        // the row above in this block has now been read by all its neighbours
+        const int prev = row - step;
+        if(prev > first && prev > vscale && prev < height - 1 - vscale)
+        {
+          finish_func(data, prev);
+          finished[prev] = 1;
+        }
       }
     }
   }
+
+  DT_OMP_FOR()
+  for(int row = 0; row < height; row++)
+    if(!finished[row]) finish_func(data, row);
 }
 
-// second, horizontal pass of wavelet decomposition; generates 'coarse' into the output buffer and overwrites
-//   the input buffer with 'details'
-static void dwt_decompose_horiz(
-    float *const restrict out,
-    float *const restrict in,
-    float *const temp,
-    size_t padded_size,
-    const size_t height,
-    const size_t width,
-    const size_t lev)
+typedef struct _dwt_layer_t
 {
-  const int hscale = MIN(1 << lev, width);  //(int because we need a signed difference below)
-  DT_OMP_FOR()
-  for(int row = 0; row < height ; row++)
+  float *coarse;
+  float *details;
+  size_t width;
+  int hscale;
+} _dwt_layer_t;
+
+// the weighted sum of a row with the rows 'scale' pixels above and below and
+// with the pixels 'scale' to the left and right of it goes into 'coarse'
+__DT_CLONE_TARGETS__
+static void _dwt_layer_row(void *data,
+                           float *const vsum,
+                           const size_t row,
+                           const size_t above_row,
+                           const size_t below_row)
+{
+  const _dwt_layer_t *const l = data;
+  const size_t width = l->width;
+  const int hscale = l->hscale;
+  const float *const restrict center = l->details + 4 * row * width;
+  const float *const restrict above = l->details + 4 * above_row * width;
+  const float *const restrict below = l->details + 4 * below_row * width;
+  float *const restrict temprow = vsum;
+  float *const restrict coarse = l->coarse + 4 * row * width;
+
+  DT_OMP_SIMD(aligned(center, above, below, temprow : 16))
+  for(size_t k = 0; k < 4 * width; k++)
+    temprow[k] = 2.f * center[k] + above[k] + below[k];
+
+  for(int col = 0; col < width - hscale; col++)
   {
-    // perform a weighted sum of the current pixel with the ones 'scale' pixels to the left and right, using
-    // reflection to get a value if either of those positions is out of bounds, i.e. we move as many columns
-    // in from the edge as we would have been beyond the edge to avoid an additional pass, we also rescale the
-    // final sum and split the original input into 'coarse' and 'details' by subtracting the scaled sum from
-    // the original input.
-    const size_t rowindex = (size_t)4 * (row * width);
-    float* const restrict temprow = dt_get_perthread(temp,padded_size);
-    float* const restrict details = in + rowindex;
-    float* const restrict coarse = out + rowindex;
-
-    for(int col = 0; col < width - hscale; col++)
+    const size_t leftpos = (size_t)4 * abs(col - hscale); // the abs() handles reflection at the left edge
+    const size_t rightpos = (size_t)4 * (col + hscale);
+    for_each_channel(c, aligned(temprow, coarse : 16))
     {
-      const size_t leftpos = (size_t)4*abs(col-hscale);	// the abs() handles reflection at the left edge
-      const size_t rightpos = (size_t)4*(col+hscale);
-      for_each_channel(c,aligned(temprow, details, coarse : 16))
-      {
-        const float left = coarse[leftpos+c];
-        const float right = coarse[rightpos+c];
-        // add up left/center/right, and renormalize by dividing by the total weight of all numbers added together
-        const float hat = (2.f * coarse[4*col+c] + left + right) / 16.f;
-        // the normalized value is our 'coarse' result; 'details' is the difference between original input and 'coarse'
-        temprow[4*col+c] = hat;
-        details[4*col+c] -= hat;
-      }
+      // add up left/center/right, and renormalize by dividing by the total weight of all numbers added together
+      coarse[4 * col + c] = (2.f * temprow[4 * col + c] + temprow[leftpos + c] + temprow[rightpos + c]) / 16.f;
     }
-    // handle reflection at right edge
-    for(int col = width - hscale; col < width; col++)
+  }
+  // handle reflection at right edge
+  for(int col = width - hscale; col < width; col++)
+  {
+    const size_t leftpos = (size_t)4 * abs(col - hscale); // still need to handle reflection, if hscale>=width/2
+    const size_t rightpos = (size_t)4 * (2 * width - 2 - (col + hscale));
+    for_each_channel(c, aligned(temprow, coarse : 16))
     {
-      const size_t leftpos = (size_t)4 * abs(col-hscale); // still need to handle reflection, if hscale>=width/2
-      const size_t rightpos = (size_t)4 * (2*width - 2 - (col+hscale));
-      for_each_channel(c,aligned(temprow, details, coarse : 16))
-      {
-        const float left = coarse[leftpos+c];
-        const float right = coarse[rightpos+c];
-        // add up left/center/right, and renormalize by dividing by the total weight of all numbers added together
-        const float hat = (2.f * coarse[4*col+c] + left + right) / 16.f;
-        // the normalized value is our 'coarse' result; 'details' is the difference between original input and 'coarse'
-        temprow[4*col+c] = hat;
-        details[4*col+c] -= hat;
-      }
+      coarse[4 * col + c] = (2.f * temprow[4 * col + c] + temprow[leftpos + c] + temprow[rightpos + c]) / 16.f;
     }
-    // now that we're done with the row of pixels, we can overwrite the intermediate result from the
-    // first pass with the final decomposition
-    memcpy(coarse, temprow, sizeof(float) * 4 * width);
   }
 }
 
+// 'details' is the difference between the original input and 'coarse'
+static void _dwt_layer_finish(void *data, const size_t row)
+{
+  const _dwt_layer_t *const l = data;
+  float *const restrict details = l->details + 4 * row * l->width;
+  const float *const restrict coarse = l->coarse + 4 * row * l->width;
+  DT_OMP_SIMD(aligned(details, coarse : 16))
+  for(size_t k = 0; k < 4 * l->width; k++)
+    details[k] -= coarse[k];
+}
+
 // split input into 'coarse' and 'details'; put 'details' back into the input buffer
-static void dwt_decompose_layer(
-    float *const restrict out,
-    float *const restrict in,
-    float *const temp,
-    size_t padded_size,
-    const int lev,
-    const dwt_params_t *const p)
+static void dwt_decompose_layer(float *const restrict out,
+                                float *const restrict in,
+                                float *const temp,
+                                const size_t padded_size,
+                                uint8_t *const finished,
+                                const int lev,
+                                const dwt_params_t *const p)
 {
-  dwt_decompose_vert(out, in, p->height, p->width, lev);
-  dwt_decompose_horiz(out, in, temp, padded_size, p->height, p->width, lev);
-  return;
+  _dwt_layer_t l = { .coarse = out, .details = in, .width = p->width,
+                     .hscale = MIN(1 << lev, p->width - 1) };
+  _dwt_decompose_rows(&l, _dwt_layer_row, _dwt_layer_finish, temp, padded_size, finished,
+                      p->height, MIN(1 << lev, p->height - 1));
 }
 
 /* actual decomposing algorithm */
@@ -227,6 +263,7 @@ static void dwt_wavelet_decompose(float *img,
   float *layers = NULL;		// buffer to reconstruct the image
   float *merged_layers = NULL;
   float *buffer[2] = { 0, 0 };
+  uint8_t *finished = NULL;
 
   if(layer_func) layer_func(img, p, 0);
 
@@ -236,20 +273,24 @@ static void dwt_wavelet_decompose(float *img,
   /* image buffers */
   buffer[0] = img;
 
-  /* allocate temporary storage */
+  /* allocate temporary storage, the reconstruction and the merged scales only if they are used */
+  const size_t npixels = (size_t)p->width * p->height;
   dt_iop_roi_t roi = { .x = 0, .y = 0, .height = p->height, .width = p->width };
   size_t padded_size;
-  const int do_merge = p->merge_from_scale > 0;
-  if (!dt_iop_alloc_image_buffers(NULL, &roi, &roi,
-                                  4 | DT_IMGSZ_INPUT, &buffer[1],
-                                  4 | DT_IMGSZ_INPUT | DT_IMGSZ_CLEARBUF, &layers,
-                                  4 | DT_IMGSZ_WIDTH | DT_IMGSZ_PERTHREAD, &temp, &padded_size,
-                                  (do_merge ? 4 | DT_IMGSZ_INPUT | DT_IMGSZ_CLEARBUF : 0), &merged_layers,
-                                  0, NULL))
+  const gboolean do_layers = p->return_layer == 0;
+  const gboolean do_merge = p->merge_from_scale > 0 && p->merge_from_scale <= p->scales;
+  if(do_layers) layers = dt_calloc_align_float(4 * npixels);
+  if(do_merge) merged_layers = dt_calloc_align_float(4 * npixels);
+  finished = dt_alloc_align_type(uint8_t, p->height);
+  if(!dt_iop_alloc_image_buffers(NULL, &roi, &roi,
+                                 4 | DT_IMGSZ_INPUT, &buffer[1],
+                                 4 | DT_IMGSZ_WIDTH | DT_IMGSZ_PERTHREAD, &temp, &padded_size,
+                                 0, NULL)
+     || (do_layers && !layers) || (do_merge && !merged_layers) || !finished)
   {
     dt_print(DT_DEBUG_ALWAYS,
              "[dwt] unable to alloc working memory, skipping wavelet decomposition\n");
-    return;
+    goto cleanup;
   }
 
   // iterate over wavelet scales
@@ -259,7 +300,7 @@ static void dwt_wavelet_decompose(float *img,
   {
     unsigned int lpass = (1 - (lev & 1));
 
-    dwt_decompose_layer(buffer[lpass], buffer[hpass], temp, padded_size, lev, p);
+    dwt_decompose_layer(buffer[lpass], buffer[hpass], temp, padded_size, finished, lev, p);
 
     // no merge scales or we didn't reach the merge scale from yet
     if(p->merge_from_scale == 0 || p->merge_from_scale > lev + 1)
@@ -320,7 +361,7 @@ static void dwt_wavelet_decompose(float *img,
     else if(p->return_layer == 0)
     {
       // some of the detail scales are on the merged layers
-      if(p->merge_from_scale > 0)
+      if(merged_layers)
       {
         // add merged layers to final image
         dt_iop_image_add_image(layers, merged_layers, p->width, p->height, p->ch);
@@ -337,11 +378,20 @@ static void dwt_wavelet_decompose(float *img,
     }
   }
 
+cleanup:
   dt_free_align(temp);
   dt_free_align(layers);
   dt_free_align(buffer[1]);
-  if(merged_layers)
-    dt_free_align(merged_layers);
+  dt_free_align(merged_layers);
+  dt_free_align(finished);
+}
+
+int dwt_get_buffer_count(const int scales, const int return_layer, const int merge_from_scale)
+{
+  if(scales <= 0) return 0;
+  // the coarse scale besides the image, the reconstruction and the merged scales
+  return 1 + (return_layer == 0 ? 1 : 0)
+           + (merge_from_scale > 0 && merge_from_scale <= scales ? 1 : 0);
 }
 
 /* this function prepares for decomposing, which is done in the function dwt_wavelet_decompose() */
@@ -374,113 +424,84 @@ void dwt_decompose(dwt_params_t *p, _dwt_layer_func layer_func)
   dwt_wavelet_decompose(p->image, p, layer_func);
 }
 
-// first, "vertical" pass of wavelet decomposition
-static void dwt_denoise_vert_1ch(
-    float *const restrict out,
-    const float *const restrict in,
-    const size_t height,
-    const size_t width,
-    const size_t lev)
+typedef struct _dwt_denoise_t
 {
-  const int vscale = MIN(1 << lev, height);
-  DT_OMP_FOR()
-  for(int rowid = 0; rowid < height ; rowid++)
-  {
-    const int row = dwt_interleave_rows(rowid,height,vscale);
-    // perform a weighted sum of the current pixel row with the rows 'scale' pixels above and below
-    // if either of those is beyond the edge of the image, we use reflection to get a value for averaging,
-    // i.e. we move as many rows in from the edge as we would have been beyond the edge
-    // for the top edge, this means we can simply use the absolute value of row-vscale; for the bottom edge,
-    //   we need to reflect around height
-    const size_t rowstart = (size_t)row * width;
-    const size_t below_row = (row + vscale < height) ? (row + vscale) : 2*(height-1) - (row + vscale);
-    const float *const restrict center = in + rowstart;
-    const float *const restrict above =  in + abs(row - vscale) * width;
-    const float *const restrict below = in + below_row * width;
-    float* const restrict outrow = out + rowstart;
-    DT_OMP_SIMD()
-    for(int col= 0; col < width; col++)
-    {
-      outrow[col] = 2.f * center[col] + above[col] + below[col];
-    }
-  }
+  float *img;
+  float *coarse;
+  float *accum;
+  size_t width;
+  int hscale;
+  float thold;
+  int last;
+} _dwt_denoise_t;
+
+static inline float _dwt_edge_hat(const float *const row, const int col, const int width, const int hscale)
+{
+  const int right = (col + hscale < width) ? col + hscale : 2 * (width - 1) - (col + hscale);
+  return (2.f * row[col] + row[abs(col - hscale)] + row[right]) / 16.f;
 }
 
-// second, horizontal pass of wavelet decomposition; generates 'coarse' into the output buffer and overwrites
-//   the input buffer with 'details'
-static void dwt_denoise_horiz_1ch(
-    float *const restrict out,
-    float *const restrict in,
-    float *const restrict accum,
-    const size_t height,
-    const size_t width,
-    const size_t lev,
-    const float thold,
-    const int last)
+// single channel version of _dwt_layer_row()
+__DT_CLONE_TARGETS__
+static void _dwt_denoise_row(void *data,
+                             float *const vsum,
+                             const size_t row,
+                             const size_t above_row,
+                             const size_t below_row)
 {
-  const int hscale = MIN(1 << lev, width);
-  DT_OMP_FOR()
-  for(int row = 0; row < height ; row++)
+  const _dwt_denoise_t *const d = data;
+  const size_t width = d->width;
+  const int hscale = d->hscale;
+  const float *const restrict center = d->img + row * width;
+  const float *const restrict above = d->img + above_row * width;
+  const float *const restrict below = d->img + below_row * width;
+  float *const restrict temprow = vsum;
+  float *const restrict coarse = d->coarse + row * width;
+
+  DT_OMP_SIMD()
+  for(size_t col = 0; col < width; col++)
+    temprow[col] = 2.f * center[col] + above[col] + below[col];
+
+  // the columns within 'hscale' of either edge reflect there, on narrow rows both edges may apply
+  const int w = width;
+  const int inner_start = MIN(hscale, w);
+  const int inner_end = MAX(w - hscale, inner_start);
+  for(int col = 0; col < inner_start; col++)
+    coarse[col] = _dwt_edge_hat(temprow, col, w, hscale);
+  DT_OMP_SIMD()
+  for(int col = inner_start; col < inner_end; col++)
+    coarse[col] = (2.f * temprow[col] + temprow[col - hscale] + temprow[col + hscale]) / 16.f;
+  for(int col = inner_end; col < w; col++)
+    coarse[col] = _dwt_edge_hat(temprow, col, w, hscale);
+}
+
+// accumulates the portion of the detail scale that is above the noise threshold, and replaces the input
+// with 'coarse'; on the last scale the accumulated details are added to the residue to create the final
+// denoised result
+__DT_CLONE_TARGETS__
+static void _dwt_denoise_finish(void *data, const size_t row)
+{
+  const _dwt_denoise_t *const d = data;
+  const size_t width = d->width;
+  const float thold = d->thold;
+  float *const restrict img = d->img + row * width;
+  const float *const restrict coarse = d->coarse + row * width;
+  float *const restrict accum = d->accum + row * width;
+  DT_OMP_SIMD()
+  for(size_t col = 0; col < width; col++)
+  {
+    const float diff = img[col] - coarse[col];
+    img[col] = coarse[col];
+    // GCC8 won't vectorize if we use the following line, but it turns out that just adding the two conditional
+    // alternatives produces exactly the same result, and *that* does get vectorized
+    //const float excess = diff < 0.0 ? MIN(diff + thold, 0.0f) : MAX(diff - thold, 0.0f);
+    accum[col] += MAX(diff - thold, 0.0f) + MIN(diff + thold, 0.0f);
+  }
+  if(d->last)
   {
-    // perform a weighted sum of the current pixel with the ones 'scale' pixels to the left and right, using
-    // reflection to get a value if either of those positions is out of bounds, i.e. we move as many columns
-    // in from the edge as we would have been beyond the edge to avoid an additional pass, we also rescale the
-    // final sum and split the original input into 'coarse' and 'details' by subtracting the scaled sum from
-    // the original input.
-    const size_t rowindex = (size_t)row * width;
-    float *const restrict details = in + rowindex;
-    float *const restrict coarse = out + rowindex;
-    float *const restrict accum_row = accum + rowindex;
-    // handle reflection at left edge
-    DT_OMP_SIMD()
-    for(int col = 0; col < hscale; col++)
-    {
-      // add up left/center/right, and renormalize by dividing by the total weight of all numbers added together
-      const float hat = (2.f * coarse[col] + coarse[hscale-col] + coarse[col+hscale]) / 16.f;
-      // the normalized value is our 'coarse' result; 'diff' is the difference between original input and 'coarse'
-      // (which would ordinarily be stored as the details scale, but we don't need it any further)
-      const float diff = details[col] - hat;
-      details[col] = hat;		// done with original input, so we can overwrite it with 'coarse'
-      // GCC8 won't vectorize if we use the following line, but it turns out that just adding the two conditional
-      // alternatives produces exactly the same result, and *that* does get vectorized
-      //const float excess = diff < 0.0 ? MIN(diff + thold, 0.0f) : MAX(diff - thold, 0.0f);
-      accum_row[col] += MAX(diff - thold,0.0f) + MIN(diff + thold, 0.0f);
-    }
-    DT_OMP_SIMD()
-    for(int col = hscale; col < width - hscale; col++)
-    {
-      // add up left/center/right, and renormalize by dividing by the total weight of all numbers added together
-      const float hat = (2.f * coarse[col] + coarse[col-hscale] + coarse[col+hscale]) / 16.f;
-      // the normalized value is our 'coarse' result; 'diff' is the difference between original input and 'coarse'
-      // (which would ordinarily be stored as the details scale, but we don't need it any further)
-      const float diff = details[col] - hat;
-      details[col] = hat;		// done with original input, so we can overwrite it with 'coarse'
-      // GCC8 won't vectorize if we use the following line, but it turns out that just adding the two conditional
-      // alternatives produces exactly the same result, and *that* does get vectorized
-      //const float excess = diff < 0.0 ? MIN(diff + thold, 0.0f) : MAX(diff - thold, 0.0f);
-      accum_row[col] += MAX(diff - thold,0.0f) + MIN(diff + thold, 0.0f);
-    }
-    // handle reflection at right edge
     DT_OMP_SIMD()
-    for(int col = width - hscale; col < width; col++)
-    {
-      const float right = coarse[2*width - 2 - (col+hscale)];
-      // add up left/center/right, and renormalize by dividing by the total weight of all numbers added together
-      const float hat = (2.f * coarse[col] + coarse[col-hscale] + right) / 16.f;
-      // the normalized value is our 'coarse' result; 'diff' is the difference between original input and 'coarse'
-      // (which would ordinarily be stored as the details scale, but we don't need it any further)
-      const float diff = details[col] - hat;
-      details[col] = hat;		// done with original input, so we can overwrite it with 'coarse'
-      accum_row[col] += MAX(diff - thold,0.0f) + MIN(diff + thold, 0.0f);
-    }
-    if(last)
-    {
-      // add the details to the residue to create the final denoised result
-      for(int col = 0; col < width; col++)
-      {
-        details[col] += accum_row[col];
-      }
-    }
+    for(size_t col = 0; col < width; col++)
+      img[col] += accum[col];
   }
 }
 
@@ -495,31 +516,37 @@ void dwt_denoise(float *const img,
                  const float *const noise)
 {
   float *const details = dt_alloc_align_float((size_t)2 * width * height);
-  if(!details)
+  size_t padded_size;
+  float *const temp = dt_alloc_perthread_float(width, &padded_size);
+  uint8_t *const finished = dt_alloc_align_type(uint8_t, height);
+  if(!details || !temp || !finished)
   {
     dt_print(DT_DEBUG_ALWAYS,"[dwt_denoise] unable to alloc working memory, skipping denoise\n");
-    return;
+    goto cleanup;
   }
-  float *const interm = details + width * height;	// temporary storage for use during each pass
+  float *const interm = details + width * height;	// 'coarse' of each pass
 
   // zero the accumulator
   dt_iop_image_fill(details, 0.0f, width, height, 1);
 
   for(int lev = 0; lev < bands; lev++)
   {
-    const int last = (lev+1) == bands;
-
-    // "vertical" pass, averages pixels with those 'scale' rows above
-    // and below and puts result in 'interm'
-    dwt_denoise_vert_1ch(interm, img, height, width, lev);
-    // horizontal filtering pass, averages pixels in 'interm' with
-    // those 'scale' rows to the left and right
-    // accumulates the portion of the detail scale that is above the
+    // averages pixels with those 'scale' rows above and below and then with
+    // those 'scale' columns to the left and right, puts the result in 'interm'
+    // and accumulates the portion of the detail scale that is above the
     // noise threshold into 'details'; this will be added to the
     // residue left in 'img' on the last iteration
-    dwt_denoise_horiz_1ch(interm, img, details, height, width, lev, noise[lev], last);
+    _dwt_denoise_t d = { .img = img, .coarse = interm, .accum = details, .width = width,
+                         .hscale = MIN(1 << lev, width - 1), .thold = noise[lev],
+                         .last = (lev + 1) == bands };
+    _dwt_decompose_rows(&d, _dwt_denoise_row, _dwt_denoise_finish, temp, padded_size, finished,
+                        height, MIN(1 << lev, height - 1));
   }
+
+cleanup:
   dt_free_align(details);
+  dt_free_align(temp);
+  dt_free_align(finished);
 }
 
 #ifdef HAVE_OPENCL
@@ -812,7 +839,7 @@ static cl_int dwt_wavelet_decompose_cl(cl_mem img, dwt_params_cl_t *const p, _dw
     else if(p->return_layer == 0)
     {
       // some of the detail scales are on the merged layers
-      if(p->merge_from_scale > 0)
+      if(merged_layers)
       {
         // add merged layers to final image
         err = dwt_add_layer_cl(merged_layers, layers, p, p->scales + 1);
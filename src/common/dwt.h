@@ -1,6 +1,6 @@
 /*
     This file is part of darktable,
-    Copyright (C) 2017-2023 darktable developers.
+    Copyright (C) 2017-2024 darktable developers.
 
     darktable is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -66,6 +66,10 @@ int dt_dwt_first_scale_visible(dwt_params_t *p);
  */
 void dwt_decompose(dwt_params_t *p, _dwt_layer_func layer_func);
 
+/* returns the number of image sized buffers dwt_decompose() allocates besides the image, for the
+ * scales, return_layer and merge_from_scale passed to dt_dwt_init(), to be used by tiling callbacks */
+int dwt_get_buffer_count(const int scales, const int return_layer, const int merge_from_scale);
+
 /* decomposes an image into 'bands' wavelet scales, then recomposes a denoised image from just that portion
  * of each scale whose absolute magnitude exceeds the threshold in noise[band]
  * img: input image, overwritten with the denoised image
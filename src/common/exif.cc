@@ -5640,11 +5640,13 @@ gboolean dt_exif_xmp_attach_export(const dt_imgid_t imgid,
   }
 }
 
-// Write XMP sidecar file: returns TRUE in case of errors.
-gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
-                           const char *filename,
-                           const gboolean force_write)
+static gboolean _exif_xmp_write(const dt_imgid_t imgid,
+                                const char *filename,
+                                const gboolean force_write,
+                                gboolean *unchanged)
 {
+  if(unchanged) *unchanged = FALSE;
+
   // Refuse to write sidecar for non-existent image:
   char imgfname[PATH_MAX] = { 0 };
   gboolean from_cache = TRUE;
@@ -5657,7 +5659,9 @@ gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
     Exiv2::XmpData xmpData;
     std::string xmpPacket;
     char *checksum_old = NULL;
-    if(!force_write && g_file_test(filename, G_FILE_TEST_EXISTS))
+    // when asked for, an existing sidecar is checked for changes even if its
+    // content is not merged
+    if((!force_write || unchanged) && g_file_test(filename, G_FILE_TEST_EXISTS))
     {
       // we want to avoid writing the sidecar file if it didn't change
       // to avoid issues when using the same images from different
@@ -5678,14 +5682,22 @@ gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
                  "cannot read XMP file '%s': '%s'\n", filename, strerror(errno));
         dt_control_log(_("cannot read XMP file '%s': '%s'"), filename, strerror(errno));
       }
+    }
 
+    if(!force_write && g_file_test(filename, G_FILE_TEST_EXISTS))
+    {
       Exiv2::DataBuf buf = Exiv2::readFile(WIDEN(filename));
 #if EXIV2_TEST_VERSION(0,28,0)
       xmpPacket.assign(buf.c_str(), buf.size());
 #else
       xmpPacket.assign(reinterpret_cast<char *>(buf.pData_), buf.size_);
 #endif
-      Exiv2::XmpParser::decode(xmpData, xmpPacket);
+      {
+        // the XMP toolkit is not set up for concurrent use and sidecars are written from
+        // several threads
+        Lock lock;
+        Exiv2::XmpParser::decode(xmpData, xmpPacket);
+      }
 
       // Because XmpSeq or XmpBag are added to the list, we first have to
       // remove these so that we don't end up with a string of duplicates.
@@ -5696,29 +5708,36 @@ gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
     _exif_xmp_read_data(xmpData, imgid, "dt_exif_xmp_write");
 
     // Serialize the xmp data and output the xmp packet.
-    if(Exiv2::XmpParser::encode(xmpPacket, xmpData,
-       Exiv2::XmpParser::useCompactFormat | Exiv2::XmpParser::omitPacketWrapper) != 0)
+    int encoded;
     {
+      Lock lock;
+      encoded = Exiv2::XmpParser::encode(xmpPacket, xmpData,
+                                         Exiv2::XmpParser::useCompactFormat
+                                         | Exiv2::XmpParser::omitPacketWrapper);
+    }
+    if(encoded != 0)
+    {
+      g_free(checksum_old);
       throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, "[xmp_write] failed to serialize xmp data");
     }
 
     // Hash the new data and compare it to the old hash (if applicable).
     const char *xml_header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
-    gboolean write_sidecar = TRUE;
-    if(checksum_old)
+    gchar *checksum_new = NULL;
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
+    if(checksum)
     {
-      GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
-      if(checksum)
-      {
-        g_checksum_update(checksum, (unsigned char*)xml_header, -1);
-        g_checksum_update(checksum, (unsigned char*)xmpPacket.c_str(), -1);
-        const char *checksum_new = g_checksum_get_string(checksum);
-        write_sidecar = g_strcmp0(checksum_old, checksum_new) != 0;
-        g_checksum_free(checksum);
-      }
-      g_free(checksum_old);
+      g_checksum_update(checksum, (unsigned char*)xml_header, -1);
+      g_checksum_update(checksum, (unsigned char*)xmpPacket.c_str(), -1);
+      checksum_new = g_strdup(g_checksum_get_string(checksum));
+      g_checksum_free(checksum);
     }
 
+    gboolean write_sidecar = TRUE;
+    if(checksum_old)
+      write_sidecar = !checksum_new || g_strcmp0(checksum_old, checksum_new) != 0;
+    g_free(checksum_old);
+
     if(write_sidecar)
     {
       // Using std::ofstream isn't possible here -- on Windows it
@@ -5736,10 +5755,14 @@ gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
         dt_print(DT_DEBUG_ALWAYS,
                  "cannot write XMP file '%s': '%s'\n", filename, strerror(errno));
         dt_control_log(_("cannot write XMP file '%s': '%s'"), filename, strerror(errno));
+        g_free(checksum_new);
         return TRUE;
       }
     }
+    else if(unchanged)
+      *unchanged = TRUE;
 
+    g_free(checksum_new);
     return FALSE;
   }
   catch(Exiv2::AnyError &e)
@@ -5752,6 +5775,24 @@ gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
   }
 }
 
+// Write XMP sidecar file: returns TRUE in case of errors.
+gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
+                           const char *filename,
+                           const gboolean force_write)
+{
+  return _exif_xmp_write(imgid, filename, force_write, NULL);
+}
+
+gboolean dt_exif_xmp_write_if_changed(const dt_imgid_t imgid,
+                                      const char *filename,
+                                      gboolean *unchanged)
+{
+  gboolean skipped = FALSE;
+  const gboolean error = _exif_xmp_write(imgid, filename, TRUE, &skipped);
+  if(unchanged) *unchanged = skipped;
+  return error;
+}
+
 dt_colorspaces_color_profile_type_t dt_exif_get_color_space(const uint8_t *data,
                                                             const size_t size)
 {
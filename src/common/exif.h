@@ -96,6 +96,11 @@ int dt_exif_write_blob(uint8_t *blob, uint32_t size, const char *path, const int
     find new edits. */
 gboolean dt_exif_xmp_write(const dt_imgid_t imgid, const char *filename, const gboolean force_write);
 
+/** write xmp sidecar file like dt_exif_xmp_write() with force_write, unless the checksum of the
+    file on disk shows it already holds the same payload. unchanged is set if the write was
+    skipped. returns TRUE in case of errors. */
+gboolean dt_exif_xmp_write_if_changed(const dt_imgid_t imgid, const char *filename, gboolean *unchanged);
+
 /** write xmp packet inside an image. */
 gboolean dt_exif_xmp_attach_export(const dt_imgid_t imgid, const char *filename, void *metadata,
     dt_develop_t *dev, dt_dev_pixelpipe_t *pipe);
@@ -0,0 +1,139 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/float16.h"
+#include "common/darktable.h"
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// values per thread and block
+#define FLOAT16_BLOCK 16384
+
+typedef union _fp32_t
+{
+  uint32_t u;
+  float f;
+} _fp32_t;
+
+/* see https://gist.github.com/rygorous/2156668, with saturation instead of
+   overflow to infinity */
+static inline uint16_t _from_float(const float f)
+{
+  static const _fp32_t denorm_magic = { ((127 - 15) + (23 - 10) + 1) << 23 };
+  _fp32_t v = { .f = f };
+  const uint16_t sign = (v.u >> 16) & 0x8000;
+  v.u &= 0x7fffffff;
+
+  uint16_t h;
+  if(v.u > 0x7f800000)                // NaN
+    h = 0x7e00;
+  else if(v.u >= 0x477ff000)          // rounds to infinity
+    h = 0x7bff;
+  else if(v.u < (113 << 23))          // half denormal or zero
+  {
+    v.f += denorm_magic.f;
+    h = v.u - denorm_magic.u;
+  }
+  else
+  {
+    const uint32_t mant_odd = (v.u >> 13) & 1;
+    v.u += ((uint32_t)(15 - 127) << 23) + 0xfff;
+    v.u += mant_odd;
+    h = v.u >> 13;
+  }
+  return h | sign;
+}
+
+static inline float _to_float(const uint16_t h)
+{
+  static const _fp32_t magic = { 113 << 23 };
+  static const uint32_t shifted_exp = 0x7c00 << 13;
+  _fp32_t o = { .u = (uint32_t)(h & 0x7fff) << 13 };
+  const uint32_t exp = shifted_exp & o.u;
+  o.u += (127 - 15) << 23;
+
+  if(exp == shifted_exp)              // infinity or NaN
+    o.u += (128 - 16) << 23;
+  else if(exp == 0)                   // denormal
+  {
+    o.u += 1 << 23;
+    o.f -= magic.f;
+  }
+  o.u |= (uint32_t)(h & 0x8000) << 16;
+  return o.f;
+}
+
+static void _from_float_block(uint16_t *const out, const float *const in, const size_t n)
+{
+  size_t k = 0;
+#if defined(__F16C__)
+  const __m256 hi = _mm256_set1_ps(DT_FLOAT16_MAX);
+  const __m256 lo = _mm256_set1_ps(-DT_FLOAT16_MAX);
+  for(; k + 8 <= n; k += 8)
+  {
+    // the constant first, so NaN passes through min and max
+    const __m256 v = _mm256_max_ps(lo, _mm256_min_ps(hi, _mm256_loadu_ps(in + k)));
+    _mm_storeu_si128((__m128i *)(out + k), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+  for(; k < n; k++)
+    out[k] = _from_float(in[k]);
+}
+
+static void _to_float_block(float *const out, const uint16_t *const in, const size_t n)
+{
+  size_t k = 0;
+#if defined(__F16C__)
+  for(; k + 8 <= n; k += 8)
+    _mm256_storeu_ps(out + k, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + k))));
+#endif
+  for(; k < n; k++)
+    out[k] = _to_float(in[k]);
+}
+
+void dt_float16_from_float(uint16_t *const out, const float *const in, const size_t n)
+{
+  const size_t blocks = (n + FLOAT16_BLOCK - 1) / FLOAT16_BLOCK;
+  DT_OMP_FOR(if(blocks > 1))
+  for(size_t b = 0; b < blocks; b++)
+  {
+    const size_t k = b * FLOAT16_BLOCK;
+    _from_float_block(out + k, in + k, MIN(FLOAT16_BLOCK, n - k));
+  }
+}
+
+void dt_float16_to_float(float *const out, const uint16_t *const in, const size_t n)
+{
+  const size_t blocks = (n + FLOAT16_BLOCK - 1) / FLOAT16_BLOCK;
+  DT_OMP_FOR(if(blocks > 1))
+  for(size_t b = 0; b < blocks; b++)
+  {
+    const size_t k = b * FLOAT16_BLOCK;
+    _to_float_block(out + k, in + k, MIN(FLOAT16_BLOCK, n - k));
+  }
+}
+
+#undef FLOAT16_BLOCK
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,47 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Conversion of float buffers to IEEE 754 half floats and back.
+ *
+ * Half floats keep 11 significant bits, a relative error of at most 2^-11
+ * for normal numbers, which is plenty for scene-referred pixel data. Values
+ * beyond the half range (including infinities) saturate to +-65504, NaN
+ * stays NaN. F16C instructions are used if the build allows them, the
+ * portable code gives identical results.
+ */
+
+// largest finite half float
+#define DT_FLOAT16_MAX 65504.0f
+
+/** convert n floats to half floats, rounding to nearest even */
+void dt_float16_from_float(uint16_t *const out, const float *const in, const size_t n);
+
+/** convert n half floats to floats, this is exact */
+void dt_float16_to_float(float *const out, const uint16_t *const in, const size_t n);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
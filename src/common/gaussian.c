@@ -196,309 +196,186 @@ error:
 }
 
 
-void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
-{
+/* The recursive filter runs down columns of floats. Neighbouring columns are
+ * filtered together in strips, so that every row of a strip is one
+ * vectorizable loop over whole cache lines instead of a walk down single
+ * pixels. The horizontal pass transposes bands of rows into the same layout. */
 
-  const int width = g->width;
-  const int height = g->height;
-  const int ch = MIN(4, g->channels); // just to appease zealous compiler warnings about stack usage
+// maximum number of float columns filtered together
+#define STRIP_FLOATS 64
+// width of the transposed bands of the horizontal pass in floats
+#define BAND_FLOATS 32
 
+typedef struct _gauss_coeffs_t
+{
   float a0, a1, a2, a3, b1, b2, coefp, coefn;
+} _gauss_coeffs_t;
+
+// forward and backward filter of n columns of length samples, rows are
+// stride floats apart and the columns are clamped to lo and hi
+__DT_CLONE_TARGETS__
+static void _blur_strip(const float *const restrict in,
+                        float *const restrict out,
+                        const size_t stride,
+                        const size_t length,
+                        const size_t n,
+                        const float *const restrict lo,
+                        const float *const restrict hi,
+                        const _gauss_coeffs_t *const c)
+{
+  const float a0 = c->a0, a1 = c->a1, a2 = c->a2, a3 = c->a3;
+  const float b1 = c->b1, b2 = c->b2;
 
-  _compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
-
-  float *temp = g->buf;
-
-  float *Labmax = g->max;
-  float *Labmin = g->min;
+  float DT_ALIGNED_ARRAY x1[STRIP_FLOATS];
+  float DT_ALIGNED_ARRAY x2[STRIP_FLOATS];
+  float DT_ALIGNED_ARRAY y1[STRIP_FLOATS];
+  float DT_ALIGNED_ARRAY y2[STRIP_FLOATS];
 
-// vertical blur column by column
-  DT_OMP_FOR()
-  for(int i = 0; i < width; i++)
+  // forward filter
+  for(size_t k = 0; k < n; k++)
   {
-    dt_aligned_pixel_t xp = {0.0f};
-    dt_aligned_pixel_t yb = {0.0f};
-    dt_aligned_pixel_t yp = {0.0f};
-
-    // forward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xp[k] = CLAMPF(in[(size_t)i * ch + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-    }
-
-    dt_aligned_pixel_t xc = {0.0f};
-    dt_aligned_pixel_t yc = {0.0f};
-    dt_aligned_pixel_t xn = {0.0f};
-    dt_aligned_pixel_t xa = {0.0f};
-    dt_aligned_pixel_t yn = {0.0f};
-    dt_aligned_pixel_t ya = {0.0f};
-    for(int j = 0; j < height; j++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        temp[offset + k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-    }
-
-    // backward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i) * ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
-    }
-
-    for(int j = height - 1; j > -1; j--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
-
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
-
-        temp[offset + k] += yc[k];
-      }
-    }
+    x1[k] = CLAMPF(in[k], lo[k], hi[k]);
+    y2[k] = x1[k] * c->coefp;
+    y1[k] = y2[k];
   }
 
-// horizontal blur line by line
-  DT_OMP_FOR()
-  for(int j = 0; j < height; j++)
+  for(size_t j = 0; j < length; j++)
   {
-    dt_aligned_pixel_t xp = {0.0f};
-    dt_aligned_pixel_t yb = {0.0f};
-    dt_aligned_pixel_t yp = {0.0f};
-
-    // forward filter
-    for(int k = 0; k < ch; k++)
+    const float *const restrict row = in + j * stride;
+    float *const restrict orow = out + j * stride;
+    DT_OMP_SIMD()
+    for(size_t k = 0; k < n; k++)
     {
-      xp[k] = CLAMPF(temp[(size_t)j * width * ch + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
+      const float xc = CLAMPF(row[k], lo[k], hi[k]);
+      const float yc = (a0 * xc) + (a1 * x1[k]) - (b1 * y1[k]) - (b2 * y2[k]);
+      orow[k] = yc;
+      x1[k] = xc;
+      y2[k] = y1[k];
+      y1[k] = yc;
     }
+  }
 
-    dt_aligned_pixel_t xc = {0.0f};
-    dt_aligned_pixel_t yc = {0.0f};
-    dt_aligned_pixel_t xn = {0.0f};
-    dt_aligned_pixel_t xa = {0.0f};
-    dt_aligned_pixel_t yn = {0.0f};
-    dt_aligned_pixel_t ya = {0.0f};
-
-    for(int i = 0; i < width; i++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        out[offset + k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-    }
+  // backward filter
+  const float *const restrict last = in + (length - 1) * stride;
+  for(size_t k = 0; k < n; k++)
+  {
+    x1[k] = CLAMPF(last[k], lo[k], hi[k]);
+    x2[k] = x1[k];
+    y1[k] = x1[k] * c->coefn;
+    y2[k] = y1[k];
+  }
 
-    // backward filter
-    for(int k = 0; k < ch; k++)
+  for(size_t j = length; j > 0; j--)
+  {
+    const float *const restrict row = in + (j - 1) * stride;
+    float *const restrict orow = out + (j - 1) * stride;
+    DT_OMP_SIMD()
+    for(size_t k = 0; k < n; k++)
     {
-      xn[k] = CLAMPF(temp[((size_t)(j + 1) * width - 1) * ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
+      const float xc = CLAMPF(row[k], lo[k], hi[k]);
+      const float yc = (a2 * x1[k]) + (a3 * x2[k]) - (b1 * y1[k]) - (b2 * y2[k]);
+      x2[k] = x1[k];
+      x1[k] = xc;
+      y2[k] = y1[k];
+      y1[k] = yc;
+      orow[k] += yc;
     }
+  }
+}
 
-    for(int i = width - 1; i > -1; i--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
-
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
-
-        out[offset + k] += yc[k];
-      }
-    }
+// clamping bounds for n floats of interleaved channels starting at channel first
+static inline void _strip_bounds(float *const lo,
+                                 float *const hi,
+                                 const size_t n,
+                                 const size_t first,
+                                 const int ch,
+                                 const float *const min,
+                                 const float *const max)
+{
+  for(size_t k = 0; k < n; k++)
+  {
+    lo[k] = min[(first + k) % ch];
+    hi[k] = max[(first + k) % ch];
   }
 }
 
-void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const out)
+static void _gaussian_blur(dt_gaussian_t *g,
+                           const float *const in,
+                           float *const out,
+                           const int ch)
 {
-  assert(g->channels == 4);
   const size_t width = g->width;
   const size_t height = g->height;
+  const size_t rowfloats = width * ch;
 
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
-
-  _compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+  _gauss_coeffs_t c;
+  _compute_gauss_params(g->sigma, g->order, &c.a0, &c.a1, &c.a2, &c.a3,
+                        &c.b1, &c.b2, &c.coefp, &c.coefn);
 
   float *const temp = g->buf;
-
-  dt_aligned_pixel_t Labmin, Labmax;
-  copy_pixel(Labmin, g->min);
-  copy_pixel(Labmax, g->max);
-
-// vertical blur column by column
+  const float *const min = g->min;
+  const float *const max = g->max;
+
+  // vertical blur strip by strip, narrower strips if there are too few
+  // of them to keep all threads busy
+  const size_t strip = rowfloats >= (size_t)STRIP_FLOATS * dt_get_num_threads()
+                         ? STRIP_FLOATS : STRIP_FLOATS / 4;
+  const size_t strips = (rowfloats + strip - 1) / strip;
   DT_OMP_FOR()
-  for(size_t i = 0; i < width; i++)
+  for(size_t s = 0; s < strips; s++)
   {
-    // forward filter
-    dt_aligned_pixel_t xp;
-    dt_aligned_pixel_t yb;
-    dt_aligned_pixel_t yp;
-    for_four_channels(k)
-    {
-      xp[k] = CLAMPF(in[4*i + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-    }
-
-    dt_aligned_pixel_t xc;
-    dt_aligned_pixel_t xn;
-    dt_aligned_pixel_t xa;
-    for(size_t j = 0; j < height; j++)
-    {
-      size_t offset = 4 * (j * width + i);
-
-      dt_aligned_pixel_t yc;
-      for_four_channels(k)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-      copy_pixel(temp + offset, yc);
-    }
-
-    // backward filter
-    dt_aligned_pixel_t yn;
-    dt_aligned_pixel_t ya;
-    for_four_channels(k)
-    {
-      xn[k] = CLAMPF(in[4*((height - 1) * width + i) + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
-    }
-
-    for(size_t j = height; j > 0; j--)
-    {
-      size_t offset = 4 * ((j-1) * width + i);
-
-      dt_aligned_pixel_t yc;
-      for_four_channels(k)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
-
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
-        temp[offset + k] += yc[k];
-      }
-    }
+    const size_t x0 = s * strip;
+    const size_t n = MIN(strip, rowfloats - x0);
+    float DT_ALIGNED_ARRAY lo[STRIP_FLOATS];
+    float DT_ALIGNED_ARRAY hi[STRIP_FLOATS];
+    _strip_bounds(lo, hi, n, x0, ch, min, max);
+    _blur_strip(in + x0, temp + x0, rowfloats, height, n, lo, hi, &c);
   }
 
-// horizontal blur line by line
+  // horizontal blur band by band, a band of rows is transposed so that
+  // its pixels are filtered like the columns of the vertical pass
+  const size_t rows = MAX(1, BAND_FLOATS / ch);
+  const size_t bands = (height + rows - 1) / rows;
+  size_t padded;
+  float *const bandbuf = dt_alloc_perthread_float(2 * BAND_FLOATS * width, &padded);
+  if(!bandbuf) return;
+
   DT_OMP_FOR()
-  for(size_t j = 0; j < height; j++)
+  for(size_t b = 0; b < bands; b++)
   {
-    // forward filter
-    dt_aligned_pixel_t xp;
-    dt_aligned_pixel_t yb;
-    dt_aligned_pixel_t yp;
-    dt_aligned_pixel_t xc;
-    for_four_channels(k)
-    {
-      xp[k] = CLAMPF(temp[4*(j * width) + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-    }
+    const size_t y0 = b * rows;
+    const size_t nrows = MIN(rows, height - y0);
+    const size_t n = nrows * ch;
+    float *const restrict tin = dt_get_perthread(bandbuf, padded);
+    float *const restrict tout = tin + BAND_FLOATS * width;
+    float DT_ALIGNED_ARRAY lo[STRIP_FLOATS];
+    float DT_ALIGNED_ARRAY hi[STRIP_FLOATS];
+    _strip_bounds(lo, hi, n, 0, ch, min, max);
 
     for(size_t i = 0; i < width; i++)
-    {
-      size_t offset = 4 * (j * width + i);
-      dt_aligned_pixel_t yc;
-
-      for_four_channels(k)
-      {
-        xc[k] = CLAMPF(temp[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        out[offset + k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-    }
-
-    // backward filter
-    dt_aligned_pixel_t xn;
-    dt_aligned_pixel_t xa;
-    dt_aligned_pixel_t ya;
-    dt_aligned_pixel_t yn;
-    for_four_channels(k)
-    {
-      xn[k] = CLAMPF(temp[4*((j + 1) * width - 1) + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
-    }
+      for(size_t r = 0; r < nrows; r++)
+        for(int k = 0; k < ch; k++)
+          tin[i * n + r * ch + k] = temp[((y0 + r) * width + i) * ch + k];
 
-    for(int i = width - 1; i > -1; i--)
-    {
-      size_t offset = 4 * (j * width + i);
-
-      dt_aligned_pixel_t yc;
-      for_four_channels(k)
-      {
-        xc[k] = CLAMPF(temp[offset + k], Labmin[k], Labmax[k]);
+    _blur_strip(tin, tout, n, width, n, lo, hi, &c);
 
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+    for(size_t r = 0; r < nrows; r++)
+      for(size_t i = 0; i < width; i++)
+        for(int k = 0; k < ch; k++)
+          out[((y0 + r) * width + i) * ch + k] = tout[i * n + r * ch + k];
+  }
+  dt_free_align(bandbuf);
+}
 
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
+void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
+{
+  _gaussian_blur(g, in, out, MIN(4, g->channels));
+}
 
-        out[offset + k] += yc[k];
-      }
-    }
-  }
+void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const out)
+{
+  assert(g->channels == 4);
+  _gaussian_blur(g, in, out, 4);
 }
 
 void dt_gaussian_free(dt_gaussian_t *g)
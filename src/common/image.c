@@ -2825,8 +2825,10 @@ static gboolean _any_altered_data(const dt_imgid_t imgid)
     || (dt_tag_count_attached(imgid, TRUE) > 0);
 }
 
-gboolean dt_image_write_sidecar_file(const dt_imgid_t imgid)
+static gboolean _image_write_sidecar(const dt_imgid_t imgid,
+                                     gboolean *unchanged)
 {
+  if(unchanged) *unchanged = FALSE;
   if(!dt_is_valid_imgid(imgid))
     return TRUE;
 
@@ -2857,8 +2859,14 @@ gboolean dt_image_write_sidecar_file(const dt_imgid_t imgid)
   {
     dt_image_path_append_version(imgid, filename, sizeof(filename));
     g_strlcat(filename, ".xmp", sizeof(filename));
-    error = dt_exif_xmp_write(imgid, filename, TRUE);
+    error = dt_exif_xmp_write_if_changed(imgid, filename, unchanged);
   }
+  return error;
+}
+
+gboolean dt_image_write_sidecar_file(const dt_imgid_t imgid)
+{
+  const gboolean error = _image_write_sidecar(imgid, NULL);
 
   /* The timestamp must be put into db
      - in case of no reported error while writing the sidecar
@@ -2878,6 +2886,32 @@ gboolean dt_image_write_sidecar_file(const dt_imgid_t imgid)
   return error;
 }
 
+gboolean dt_image_write_sidecar_file_unstamped(const dt_imgid_t imgid,
+                                               gboolean *unchanged)
+{
+  return _image_write_sidecar(imgid, unchanged);
+}
+
+void dt_image_set_write_timestamps(const GList *imgs)
+{
+  if(!imgs) return;
+
+  dt_database_start_transaction(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2
+    (dt_database_get(darktable.db),
+     "UPDATE main.images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1",
+     -1, &stmt, NULL);
+  for(const GList *l = imgs; l; l = g_list_next(l))
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_transaction(darktable.db);
+}
+
 void dt_image_synch_xmps(const GList *imgs)
 {
   dt_sidecar_synch_enqueue_list(imgs);
@@ -588,6 +588,11 @@ gboolean dt_image_safe_remove(const dt_imgid_t imgid);
 void dt_image_local_copy_synch(void);
 // xmp functions:
 gboolean dt_image_write_sidecar_file(const dt_imgid_t imgid);
+/** write the sidecar like dt_image_write_sidecar_file() but leave the write timestamp to
+    the caller, unchanged is set if the sidecar already held the same data */
+gboolean dt_image_write_sidecar_file_unstamped(const dt_imgid_t imgid, gboolean *unchanged);
+/** set the write timestamp of all images to now, in a single transaction */
+void dt_image_set_write_timestamps(const GList *imgs);
 void dt_image_synch_xmp(const int32_t selected);
 void dt_image_synch_xmps(const GList *img);
 void dt_image_synch_all_xmp(const gchar *pathname);
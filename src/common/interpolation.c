@@ -24,6 +24,7 @@
 #include <assert.h>
 #include <glib.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -460,24 +461,25 @@ static inline void _compute_downsampling_kernel(const struct dt_interpolation *i
                                                 float *kernel,
                                                 float *norm,
                                                 const float outoinratio,
-                                                const int xout)
+                                                const float xout)
 {
   // Keep this at hand
   const float w = (float)itor->width;
 
   /* Compute the phase difference between output pixel and its
    * input corresponding input pixel */
-  const float xin = ceil_fast(((float)xout - w) / outoinratio);
+  const float xin = ceil_fast((xout - w) / outoinratio);
   if(first)
   {
     *first = (int)xin;
   }
 
   // Compute first interpolator parameter
-  float t = xin * outoinratio - (float)xout;
+  float t = xin * outoinratio - xout;
 
-  // Compute all filter taps
-  int num_taps = *taps = (int)((w - t) / outoinratio);
+  // Compute all filter taps, ceilf() to keep the last one when xout is
+  // not an integer and the taps don't end exactly at the kernel width
+  int num_taps = *taps = (int)ceilf((w - t) / outoinratio);
   itor->maketaps(kernel, num_taps, itor->width, t, outoinratio);
   // compute the kernel norm if requested
   if (norm)
@@ -812,6 +814,8 @@ const struct dt_interpolation *dt_interpolation_new(enum dt_interpolation_type t
  * @param itor interpolator used to resample
  * @param in [in] Number of input samples
  * @param out [in] Number of output samples
+ * @param offset [in] Shift of the output samples, in output samples, for input
+ *        samples that don't sit at integer positions of the original input
  * @param plength [out] Array of lengths for each pixel filtering (number
  * of taps/indexes to use). This array mus be freed with dt_free_align() when you're
  * done with the plan.
@@ -829,6 +833,7 @@ static gboolean _prepare_resampling_plan(const struct dt_interpolation *itor,
                                          const int out,
                                          const int out_x0,
                                          const float scale,
+                                         const float offset,
                                          int **plength,
                                          float **pkernel,
                                          int **pindex,
@@ -910,7 +915,7 @@ static gboolean _prepare_resampling_plan(const struct dt_interpolation *itor,
       }
 
       // Projected position in input samples
-      float fx = (float)(out_x0 + x) / scale;
+      float fx = ((float)(out_x0 + x) - offset) / scale;
 
       // Compute the filter kernel at that position
       int first;
@@ -963,7 +968,8 @@ static gboolean _prepare_resampling_plan(const struct dt_interpolation *itor,
       // Compute downsampling kernel centered on output position
       int taps;
       int first;
-      _compute_downsampling_kernel(itor, &taps, &first, scratchpad, NULL, scale, out_x0 + x);
+      _compute_downsampling_kernel(itor, &taps, &first, scratchpad, NULL, scale,
+                                   (float)(out_x0 + x) - offset);
 
       /* Check lower and higher bound pixel index and skip as many pixels as
        * necessary to fall into range */
@@ -1007,6 +1013,88 @@ static gboolean _prepare_resampling_plan(const struct dt_interpolation *itor,
   return FALSE;
 }
 
+/** Downscaling by a large factor makes the filter kernels very wide, the taps
+ * per output pixel grow with the square of the factor. Up to this scale the input
+ * is first averaged in blocks of a power of two pixels, so that the kernel only
+ * has to cover the remaining factor of 2 to 4. */
+#define RESAMPLING_SHRINK_MAX_SCALE 0.25f
+
+static int _resampling_shrink_factor(const float scale)
+{
+  int factor = 1;
+  while(scale * factor <= RESAMPLING_SHRINK_MAX_SCALE) factor *= 2;
+  return factor;
+}
+
+// first and last+1 sample used by a resampling plan
+static void _resampling_plan_range(const int *const length,
+                                   const int *const index,
+                                   const int out,
+                                   int *first,
+                                   int *last)
+{
+  int n = 0;
+  for(int k = 0; k < out; k++) n += length[k];
+  int lo = INT_MAX;
+  int hi = 0;
+  for(int k = 0; k < n; k++)
+  {
+    lo = MIN(lo, index[k]);
+    hi = MAX(hi, index[k] + 1);
+  }
+  *first = MIN(lo, hi);
+  *last = hi;
+}
+
+/** Averages blocks of factor x factor pixels of in, the blocks at the right and
+ * bottom border can be smaller. Only the output rows y0 to y1 and columns x0
+ * to x1 are computed. */
+__DT_CLONE_TARGETS__
+static void _resampling_shrink(float *const out,
+                               const int out_width,
+                               const float *const in,
+                               const int in_width,
+                               const int in_height,
+                               const int factor,
+                               const int x0,
+                               const int x1,
+                               const int y0,
+                               const int y1)
+{
+  const int width = x1 - x0;
+  size_t padded;
+  float *const sums = dt_alloc_perthread_float(4 * width, &padded);
+  if(!sums) return;
+
+  DT_OMP_FOR()
+  for(int y = y0; y < y1; y++)
+  {
+    float *const restrict sum = dt_get_perthread(sums, padded);
+    memset(sum, 0, sizeof(float) * 4 * width);
+    const int iy0 = y * factor;
+    const int iy1 = MIN(iy0 + factor, in_height);
+    // add up whole input rows to read memory in order
+    for(int iy = iy0; iy < iy1; iy++)
+    {
+      const float *const restrict row = in + 4 * ((size_t)iy * in_width + (size_t)x0 * factor);
+      const int cols = MIN(x1 * factor, in_width) - x0 * factor;
+      for(int ix = 0; ix < cols; ix++)
+      {
+        float *const restrict s = sum + 4 * (ix / factor);
+        for_four_channels(c) s[c] += row[4 * ix + c];
+      }
+    }
+    float *const restrict o = out + 4 * ((size_t)y * out_width + x0);
+    for(int x = 0; x < width; x++)
+    {
+      const int cols = MIN((x0 + x + 1) * factor, in_width) - (x0 + x) * factor;
+      const float norm = 1.0f / (float)(cols * (iy1 - iy0));
+      for_four_channels(c) o[4 * x + c] = sum[4 * x + c] * norm;
+    }
+  }
+  dt_free_align(sums);
+}
+
 static void _interpolation_resample_plain(const struct dt_interpolation *itor,
                                           float *out,
                                           const dt_iop_roi_t *const roi_out,
@@ -1020,8 +1108,18 @@ static void _interpolation_resample_plain(const struct dt_interpolation *itor,
   int *vlength = NULL;
   float *vkernel = NULL;
   int *vmeta = NULL;
-
-  const int32_t in_stride_floats = roi_in->width * 4;
+  float *shrunk = NULL;
+
+  // the input after averaging blocks of shrink x shrink pixels
+  const int shrink = _resampling_shrink_factor(roi_out->scale);
+  const int in_width = (roi_in->width + shrink - 1) / shrink;
+  const int in_height = (roi_in->height + shrink - 1) / shrink;
+  const float scale = roi_out->scale * shrink;
+  // a block average sits at the centre of the block
+  const float offset = roi_out->scale * (shrink - 1) * 0.5f;
+  const float *src = in;
+
+  const int32_t in_stride_floats = in_width * 4;
   const int32_t out_stride_floats = roi_out->width * 4;
 
   dt_print_pipe(DT_DEBUG_PIPE | DT_DEBUG_VERBOSE,
@@ -1051,16 +1149,28 @@ static void _interpolation_resample_plain(const struct dt_interpolation *itor,
   // Generic non 1:1 case... much more complicated :D
 
   // Prepare resampling plans once and for all
-  if(_prepare_resampling_plan(itor, roi_in->width, roi_in->x,
-                              roi_out->width, roi_out->x, roi_out->scale,
+  if(_prepare_resampling_plan(itor, in_width, roi_in->x,
+                              roi_out->width, roi_out->x, scale, offset,
                               &hlength, &hkernel, &hindex, NULL))
     goto exit;
 
-  if(_prepare_resampling_plan(itor, roi_in->height, roi_in->y,
-                              roi_out->height, roi_out->y, roi_out->scale,
+  if(_prepare_resampling_plan(itor, in_height, roi_in->y,
+                              roi_out->height, roi_out->y, scale, offset,
                               &vlength, &vkernel, &vindex, &vmeta))
     goto exit;
 
+  if(shrink > 1)
+  {
+    shrunk = dt_alloc_align_float((size_t)4 * in_width * in_height);
+    if(!shrunk) goto exit;
+    // only the part of the input used by the plans
+    int x0, x1, y0, y1;
+    _resampling_plan_range(hlength, hindex, roi_out->width, &x0, &x1);
+    _resampling_plan_range(vlength, vindex, roi_out->height, &y0, &y1);
+    _resampling_shrink(shrunk, in_width, in, roi_in->width, roi_in->height, shrink, x0, x1, y0, y1);
+    src = shrunk;
+  }
+
   dt_get_perf_times(&mid);
 
   const size_t height = roi_out->height;
@@ -1104,7 +1214,7 @@ static void _interpolation_resample_plain(const struct dt_interpolation *itor,
           const size_t baseidx = baseidx_vindex + (size_t)hindex[hkidx] * 4;
           const float htap = hkernel[hkidx++];
           dt_aligned_pixel_t tmp;
-          copy_pixel(tmp, in + baseidx);
+          copy_pixel(tmp, src + baseidx);
           for_each_channel(c, aligned(tmp,vhs:16))
             vhs[c] += tmp[c] * htap;
         }
@@ -1143,6 +1253,7 @@ exit:
    * allocated. */
   dt_free_align(hlength);
   dt_free_align(vlength);
+  dt_free_align(shrunk);
   _show_2_times(&start, &mid, "resample_plain");
 }
 
@@ -1184,6 +1295,187 @@ void dt_interpolation_resample_roi(const struct dt_interpolation *itor,
   dt_interpolation_resample(itor, out, &oroi, in, &iroi);
 }
 
+// rows of points handed to the backtransform at once, keeps the point buffer
+// small while still giving the backtransform enough points to go parallel
+#define BACKTRANSFORM_ROWS 32
+
+void dt_interpolation_resample_backtransform(const struct dt_interpolation *itor,
+                                             float *out,
+                                             const dt_iop_roi_t *const roi_out,
+                                             const float *const in,
+                                             const dt_iop_roi_t *const roi_in,
+                                             dt_interpolation_backtransform_t backtransform,
+                                             void *data)
+{
+  const int width = roi_out->width;
+  const size_t band_points = (size_t)width * BACKTRANSFORM_ROWS;
+  float *const points = dt_alloc_align_float(2 * band_points);
+  if(!points)
+  {
+    memset(out, 0, sizeof(float) * 4 * roi_out->width * roi_out->height);
+    return;
+  }
+
+  for(int band = 0; band < roi_out->height; band += BACKTRANSFORM_ROWS)
+  {
+    const int rows = MIN(BACKTRANSFORM_ROWS, roi_out->height - band);
+    const size_t npoints = (size_t)width * rows;
+
+    DT_OMP_FOR()
+    for(int j = 0; j < rows; j++)
+      for(int i = 0; i < width; i++)
+      {
+        float *const p = points + 2 * ((size_t)j * width + i);
+        p[0] = (roi_out->x + i + 0.5f) / roi_out->scale;
+        p[1] = (roi_out->y + band + j + 0.5f) / roi_out->scale;
+      }
+
+    backtransform(points, npoints, data);
+
+    DT_OMP_FOR()
+    for(int j = 0; j < rows; j++)
+    {
+      float *const o = out + (size_t)4 * (band + j) * width;
+      for(int i = 0; i < width; i++)
+      {
+        const float *const p = points + 2 * ((size_t)j * width + i);
+        if(!isfinite(p[0]) || !isfinite(p[1]))
+        {
+          static const dt_aligned_pixel_t zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+          copy_pixel(o + 4 * i, zero);
+          continue;
+        }
+        const float x = p[0] * roi_in->scale - roi_in->x - 0.5f;
+        const float y = p[1] * roi_in->scale - roi_in->y - 0.5f;
+        dt_interpolation_compute_pixel4c(itor, in, o + 4 * i, x, y,
+                                         roi_in->width, roi_in->height, 4 * roi_in->width);
+      }
+    }
+  }
+  dt_free_align(points);
+}
+
+#undef BACKTRANSFORM_ROWS
+
+// how far the probed corners may be off the pixel grid
+#define PERMUTATION_EPS 1e-3f
+
+gboolean dt_interpolation_permutation_probe(dt_interpolation_permutation_t *perm,
+                                            const dt_iop_roi_t *const roi_out,
+                                            const dt_iop_roi_t *const roi_in,
+                                            dt_interpolation_backtransform_t backtransform,
+                                            void *data)
+{
+  const int w = roi_out->width;
+  const int h = roi_out->height;
+  if(w < 2 || h < 2 || roi_in->scale != roi_out->scale) return FALSE;
+
+  // centres of the corner pixels, the fourth one catches non-linear maps
+  const int corner[4][2] = { { 0, 0 }, { w - 1, 0 }, { 0, h - 1 }, { w - 1, h - 1 } };
+  float points[8];
+  for(int k = 0; k < 4; k++)
+  {
+    points[2 * k] = (roi_out->x + corner[k][0] + 0.5f) / roi_out->scale;
+    points[2 * k + 1] = (roi_out->y + corner[k][1] + 0.5f) / roi_out->scale;
+  }
+  backtransform(points, 4, data);
+
+  float b[4][2];
+  for(int k = 0; k < 4; k++)
+  {
+    if(!isfinite(points[2 * k]) || !isfinite(points[2 * k + 1])) return FALSE;
+    b[k][0] = points[2 * k] * roi_in->scale - roi_in->x - 0.5f;
+    b[k][1] = points[2 * k + 1] * roi_in->scale - roi_in->y - 0.5f;
+  }
+
+  const float m[4] = { (b[1][0] - b[0][0]) / (w - 1), (b[2][0] - b[0][0]) / (h - 1),
+                       (b[1][1] - b[0][1]) / (w - 1), (b[2][1] - b[0][1]) / (h - 1) };
+  for(int k = 0; k < 4; k++)
+  {
+    perm->m[k] = lrintf(m[k]);
+    if(fabsf(m[k] - perm->m[k]) > PERMUTATION_EPS) return FALSE;
+  }
+  // one entry of magnitude one per row and column
+  if(abs(perm->m[0]) + abs(perm->m[1]) != 1
+     || abs(perm->m[2]) + abs(perm->m[3]) != 1
+     || abs(perm->m[0]) + abs(perm->m[2]) != 1)
+    return FALSE;
+
+  // the modules copy the whole roi_in, so the offset follows from the rois
+  // and not from the backtransform, which may be off by a fraction of a pixel
+  const int extent_x = abs(perm->m[0]) * (w - 1) + abs(perm->m[1]) * (h - 1) + 1;
+  const int extent_y = abs(perm->m[2]) * (w - 1) + abs(perm->m[3]) * (h - 1) + 1;
+  if(extent_x != roi_in->width || extent_y != roi_in->height) return FALSE;
+  perm->c[0] = -(MIN(0, perm->m[0] * (w - 1)) + MIN(0, perm->m[1] * (h - 1)));
+  perm->c[1] = -(MIN(0, perm->m[2] * (w - 1)) + MIN(0, perm->m[3] * (h - 1)));
+  if(fabsf(b[0][0] - perm->c[0]) >= 1.0f || fabsf(b[0][1] - perm->c[1]) >= 1.0f)
+    return FALSE;
+
+  // the last corner has to follow the same map
+  const float x3 = b[0][0] + perm->m[0] * (w - 1) + perm->m[1] * (h - 1);
+  const float y3 = b[0][1] + perm->m[2] * (w - 1) + perm->m[3] * (h - 1);
+  if(fabsf(b[3][0] - x3) > PERMUTATION_EPS * w || fabsf(b[3][1] - y3) > PERMUTATION_EPS * h)
+    return FALSE;
+
+  perm->roi_out = *roi_out;
+  perm->roi_in = *roi_in;
+  return TRUE;
+}
+
+#undef PERMUTATION_EPS
+
+void dt_interpolation_permutation_backtransform(float *const points,
+                                                const size_t points_count,
+                                                void *data)
+{
+  const dt_interpolation_permutation_t *const perm = data;
+  const dt_iop_roi_t *const ro = &perm->roi_out;
+  const dt_iop_roi_t *const ri = &perm->roi_in;
+  for(size_t k = 0; k < 2 * points_count; k += 2)
+  {
+    const float u = points[k] * ro->scale - ro->x - 0.5f;
+    const float v = points[k + 1] * ro->scale - ro->y - 0.5f;
+    points[k] = (perm->m[0] * u + perm->m[1] * v + perm->c[0] + ri->x + 0.5f) / ri->scale;
+    points[k + 1] = (perm->m[2] * u + perm->m[3] * v + perm->c[1] + ri->y + 0.5f) / ri->scale;
+  }
+}
+
+void dt_interpolation_permutation_chain(dt_interpolation_permutation_t *perm,
+                                        const dt_interpolation_permutation_t *const below)
+{
+  const int m[4] = { below->m[0] * perm->m[0] + below->m[1] * perm->m[2],
+                     below->m[0] * perm->m[1] + below->m[1] * perm->m[3],
+                     below->m[2] * perm->m[0] + below->m[3] * perm->m[2],
+                     below->m[2] * perm->m[1] + below->m[3] * perm->m[3] };
+  const int c[2] = { below->m[0] * perm->c[0] + below->m[1] * perm->c[1] + below->c[0],
+                     below->m[2] * perm->c[0] + below->m[3] * perm->c[1] + below->c[1] };
+  for(int k = 0; k < 4; k++) perm->m[k] = m[k];
+  perm->c[0] = c[0];
+  perm->c[1] = c[1];
+  perm->roi_in = below->roi_in;
+}
+
+void dt_interpolation_permute(const dt_interpolation_permutation_t *const perm,
+                              float *out,
+                              const float *const in)
+{
+  const int width = perm->roi_out.width;
+  const int in_width = perm->roi_in.width;
+  const int *const m = perm->m;
+  const int *const c = perm->c;
+  DT_OMP_FOR()
+  for(int j = 0; j < perm->roi_out.height; j++)
+  {
+    float *const o = out + (size_t)4 * j * width;
+    for(int i = 0; i < width; i++)
+    {
+      const int x = m[0] * i + m[1] * j + c[0];
+      const int y = m[2] * i + m[3] * j + c[1];
+      copy_pixel(o + 4 * i, in + 4 * ((size_t)y * in_width + x));
+    }
+  }
+}
+
 #ifdef HAVE_OPENCL
 dt_interpolation_cl_global_t *dt_interpolation_init_cl_global()
 {
@@ -1272,12 +1564,12 @@ int dt_interpolation_resample_cl(const struct dt_interpolation *itor,
 
   // Prepare resampling plans once and for all
   if(_prepare_resampling_plan(itor, roi_in->width, roi_in->x,
-                              roi_out->width, roi_out->x, roi_out->scale,
+                              roi_out->width, roi_out->x, roi_out->scale, 0.0f,
                               &hlength, &hkernel, &hindex, &hmeta))
     goto error;
 
   if(_prepare_resampling_plan(itor, roi_in->height, roi_in->y,
-                              roi_out->height, roi_out->y, roi_out->scale,
+                              roi_out->height, roi_out->y, roi_out->scale, 0.0f,
                               &vlength, &vkernel, &vindex, &vmeta))
     goto error;
 
@@ -1465,12 +1757,12 @@ static void _interpolation_resample_1c_plain(const struct dt_interpolation *itor
 
   // Prepare resampling plans once and for all
   if(_prepare_resampling_plan(itor, roi_in->width, roi_in->x,
-                              roi_out->width, roi_out->x, roi_out->scale,
+                              roi_out->width, roi_out->x, roi_out->scale, 0.0f,
                               &hlength, &hkernel, &hindex, NULL))
     goto exit;
 
   if(_prepare_resampling_plan(itor, roi_in->height, roi_in->y,
-                              roi_out->height, roi_out->y, roi_out->scale,
+                              roi_out->height, roi_out->y, roi_out->scale, 0.0f,
                               &vlength, &vkernel, &vindex, &vmeta))
     goto exit;
 
@@ -136,6 +136,73 @@ void dt_interpolation_resample_roi(const struct dt_interpolation *itor, float *o
                                    const dt_iop_roi_t *const roi_out,
                                    const float *const in, const dt_iop_roi_t *const roi_in);
 
+/** maps points_count (x,y) pairs from output to input image coordinates in place */
+typedef void (*dt_interpolation_backtransform_t)(float *const points,
+                                                 const size_t points_count,
+                                                 void *data);
+
+/** Warping resampler.
+ *
+ * Generates the 4 channel image "out" by sampling "in" at the positions given
+ * by a coordinate backtransform, the way the distorting modules do it:
+ * <ul>
+ * <li>the centre of output pixel (i, j) is at ((roi_out->x + i + 0.5) / roi_out->scale,
+ *     (roi_out->y + j + 0.5) / roi_out->scale)</li>
+ * <li>the backtransform maps that to a point p in the input image</li>
+ * <li>the sample is taken at p * roi_in->scale - (roi_in->x + 0.5, roi_in->y + 0.5) of the in buffer</li>
+ * </ul>
+ * Points the backtransform can't map (non-finite coordinates) give zero pixels.
+ *
+ * @param itor [in] Interpolator to use
+ * @param out [out] Will hold the resampled image
+ * @param roi_out [in] Region of interest of the resampled image
+ * @param in [in] The input image
+ * @param roi_in [in] Region of interest of the input image
+ * @param backtransform [in] Coordinate mapping, called for batches of points
+ * @param data [in] Passed to backtransform
+ */
+void dt_interpolation_resample_backtransform(const struct dt_interpolation *itor, float *out,
+                                             const dt_iop_roi_t *const roi_out,
+                                             const float *const in,
+                                             const dt_iop_roi_t *const roi_in,
+                                             dt_interpolation_backtransform_t backtransform,
+                                             void *data);
+
+/** A backtransform moving whole pixels: crops, flips and rotations by
+ *  multiples of 90 degrees. Pixel (i, j) of roi_out comes from pixel
+ *  (m[0] * i + m[1] * j + c[0], m[2] * i + m[3] * j + c[1]) of roi_in. */
+typedef struct dt_interpolation_permutation_t
+{
+  dt_iop_roi_t roi_out;
+  dt_iop_roi_t roi_in;
+  int m[4];
+  int c[2];
+} dt_interpolation_permutation_t;
+
+/** checks whether backtransform maps the pixels of roi_out one to one onto
+ *  all pixels of roi_in and sets up perm for it. The offset is taken from the
+ *  rois, like the copying modules do, the backtransform only has to agree
+ *  with it to less than a pixel. */
+gboolean dt_interpolation_permutation_probe(dt_interpolation_permutation_t *perm,
+                                            const dt_iop_roi_t *const roi_out,
+                                            const dt_iop_roi_t *const roi_in,
+                                            dt_interpolation_backtransform_t backtransform,
+                                            void *data);
+
+/** the backtransform of a permutation, data is the dt_interpolation_permutation_t */
+void dt_interpolation_permutation_backtransform(float *const points,
+                                                const size_t points_count,
+                                                void *data);
+
+/** appends the permutation below (whose roi_out is perm->roi_in) to perm */
+void dt_interpolation_permutation_chain(dt_interpolation_permutation_t *perm,
+                                        const dt_interpolation_permutation_t *const below);
+
+/** copies the 4 channel pixels of in to out along perm, no interpolation */
+void dt_interpolation_permute(const dt_interpolation_permutation_t *const perm,
+                              float *out,
+                              const float *const in);
+
 #ifdef HAVE_OPENCL
 typedef struct dt_interpolation_cl_global_t
 {
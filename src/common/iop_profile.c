@@ -1230,6 +1230,32 @@ void dt_ioppr_transform_image_colorspace
 }
 
 
+gboolean dt_ioppr_can_transform_pixels_colorspace(const dt_iop_order_iccprofile_info_t *const profile_info)
+{
+  return profile_info
+    && profile_info->type != DT_COLORSPACE_NONE
+    && dt_is_valid_colormatrix(profile_info->matrix_in[0][0])
+    && dt_is_valid_colormatrix(profile_info->matrix_out[0][0]);
+}
+
+void dt_ioppr_transform_pixels_colorspace
+  (const float *const in,
+   float *const out,
+   const size_t npixels,
+   const int cst_from,
+   const int cst_to,
+   const dt_iop_order_iccprofile_info_t *const profile_info)
+{
+  // called from within a parallel loop, the loops of the helpers run on this thread only.
+  // per pixel they do exactly what the full image conversion does.
+  if(cst_from == IOP_CS_RGB && cst_to == IOP_CS_LAB)
+    _transform_rgb_to_lab_matrix(in, out, npixels, 1, profile_info);
+  else if(cst_from == IOP_CS_LAB && cst_to == IOP_CS_RGB)
+    _transform_lab_to_rgb_matrix(in, out, npixels, 1, profile_info);
+  else if(in != out)
+    memcpy(out, in, sizeof(float) * 4 * npixels);
+}
+
 __DT_CLONE_TARGETS__
 void dt_ioppr_transform_image_colorspace_rgb
   (const float *const restrict image_in,
@@ -170,6 +170,19 @@ void dt_ioppr_transform_image_colorspace
    int *converted_cst,
    const dt_iop_order_iccprofile_info_t *const profile_info);
 
+/** can dt_ioppr_transform_pixels_colorspace() convert between RGB and Lab with profile_info? */
+gboolean dt_ioppr_can_transform_pixels_colorspace(const dt_iop_order_iccprofile_info_t *const profile_info);
+
+/** the same as dt_ioppr_transform_image_colorspace() between RGB and Lab for a band of
+    npixels 4-channel pixels, quietly and without starting threads. only for matrix profiles. */
+void dt_ioppr_transform_pixels_colorspace
+  (const float *const in,
+   float *const out,
+   const size_t npixels,
+   const int cst_from,
+   const int cst_to,
+   const dt_iop_order_iccprofile_info_t *const profile_info);
+
 void dt_ioppr_transform_image_colorspace_rgb
   (const float *const image_in,
    float *const image_out,
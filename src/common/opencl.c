@@ -19,6 +19,7 @@
 #ifdef HAVE_OPENCL
 
 #include "common/opencl.h"
+#include "common/atomic.h"
 #include "common/bilateralcl.h"
 #include "common/darktable.h"
 #include "common/dlopencl.h"
@@ -2508,9 +2509,9 @@ int dt_opencl_create_kernel(const int prog,
 {
   dt_opencl_t *cl = darktable.opencl;
 
-  static int k = 0;
-  cl->name_saved[k] = name;
-  cl->program_saved[k] = prog;
+  // modules register their kernels while dt_opencl_init() registers the common ones
+  static dt_atomic_int next_kernel;
+  const int k = dt_atomic_add_int(&next_kernel, 1);
 
   if(k >= DT_OPENCL_MAX_KERNELS)
   {
@@ -2519,7 +2520,9 @@ int dt_opencl_create_kernel(const int prog,
               name);
     return -1;
   }
-  return k++;
+  cl->name_saved[k] = name;
+  cl->program_saved[k] = prog;
+  return k;
 }
 
 
@@ -0,0 +1,155 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/readahead.h"
+#include "common/darktable.h"
+#include "common/image.h"
+#include "control/conf.h"
+
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// the read lock of the image loaders is taken for each chunk, so a loader
+// waits for at most one chunk of read-ahead
+#define DT_READAHEAD_CHUNK (4 << 20)
+
+// the page cache may have dropped a file by then, so it is read again
+#define DT_READAHEAD_FORGET (60 * G_USEC_PER_SEC)
+
+static GMutex _lock;
+static GThreadPool *_pool = NULL;
+static GHashTable *_queued = NULL; // file name -> time it was queued
+static gint _stop = 0;
+
+static gboolean _expired(gpointer key, gpointer value, gpointer user_data)
+{
+  return *(gint64 *)value < *(gint64 *)user_data;
+}
+
+// note a file as queued at time now, FALSE if it was queued recently. needs _lock
+static gboolean _remember(const char *filename, const gint64 now)
+{
+  if(!_queued)
+    _queued = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  const gint64 before = now - DT_READAHEAD_FORGET;
+  g_hash_table_foreach_remove(_queued, _expired, (gpointer)&before);
+  if(g_hash_table_contains(_queued, filename)) return FALSE;
+
+  gint64 *queued = g_new(gint64, 1);
+  *queued = now;
+  g_hash_table_insert(_queued, g_strdup(filename), queued);
+  return TRUE;
+}
+
+static size_t _read_into_cache(const char *filename)
+{
+  size_t bytes = 0;
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return 0;
+
+#if defined(POSIX_FADV_WILLNEED) && !defined(_WIN32)
+  // let the kernel start on it, the reads below make sure it happens on
+  // file systems ignoring the hint
+  posix_fadvise(fileno(f), 0, 0, POSIX_FADV_WILLNEED);
+#endif
+  uint8_t *buf = g_malloc(DT_READAHEAD_CHUNK);
+  size_t n = 0;
+  do
+  {
+    dt_pthread_mutex_lock(&darktable.readFile_mutex);
+    n = fread(buf, 1, DT_READAHEAD_CHUNK, f);
+    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+    bytes += n;
+  } while(n == DT_READAHEAD_CHUNK && !g_atomic_int_get(&_stop));
+  g_free(buf);
+  fclose(f);
+  return bytes;
+}
+
+static void _read_file(gpointer data, gpointer user_data)
+{
+  gchar *filename = (gchar *)data;
+
+  const double start = dt_get_wtime();
+  const size_t bytes = g_atomic_int_get(&_stop) ? 0 : _read_into_cache(filename);
+  const double secs = dt_get_wtime() - start;
+
+  if(bytes > 0)
+    dt_print(DT_DEBUG_PERF,
+             "[readahead] %s: %.1f MB in %.3f secs (%.1f MB/s)\n",
+             filename, bytes / 1e6, secs, secs > 0.0 ? bytes / 1e6 / secs : 0.0);
+  else
+  {
+    // nothing in the page cache, try again next time
+    g_mutex_lock(&_lock);
+    if(_queued) g_hash_table_remove(_queued, filename);
+    g_mutex_unlock(&_lock);
+  }
+  g_free(filename);
+}
+
+void dt_readahead_images(const GList *imgs)
+{
+  const int n = dt_conf_get_int("readahead_images");
+  if(n <= 0) return;
+
+  g_mutex_lock(&_lock);
+  if(!_pool)
+    _pool = g_thread_pool_new(_read_file, NULL, 1, FALSE, NULL);
+
+  const gint64 now = g_get_monotonic_time();
+  int k = 0;
+  for(const GList *l = imgs; l && k < n; l = g_list_next(l), k++)
+  {
+    char filename[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(GPOINTER_TO_INT(l->data), filename, sizeof(filename), &from_cache);
+    if(*filename && _remember(filename, now))
+      g_thread_pool_push(_pool, g_strdup(filename), NULL);
+  }
+  g_mutex_unlock(&_lock);
+}
+
+void dt_readahead_cleanup(void)
+{
+  g_mutex_lock(&_lock);
+  GThreadPool *pool = _pool;
+  _pool = NULL;
+  g_mutex_unlock(&_lock);
+
+  // let the queued files run through without reading them and wait for the
+  // worker, outside of the lock as the worker takes it when it is done
+  g_atomic_int_set(&_stop, 1);
+  if(pool) g_thread_pool_free(pool, FALSE, TRUE);
+
+  g_mutex_lock(&_lock);
+  if(_queued) g_hash_table_destroy(_queued);
+  _queued = NULL;
+  g_mutex_unlock(&_lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
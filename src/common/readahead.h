@@ -0,0 +1,46 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Read-ahead for batch jobs.
+ *
+ * Exports and thumbnail generation load an image only once the previous one
+ * is finished, so on slow or network storage the I/O doesn't overlap with
+ * the processing. Batch loops call dt_readahead_images() with the images
+ * still to come; a background thread reads the source files of the next few
+ * of them into the page cache while the current one is being processed.
+ * The number of images is set by the readahead_images config key.
+ */
+
+/** queue the source files of the first images of imgs (a list of
+ *  GINT_TO_POINTER(imgid)) for reading into the page cache. images already
+ *  queued are skipped, so this can be called once per processed image. */
+void dt_readahead_images(const GList *imgs);
+
+/** drop queued files and wait for the file being read, called on shutdown */
+void dt_readahead_cleanup(void);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -101,6 +101,28 @@ void dt_style_item_free(gpointer data)
   free(item);
 }
 
+dt_style_item_t *dt_style_item_copy(const dt_style_item_t *item)
+{
+  dt_style_item_t *copy = malloc(sizeof(dt_style_item_t));
+  *copy = *item;
+  copy->name = g_strdup(item->name);
+  copy->operation = g_strdup(item->operation);
+  copy->multi_name = g_strdup(item->multi_name);
+  copy->params = NULL;
+  copy->blendop_params = NULL;
+  if(item->params)
+  {
+    copy->params = malloc(item->params_size);
+    memcpy(copy->params, item->params, item->params_size);
+  }
+  if(item->blendop_params)
+  {
+    copy->blendop_params = malloc(item->blendop_params_size);
+    memcpy(copy->blendop_params, item->blendop_params, item->blendop_params_size);
+  }
+  return copy;
+}
+
 static void _apply_style_shortcut_callback(dt_action_t *action)
 {
   GList *imgs = dt_act_on_get_images(TRUE, TRUE, FALSE);
@@ -58,6 +58,8 @@ typedef struct dt_style_item_t
 /** helpers that free a style or style_item. can be used in g_list_free_full() */
 void dt_style_free(gpointer data);
 void dt_style_item_free(gpointer data);
+/** deep copy of a style item, to be freed with dt_style_item_free() */
+dt_style_item_t *dt_style_item_copy(const dt_style_item_t *item);
 
 /** creates a new style from specified image, items are the history stack number of items to include in style
  */
@@ -27,7 +27,9 @@
 #include "common/history_snapshot.h"
 #include "common/image.h"
 #include "common/image_cache.h"
+#include "common/buffer_pool.h"
 #include "common/mipmap_cache.h"
+#include "common/readahead.h"
 #include "common/styles.h"
 #include "common/tags.h"
 #include "common/undo.h"
@@ -1871,12 +1873,16 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
 
   double prev_time = 0;
 
+  dt_imageio_export_batch_begin();
   while(t && !_job_cancelled(job))
   {
     const dt_imgid_t imgid = GPOINTER_TO_INT(t->data);
     t = g_list_next(t);
     const guint num = total - g_list_length(t);
 
+    // have the next images read while this one is processed
+    dt_readahead_images(t);
+
     // progress message
     char message[512] = { 0 };
     snprintf(message, sizeof(message), _("exporting %d / %d to %s"),
@@ -1925,10 +1931,15 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     fraction += 1.0 / total;
     _update_progress(job, fraction, &prev_time);
   }
+  dt_imageio_export_batch_end();
   g_list_free_full(metadata.list, g_free);
 
   if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
 
+  // the batch is done, hand the recycled pixel buffers back
+  dt_print_mem_usage();
+  dt_buffer_pool_trim();
+
 end:
   // all threads free their fdata
   mformat->free_params(mformat, fdata);
@@ -45,10 +45,36 @@ static void _unlock_pending_queue()
 }
 #endif /* !_OPENMP */
 
+// sidecars are mostly waiting on the database, exiv2 and the disk, a few writers
+// are enough to keep up with bulk edits
+#define DT_SIDECAR_MAX_WORKERS 4
+// images handed to the writers at once, their write timestamps go into one transaction
+#define DT_SIDECAR_BATCH 32
+
+typedef struct _sidecar_result_t
+{
+  dt_imgid_t imgid;
+  gboolean error;
+  gboolean unchanged;
+} _sidecar_result_t;
+
+static void _write_sidecar(gpointer data, gpointer user_data)
+{
+  GAsyncQueue *results = (GAsyncQueue *)user_data;
+  _sidecar_result_t *res = g_new(_sidecar_result_t, 1);
+  res->imgid = GPOINTER_TO_INT(data);
+  res->error = dt_image_write_sidecar_file_unstamped(res->imgid, &res->unchanged);
+  g_async_queue_push(results, res);
+}
+
 static int32_t _control_write_sidecars_job_run(dt_job_t *job)
 {
   GSList *imgs = NULL;
+  int queued = 0;
   GHashTable *enqueued = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GAsyncQueue *results = g_async_queue_new();
+  const int workers = CLAMP(dt_get_num_procs(), 1, DT_SIDECAR_MAX_WORKERS);
+  GThreadPool *pool = g_thread_pool_new(_write_sidecar, results, workers, FALSE, NULL);
 
   double prev_fetch = 0;
   // keep going until explicitly cancelled or darktable shuts down AND all writes have finished
@@ -80,21 +106,55 @@ static int32_t _control_write_sidecars_job_run(dt_job_t *job)
           {
             to_add = g_slist_prepend(to_add, imglist->data);
             g_hash_table_insert(enqueued, GINT_TO_POINTER(imglist->data), GINT_TO_POINTER(imglist->data));
+            queued++;
           }
         }
         imgs = g_slist_concat(imgs, to_add);
         g_slist_free(new_imgs);
       }
     }
-    // synchronize the first few images on the queue
-    for(int i = 0; imgs && i < 3; i++)
+    // hand the first few images on the queue to the writers and wait for them
+    const double start = dt_get_wtime();
+    int batch = 0;
+    while(imgs && batch < DT_SIDECAR_BATCH)
     {
-      dt_imgid_t imgid = GPOINTER_TO_INT(imgs->data);
-      dt_image_write_sidecar_file(imgid);
+      const dt_imgid_t imgid = GPOINTER_TO_INT(imgs->data);
       // remove the head of the image queue
       g_hash_table_remove(enqueued, GINT_TO_POINTER(imgid));
       imgs = g_slist_delete_link(imgs, imgs);
+      queued--;
+      // the pool does not take NULL tasks, there is nothing to write for those anyway
+      if(!dt_is_valid_imgid(imgid)) continue;
+      g_thread_pool_push(pool, GINT_TO_POINTER(imgid), NULL);
+      batch++;
     }
+
+    GList *written = NULL;
+    int unchanged = 0, failed = 0;
+    for(int i = 0; i < batch; i++)
+    {
+      _sidecar_result_t *res = g_async_queue_pop(results);
+      if(res->error)
+        failed++;
+      else
+      {
+        // the timestamp goes into the db if there was no error or no sidecar was required
+        written = g_list_prepend(written, GINT_TO_POINTER(res->imgid));
+        if(res->unchanged) unchanged++;
+      }
+      g_free(res);
+    }
+    dt_image_set_write_timestamps(written);
+    g_list_free(written);
+
+    if(batch)
+    {
+      const double secs = dt_get_wtime() - start;
+      dt_print(DT_DEBUG_PERF,
+               "[sidecar] %d sidecars (%d unchanged, %d failed) in %.3f secs, %d queued\n",
+               batch, unchanged, failed, secs, queued);
+    }
+
     if(imgs) // do we have more images already queued?
     {
       // give others a chance to run by sleeping 10ms; avoids apparent
@@ -107,6 +167,8 @@ static int32_t _control_write_sidecars_job_run(dt_job_t *job)
       g_usleep(1000000);
     }
   }
+  g_thread_pool_free(pool, FALSE, TRUE);
+  g_async_queue_unref(results);
   g_hash_table_destroy(enqueued);
   return 0;
 }
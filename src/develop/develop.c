@@ -625,6 +625,86 @@ void dt_dev_load_image(dt_develop_t *dev,
   dt_unlock_image(imgid);
 }
 
+void dt_dev_load_next_image(dt_develop_t *dev,
+                            const dt_imgid_t imgid)
+{
+  // without instances from a previous image this is a plain load
+  if(!dev->iop)
+  {
+    dt_dev_load_image(dev, imgid);
+    return;
+  }
+
+  dt_lock_image(imgid);
+
+  while(dev->history)
+  {
+    dt_dev_free_history_item(dev->history->data);
+    dev->history = g_list_delete_link(dev->history, dev->history);
+  }
+  dev->history_end = 0;
+
+  _dt_dev_load_raw(dev, imgid);
+  dev->first_load = TRUE;
+
+  dt_pthread_mutex_lock(&darktable.dev_threadsafe);
+
+  // chroma data will be fixed by reading whitebalance data from history
+  dt_dev_init_chroma(dev);
+
+  // keep the base instance of every module, as in darkroom when
+  // changing the image. reading the history reloads all defaults and
+  // params and sets the iop order of the new image.
+  for(GList *modules = g_list_last(dev->iop); modules; )
+  {
+    dt_iop_module_t *module = modules->data;
+    GList *prev = g_list_previous(modules);
+
+    int base_multi_priority = 0;
+    for(const GList *l = dev->iop; l; l = g_list_next(l))
+    {
+      const dt_iop_module_t *mod = l->data;
+      if(dt_iop_module_is(module->so, mod->op))
+        base_multi_priority = MIN(base_multi_priority, mod->multi_priority);
+    }
+
+    if(module->multi_priority == base_multi_priority)
+    {
+      module->iop_order =
+        dt_ioppr_get_iop_order(dev->iop_order_list, module->op, module->multi_priority);
+      module->multi_priority = 0;
+      module->multi_name[0] = '\0';
+      module->multi_name_hand_edited = FALSE;
+    }
+    else
+    {
+      dev->iop = g_list_delete_link(dev->iop, modules);
+      dt_iop_cleanup_module(module);
+      free(module);
+    }
+    modules = prev;
+  }
+  dev->iop = g_list_sort(dev->iop, dt_sort_iop_by_order);
+
+  while(dev->alliop)
+  {
+    dt_iop_cleanup_module((dt_iop_module_t *)dev->alliop->data);
+    free(dev->alliop->data);
+    dev->alliop = g_list_delete_link(dev->alliop, dev->alliop);
+  }
+  g_list_free_full(dev->forms, (void (*)(void *))dt_masks_free_form);
+  dev->forms = NULL;
+  g_list_free_full(dev->allforms, (void (*)(void *))dt_masks_free_form);
+  dev->allforms = NULL;
+
+  dt_dev_read_history_ext(dev, dev->image_storage.id, FALSE);
+  dt_pthread_mutex_unlock(&darktable.dev_threadsafe);
+
+  dev->first_load = FALSE;
+
+  dt_unlock_image(imgid);
+}
+
 void dt_dev_configure(dt_dev_viewport_t *port)
 {
   int32_t tb = 0;
@@ -369,6 +369,10 @@ void dt_dev_process_preview2(dt_develop_t *dev);
 
 void dt_dev_load_image(dt_develop_t *dev,
                        const dt_imgid_t imgid);
+/** load another image into a headless develop, keeping the base
+ *  instances of the modules loaded for the previous one */
+void dt_dev_load_next_image(dt_develop_t *dev,
+                            const dt_imgid_t imgid);
 void dt_dev_reload_image(dt_develop_t *dev,
                          const dt_imgid_t imgid);
 /** checks if provided imgid is the image currently in develop */
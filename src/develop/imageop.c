@@ -357,14 +357,29 @@ int dt_iop_load_module_so(void *m, const char *libname, const char *module_name)
                module_name);
   }
 
-  if(module->init_global)
-    module->init_global(module);
+  // init_global() is deferred until the module is instantiated for some develop
   return 0;
 }
 
-gboolean dt_iop_load_module_by_so(dt_iop_module_t *module,
-                                  dt_iop_module_so_t *so,
-                                  dt_develop_t *dev)
+// protects the lazy init_global() of the modules
+static GMutex _global_data_lock;
+
+static void _iop_init_global(dt_iop_module_so_t *so)
+{
+  g_mutex_lock(&_global_data_lock);
+  if(!so->global_data_inited)
+  {
+    if(so->init_global)
+      so->init_global(so);
+    so->global_data_inited = TRUE;
+  }
+  g_mutex_unlock(&_global_data_lock);
+}
+
+static gboolean _iop_load_module_by_so(dt_iop_module_t *module,
+                                       dt_iop_module_so_t *so,
+                                       dt_develop_t *dev,
+                                       const gboolean need_global_data)
 {
   module->actions = DT_ACTION_TYPE_IOP_INSTANCE;
   module->dev = dev;
@@ -431,6 +446,8 @@ gboolean dt_iop_load_module_by_so(dt_iop_module_t *module,
     dt_iop_gui_set_state(module, state);
   }
 
+  if(need_global_data)
+    _iop_init_global(so);
   module->global_data = so->data;
 
   // now init the instance:
@@ -454,6 +471,13 @@ gboolean dt_iop_load_module_by_so(dt_iop_module_t *module,
   return FALSE;
 }
 
+gboolean dt_iop_load_module_by_so(dt_iop_module_t *module,
+                                  dt_iop_module_so_t *so,
+                                  dt_develop_t *dev)
+{
+  return _iop_load_module_by_so(module, so, dev, TRUE);
+}
+
 void dt_iop_init_pipe(dt_iop_module_t *module,
                       dt_dev_pixelpipe_t *pipe,
                       dt_dev_pixelpipe_iop_t *piece)
@@ -1677,11 +1701,18 @@ static void _init_presets_actions(dt_iop_module_so_t *module)
   sqlite3_finalize(stmt);
 }
 
+// time spent for the presets and the accelerators of all modules, with -d perf
+static double _presets_wtime = 0.0;
+static double _accels_wtime = 0.0;
+
 static void _init_module_so(void *m)
 {
   dt_iop_module_so_t *module = (dt_iop_module_so_t *)m;
 
+  double wtime = dt_get_debug_wtime();
   _init_presets(module);
+  _presets_wtime += dt_get_debug_wtime() - wtime;
+  wtime = dt_get_debug_wtime();
 
   // do not init accelerators if there is no gui
   if(darktable.gui)
@@ -1692,11 +1723,12 @@ static void _init_module_so(void *m)
     // Calling the accelerator initialization callback, if present
     _init_presets_actions(module);
 
-    // create a gui and have the widgets register their accelerators
+    // create a gui and have the widgets register their accelerators,
+    // the widgets don't need the global data yet
     dt_iop_module_t *module_instance = calloc(1, sizeof(dt_iop_module_t));
 
     if(module->gui_init
-       && !dt_iop_load_module_by_so(module_instance, module, NULL))
+       && !_iop_load_module_by_so(module_instance, module, NULL, FALSE))
     {
       darktable.control->accel_initialising = TRUE;
       dt_iop_gui_init(module_instance);
@@ -1727,13 +1759,26 @@ static void _init_module_so(void *m)
 
     free(module_instance);
   }
+  _accels_wtime += dt_get_debug_wtime() - wtime;
 }
 
 void dt_iop_load_modules_so(void)
 {
+  const double start = dt_get_debug_wtime();
+
+  // every module writes its built-in presets, commit them all at once
+  dt_database_start_transaction(darktable.db);
   darktable.iop = dt_module_load_modules
     ("/plugins", sizeof(dt_iop_module_so_t),
      dt_iop_load_module_so, _init_module_so, NULL);
+  dt_database_release_transaction(darktable.db);
+
+  const double total = dt_get_debug_wtime() - start;
+  dt_print(DT_DEBUG_PERF,
+           "[iop_load_modules_so] %d modules in %.3f secs:"
+           " %.3f loading, %.3f presets, %.3f accelerators\n",
+           g_list_length(darktable.iop), total,
+           total - _presets_wtime - _accels_wtime, _presets_wtime, _accels_wtime);
 
   DT_CONTROL_SIGNAL_CONNECT(DT_SIGNAL_PREFERENCES_CHANGE, _iop_preferences_changed, darktable.iop);
 }
@@ -1819,7 +1864,7 @@ void dt_iop_unload_modules_so()
   while(darktable.iop)
   {
     dt_iop_module_so_t *module = darktable.iop->data;
-    if(module->cleanup_global)
+    if(module->cleanup_global && module->global_data_inited)
       module->cleanup_global(module);
     if(module->module)
       g_module_close(module->module);
@@ -2134,6 +2179,10 @@ void dt_iop_commit_params(dt_iop_module_t *module,
   if(module->flags() & IOP_FLAGS_ALLOW_TILING)
     piece->process_tiling_ready = TRUE;
 
+  // same for the row-wise raw processing and the point-wise one
+  piece->process_mosaic_ready = module->process_mosaic != NULL;
+  piece->process_pixels_ready = module->process_pixels != NULL;
+
   if((piece->enabled || module->enabled) // better to check for both
     && module->so->get_introspection()
     && darktable.unmuted & DT_DEBUG_PARAMS)
@@ -3846,6 +3895,24 @@ gboolean dt_iop_have_required_input_format(const int req_ch,
   }
 }
 
+void dt_iop_process_pixels(dt_iop_module_t *self,
+                           dt_dev_pixelpipe_iop_t *piece,
+                           const float *const in,
+                           float *const out,
+                           const dt_iop_roi_t *const roi_out)
+{
+  // same bands as a fused run in the pipe, the result doesn't depend on them
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+  const size_t nbands = (npixels + DT_IOP_PIXELS_BAND - 1) / DT_IOP_PIXELS_BAND;
+  DT_OMP_FOR()
+  for(size_t b = 0; b < nbands; b++)
+  {
+    const size_t offset = 4 * b * DT_IOP_PIXELS_BAND;
+    const size_t n = MIN(DT_IOP_PIXELS_BAND, npixels - b * DT_IOP_PIXELS_BAND);
+    self->process_pixels(self, piece, in + offset, out + offset, n);
+  }
+}
+
 gboolean dt_iop_canvas_not_sensitive(const struct dt_develop_t *dev)
 {
   return dt_iop_color_picker_is_visible(dev)
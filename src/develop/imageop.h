@@ -119,7 +119,10 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_GUIDES_SPECIAL_DRAW = 1 << 14, // handle the grid drawing directly
   IOP_FLAGS_GUIDES_WIDGET = 1 << 15,     // require the guides widget
   IOP_FLAGS_CROP_EXPOSER = 1 << 16,      // offers crop exposing
-  IOP_FLAGS_EXPAND_ROI_IN = 1 << 17      // we might have to take special care about roi expansion
+  IOP_FLAGS_EXPAND_ROI_IN = 1 << 17,     // we might have to take special care about roi expansion
+  IOP_FLAGS_PURE_GEOMETRY = 1 << 18,     // process() only moves the input along distort_backtransform(), resampling or copying whole pixels, may be fused with neighbours
+  IOP_FLAGS_IMAGE_STATISTICS = 1 << 19,  // process() derives its parameters from all of roi_in, parts of the image don't give the same result
+  IOP_FLAGS_ROI_EXACT = 1 << 20          // process() needs no pixels around roi_out, parts of the image give the same result without tiling support
 } dt_iop_flags_t;
 
 /** status of a module*/
@@ -164,6 +167,8 @@ typedef struct dt_iop_module_so_t
   /** other stuff that may be needed by the module, not only in gui
    * mode. inited only once, has to be read-only then. */
   dt_iop_global_data_t *data;
+  /** init_global() has been called, it is deferred until the first instance. */
+  gboolean global_data_inited;
   /** button used to show/hide this module in the plugin list. */
   dt_iop_module_state_t state;
 
@@ -561,6 +566,17 @@ gboolean dt_iop_have_required_input_format(const int required_ch,
                                            const dt_iop_roi_t *const roi_in,
                                            const dt_iop_roi_t *const roi_out);
 
+// pixels per band of point-wise processing, input and output of a band stay in L2
+#define DT_IOP_PIXELS_BAND 8192
+
+/** the pixel loop of process() for modules with process_pixels(), runs it
+ ** band by band on the 4-channel roi_out like the pipe does for a fused run */
+void dt_iop_process_pixels(dt_iop_module_t *self,
+                           struct dt_dev_pixelpipe_iop_t *piece,
+                           const float *const in,
+                           float *const out,
+                           const dt_iop_roi_t *const roi_out);
+
 // should module ignore mouse actions on gui elements, like handles or shapes?
 // returns true while color picker or snapshots active; show other elements dimmed
 gboolean dt_iop_canvas_not_sensitive(const struct dt_develop_t *dev);
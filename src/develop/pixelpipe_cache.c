@@ -17,6 +17,8 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/float16.h"
+#include "control/conf.h"
 #include "develop/format.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
@@ -30,6 +32,12 @@ static inline int _to_mb(size_t m)
   return (int)((m + 0x80000lu) / 0x400lu / 0x400lu);
 }
 
+// memory held by a cacheline, packed lines need half of the float buffer
+static inline size_t _line_mem(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  return cache->half[k] ? cache->size[k] / 2 : cache->size[k];
+}
+
 gboolean dt_dev_pixelpipe_cache_init(
            struct dt_dev_pixelpipe_t *pipe,
            const int entries,
@@ -41,14 +49,16 @@ gboolean dt_dev_pixelpipe_cache_init(
   cache->entries = entries;
   cache->allmem = cache->hits = cache->calls = cache->tests = 0;
   cache->memlimit = limit;
+  cache->half_float = dt_conf_get_bool("pixelpipe_cache_half_float");
 
-  const size_t csize = sizeof(void *) + sizeof(size_t) + sizeof(dt_iop_buffer_dsc_t) + 2*sizeof(int32_t) + sizeof(uint64_t);
+  const size_t csize = sizeof(void *) + sizeof(size_t) + sizeof(dt_iop_buffer_dsc_t) + 3*sizeof(int32_t) + sizeof(uint64_t);
   cache->data = (void **) calloc(entries, csize);
   cache->size = (size_t *)((void *)cache->data + entries * sizeof(void *));
   cache->dsc = (dt_iop_buffer_dsc_t *)((void *)cache->size + entries * sizeof(size_t));
   cache->hash = (dt_hash_t *)((void *)cache->dsc + entries * sizeof(dt_iop_buffer_dsc_t));
   cache->used = (int32_t *)((void *)cache->hash + entries * sizeof(dt_hash_t));
   cache->ioporder = (int32_t *)((void *)cache->used + entries * sizeof(int32_t));
+  cache->half = (int32_t *)((void *)cache->ioporder + entries * sizeof(int32_t));
 
   for(int k = 0; k < entries; k++)
   {
@@ -166,6 +176,79 @@ dt_hash_t dt_dev_pixelpipe_cache_hash(
   return dt_hash(hash, &pipe->scharr.hash, sizeof(pipe->scharr.hash));
 }
 
+static void _mark_invalid_cacheline(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  cache->hash[k] = INVALID_CACHEHASH;
+  cache->ioporder[k] = 0;
+}
+
+// only scene data in 4 floats per pixel is precise enough in half floats
+static inline gboolean _packable_cacheline(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  return cache->data[k]
+    && !cache->half[k]
+    && cache->hash[k] != INVALID_CACHEHASH
+    && cache->dsc[k].datatype == TYPE_FLOAT
+    && cache->dsc[k].channels == 4
+    && cache->dsc[k].cst != IOP_CS_RAW;
+}
+
+static gboolean _pack_cacheline(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  const size_t n = cache->size[k] / sizeof(float);
+  uint16_t *packed = dt_alloc_aligned(n * sizeof(uint16_t));
+  if(!packed) return FALSE;
+
+  const double start = dt_get_debug_wtime();
+  dt_float16_from_float(packed, cache->data[k], n);
+  const double spent = dt_get_debug_wtime() - start;
+
+  dt_free_align(cache->data[k]);
+  cache->data[k] = packed;
+  cache->half[k] = TRUE;
+  cache->allmem -= cache->size[k] / 2;
+
+  dt_print(DT_DEBUG_PERF, "[pixelpipe_cache] packed line %i, %iMB in %.3fs (%.0fMB/s)\n",
+           k, _to_mb(cache->size[k]), spent, 1e-6 * cache->size[k] / fmax(1e-6, spent));
+  return TRUE;
+}
+
+static gboolean _unpack_cacheline(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  const size_t n = cache->size[k] / sizeof(float);
+  float *unpacked = dt_alloc_aligned(cache->size[k]);
+  if(!unpacked) return FALSE;
+
+  const double start = dt_get_debug_wtime();
+  dt_float16_to_float(unpacked, cache->data[k], n);
+  const double spent = dt_get_debug_wtime() - start;
+
+  dt_free_align(cache->data[k]);
+  cache->data[k] = unpacked;
+  cache->half[k] = FALSE;
+  cache->allmem += cache->size[k] / 2;
+
+  dt_print(DT_DEBUG_PERF, "[pixelpipe_cache] unpacked line %i, %iMB in %.3fs (%.0fMB/s)\n",
+           k, _to_mb(cache->size[k]), spent, 1e-6 * cache->size[k] / fmax(1e-6, spent));
+  return TRUE;
+}
+
+// the oldest line worth packing, 0 if there is none
+static int _get_oldest_packable(const dt_dev_pixelpipe_cache_t *cache)
+{
+  int age = 1;
+  int id = 0;
+  for(int k = DT_PIPECACHE_MIN; k < cache->entries; k++)
+  {
+    if(cache->used[k] > age && k != cache->lastline && _packable_cacheline(cache, k))
+    {
+      age = cache->used[k];
+      id = k;
+    }
+  }
+  return id;
+}
+
 gboolean dt_dev_pixelpipe_cache_available(
            dt_dev_pixelpipe_t *pipe,
            const dt_hash_t hash,
@@ -183,6 +266,12 @@ gboolean dt_dev_pixelpipe_cache_available(
   {
     if((cache->size[k] == size) && (cache->hash[k] == hash))
     {
+      // unpack right now, the caller relies on getting the data
+      if(cache->half[k] && !_unpack_cacheline(cache, k))
+      {
+        _mark_invalid_cacheline(cache, k);
+        return FALSE;
+      }
       cache->hits++;
       return TRUE;
     }
@@ -271,6 +360,11 @@ static gboolean _get_by_hash(
         // this should not happen but we make sure
         cache->hash[k] = INVALID_CACHEHASH;
       }
+      else if(cache->half[k] && !_unpack_cacheline(cache, k))
+      {
+        // no memory to unpack, treat as a miss
+        _mark_invalid_cacheline(cache, k);
+      }
       else
       {
         // we have a proper hit
@@ -321,10 +415,12 @@ gboolean dt_dev_pixelpipe_cache_get(
   const int cline = _get_cacheline(pipe);
 
   if(((cache->entries == DT_PIPECACHE_MIN) && (cache->size[cline] < size))
-     || ((cache->entries > DT_PIPECACHE_MIN) && (cache->size[cline] != size)))
+     || ((cache->entries > DT_PIPECACHE_MIN) && (cache->size[cline] != size))
+     || cache->half[cline])
   {
     dt_free_align(cache->data[cline]);
-    cache->allmem -= cache->size[cline];
+    cache->allmem -= _line_mem(cache, cline);
+    cache->half[cline] = FALSE;
     cache->data[cline] = (void *)dt_alloc_aligned(size);
     if(cache->data[cline])
     {
@@ -361,12 +457,6 @@ gboolean dt_dev_pixelpipe_cache_get(
   return TRUE;
 }
 
-static void _mark_invalid_cacheline(const dt_dev_pixelpipe_cache_t *cache, const int k)
-{
-  cache->hash[k] = INVALID_CACHEHASH;
-  cache->ioporder[k] = 0;
-}
-
 void dt_dev_pixelpipe_cache_invalidate_later(
         const struct dt_dev_pixelpipe_t *pipe,
         const int32_t order)
@@ -412,10 +502,11 @@ void dt_dev_pixelpipe_invalidate_cacheline(const struct dt_dev_pixelpipe_t *pipe
 
 static size_t _free_cacheline(dt_dev_pixelpipe_cache_t *cache, const int k)
 {
-  const size_t removed = cache->size[k];
+  const size_t removed = _line_mem(cache, k);
 
   dt_free_align(cache->data[k]);
   cache->allmem -= removed;
+  cache->half[k] = FALSE;
   cache->size[k] = 0;
   cache->data[k] = NULL;
   _mark_invalid_cacheline(cache, k);
@@ -424,10 +515,11 @@ static size_t _free_cacheline(dt_dev_pixelpipe_cache_t *cache, const int k)
 
 static void _cline_stats(dt_dev_pixelpipe_cache_t *cache)
 {
-  cache->lused = cache->linvalid = cache->limportant = 0;
+  cache->lused = cache->linvalid = cache->limportant = cache->lhalf = 0;
   for(int k = DT_PIPECACHE_MIN; k < cache->entries; k++)
   {
     if(cache->data[k] != NULL) cache->lused++;
+    if(cache->half[k]) cache->lhalf++;
     if((cache->data[k] != NULL) && (cache->hash[k] == INVALID_CACHEHASH)) cache->linvalid++;
     if(cache->used[k] < 0) cache->limportant++;
   }
@@ -452,6 +544,14 @@ void dt_dev_pixelpipe_cache_checkmem(struct dt_dev_pixelpipe_t *pipe)
 
   while(cache->memlimit && (cache->memlimit < cache->allmem))
   {
+    // rather keep old lines at half the size than drop them
+    const int p = cache->half_float ? _get_oldest_packable(cache) : 0;
+    if(p > 0 && _pack_cacheline(cache, p))
+    {
+      freed += cache->size[p] / 2;
+      continue;
+    }
+
     const int k = _get_oldest_cacheline(cache, DT_CACHETEST_USED);
     if(k == 0) break;
 
@@ -460,8 +560,8 @@ void dt_dev_pixelpipe_cache_checkmem(struct dt_dev_pixelpipe_t *pipe)
 
   _cline_stats(cache);
   dt_print_pipe(DT_DEBUG_PIPE, "pipe cache check", pipe, NULL, DT_DEVICE_NONE, NULL, NULL,
-    "%i lines (important=%i, used=%i). Freed %iMB. Using using %iMB, limit=%iMB\n",
-    cache->entries, cache->limportant, cache->lused,
+    "%i lines (important=%i, used=%i, half=%i). Freed %iMB. Using using %iMB, limit=%iMB\n",
+    cache->entries, cache->limportant, cache->lused, cache->lhalf,
     _to_mb(freed), _to_mb(cache->allmem), _to_mb(cache->memlimit));
 }
 
@@ -471,8 +571,8 @@ void dt_dev_pixelpipe_cache_report(struct dt_dev_pixelpipe_t *pipe)
 
   _cline_stats(cache);
   dt_print_pipe(DT_DEBUG_PIPE, "cache report", pipe, NULL, DT_DEVICE_NONE, NULL, NULL,
-    "%i lines (important=%i, used=%i, invalid=%i). Using %iMB, limit=%iMB. Hits/run=%.2f. Hits/test=%.3f\n",
-    cache->entries, cache->limportant, cache->lused, cache->linvalid,
+    "%i lines (important=%i, used=%i, invalid=%i, half=%i). Using %iMB, limit=%iMB. Hits/run=%.2f. Hits/test=%.3f\n",
+    cache->entries, cache->limportant, cache->lused, cache->linvalid, cache->lhalf,
     _to_mb(cache->allmem), _to_mb(cache->memlimit),
     (double)(cache->hits) / fmax(1.0, pipe->runs),
     (double)(cache->hits) / fmax(1.0, cache->tests));
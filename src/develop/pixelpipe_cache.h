@@ -29,6 +29,8 @@ struct dt_iop_roi_t;
  * corresponding to history items and zoom/pan settings in the develop module.
  * correctness is secured via the hash so make sure everything is included here.
  * No caching if cl_mem, instead copied cache buffers are used.
+ * If enabled, old 4-channel float lines are packed to half floats instead of being
+ * dropped when the cache exceeds its memory limit, and unpacked again on a hit.
  */
 typedef struct dt_dev_pixelpipe_cache_t
 {
@@ -36,19 +38,22 @@ typedef struct dt_dev_pixelpipe_cache_t
   size_t allmem;
   size_t memlimit;
   void **data;
-  size_t *size;
+  size_t *size;   // size of the unpacked float buffer
   struct dt_iop_buffer_dsc_t *dsc;
   dt_hash_t *hash;
   int32_t *used;
   int32_t *ioporder;
+  int32_t *half;  // data is packed to half floats
   uint64_t calls;
   int32_t lastline;
+  gboolean half_float;
   // profiling & stats:
   uint64_t tests;
   uint64_t hits;
   uint32_t lused;
   uint32_t linvalid;
   uint32_t limportant;
+  uint32_t lhalf;
 } dt_dev_pixelpipe_cache_t;
 
 typedef enum dt_dev_pixelpipe_cache_test_t
@@ -19,6 +19,7 @@
 #include "common/color_picker.h"
 #include "common/colorspaces.h"
 #include "common/histogram.h"
+#include "common/interpolation.h"
 #include "common/opencl.h"
 #include "common/iop_order.h"
 #include "common/imagebuf.h"
@@ -236,6 +237,11 @@ gboolean dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe,
   pipe->tiling = FALSE;
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   pipe->bypass_blendif = FALSE;
+  pipe->fuse_geometry = dt_conf_get_bool("pixelpipe_fuse_geometry");
+  pipe->fuse_pointwise = dt_conf_get_bool("pixelpipe_fuse_pointwise");
+  pipe->progress = NULL;
+  pipe->progress_data = NULL;
+  pipe->progress_modules = 0;
   pipe->input_timestamp = 0;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
   dt_pthread_mutex_init(&(pipe->mutex), NULL);
@@ -421,6 +427,8 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe,
     piece->hash = 0;
     piece->process_cl_ready = FALSE;
     piece->process_tiling_ready = FALSE;
+    piece->process_mosaic_ready = FALSE;
+    piece->process_pixels_ready = FALSE;
     piece->raster_masks = g_hash_table_new_full(g_direct_hash,
                                                 g_direct_equal, NULL, dt_free_align_ptr);
     memset(&piece->processed_roi_in, 0, sizeof(piece->processed_roi_in));
@@ -558,11 +566,23 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_print_pipe(DT_DEBUG_PARAMS, "synch all module defaults",
     pipe, NULL, DT_DEVICE_NONE, NULL, NULL, "\n");
 
-  // call reset_params on all pieces first. This is mandatory to init
-  // utility modules that don't have an history stack
+  // only the last history item of a module up to history_end is
+  // relevant, older ones would just be committed and overwritten
+  GHashTable *last_item = g_hash_table_new(NULL, NULL);
+  GList *history = dev->history;
+  for(int k = 0; k < dev->history_end && history; k++)
+  {
+    const dt_dev_history_item_t *hist = history->data;
+    g_hash_table_insert(last_item, hist->module, history);
+    history = g_list_next(history);
+  }
+
+  // call reset_params on all pieces without history first. This is
+  // mandatory to init utility modules that don't have an history stack
   for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
   {
     dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    if(g_hash_table_contains(last_item, piece->module)) continue;
     piece->hash = 0;
     piece->enabled = piece->module->default_enabled;
     dt_iop_commit_params(piece->module,
@@ -578,18 +598,22 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_dev_clear_scharr_mask(pipe);
   pipe->want_detail_mask = FALSE;
 
-  // go through all history items and adjust params
-  GList *history = dev->history;
+  // go through the history in order and adjust params
+  history = dev->history;
   for(int k = 0; k < dev->history_end && history; k++)
   {
-    _dev_pixelpipe_synch(pipe, dev, history);
+    const dt_dev_history_item_t *hist = history->data;
+    if(g_hash_table_lookup(last_item, hist->module) == history)
+      _dev_pixelpipe_synch(pipe, dev, history);
     history = g_list_next(history);
   }
   dt_print_pipe(DT_DEBUG_PARAMS,
            "synch all modules done",
            pipe, NULL, DT_DEVICE_NONE, NULL, NULL,
-           "defaults %.4fs, history %.4fs\n",
-           defaults - start, dt_get_wtime() - defaults);
+           "defaults %.4fs, history %.4fs, %u modules from %d items\n",
+           defaults - start, dt_get_wtime() - defaults,
+           g_hash_table_size(last_item), dev->history_end);
+  g_hash_table_destroy(last_item);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -1325,6 +1349,614 @@ static inline gboolean _skip_piece_on_tags(const dt_dev_pixelpipe_iop_t *piece)
           && (piece->pipe->type & DT_DEV_PIXELPIPE_BASIC);
 }
 
+static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
+                                           dt_develop_t *dev,
+                                           void **output,
+                                           void **cl_mem_output,
+                                           dt_iop_buffer_dsc_t **out_format,
+                                           const dt_iop_roi_t *roi_out,
+                                           GList *modules,
+                                           GList *pieces,
+                                           const int pos);
+
+// debugging and benchmarking options want to see every module on its own,
+// the modules are rather run on the GPU if there is one
+static gboolean _fusion_allowed(dt_dev_pixelpipe_t *pipe, const gboolean enabled)
+{
+  if(!enabled
+     || pipe->mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE
+     || pipe->store_all_raster_masks
+     || darktable.dump_pfm_pipe
+     || darktable.bench_module
+     || (darktable.unmuted & DT_DEBUG_NAN))
+    return FALSE;
+#ifdef HAVE_OPENCL
+  if(_opencl_pipe_isok(pipe))
+    return FALSE;
+#endif
+  return TRUE;
+}
+
+// longest run of geometry modules resampled in one go
+#define DT_FUSED_GEOMETRY_MAX 8
+
+typedef struct _fused_geometry_t
+{
+  int count;
+  // top (last in pipe) first
+  dt_iop_module_t *module[DT_FUSED_GEOMETRY_MAX];
+  dt_dev_pixelpipe_iop_t *piece[DT_FUSED_GEOMETRY_MAX];
+  dt_iop_roi_t roi_in[DT_FUSED_GEOMETRY_MAX];
+  dt_iop_roi_t roi_out[DT_FUSED_GEOMETRY_MAX];
+  // pieces only moving whole pixels (crop, flip) are applied exactly
+  gboolean permutes[DT_FUSED_GEOMETRY_MAX];
+  dt_interpolation_permutation_t perm[DT_FUSED_GEOMETRY_MAX];
+  // list position just below the run, and the number of list entries spanned
+  GList *below_modules;
+  GList *below_pieces;
+  int span;
+} _fused_geometry_t;
+
+static gboolean _fusable_geometry_piece(dt_dev_pixelpipe_t *pipe,
+                                        dt_develop_t *dev,
+                                        dt_iop_module_t *module,
+                                        dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!(module->flags() & IOP_FLAGS_PURE_GEOMETRY)) return FALSE;
+
+  // blending needs the module output, pickers and histograms look at
+  // it too. the focused module shows the uncropped image and modules
+  // with a gui might grab their input in the preview pipe.
+  const dt_develop_blend_params_t *const bp = piece->blendop_data;
+  if(bp && bp->mask_mode != DEVELOP_MASK_DISABLED) return FALSE;
+  if(_request_color_pick(pipe, dev, module)) return FALSE;
+  if((piece->request_histogram | module->request_histogram) & DT_REQUEST_ON) return FALSE;
+  if(module == dt_dev_gui_module()) return FALSE;
+  if(module->gui_data && (pipe->type & DT_DEV_PIXELPIPE_PREVIEW)) return FALSE;
+
+  return TRUE;
+}
+
+typedef struct _fused_geometry_piece_t
+{
+  dt_iop_module_t *module;
+  dt_dev_pixelpipe_iop_t *piece;
+} _fused_geometry_piece_t;
+
+static void _fused_geometry_piece_backtransform(float *const points,
+                                                const size_t points_count,
+                                                void *data)
+{
+  const _fused_geometry_piece_t *const p = data;
+  p->module->distort_backtransform(p->module, p->piece, points, points_count);
+}
+
+static void _fused_geometry_backtransform(float *const points,
+                                          const size_t points_count,
+                                          void *data)
+{
+  _fused_geometry_t *const run = data;
+  for(int k = 0; k < run->count; k++)
+  {
+    if(run->permutes[k])
+      dt_interpolation_permutation_backtransform(points, points_count, &run->perm[k]);
+    else
+      run->module[k]->distort_backtransform(run->module[k], run->piece[k],
+                                            points, points_count);
+  }
+}
+
+// collect the run of geometry modules ending at modules/pieces, returns FALSE
+// if there is nothing worth fusing
+static gboolean _fused_geometry_collect(dt_dev_pixelpipe_t *pipe,
+                                        dt_develop_t *dev,
+                                        const dt_iop_roi_t *roi_out,
+                                        GList *modules,
+                                        GList *pieces,
+                                        _fused_geometry_t *run)
+{
+  run->count = 0;
+  run->span = 0;
+
+  // raw data isn't 4 channel float before demosaic
+  const int first_order = dt_image_is_raw(&pipe->image)
+    ? dt_ioppr_get_iop_order(pipe->iop_order_list, "demosaic", 0)
+    : INT_MIN;
+
+  dt_iop_roi_t r_out = *roi_out;
+  while(modules && run->count < DT_FUSED_GEOMETRY_MAX)
+  {
+    dt_iop_module_t *module = modules->data;
+    dt_dev_pixelpipe_iop_t *piece = pieces->data;
+
+    if(!_skip_piece_on_tags(piece))
+    {
+      if(module->iop_order <= first_order
+         || !_fusable_geometry_piece(pipe, dev, module, piece))
+        break;
+
+      dt_iop_roi_t r_in = r_out;
+      module->modify_roi_in(module, piece, &r_out, &r_in);
+      // a change of scale would need a proper downscaler, not point sampling
+      if(r_in.scale != r_out.scale) break;
+
+      const int k = run->count;
+      run->module[k] = module;
+      run->piece[k] = piece;
+      run->roi_in[k] = r_in;
+      run->roi_out[k] = r_out;
+      _fused_geometry_piece_t p = { module, piece };
+      run->permutes[k] = dt_interpolation_permutation_probe(&run->perm[k], &r_out, &r_in,
+                                                            _fused_geometry_piece_backtransform,
+                                                            &p);
+      run->count++;
+      r_out = r_in;
+    }
+    run->span++;
+    modules = g_list_previous(modules);
+    pieces = g_list_previous(pieces);
+  }
+
+  run->below_modules = modules;
+  run->below_pieces = pieces;
+  return run->count >= 2;
+}
+
+// process a run of pure geometry modules ending at modules/pieces by composing
+// their backtransforms and resampling the run's input once. if all of them
+// only move whole pixels the input is copied without interpolation. returns
+// -1 if the run can't be fused and the modules have to be processed one by one.
+static int _dev_pixelpipe_process_fused(dt_dev_pixelpipe_t *pipe,
+                                        dt_develop_t *dev,
+                                        void **output,
+                                        void **cl_mem_output,
+                                        dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out,
+                                        GList *modules,
+                                        GList *pieces,
+                                        const int pos,
+                                        const dt_hash_t hash,
+                                        const size_t bufsize)
+{
+  if(!_fusion_allowed(pipe, pipe->fuse_geometry))
+    return -1;
+
+  _fused_geometry_t run;
+  if(!_fused_geometry_collect(pipe, dev, roi_out, modules, pieces, &run))
+    return -1;
+
+  // input and output have to fit next to each other, otherwise the
+  // modules tile on their own
+  const dt_iop_roi_t roi_in = run.roi_in[run.count - 1];
+  if(!dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
+                                       MAX(roi_in.height, roi_out->height),
+                                       4 * sizeof(float), 2.0f, 0))
+    return -1;
+
+  gboolean permutes = TRUE;
+  for(int k = 0; k < run.count; k++)
+    permutes = permutes && run.permutes[k];
+
+  for(int k = 0; k < run.count; k++)
+  {
+    run.piece[k]->processed_roi_in = run.roi_in[k];
+    run.piece[k]->processed_roi_out = run.roi_out[k];
+  }
+
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+
+  if(_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, &roi_in,
+                                run.below_modules, run.below_pieces, pos - run.span))
+    return TRUE;
+
+  const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
+
+  // the pipe runs on the CPU, the input can't be on a device
+  *cl_mem_output = NULL;
+
+  // _fused_geometry_collect() only accepts modules after demosaic, check it anyway
+  // before taking the output from the cache and leave anything else to one by one
+  // processing
+  if(input_format->datatype != TYPE_FLOAT || input_format->channels != 4
+     || in_bpp * roi_out->width * roi_out->height != bufsize)
+  {
+    dt_print_pipe(DT_DEBUG_PIPE,
+      "fused geometry", pipe, run.module[0], DT_DEVICE_CPU, &roi_in, roi_out,
+      "unexpected input format, %d channels, process the modules one by one\n",
+      input_format->channels);
+    return -1;
+  }
+
+  for(int k = 0; k < run.count; k++)
+    run.piece[k]->dsc_in = run.piece[k]->dsc_out = *input_format;
+  **out_format = pipe->dsc = *input_format;
+
+  dt_dev_pixelpipe_cache_get(pipe, hash, bufsize, output, out_format, run.module[0], FALSE);
+
+  if(dt_atomic_get_int(&pipe->shutdown))
+    return TRUE;
+
+  dt_times_t start;
+  dt_get_perf_times(&start);
+
+  dt_print_pipe(DT_DEBUG_PIPE,
+    "fused geometry", pipe, run.module[0], DT_DEVICE_CPU, &roi_in, roi_out,
+    "%d modules down to `%s%s'%s\n",
+    run.count, run.module[run.count - 1]->op,
+    dt_iop_get_instance_id(run.module[run.count - 1]),
+    permutes ? ", exact copy" : "");
+
+  if(permutes)
+  {
+    dt_interpolation_permutation_t perm = run.perm[0];
+    for(int k = 1; k < run.count; k++)
+      dt_interpolation_permutation_chain(&perm, &run.perm[k]);
+    dt_interpolation_permute(&perm, *output, input);
+  }
+  else
+  {
+    // the interpolator the warping modules use on their own
+    const struct dt_interpolation *itor =
+      dt_interpolation_new(DT_INTERPOLATION_USERPREF_WARP);
+    dt_interpolation_resample_backtransform(itor, *output, roi_out, input, &roi_in,
+                                            _fused_geometry_backtransform, &run);
+  }
+
+  dt_show_times_f(&start, "[dev_pixelpipe]", "[%s] fused %d geometry modules up to `%s%s'",
+                  dt_dev_pixelpipe_type_to_str(pipe->type), run.count,
+                  run.module[0]->op, dt_iop_get_instance_id(run.module[0]));
+
+  return dt_atomic_get_int(&pipe->shutdown) ? TRUE : FALSE;
+}
+
+// longest run of point-wise or raw front-end modules processed band by band
+#define DT_FUSED_BANDS_MAX 16
+
+// sensels per band of the raw front-end, rows are never split
+#define DT_FUSED_MOSAIC_BAND 32768
+
+typedef struct _fused_bands_t
+{
+  int count;
+  // top (last in pipe) first
+  dt_iop_module_t *module[DT_FUSED_BANDS_MAX];
+  dt_dev_pixelpipe_iop_t *piece[DT_FUSED_BANDS_MAX];
+  // colorspaces of the module input and output
+  dt_iop_colorspace_type_t cst_in[DT_FUSED_BANDS_MAX];
+  dt_iop_colorspace_type_t cst_out[DT_FUSED_BANDS_MAX];
+  // raw front-end, bands of rows through process_mosaic() instead of
+  // pixels through process_pixels()
+  gboolean mosaic;
+  int band_rows;
+  // input of the first module of the run, only the mosaic may be cropped
+  dt_iop_roi_t roi_in;
+  dt_iop_roi_t roi_out;
+  const dt_iop_order_iccprofile_info_t *work_profile;
+  GList *below_modules;
+  GList *below_pieces;
+  int span;
+} _fused_bands_t;
+
+static gboolean _fusable_band_piece(dt_dev_pixelpipe_t *pipe,
+                                    dt_develop_t *dev,
+                                    dt_iop_module_t *module,
+                                    dt_dev_pixelpipe_iop_t *piece)
+{
+  // blending needs the module input and output, pickers and histograms
+  // look at them too. the focused module and the one last changed keep
+  // their input in the cache, so they are processed on their own.
+  const dt_develop_blend_params_t *const bp = piece->blendop_data;
+  if(bp && bp->mask_mode != DEVELOP_MASK_DISABLED) return FALSE;
+  if(_request_color_pick(pipe, dev, module)) return FALSE;
+  if((piece->request_histogram | module->request_histogram) & DT_REQUEST_ON) return FALSE;
+  if(dev->gui_attached
+     && (module == dt_dev_gui_module() || module == dev->history_last_module))
+    return FALSE;
+
+  return TRUE;
+}
+
+static gboolean _fusable_pointwise_piece(dt_dev_pixelpipe_t *pipe,
+                                         dt_develop_t *dev,
+                                         dt_iop_module_t *module,
+                                         dt_dev_pixelpipe_iop_t *piece,
+                                         const dt_iop_roi_t *roi)
+{
+  if(!module->process_pixels || !piece->process_pixels_ready
+     || !_fusable_band_piece(pipe, dev, module, piece))
+    return FALSE;
+
+  // bands are converted between RGB and Lab on the fly for modules like colorout
+  const dt_iop_colorspace_type_t cst_in = module->input_colorspace(module, pipe, piece);
+  const dt_iop_colorspace_type_t cst_out = module->output_colorspace(module, pipe, piece);
+  if((cst_in != IOP_CS_RGB && cst_in != IOP_CS_LAB)
+     || (cst_out != IOP_CS_RGB && cst_out != IOP_CS_LAB))
+    return FALSE;
+  if((cst_in == IOP_CS_LAB || cst_out == IOP_CS_LAB)
+     && !dt_ioppr_can_transform_pixels_colorspace(dt_ioppr_get_pipe_work_profile_info(pipe)))
+    return FALSE;
+
+  dt_iop_roi_t roi_in = *roi;
+  module->modify_roi_in(module, piece, roi, &roi_in);
+  return !memcmp(&roi_in, roi, sizeof(dt_iop_roi_t));
+}
+
+static gboolean _fusable_mosaic_piece(dt_dev_pixelpipe_t *pipe,
+                                      dt_develop_t *dev,
+                                      dt_iop_module_t *module,
+                                      dt_dev_pixelpipe_iop_t *piece)
+{
+  return module->process_mosaic && piece->process_mosaic_ready
+    && _fusable_band_piece(pipe, dev, module, piece);
+}
+
+// collect the run of point-wise modules ending at modules/pieces
+static void _fused_pointwise_collect(dt_dev_pixelpipe_t *pipe,
+                                     dt_develop_t *dev,
+                                     GList *modules,
+                                     GList *pieces,
+                                     _fused_bands_t *run)
+{
+  // raw data isn't 4 channel float before demosaic
+  const int first_order = dt_image_is_raw(&pipe->image)
+    ? dt_ioppr_get_iop_order(pipe->iop_order_list, "demosaic", 0)
+    : INT_MIN;
+
+  while(modules && run->count < DT_FUSED_BANDS_MAX)
+  {
+    dt_iop_module_t *module = modules->data;
+    dt_dev_pixelpipe_iop_t *piece = pieces->data;
+
+    if(!_skip_piece_on_tags(piece))
+    {
+      if(module->iop_order <= first_order
+         || !_fusable_pointwise_piece(pipe, dev, module, piece, &run->roi_out))
+        break;
+
+      run->module[run->count] = module;
+      run->piece[run->count] = piece;
+      run->count++;
+    }
+    run->span++;
+    modules = g_list_previous(modules);
+    pieces = g_list_previous(pieces);
+  }
+
+  run->below_modules = modules;
+  run->below_pieces = pieces;
+}
+
+// collect the run of raw front-end modules ending at modules/pieces. only
+// the first module of the run may change the roi.
+static void _fused_mosaic_collect(dt_dev_pixelpipe_t *pipe,
+                                  dt_develop_t *dev,
+                                  GList *modules,
+                                  GList *pieces,
+                                  _fused_bands_t *run)
+{
+  if(!pipe->image.buf_dsc.filters || pipe->image.buf_dsc.channels != 1)
+    return;
+
+  gboolean head = FALSE;
+  while(modules && run->count < DT_FUSED_BANDS_MAX && !head)
+  {
+    dt_iop_module_t *module = modules->data;
+    dt_dev_pixelpipe_iop_t *piece = pieces->data;
+
+    if(!_skip_piece_on_tags(piece))
+    {
+      if(!_fusable_mosaic_piece(pipe, dev, module, piece))
+        break;
+
+      module->modify_roi_in(module, piece, &run->roi_out, &run->roi_in);
+      head = memcmp(&run->roi_in, &run->roi_out, sizeof(dt_iop_roi_t)) != 0;
+      run->module[run->count] = module;
+      run->piece[run->count] = piece;
+      run->count++;
+    }
+    run->span++;
+    modules = g_list_previous(modules);
+    pieces = g_list_previous(pieces);
+  }
+
+  run->below_modules = modules;
+  run->below_pieces = pieces;
+}
+
+// formats and per-image setup in pipe order, like one by one processing.
+// returns TRUE if a module can't be set up for this run.
+static gboolean _fused_bands_setup(dt_dev_pixelpipe_t *pipe,
+                               _fused_bands_t *run,
+                               const dt_iop_buffer_dsc_t *input_format)
+{
+  gboolean failed = FALSE;
+  pipe->dsc = *input_format;
+  for(int k = run->count - 1; k >= 0; k--)
+  {
+    dt_iop_module_t *module = run->module[k];
+    dt_dev_pixelpipe_iop_t *piece = run->piece[k];
+    run->cst_in[k] = module->input_colorspace(module, pipe, piece);
+    pipe->dsc.cst = run->cst_in[k];
+    piece->dsc_out = piece->dsc_in = pipe->dsc;
+    module->output_format(module, pipe, piece, &piece->dsc_out);
+    pipe->dsc = piece->dsc_out;
+    if(run->mosaic && module->process_mosaic_prepare)
+      module->process_mosaic_prepare(module, piece);
+    else if(!run->mosaic && module->process_pixels_prepare)
+      failed |= module->process_pixels_prepare(module, piece);
+    run->cst_out[k] = module->output_colorspace(module, pipe, piece);
+    pipe->dsc.cst = run->cst_out[k];
+    piece->dsc_out = pipe->dsc;
+  }
+  return failed;
+}
+
+// band b through module k of the run, the first module reads the input,
+// all others work in place
+static void _fused_bands_process(const _fused_bands_t *const run,
+                                 const int k,
+                                 const void *const input,
+                                 float *const out,
+                                 const size_t b)
+{
+  dt_iop_module_t *module = run->module[k];
+  dt_dev_pixelpipe_iop_t *piece = run->piece[k];
+  const gboolean head = k == run->count - 1;
+
+  if(run->mosaic)
+  {
+    const int row = b * run->band_rows;
+    const int rows = MIN(run->band_rows, run->roi_out.height - row);
+    module->process_mosaic(module, piece, head ? input : out, out,
+                           head ? &run->roi_in : &run->roi_out, &run->roi_out, row, rows);
+    return;
+  }
+
+  const size_t npixels = (size_t)run->roi_out.width * run->roi_out.height;
+  const size_t offset = 4 * b * DT_IOP_PIXELS_BAND;
+  const size_t n = MIN(DT_IOP_PIXELS_BAND, npixels - b * DT_IOP_PIXELS_BAND);
+  if(head)
+  {
+    module->process_pixels(module, piece, (const float *)input + offset, out + offset, n);
+    return;
+  }
+  if(run->cst_out[k + 1] != run->cst_in[k])
+    dt_ioppr_transform_pixels_colorspace(out + offset, out + offset, n,
+                                         run->cst_out[k + 1], run->cst_in[k], run->work_profile);
+  module->process_pixels(module, piece, out + offset, out + offset, n);
+}
+
+// process a run of point-wise modules, or of raw front-end modules (black/white
+// levels, white balance, clipping) on the mosaic, ending at modules/pieces in one
+// pass over the image. each band goes through all modules while it is in the cache.
+// returns -1 if the run can't be fused and the modules have to be processed one by one.
+static int _dev_pixelpipe_process_bands(dt_dev_pixelpipe_t *pipe,
+                                        dt_develop_t *dev,
+                                        void **output,
+                                        void **cl_mem_output,
+                                        dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out,
+                                        GList *modules,
+                                        GList *pieces,
+                                        const int pos,
+                                        const dt_hash_t hash,
+                                        const size_t bufsize,
+                                        const gboolean mosaic)
+{
+  if(!_fusion_allowed(pipe, pipe->fuse_pointwise))
+    return -1;
+
+  _fused_bands_t run = { .mosaic = mosaic, .roi_in = *roi_out, .roi_out = *roi_out };
+  if(mosaic)
+    _fused_mosaic_collect(pipe, dev, modules, pieces, &run);
+  else
+    _fused_pointwise_collect(pipe, dev, modules, pieces, &run);
+  if(run.count < 2)
+    return -1;
+
+  for(int k = 0; k < run.count; k++)
+    run.piece[k]->processed_roi_in = run.piece[k]->processed_roi_out = *roi_out;
+  run.piece[run.count - 1]->processed_roi_in = run.roi_in;
+
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+
+  if(_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, &run.roi_in,
+                                run.below_modules, run.below_pieces, pos - run.span))
+    return TRUE;
+
+  // the pipe runs on the CPU, the input can't be on a device
+  *cl_mem_output = NULL;
+
+  const char *kind = mosaic ? "fused mosaic" : "fused pointwise";
+  dt_iop_module_t *head = run.module[run.count - 1];
+  dt_dev_pixelpipe_iop_t *head_piece = run.piece[run.count - 1];
+  run.work_profile = dt_ioppr_get_pipe_work_profile_info(pipe);
+
+  // _fused_mosaic_collect() only accepts raw images and _fused_pointwise_collect()
+  // only modules after demosaic, check it anyway before taking the output from the
+  // cache and leave anything else to one by one processing
+  const gboolean format_ok = mosaic
+    ? input_format->channels == 1
+      && (input_format->datatype == TYPE_FLOAT || input_format->datatype == TYPE_UINT16)
+    : input_format->datatype == TYPE_FLOAT && input_format->channels == 4
+      && dt_iop_buffer_dsc_to_bpp(input_format) * roi_out->width * roi_out->height == bufsize;
+  if(!format_ok)
+  {
+    dt_print_pipe(DT_DEBUG_PIPE,
+      kind, pipe, run.module[0], DT_DEVICE_CPU, &run.roi_in, roi_out,
+      "unexpected input format, %d channels, process the modules one by one\n",
+      input_format->channels);
+    return -1;
+  }
+
+  // same as the first module would do in _pixelpipe_process_on_CPU()
+  if(!mosaic)
+    dt_ioppr_transform_image_colorspace(head, input, input,
+                                        roi_out->width, roi_out->height,
+                                        input_format->cst,
+                                        head->input_colorspace(head, pipe, head_piece),
+                                        &input_format->cst, run.work_profile);
+
+  if(_fused_bands_setup(pipe, &run, input_format))
+  {
+    dt_print_pipe(DT_DEBUG_PIPE,
+      kind, pipe, run.module[0], DT_DEVICE_CPU, &run.roi_in, roi_out,
+      "modules can't be set up, process them one by one\n");
+    return -1;
+  }
+
+  // the bands are written as float, with the channels of the input
+  if(pipe->dsc.datatype != TYPE_FLOAT || pipe->dsc.channels != (mosaic ? 1 : 4))
+  {
+    dt_print_pipe(DT_DEBUG_PIPE,
+      kind, pipe, run.module[0], DT_DEVICE_CPU, &run.roi_in, roi_out,
+      "unexpected output format, %d channels, process the modules one by one\n",
+      pipe->dsc.channels);
+    return -1;
+  }
+  **out_format = pipe->dsc;
+
+  dt_dev_pixelpipe_cache_get(pipe, hash, bufsize, output, out_format, run.module[0], FALSE);
+
+  if(dt_atomic_get_int(&pipe->shutdown))
+    return TRUE;
+
+  dt_times_t start;
+  dt_get_perf_times(&start);
+
+  dt_print_pipe(DT_DEBUG_PIPE,
+    kind, pipe, run.module[0], DT_DEVICE_CPU, &run.roi_in, roi_out,
+    "%d modules from `%s%s'\n",
+    run.count, head->op, dt_iop_get_instance_id(head));
+
+  run.band_rows = MAX(1, DT_FUSED_MOSAIC_BAND / MAX(1, roi_out->width));
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+  const size_t nbands = mosaic
+    ? (roi_out->height + run.band_rows - 1) / run.band_rows
+    : (npixels + DT_IOP_PIXELS_BAND - 1) / DT_IOP_PIXELS_BAND;
+  float *const out = *output;
+  DT_OMP_FOR()
+  for(size_t b = 0; b < nbands; b++)
+    for(int k = run.count - 1; k >= 0; k--)
+      _fused_bands_process(&run, k, input, out, b);
+
+  // every module on its own would read and write the full buffer
+  dt_show_times_f(&start, "[dev_pixelpipe]",
+                  "[%s] fused %d %s modules up to `%s%s', saved %.1fMB of memory traffic",
+                  dt_dev_pixelpipe_type_to_str(pipe->type), run.count,
+                  mosaic ? "raw" : "pointwise",
+                  run.module[0]->op, dt_iop_get_instance_id(run.module[0]),
+                  2e-6 * (run.count - 1) * bufsize);
+
+  return dt_atomic_get_int(&pipe->shutdown) ? TRUE : FALSE;
+}
+
 // recursive helper for process, returns TRUE in case of unfinished work or error
 static gboolean _dev_pixelpipe_process_rec(
                  dt_dev_pixelpipe_t *pipe,
@@ -1524,6 +2156,26 @@ static gboolean _dev_pixelpipe_process_rec(
   if(dt_atomic_get_int(&pipe->shutdown))
     return TRUE;
 
+  // a run of pure geometry modules ending here is resampled in one go
+  const int fused = _dev_pixelpipe_process_fused(pipe, dev, output, cl_mem_output, out_format,
+                                                 roi_out, modules, pieces, pos, hash, bufsize);
+  if(fused >= 0)
+    return fused;
+
+  // and so is a run of point-wise modules, band by band
+  const int pointwise = _dev_pixelpipe_process_bands(pipe, dev, output, cl_mem_output,
+                                                     out_format, roi_out, modules, pieces,
+                                                     pos, hash, bufsize, FALSE);
+  if(pointwise >= 0)
+    return pointwise;
+
+  // the raw front-end up to the white balance and clipping as well
+  const int mosaic = _dev_pixelpipe_process_bands(pipe, dev, output, cl_mem_output,
+                                                  out_format, roi_out, modules, pieces,
+                                                  pos, hash, bufsize, TRUE);
+  if(mosaic >= 0)
+    return mosaic;
+
   module->modify_roi_in(module, piece, roi_out, &roi_in);
   if((darktable.unmuted & DT_DEBUG_PIPE) && memcmp(roi_out, &roi_in, sizeof(dt_iop_roi_t)))
     dt_print_pipe(DT_DEBUG_PIPE,
@@ -1544,6 +2196,10 @@ static gboolean _dev_pixelpipe_process_rec(
                                 g_list_previous(pieces), pos - 1))
     return TRUE;
 
+  // all modules before this one are done
+  if(pipe->progress)
+    pipe->progress(pipe->progress_data, (float)(pos - 1) / MAX(pipe->progress_modules, 1));
+
   const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
 
   piece->dsc_out = piece->dsc_in = *input_format;
@@ -2726,6 +3382,7 @@ gboolean dt_dev_pixelpipe_process(
 
   //  go through list of modules from the end:
   const guint pos = g_list_length(pipe->iop);
+  pipe->progress_modules = pos;
   GList *modules = g_list_last(pipe->iop);
   GList *pieces = g_list_last(pipe->nodes);
 
@@ -66,6 +66,8 @@ typedef struct dt_dev_pixelpipe_iop_t
   dt_iop_roi_t processed_roi_out;
   gboolean process_cl_ready;      // set this to FALSE in commit_params to temporarily disable the use of process_cl
   gboolean process_tiling_ready;  // set this to FALSE in commit_params to temporarily disable tiling
+  gboolean process_mosaic_ready;  // set this to FALSE in commit_params if process_mosaic can't be used
+  gboolean process_pixels_ready;  // set this to FALSE in commit_params if process_pixels can't be used
 
   // the following are used internally for caching:
   dt_iop_buffer_dsc_t dsc_in;
@@ -173,6 +175,15 @@ typedef struct dt_dev_pixelpipe_t
   dt_dev_pixelpipe_display_mask_t mask_display;
   // should this pixelpipe completely suppressed the blendif module?
   gboolean bypass_blendif;
+  // resample runs of pure geometry modules (IOP_FLAGS_PURE_GEOMETRY) in one step?
+  gboolean fuse_geometry;
+  // process runs of point-wise modules (process_pixels(), process_mosaic()) band by band?
+  gboolean fuse_pointwise;
+  // if set, called with the fraction of the modules processed so far
+  void (*progress)(void *data, const float fraction);
+  void *progress_data;
+  // number of modules of the current run, to scale the progress
+  int progress_modules;
   // input data based on this timestamp:
   int input_timestamp;
   uint32_t average_delay;
@@ -34,6 +34,7 @@
 #include "common/mipmap_cache.h" // for dt_mipmap_size_t, etc
 #include "common/file_location.h"
 #include "common/history.h"      // for dt_history_hash_set_mipmap
+#include "common/readahead.h"    // for dt_readahead_images
 #include "config.h"              // for GETTEXT_PACKAGE, etc
 #include "control/conf.h"        // for dt_conf_get_bool
 
@@ -87,9 +88,23 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
+  // the ids of all images, to read the files of the next ones ahead
+  GList *imgs = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2 ORDER BY id",
+                              -1, &stmt, 0);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  imgs = g_list_reverse(imgs);
+  const GList *next = imgs;
+
   // go through all images:
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id, filename FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
+                              "SELECT id, filename FROM main.images WHERE id >= ?1 AND id <= ?2 ORDER BY id",
+                              -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -97,6 +112,9 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     const dt_imgid_t imgid = sqlite3_column_int(stmt, 0);
     const char *imgfilename = (const char*)sqlite3_column_text(stmt, 1);
 
+    if(next) next = g_list_next(next);
+    dt_readahead_images(next);
+
     counter++;
     fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d, file=%s)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid, imgfilename);
 
@@ -121,6 +139,7 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
   }
 
   sqlite3_finalize(stmt);
+  g_list_free(imgs);
   fprintf(stderr, "done\n");
 
   return 0;
@@ -118,18 +118,14 @@ void cleanup(dt_imageio_module_format_t *self)
 {
 }
 
-int write_image(dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, dt_imgid_t imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+static void _init_header(Imf::Header &header,
+                         const dt_imageio_exr_t *exr,
+                         void *exif,
+                         int exif_len,
+                         dt_imgid_t imgid,
+                         dt_colorspaces_color_profile_type_t over_type,
+                         const char *over_filename)
 {
-  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
-
-  Imf::setGlobalThreadCount(dt_get_num_threads());
-
-  Imf::Header header(exr->global.width, exr->global.height, 1, Imath::V2f(0, 0), 1, Imf::INCREASING_Y,
-                     (Imf::Compression)exr->compression);
-
   char comment[1024];
   snprintf(comment, sizeof(comment), "Created with %s", darktable_package_string);
 
@@ -224,6 +220,23 @@ icc_end:
   header.channels().insert("R", Imf::Channel(pixel_type, 1, 1, true));
   header.channels().insert("G", Imf::Channel(pixel_type, 1, 1, true));
   header.channels().insert("B", Imf::Channel(pixel_type, 1, 1, true));
+}
+
+int write_image(dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, dt_imgid_t imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+
+  Imf::setGlobalThreadCount(dt_get_num_threads());
+
+  Imf::Header header(exr->global.width, exr->global.height, 1, Imath::V2f(0, 0), 1, Imf::INCREASING_Y,
+                     (Imf::Compression)exr->compression);
+
+  _init_header(header, exr, exif, exif_len, imgid, over_type, over_filename);
+
+  Imf::PixelType pixel_type = (Imf::PixelType)exr->pixel_type;
 
   Imf::FrameBuffer data;
   size_t stride;
@@ -369,6 +382,123 @@ icc_end:
   return 0;
 }
 
+// state of an image being written band by band
+typedef struct dt_imageio_exr_stream_t
+{
+  Imf::OutputFile *file;
+  void *half_rows; // conversion buffer for half float output
+  int half_rows_height;
+  int y;
+} dt_imageio_exr_stream_t;
+
+void *write_begin(dt_imageio_module_data_t *tmp, const char *filename,
+                  dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                  void *exif, int exif_len, dt_imgid_t imgid, int num, int total,
+                  struct dt_dev_pixelpipe_t *pipe)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+
+  Imf::setGlobalThreadCount(dt_get_num_threads());
+
+  try
+  {
+    Imf::Header header(exr->global.width, exr->global.height, 1, Imath::V2f(0, 0), 1, Imf::INCREASING_Y,
+                       (Imf::Compression)exr->compression);
+
+    _init_header(header, exr, exif, exif_len, imgid, over_type, over_filename);
+
+    std::unique_ptr<Imf::OutputFile> file(new Imf::OutputFile(filename, header));
+    dt_imageio_exr_stream_t *s = new dt_imageio_exr_stream_t();
+    s->file = file.release();
+    return s;
+  }
+  catch(const std::exception &e)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[exr export] error opening %s: %s\n", filename, e.what());
+    return NULL;
+  }
+}
+
+int write_rows(dt_imageio_module_data_t *tmp, void *handle, const void *in_tmp, const int rows)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+  dt_imageio_exr_stream_t *s = (dt_imageio_exr_stream_t *)handle;
+  const Imf::PixelType pixel_type = (Imf::PixelType)exr->pixel_type;
+  const size_t width = exr->global.width;
+
+  // the slices are addressed by the row number in the whole image
+  Imf::FrameBuffer data;
+  if(pixel_type == Imf::PixelType::FLOAT)
+  {
+    const size_t stride = 4 * sizeof(float);
+    char *base = (char *)in_tmp - stride * width * s->y;
+
+    data.insert("R", Imf::Slice(pixel_type, base + 0 * sizeof(float), stride, stride * width));
+    data.insert("G", Imf::Slice(pixel_type, base + 1 * sizeof(float), stride, stride * width));
+    data.insert("B", Imf::Slice(pixel_type, base + 2 * sizeof(float), stride, stride * width));
+  }
+  else
+  {
+    const size_t stride = 3 * sizeof(unsigned short);
+    if(s->half_rows_height < rows)
+    {
+      dt_free_align(s->half_rows);
+      s->half_rows = dt_alloc_aligned(stride * width * rows);
+      s->half_rows_height = s->half_rows ? rows : 0;
+    }
+    if(s->half_rows == NULL)
+    {
+      dt_print(DT_DEBUG_ALWAYS, "[exr export] error allocating image conversion buffer\n");
+      return 1;
+    }
+
+    unsigned short *const out_rows = (unsigned short *)s->half_rows;
+    DT_OMP_FOR()
+    for(size_t k = 0; k < width * rows; k++)
+    {
+      const float *in_pixel = (const float *)in_tmp + 4 * k;
+      unsigned short *out_pixel = out_rows + 3 * k;
+
+      out_pixel[0] = half(in_pixel[0]).bits();
+      out_pixel[1] = half(in_pixel[1]).bits();
+      out_pixel[2] = half(in_pixel[2]).bits();
+    }
+
+    char *base = (char *)s->half_rows - stride * width * s->y;
+
+    data.insert("R", Imf::Slice(pixel_type, base + 0 * sizeof(unsigned short), stride, stride * width));
+    data.insert("G", Imf::Slice(pixel_type, base + 1 * sizeof(unsigned short), stride, stride * width));
+    data.insert("B", Imf::Slice(pixel_type, base + 2 * sizeof(unsigned short), stride, stride * width));
+  }
+
+  try
+  {
+    s->file->setFrameBuffer(data);
+    s->file->writePixels(rows);
+  }
+  catch(const std::exception &e)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[exr export] error writing rows %d-%d: %s\n", s->y, s->y + rows - 1, e.what());
+    return 1;
+  }
+
+  s->y += rows;
+  return 0;
+}
+
+int write_finish(dt_imageio_module_data_t *tmp, void *handle, const gboolean abort)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+  dt_imageio_exr_stream_t *s = (dt_imageio_exr_stream_t *)handle;
+  const int rc = abort || s->y != exr->global.height;
+
+  // closing the file writes the offset table
+  delete s->file;
+  dt_free_align(s->half_rows);
+  delete s;
+  return rc;
+}
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_exr_t);
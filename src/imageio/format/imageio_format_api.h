@@ -84,6 +84,18 @@ REQUIRED(int, write_image, struct dt_imageio_module_data_t *data, const char *fi
                            dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                            void *exif, int exif_len, dt_imgid_t imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
                            const gboolean export_masks);
+/* streaming export, optional: formats able to write the image in bands of rows implement all three.
+   start writing an image of data->width x data->height pixels, the arguments are the ones of write_image().
+   returns NULL if the image can't be streamed with the current parameters, write_image() is used then.
+   exif has to stay valid until write_finish(). */
+OPTIONAL(void *, write_begin, struct dt_imageio_module_data_t *data, const char *filename,
+                              dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                              void *exif, int exif_len, dt_imgid_t imgid, int num, int total,
+                              struct dt_dev_pixelpipe_t *pipe);
+/* write the next rows, in the same layout as the buffer given to write_image(). return != 0 on fail. */
+OPTIONAL(int, write_rows, struct dt_imageio_module_data_t *data, void *handle, const void *in, const int rows);
+/* complete the file and free the handle, abort after a failure. return != 0 on fail. */
+OPTIONAL(int, write_finish, struct dt_imageio_module_data_t *data, void *handle, const gboolean abort);
 /* flag that describes the available precision/levels of output format. mainly used for dithering. */
 OPTIONAL(int, levels, struct dt_imageio_module_data_t *data);
 
@@ -171,128 +171,459 @@ static void write_icc_profile(j_compress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
-int write_image(dt_imageio_module_data_t *jpg_tmp,
-                const char *filename,
-                const void *in_tmp,
-                dt_colorspaces_color_profile_type_t over_type,
-                const char *over_filename,
-                void *exif, int exif_len,
-                dt_imgid_t imgid,
-                int num,
-                int total,
-                struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+/*
+ * libjpeg encodes on a single thread. To use all of them the image is cut into
+ * bands of whole iMCU rows, each band is encoded on its own into memory and the
+ * entropy coded data of the bands are concatenated. Every iMCU row starts a
+ * restart interval, this resets the DC prediction like a new image does, so the
+ * only thing left to do is to number the restart markers across the bands.
+ * All bands have to share the Huffman tables, which rules out optimised tables:
+ * the files are a few percent larger than the single threaded ones, the pixels
+ * decode the same. Smoothing (quality below 80) would differ at the band
+ * borders and keeps the single threaded encoder.
+ */
+
+// roughly the pixels per band
+#define JPEG_BAND_PIXELS (1 << 20)
+
+// state of an image being written band by band
+typedef struct dt_imageio_jpeg_stream_t
 {
-  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
-  const uint8_t *in = (const uint8_t *)in_tmp;
+  struct jpeg_compress_struct cinfo;
   struct dt_imageio_jpeg_error_mgr jerr;
+  FILE *f;
+  uint8_t *row;
+  char *filename;
+  void *exif;
+  int exif_len;
+  int quality;
+  int subsample;
+  int resolution;
+  // parallel encoding
+  gboolean parallel;
+  int band_rows;      // rows per band, whole iMCU rows
+  int n_bands;        // bands encoded at once
+  uint8_t *rows;      // RGB rows not encoded yet
+  int n_rows;
+  int next_row;       // image row of the first one in rows
+  int intervals;      // restart intervals written
+  unsigned char *icc;
+  uint32_t icc_len;
+  double seconds;
+} dt_imageio_jpeg_stream_t;
+
+static void _stream_free(dt_imageio_jpeg_stream_t *s)
+{
+  jpeg_destroy_compress(&(s->cinfo));
+  if(s->f) fclose(s->f);
+  dt_free_align(s->row);
+  dt_free_align(s->rows);
+  free(s->icc);
+  g_free(s->filename);
+  free(s);
+}
 
-  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
-  if(setjmp(jerr.setjmp_buffer))
-  {
-    jpeg_destroy_compress(&(jpg->cinfo));
-    return 1;
-  }
-  jpeg_create_compress(&(jpg->cinfo));
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
-  jpeg_stdio_dest(&(jpg->cinfo), f);
-
-  jpg->cinfo.image_width = jpg->global.width;
-  jpg->cinfo.image_height = jpg->global.height;
-  jpg->cinfo.input_components = 3;
-  jpg->cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
+static void _setup_compress(struct jpeg_compress_struct *cinfo,
+                            const int quality,
+                            const int subsample,
+                            const int resolution,
+                            const int width,
+                            const int height)
+{
+  cinfo->image_width = width;
+  cinfo->image_height = height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, quality, TRUE);
+
+  if(quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(quality < 80) cinfo->smoothing_factor = 20;
+  if(quality < 60) cinfo->smoothing_factor = 40;
+  if(quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = 1;
 
   // Common part for all subsampling formulas:
-  jpg->cinfo.comp_info[1].h_samp_factor = 1;
-  jpg->cinfo.comp_info[1].v_samp_factor = 1;
-  jpg->cinfo.comp_info[2].h_samp_factor = 1;
-  jpg->cinfo.comp_info[2].v_samp_factor = 1;
+  cinfo->comp_info[1].h_samp_factor = 1;
+  cinfo->comp_info[1].v_samp_factor = 1;
+  cinfo->comp_info[2].h_samp_factor = 1;
+  cinfo->comp_info[2].v_samp_factor = 1;
 
-  const int subsample = dt_conf_get_int("plugins/imageio/format/jpeg/subsample");
   switch(subsample)
   {
     case 1: // 1x1 1x1 1x1 (4:4:4) : No chroma subsampling
     {
-      jpg->cinfo.comp_info[0].h_samp_factor = 1;
-      jpg->cinfo.comp_info[0].v_samp_factor = 1;
+      cinfo->comp_info[0].h_samp_factor = 1;
+      cinfo->comp_info[0].v_samp_factor = 1;
       break;
     }
     case 2: // 1x2 1x1 1x1 (4:4:0) : Color sampling rate halved vertically
     {
-      jpg->cinfo.comp_info[0].h_samp_factor = 1;
-      jpg->cinfo.comp_info[0].v_samp_factor = 2;
+      cinfo->comp_info[0].h_samp_factor = 1;
+      cinfo->comp_info[0].v_samp_factor = 2;
       break;
     }
     case 3: // 2x1 1x1 1x1 (4:2:2) : Color sampling rate halved horizontally
     {
-      jpg->cinfo.comp_info[0].h_samp_factor = 2;
-      jpg->cinfo.comp_info[0].v_samp_factor = 1;
+      cinfo->comp_info[0].h_samp_factor = 2;
+      cinfo->comp_info[0].v_samp_factor = 1;
       break;
     }
     case 4: // 2x2 1x1 1x1 (4:2:0) : Color sampling rate halved horizontally and vertically
     {
-      jpg->cinfo.comp_info[0].h_samp_factor = 2;
-      jpg->cinfo.comp_info[0].v_samp_factor = 2;
+      cinfo->comp_info[0].h_samp_factor = 2;
+      cinfo->comp_info[0].v_samp_factor = 2;
+      break;
+    }
+  }
+
+  cinfo->density_unit = 1;
+  cinfo->X_density = resolution;
+  cinfo->Y_density = resolution;
+}
+
+#ifdef MEM_SRCDST_SUPPORTED
+// encode rows of RGB data as a jpeg with a restart interval per iMCU row,
+// only the first band gets the JFIF and ICC markers
+static int _encode_band(const dt_imageio_jpeg_stream_t *s,
+                        uint8_t *rgb,
+                        const int rows,
+                        const gboolean first,
+                        unsigned char **out,
+                        unsigned long *out_len)
+{
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    return 1;
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, out, out_len);
+
+  const size_t width = s->cinfo.image_width;
+  _setup_compress(&cinfo, s->quality, s->subsample, s->resolution, width, rows);
+  cinfo.optimize_coding = FALSE;
+  cinfo.restart_in_rows = 1;
+  cinfo.write_JFIF_header = first;
+  jpeg_start_compress(&cinfo, TRUE);
+  if(first && s->icc) write_icc_profile(&cinfo, s->icc, s->icc_len);
+
+  while(cinfo.next_scanline < cinfo.image_height)
+  {
+    JSAMPROW row = rgb + (size_t)cinfo.next_scanline * 3 * width;
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return 0;
+}
+
+// find the frame header and the entropy coded data following the scan header
+static gboolean _band_layout(const unsigned char *buf,
+                             const size_t len,
+                             size_t *sof,
+                             size_t *data)
+{
+  *sof = 0;
+  size_t pos = 2;
+  while(pos + 4 <= len && buf[pos] == 0xFF)
+  {
+    const int marker = buf[pos + 1];
+    const size_t seg_len = (buf[pos + 2] << 8) | buf[pos + 3];
+    if(marker == 0xC0 || marker == 0xC1) *sof = pos;
+    pos += 2 + seg_len;
+    if(marker == 0xDA)
+    {
+      *data = pos;
+      // the data ends in front of the EOI marker
+      return *sof && pos + 2 <= len;
+    }
+  }
+  return FALSE;
+}
+
+// encode the buffered rows and append them to the file
+static int _write_bands(dt_imageio_jpeg_stream_t *s)
+{
+  const int n_bands = (s->n_rows + s->band_rows - 1) / s->band_rows;
+  const size_t width = s->cinfo.image_width;
+  const gboolean first = s->next_row == 0;
+  unsigned char **out = calloc(n_bands, sizeof(unsigned char *));
+  unsigned long *out_len = calloc(n_bands, sizeof(unsigned long));
+  int *err = calloc(n_bands, sizeof(int));
+  if(!out || !out_len || !err)
+  {
+    free(out);
+    free(out_len);
+    free(err);
+    return 1;
+  }
+
+  DT_OMP_FOR()
+  for(int b = 0; b < n_bands; b++)
+  {
+    const int row = b * s->band_rows;
+    err[b] = _encode_band(s, s->rows + (size_t)row * 3 * width,
+                          MIN(s->band_rows, s->n_rows - row), first && b == 0,
+                          &out[b], &out_len[b]);
+  }
+
+  const int mcu_rows = s->cinfo.comp_info[0].v_samp_factor * DCTSIZE;
+  int res = 0;
+  for(int b = 0; b < n_bands && !res; b++)
+  {
+    size_t sof = 0, data = 0;
+    if(err[b] || !_band_layout(out[b], out_len[b], &sof, &data))
+    {
+      res = 1;
       break;
     }
+    const size_t end = out_len[b] - 2;
+    const int rows = MIN(s->band_rows, s->n_rows - b * s->band_rows);
+
+    // restart markers count on from the previous bands
+    int interval = s->intervals;
+    for(size_t k = data; k + 1 < end; k++)
+      if(out[b][k] == 0xFF && out[b][k + 1] >= 0xD0 && out[b][k + 1] <= 0xD7)
+        out[b][++k] = 0xD0 + (interval++ & 7);
+
+    if(first && b == 0)
+    {
+      // the frame header of the first band stands for the whole image
+      out[b][sof + 5] = s->cinfo.image_height >> 8;
+      out[b][sof + 6] = s->cinfo.image_height & 0xFF;
+      res = fwrite(out[b], 1, end, s->f) != end;
+    }
+    else
+    {
+      const unsigned char rst[2] = { 0xFF, 0xD0 + ((s->intervals - 1) & 7) };
+      res = fwrite(rst, 1, 2, s->f) != 2
+        || fwrite(out[b] + data, 1, end - data, s->f) != end - data;
+    }
+    s->intervals += (rows + mcu_rows - 1) / mcu_rows;
   }
 
-  const int resolution = dt_conf_get_int("metadata/resolution");
-  jpg->cinfo.density_unit = 1;
-  jpg->cinfo.X_density = resolution;
-  jpg->cinfo.Y_density = resolution;
+  for(int b = 0; b < n_bands; b++) free(out[b]);
+  free(out);
+  free(out_len);
+  free(err);
 
-  jpeg_start_compress(&(jpg->cinfo), TRUE);
+  s->next_row += s->n_rows;
+  s->n_rows = 0;
+  return res;
+}
+#endif
+
+void *write_begin(dt_imageio_module_data_t *jpg_tmp,
+                  const char *filename,
+                  dt_colorspaces_color_profile_type_t over_type,
+                  const char *over_filename,
+                  void *exif, int exif_len,
+                  dt_imgid_t imgid,
+                  int num,
+                  int total,
+                  struct dt_dev_pixelpipe_t *pipe)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_stream_t *s = calloc(1, sizeof(dt_imageio_jpeg_stream_t));
+  if(!s) return NULL;
+
+  s->cinfo.err = jpeg_std_error(&(s->jerr.pub));
+  s->jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(s->jerr.setjmp_buffer))
+  {
+    _stream_free(s);
+    return NULL;
+  }
+  jpeg_create_compress(&(s->cinfo));
+  s->f = g_fopen(filename, "wb");
+  if(!s->f)
+  {
+    _stream_free(s);
+    return NULL;
+  }
+
+  s->quality = jpg->quality;
+  s->subsample = dt_conf_get_int("plugins/imageio/format/jpeg/subsample");
+  s->resolution = dt_conf_get_int("metadata/resolution");
+  _setup_compress(&(s->cinfo), s->quality, s->subsample, s->resolution,
+                  jpg->global.width, jpg->global.height);
 
   cmsHPROFILE out_profile =
     dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
-  uint32_t len = 0;
-  cmsSaveProfileToMem(out_profile, NULL, &len);
-  if(len > 0)
+  cmsSaveProfileToMem(out_profile, NULL, &s->icc_len);
+  if(s->icc_len > 0)
+  {
+    s->icc = malloc(sizeof(unsigned char) * s->icc_len);
+    if(s->icc)
+      cmsSaveProfileToMem(out_profile, s->icc, &s->icc_len);
+  }
+
+#ifdef MEM_SRCDST_SUPPORTED
+  // bands of whole iMCU rows, at least two of them
+  const int mcu_rows = s->cinfo.comp_info[0].v_samp_factor * DCTSIZE;
+  s->band_rows = mcu_rows * MAX(1, JPEG_BAND_PIXELS / (jpg->global.width * mcu_rows));
+  s->n_bands = dt_get_num_threads();
+  // smoothing looks across the band borders
+  s->parallel = s->n_bands > 1 && jpg->global.height >= 2 * s->band_rows
+                && s->cinfo.smoothing_factor == 0;
+  if(s->parallel)
   {
-    unsigned char *buf = malloc(sizeof(unsigned char) * len);
-    if(buf)
+    s->rows = dt_alloc_align_uint8((size_t)s->n_bands * s->band_rows * 3 * jpg->global.width);
+    if(!s->rows)
     {
-      cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
-      free(buf);
+      _stream_free(s);
+      return NULL;
     }
   }
+  else
+#endif
+  {
+    jpeg_stdio_dest(&(s->cinfo), s->f);
+    jpeg_start_compress(&(s->cinfo), TRUE);
+    if(s->icc) write_icc_profile(&(s->cinfo), s->icc, s->icc_len);
 
-  uint8_t *row = dt_alloc_align_uint8(3 * jpg->global.width);
-  const uint8_t *buf;
-  while(row && jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+    s->row = dt_alloc_align_uint8(3 * jpg->global.width);
+    if(!s->row)
+    {
+      _stream_free(s);
+      return NULL;
+    }
+  }
+
+  s->filename = g_strdup(filename);
+  s->exif = exif;
+  s->exif_len = exif_len;
+  return s;
+}
+
+int write_rows(dt_imageio_module_data_t *jpg_tmp,
+               void *handle,
+               const void *in_tmp,
+               const int rows)
+{
+  dt_imageio_jpeg_stream_t *s = (dt_imageio_jpeg_stream_t *)handle;
+  const uint8_t *in = (const uint8_t *)in_tmp;
+  const size_t width = s->cinfo.image_width;
+
+  const double start = dt_get_debug_wtime();
+#ifdef MEM_SRCDST_SUPPORTED
+  if(s->parallel)
   {
-    JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
-    for(int i = 0; i < jpg->global.width; i++)
-      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    const int capacity = s->n_bands * s->band_rows;
+    int done = 0;
+    while(done < rows)
+    {
+      const int n = MIN(rows - done, capacity - s->n_rows);
+      uint8_t *const out = s->rows + (size_t)s->n_rows * 3 * width;
+      DT_OMP_FOR()
+      for(int r = 0; r < n; r++)
+      {
+        const uint8_t *const buf = in + (size_t)(done + r) * 4 * width;
+        for(size_t i = 0; i < width; i++)
+          for(int k = 0; k < 3; k++)
+            out[((size_t)r * width + i) * 3 + k] = buf[4 * i + k];
+      }
+      s->n_rows += n;
+      done += n;
+      if(s->n_rows == capacity && _write_bands(s))
+        return 1;
+    }
+    s->seconds += dt_get_debug_wtime() - start;
+    return 0;
   }
-  jpeg_finish_compress(&(jpg->cinfo));
-  dt_free_align(row);
-  jpeg_destroy_compress(&(jpg->cinfo));
-  fclose(f);
+#endif
 
-  if(exif) dt_exif_write_blob(exif, exif_len, filename, 1);
+  if(setjmp(s->jerr.setjmp_buffer))
+    return 1;
 
+  for(int r = 0; r < rows && s->cinfo.next_scanline < s->cinfo.image_height; r++)
+  {
+    JSAMPROW tmp[1];
+    const uint8_t *buf = in + (size_t)r * width * 4;
+    for(size_t i = 0; i < width; i++)
+      for(int k = 0; k < 3; k++) s->row[3 * i + k] = buf[4 * i + k];
+    tmp[0] = s->row;
+    jpeg_write_scanlines(&(s->cinfo), tmp, 1);
+  }
+  s->seconds += dt_get_debug_wtime() - start;
   return 0;
 }
 
+int write_finish(dt_imageio_module_data_t *jpg_tmp,
+                 void *handle,
+                 const gboolean abort)
+{
+  dt_imageio_jpeg_stream_t *s = (dt_imageio_jpeg_stream_t *)handle;
+  volatile int rc = 1;
+
+  if(!abort)
+  {
+#ifdef MEM_SRCDST_SUPPORTED
+    if(s->parallel)
+    {
+      const double start = dt_get_debug_wtime();
+      const unsigned char eoi[2] = { 0xFF, 0xD9 };
+      if((s->n_rows == 0 || !_write_bands(s))
+         && s->next_row == s->cinfo.image_height
+         && fwrite(eoi, 1, 2, s->f) == 2)
+        rc = 0;
+      s->seconds += dt_get_debug_wtime() - start;
+    }
+    else
+#endif
+    if(!setjmp(s->jerr.setjmp_buffer))
+    {
+      const double start = dt_get_debug_wtime();
+      jpeg_finish_compress(&(s->cinfo));
+      s->seconds += dt_get_debug_wtime() - start;
+      rc = 0;
+    }
+  }
+
+  if(rc == 0)
+  {
+    const double mp = s->cinfo.image_width * (double)s->cinfo.image_height / 1e6;
+    dt_print(DT_DEBUG_PERF, "[jpeg] encoded %.1f MP%s in %.3f secs (%.1f MP/s)\n",
+             mp, s->parallel ? " in parallel bands" : "", s->seconds,
+             s->seconds > 0.0 ? mp / s->seconds : 0.0);
+  }
+  fclose(s->f);
+  s->f = NULL;
+
+  if(rc == 0 && s->exif) dt_exif_write_blob(s->exif, s->exif_len, s->filename, 1);
+
+  _stream_free(s);
+  return rc;
+}
+
+int write_image(dt_imageio_module_data_t *jpg_tmp,
+                const char *filename,
+                const void *in_tmp,
+                dt_colorspaces_color_profile_type_t over_type,
+                const char *over_filename,
+                void *exif, int exif_len,
+                dt_imgid_t imgid,
+                int num,
+                int total,
+                struct dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  void *s = write_begin(jpg_tmp, filename, over_type, over_filename,
+                        exif, exif_len, imgid, num, total, pipe);
+  if(!s) return 1;
+
+  const int err = write_rows(jpg_tmp, s, in_tmp, jpg_tmp->height);
+  return write_finish(jpg_tmp, s, err != 0) || err;
+}
+
 static int __attribute__((__unused__)) read_header(const char *filename,
                                                    dt_imageio_jpeg_t *jpg)
 {
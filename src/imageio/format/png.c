@@ -138,51 +138,363 @@ cleanup:
 }
 #endif
 
-int write_image(dt_imageio_module_data_t *p_tmp,
-                const char *filename,
-                const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type,
-                const char *over_filename,
-                void *exif,
-                int exif_len,
-                dt_imgid_t imgid,
-                int num,
-                int total,
-                struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+/*
+ * Deflate dominates the time to write a PNG. When more than one thread is
+ * available we filter the rows ourselves, using the same adaptive filter
+ * selection as libpng, and deflate the filtered data in independent chunks
+ * on all threads. Every chunk is primed with the 32 kB preceding it and ends
+ * on a sync flush, so the chunks simply concatenate into one zlib stream
+ * that is written as IDAT chunks. The pixels decode identically but the
+ * file is not byte identical to the single threaded output.
+ *
+ * libpng only finishes files whose IDAT chunks it wrote itself, so at the end
+ * we let it compress a dummy row, drop its IDAT chunks on the way to the file
+ * and have png_write_end() write the chunks after the image.
+ */
+
+// input bytes per deflate chunk
+#define PNG_DEFLATE_CHUNK (256 << 10)
+#define PNG_DEFLATE_WINDOW (32 << 10)
+
+// state of an image being written band by band
+typedef struct dt_imageio_png_stream_t
+{
+  FILE *f;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  int width;
+  int bpp;
+  int level;
+  // parallel deflate
+  gboolean parallel;
+  size_t rowbytes;
+  uint8_t *prev;    // previous row in file layout, for filtering
+  uint8_t *window;  // last filtered bytes, the dictionary of the next chunk
+  size_t window_len;
+  uLong adler;
+  gboolean header_written;
+  gboolean own_idat;  // the IDAT chunk being written is ours
+  gboolean skip;      // drop the chunk being written
+  size_t bytes_in;
+  double seconds;
+} dt_imageio_png_stream_t;
+
+static void _stream_free(dt_imageio_png_stream_t *s)
+{
+  if(s->png_ptr) png_destroy_write_struct(&s->png_ptr, &s->info_ptr);
+  if(s->f) fclose(s->f);
+  free(s->prev);
+  free(s->window);
+  free(s);
+}
+
+// RGBA row to RGB with 16 bit samples most significant byte first
+static void _pack_row(const void *const in,
+                      uint8_t *const out,
+                      const int width,
+                      const int bpp)
+{
+  if(bpp > 8)
+  {
+    const uint16_t *const in16 = (const uint16_t *)in;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 3; c++)
+      {
+        const uint16_t v = in16[4 * x + c];
+        out[6 * x + 2 * c] = v >> 8;
+        out[6 * x + 2 * c + 1] = v & 0xff;
+      }
+  }
+  else
+  {
+    const uint8_t *const in8 = (const uint8_t *)in;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 3; c++) out[3 * x + c] = in8[4 * x + c];
+  }
+}
+
+static inline int _paeth(const int a, const int b, const int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a);
+  const int pb = abs(p - b);
+  const int pc = abs(p - c);
+  return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+static inline uint8_t _filter_byte(const int type,
+                                   const uint8_t *const row,
+                                   const uint8_t *const prev,
+                                   const size_t i,
+                                   const size_t pixel_bytes)
+{
+  const int a = i >= pixel_bytes ? row[i - pixel_bytes] : 0;
+  const int b = prev[i];
+  const int c = i >= pixel_bytes ? prev[i - pixel_bytes] : 0;
+  switch(type)
+  {
+    case PNG_FILTER_VALUE_NONE:
+      return row[i];
+    case PNG_FILTER_VALUE_SUB:
+      return row[i] - a;
+    case PNG_FILTER_VALUE_UP:
+      return row[i] - b;
+    case PNG_FILTER_VALUE_AVG:
+      return row[i] - ((a + b) >> 1);
+    default:
+      return row[i] - _paeth(a, b, c);
+  }
+}
+
+// filter a row like libpng does by default: the filter type with the
+// smallest sum of absolute (signed) values wins
+static void _filter_row(const uint8_t *const row,
+                        const uint8_t *const prev,
+                        uint8_t *const out,
+                        const size_t rowbytes,
+                        const size_t pixel_bytes)
+{
+  int best = PNG_FILTER_VALUE_NONE;
+  uint64_t best_sum = UINT64_MAX;
+  for(int type = PNG_FILTER_VALUE_NONE; type < PNG_FILTER_VALUE_LAST; type++)
+  {
+    uint64_t sum = 0;
+    for(size_t i = 0; i < rowbytes && sum < best_sum; i++)
+    {
+      const uint8_t v = _filter_byte(type, row, prev, i, pixel_bytes);
+      sum += v < 128 ? v : 256 - v;
+    }
+    if(sum < best_sum)
+    {
+      best_sum = sum;
+      best = type;
+    }
+  }
+
+  out[0] = best;
+  for(size_t i = 0; i < rowbytes; i++)
+    out[i + 1] = _filter_byte(best, row, prev, i, pixel_bytes);
+}
+
+static void _write_data(png_structp png_ptr,
+                        png_bytep data,
+                        size_t length)
+{
+  dt_imageio_png_stream_t *s = png_get_io_ptr(png_ptr);
+  // a chunk header comes in one piece: length, then the name
+  if(png_get_io_state(png_ptr) & PNG_IO_CHUNK_HDR)
+    s->skip = s->parallel && !s->own_idat && length >= 8 && !memcmp(data + 4, "IDAT", 4);
+  if(!s->skip && fwrite(data, 1, length, s->f) != length)
+    png_error(png_ptr, "write error");
+}
+
+static void _flush_data(png_structp png_ptr)
+{
+  dt_imageio_png_stream_t *s = png_get_io_ptr(png_ptr);
+  fflush(s->f);
+}
+
+static void _write_idat(dt_imageio_png_stream_t *s,
+                        const uint8_t *const data,
+                        const size_t len)
+{
+  const png_byte chunk_name[5] = "IDAT";
+  s->own_idat = TRUE;
+  // stay well below the 2^31 limit of a png chunk
+  for(size_t pos = 0; pos < len; pos += (size_t)1 << 30)
+    png_write_chunk(s->png_ptr, chunk_name, data + pos, MIN(len - pos, (size_t)1 << 30));
+  s->own_idat = FALSE;
+}
+
+// let libpng start its zlib stream on a dummy row, its IDAT chunks are dropped
+// by _write_data(). png_write_end() accepts the file afterwards.
+static void _start_libpng_idat(dt_imageio_png_stream_t *s,
+                               const size_t stride)
+{
+  png_bytep row = calloc(stride, 1);
+  if(!row) png_error(s->png_ptr, "out of memory");
+  png_set_filter(s->png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+  png_set_compression_level(s->png_ptr, 0);
+  // the smallest buffer, so the flush writes a chunk
+  png_set_compression_buffer_size(s->png_ptr, 6);
+  png_write_row(s->png_ptr, row);
+  png_write_flush(s->png_ptr);
+  free(row);
+}
+
+// deflate len filtered bytes as the next part of the image's zlib stream and write them
+// as IDAT chunks. last finishes the stream.
+static int _deflate_parallel(dt_imageio_png_stream_t *s,
+                             const uint8_t *const data,
+                             const size_t len,
+                             const gboolean last)
+{
+  const size_t n_chunks = MAX((len + PNG_DEFLATE_CHUNK - 1) / PNG_DEFLATE_CHUNK, 1);
+  uint8_t **out = calloc(n_chunks, sizeof(uint8_t *));
+  size_t *out_len = calloc(n_chunks, sizeof(size_t));
+  uLong *adler = calloc(n_chunks, sizeof(uLong));
+  int err = !out || !out_len || !adler;
+
+  const int level = s->level;
+  const uint8_t *const window = s->window;
+  const size_t window_len = s->window_len;
+
+  if(!err)
+  {
+    DT_OMP_FOR(reduction(|: err))
+    for(size_t k = 0; k < n_chunks; k++)
+    {
+      if(err) continue;
+      const size_t start = k * PNG_DEFLATE_CHUNK;
+      const size_t size = MIN(PNG_DEFLATE_CHUNK, len - MIN(start, len));
+
+      z_stream z = { 0 };
+      if(deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      {
+        err = 1;
+        continue;
+      }
+      // prime with the data preceding this chunk, carried over from the last call for the first one
+      if(k > 0)
+        deflateSetDictionary(&z, data + start - MIN(start, PNG_DEFLATE_WINDOW),
+                             MIN(start, PNG_DEFLATE_WINDOW));
+      else if(window_len > 0)
+        deflateSetDictionary(&z, window, window_len);
+
+      // room for the stored block fallback and the flush markers
+      const size_t bound = deflateBound(&z, size) + 16;
+      out[k] = malloc(bound);
+      if(!out[k])
+      {
+        deflateEnd(&z);
+        err = 1;
+        continue;
+      }
+      z.next_in = (Bytef *)data + start;
+      z.avail_in = size;
+      z.next_out = out[k];
+      z.avail_out = bound;
+      const int flush = last && k == n_chunks - 1 ? Z_FINISH : Z_SYNC_FLUSH;
+      const int ret = deflate(&z, flush);
+      if(ret != (flush == Z_FINISH ? Z_STREAM_END : Z_OK) || z.avail_in || z.avail_out == 0)
+        err = 1;
+      out_len[k] = bound - z.avail_out;
+      adler[k] = adler32(adler32(0, NULL, 0), data + start, size);
+      deflateEnd(&z);
+    }
+  }
+
+  if(!err)
+  {
+    if(setjmp(png_jmpbuf(s->png_ptr)))
+      err = 1;
+    else
+    {
+      if(!s->header_written)
+      {
+        // zlib header for a 32 kB window and the compression level in use
+        const int level_flags = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        unsigned int header = (0x78 << 8) | (level_flags << 6);
+        header += 31 - header % 31;
+        const uint8_t hdr[2] = { header >> 8, header & 0xff };
+        _write_idat(s, hdr, 2);
+        s->header_written = TRUE;
+      }
+      for(size_t k = 0; k < n_chunks; k++)
+      {
+        const size_t start = k * PNG_DEFLATE_CHUNK;
+        const size_t size = MIN(PNG_DEFLATE_CHUNK, len - MIN(start, len));
+        _write_idat(s, out[k], out_len[k]);
+        s->adler = adler32_combine(s->adler, adler[k], size);
+      }
+      if(last)
+      {
+        const uint8_t trailer[4] = { s->adler >> 24, (s->adler >> 16) & 0xff,
+                                     (s->adler >> 8) & 0xff, s->adler & 0xff };
+        _write_idat(s, trailer, 4);
+      }
+
+      // keep the tail as the dictionary of the next call
+      const size_t keep = MIN(len + s->window_len, PNG_DEFLATE_WINDOW);
+      const size_t from_old = keep - MIN(len, keep);
+      memmove(s->window, s->window + s->window_len - from_old, from_old);
+      memcpy(s->window + from_old, data + len - (keep - from_old), keep - from_old);
+      s->window_len = keep;
+      s->bytes_in += len;
+    }
+  }
+
+  if(out)
+    for(size_t k = 0; k < n_chunks; k++) free(out[k]);
+  free(out);
+  free(out_len);
+  free(adler);
+  return err;
+}
+
+void *write_begin(dt_imageio_module_data_t *p_tmp,
+                  const char *filename,
+                  dt_colorspaces_color_profile_type_t over_type,
+                  const char *over_filename,
+                  void *exif,
+                  int exif_len,
+                  dt_imgid_t imgid,
+                  int num,
+                  int total,
+                  struct dt_dev_pixelpipe_t *pipe)
 {
   dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->global.width;
   const int height = p->global.height;
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
 
-  png_structp png_ptr;
-  png_infop info_ptr;
+  dt_imageio_png_stream_t *s = calloc(1, sizeof(dt_imageio_png_stream_t));
+  if(!s) return NULL;
+  s->width = width;
+  s->bpp = p->bpp;
+  s->level = p->compression;
+  s->rowbytes = (size_t)3 * width * (p->bpp > 8 ? 2 : 1);
+#ifdef PNG_IO_STATE_SUPPORTED
+  s->parallel = dt_get_num_threads() > 1;
+#endif
+  if(s->parallel)
+  {
+    s->prev = calloc(s->rowbytes, 1); // the row above the first one is all zero
+    s->window = malloc(PNG_DEFLATE_WINDOW);
+    s->adler = adler32(0, NULL, 0);
+    s->parallel = s->prev && s->window;
+  }
 
-  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if(!png_ptr)
+  s->f = g_fopen(filename, "wb");
+  if(!s->f)
   {
-    fclose(f);
-    return 1;
+    _stream_free(s);
+    return NULL;
   }
 
-  info_ptr = png_create_info_struct(png_ptr);
-  if(!info_ptr)
+  s->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if(!s->png_ptr)
   {
-    fclose(f);
-    png_destroy_write_struct(&png_ptr, NULL);
-    return 1;
+    _stream_free(s);
+    return NULL;
   }
 
+  s->info_ptr = png_create_info_struct(s->png_ptr);
+  if(!s->info_ptr)
+  {
+    _stream_free(s);
+    return NULL;
+  }
+
+  png_structp png_ptr = s->png_ptr;
+  png_infop info_ptr = s->info_ptr;
+
   if(setjmp(png_jmpbuf(png_ptr)))
   {
-    fclose(f);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    return 1;
+    _stream_free(s);
+    return NULL;
   }
 
-  png_init_io(png_ptr, f);
+  png_set_write_fn(png_ptr, s, _write_data, _flush_data);
 
   png_set_compression_level(png_ptr, p->compression);
   png_set_compression_mem_level(png_ptr, 8);
@@ -310,35 +622,122 @@ int write_image(dt_imageio_module_data_t *p_tmp,
    */
   png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
 
-  png_bytep *row_pointers = dt_alloc_align_type(png_bytep, height);
-  if(row_pointers)
+  /* swap bytes of 16 bit files to most significant bit first */
+  if(p->bpp > 8)
+    png_set_swap(png_ptr);
+
+  return s;
+}
+
+static int _write_rows_parallel(dt_imageio_png_stream_t *s,
+                                const void *ivoid,
+                                const int rows)
+{
+  const double start = dt_get_debug_wtime();
+  const size_t rowbytes = s->rowbytes;
+  const size_t pixel_bytes = s->bpp > 8 ? 6 : 3;
+  const size_t stride = (size_t)4 * s->width * (s->bpp > 8 ? sizeof(uint16_t) : sizeof(uint8_t));
+  const int width = s->width;
+  const int bpp = s->bpp;
+
+  uint8_t *packed = malloc(rows * rowbytes);
+  uint8_t *filtered = malloc(rows * (rowbytes + 1));
+  if(!packed || !filtered)
   {
-    if(p->bpp > 8)
-    {
-      /* swap bytes of 16 bit files to most significant bit first */
-      png_set_swap(png_ptr);
+    free(packed);
+    free(filtered);
+    return 1;
+  }
 
-      for(unsigned i = 0; i < height; i++)
-        row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
-    }
-    else
-    {
-      for(unsigned i = 0; i < height; i++)
-        row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
-    }
+  DT_OMP_FOR()
+  for(int i = 0; i < rows; i++)
+    _pack_row((const uint8_t *)ivoid + i * stride, packed + i * rowbytes, width, bpp);
 
-    png_write_image(png_ptr, row_pointers);
+  const uint8_t *const prev = s->prev;
+  DT_OMP_FOR()
+  for(int i = 0; i < rows; i++)
+    _filter_row(packed + i * rowbytes, i > 0 ? packed + (i - 1) * rowbytes : prev,
+                filtered + i * (rowbytes + 1), rowbytes, pixel_bytes);
 
-    dt_free_align(row_pointers);
+  if(rows > 0) memcpy(s->prev, packed + (rows - 1) * rowbytes, rowbytes);
+  free(packed);
+
+  const int err = _deflate_parallel(s, filtered, rows * (rowbytes + 1), FALSE);
+  free(filtered);
+  s->seconds += dt_get_debug_wtime() - start;
+  return err;
+}
+
+int write_rows(dt_imageio_module_data_t *p_tmp,
+               void *handle,
+               const void *ivoid,
+               const int rows)
+{
+  dt_imageio_png_stream_t *s = (dt_imageio_png_stream_t *)handle;
+
+  if(s->parallel)
+    return _write_rows_parallel(s, ivoid, rows);
+
+  if(setjmp(png_jmpbuf(s->png_ptr)))
+    return 1;
+
+  const size_t stride = (size_t)4 * s->width * (s->bpp > 8 ? sizeof(uint16_t) : sizeof(uint8_t));
+  for(int i = 0; i < rows; i++)
+    png_write_row(s->png_ptr, (png_const_bytep)ivoid + i * stride);
+
+  return 0;
+}
+
+int write_finish(dt_imageio_module_data_t *p_tmp,
+                 void *handle,
+                 const gboolean abort)
+{
+  dt_imageio_png_stream_t *s = (dt_imageio_png_stream_t *)handle;
+  volatile int rc = 1;
+
+  if(!abort && s->parallel)
+  {
+    // finish our zlib stream, then the file
+    static const uint8_t nothing = 0;
+    const size_t stride = (size_t)4 * s->width * (s->bpp > 8 ? sizeof(uint16_t) : sizeof(uint8_t));
+    if(!_deflate_parallel(s, &nothing, 0, TRUE) && !setjmp(png_jmpbuf(s->png_ptr)))
+    {
+      _start_libpng_idat(s, stride);
+      png_write_end(s->png_ptr, s->info_ptr);
+      rc = 0;
+      dt_print(DT_DEBUG_PERF, "[png] filtered and deflated %.1f MB in %.3f secs (%.1f MB/s)\n",
+               s->bytes_in / 1e6, s->seconds, s->seconds > 0.0 ? s->bytes_in / 1e6 / s->seconds : 0.0);
+    }
   }
-  else
+  else if(!abort && !setjmp(png_jmpbuf(s->png_ptr)))
   {
-    dt_print(DT_DEBUG_ALWAYS, "[png] out of memory writing %s\n", filename);
+    png_write_end(s->png_ptr, s->info_ptr);
+    rc = 0;
   }
-  png_write_end(png_ptr, info_ptr);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
-  fclose(f);
-  return 0;
+
+  _stream_free(s);
+  return rc;
+}
+
+int write_image(dt_imageio_module_data_t *p_tmp,
+                const char *filename,
+                const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type,
+                const char *over_filename,
+                void *exif,
+                int exif_len,
+                dt_imgid_t imgid,
+                int num,
+                int total,
+                struct dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  void *s = write_begin(p_tmp, filename, over_type, over_filename,
+                        exif, exif_len, imgid, num, total, pipe);
+  if(!s) return 1;
+
+  const int err = write_rows(p_tmp, s, ivoid, p_tmp->height);
+  return write_finish(p_tmp, s, err != 0) || err;
 }
 
 static int __attribute__((__unused__)) read_header(const char *filename,
@@ -1,6 +1,6 @@
 /*
     This file is part of darktable,
-    Copyright (C) 2010-2023 darktable developers.
+    Copyright (C) 2010-2024 darktable developers.
 
     darktable is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <tiffio.h>
+#include <zlib.h>
 #ifdef HAVE_IMATH
 #include "Imath/half.h"
 #endif
@@ -63,6 +64,331 @@ typedef struct dt_imageio_tiff_gui_t
   GtkWidget *shortfiles;
 } dt_imageio_tiff_gui_t;
 
+static void _set_image_tags(TIFF *tif,
+                            const dt_imageio_tiff_t *d,
+                            const char *filename,
+                            const uint16_t n_pages,
+                            uint8_t *profile,
+                            const uint32_t profile_len,
+                            const uint16_t layers)
+{
+  if(n_pages > 1)
+  {
+    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+    TIFFSetField(tif, TIFFTAG_PAGENAME, _("image"));
+    TIFFSetField(tif, TIFFTAG_PAGENUMBER, 0, n_pages);
+  }
+  else
+    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, 0);
+
+  TIFFSetField(tif, TIFFTAG_DOCUMENTNAME, filename);
+
+  // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
+  // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
+  // "software vendors. This code should be considered obsolete. We recommend"
+  // "that TIFF implementations recognize and read the obsolete code but only"
+  // "write the official compression code (0x0008)."
+  // http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
+  // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
+  if(d->compress == 1)
+  {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_NONE);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
+  }
+  else if(d->compress == 2)
+  {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    if(d->bpp == 32 || (d->bpp == 16 && d->pixelformat))
+      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
+    else
+      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
+  }
+
+  if(profile != NULL)
+  {
+    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
+  }
+
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, layers);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
+  TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT,
+               d->bpp == 32 || (d->bpp == 16 && d->pixelformat) ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32_t)d->global.width);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)d->global.height);
+  if(layers == 3)
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  else
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
+
+  const int resolution = dt_conf_get_int("metadata/resolution");
+  TIFFSetField(tif, TIFFTAG_XRESOLUTION, (float)resolution);
+  TIFFSetField(tif, TIFFTAG_YRESOLUTION, (float)resolution);
+  TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
+}
+
+// input row y of the 4 channel buffer in_void converted to the file layout
+static void _convert_row(const dt_imageio_tiff_t *d,
+                         const void *in_void,
+                         const size_t y,
+                         const uint16_t layers,
+                         void *rowdata)
+{
+  const size_t width = d->global.width;
+  if(d->bpp == 32)
+  {
+    const float *in = (const float *)in_void + 4 * y * width;
+    float *out = (float *)rowdata;
+    for(size_t x = 0; x < width; x++, in += 4, out += layers)
+      memcpy(out, in, sizeof(float) * layers);
+  }
+#ifdef HAVE_IMATH
+  else if(d->bpp == 16 && d->pixelformat)
+  {
+    const float *in = (const float *)in_void + 4 * y * width;
+    uint16_t *out = (uint16_t *)rowdata;
+    for(size_t x = 0; x < width; x++, in += 4, out += layers)
+      for(int l = 0; l < layers; ++l) out[l] = imath_float_to_half(in[l]);
+  }
+#endif
+  else if(d->bpp == 16 && !d->pixelformat)
+  {
+    const uint16_t *in = (const uint16_t *)in_void + 4 * y * width;
+    uint16_t *out = (uint16_t *)rowdata;
+    for(size_t x = 0; x < width; x++, in += 4, out += layers)
+      memcpy(out, in, sizeof(uint16_t) * layers);
+  }
+  else // 8bpp
+  {
+    const uint8_t *in = (const uint8_t *)in_void + 4 * y * width;
+    uint8_t *out = (uint8_t *)rowdata;
+    for(size_t x = 0; x < width; x++, in += 4, out += layers)
+      memcpy(out, in, sizeof(uint8_t) * layers);
+  }
+}
+
+/*
+ * Deflate is by far the slowest part of writing a compressed TIFF. The strips
+ * of an image are compressed independently of each other, so instead of
+ * handing scanlines to libtiff we apply the predictor and deflate the strips
+ * on all threads and write them in order with TIFFWriteRawStrip(). The strips
+ * are exactly those libtiff would have produced, with the same rows per strip,
+ * predictor and zlib level, so readers can't tell the difference.
+ */
+typedef struct dt_imageio_tiff_strips_t
+{
+  TIFF *tif;
+  const dt_imageio_tiff_t *d;
+  uint16_t layers;
+  int predictor;
+  gboolean parallel;
+  size_t rowsize;
+  uint32_t rows_per_strip;
+  uint8_t *rows;      // converted rows not written yet
+  uint32_t n_rows;
+  uint32_t capacity;  // in rows, a multiple of rows_per_strip
+  uint32_t y;         // rows written to the file so far
+  double seconds;
+} dt_imageio_tiff_strips_t;
+
+static void _strips_free(dt_imageio_tiff_strips_t *w)
+{
+  if(!w) return;
+  free(w->rows);
+  free(w);
+}
+
+// must be called after the image tags are set
+static dt_imageio_tiff_strips_t *_strips_new(TIFF *tif,
+                                             const dt_imageio_tiff_t *d,
+                                             const uint16_t layers)
+{
+  dt_imageio_tiff_strips_t *w = calloc(1, sizeof(dt_imageio_tiff_strips_t));
+  if(!w) return NULL;
+
+  w->tif = tif;
+  w->d = d;
+  w->layers = layers;
+  w->rowsize = (size_t)(d->global.width * layers) * d->bpp / 8;
+
+  uint32_t rows_per_strip = 0;
+  TIFFGetField(tif, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+  w->rows_per_strip = CLAMP(rows_per_strip, 1, MAX(d->global.height, 1));
+
+  uint16_t predictor = PREDICTOR_NONE;
+  if(d->compress > 0) TIFFGetField(tif, TIFFTAG_PREDICTOR, &predictor);
+  w->predictor = predictor;
+
+  // the predictors below work on host byte order, the file is little endian
+  const size_t threads = dt_get_num_threads();
+  w->parallel = d->compress > 0 && threads > 1 && G_BYTE_ORDER == G_LITTLE_ENDIAN;
+
+  // a few strips per thread, but at least 4 MB per batch
+  const size_t strip_bytes = w->rowsize * w->rows_per_strip;
+  const size_t strips = MAX(4 * threads, ((size_t)4 << 20) / MAX(strip_bytes, 1));
+  w->capacity = MIN(strips * w->rows_per_strip,
+                    ((size_t)d->global.height + w->rows_per_strip - 1)
+                    / w->rows_per_strip * w->rows_per_strip);
+  w->rows = malloc(w->rowsize * w->capacity);
+  if(!w->rows)
+  {
+    _strips_free(w);
+    return NULL;
+  }
+  return w;
+}
+
+// what libtiff's predictor does to a scanline before it is deflated
+static void _predict_row(const uint8_t *const in,
+                         uint8_t *const out,
+                         const size_t rowsize,
+                         const int predictor,
+                         const int bytes,
+                         const uint16_t layers)
+{
+  if(predictor == PREDICTOR_HORIZONTAL && bytes == 2)
+  {
+    const uint16_t *const in16 = (const uint16_t *)in;
+    uint16_t *const out16 = (uint16_t *)out;
+    const size_t n = rowsize / 2;
+    for(size_t i = 0; i < MIN(n, layers); i++) out16[i] = in16[i];
+    for(size_t i = layers; i < n; i++) out16[i] = in16[i] - in16[i - layers];
+  }
+  else if(predictor == PREDICTOR_HORIZONTAL)
+  {
+    for(size_t i = 0; i < MIN(rowsize, layers); i++) out[i] = in[i];
+    for(size_t i = layers; i < rowsize; i++) out[i] = in[i] - in[i - layers];
+  }
+  else // PREDICTOR_FLOATINGPOINT
+  {
+    // split the values into planes of bytes, most significant first, then difference the bytes
+    const size_t wc = rowsize / bytes;
+    for(size_t i = 0; i < wc; i++)
+      for(int b = 0; b < bytes; b++)
+        out[(bytes - b - 1) * wc + i] = in[bytes * i + b];
+    for(size_t i = rowsize; i > layers; i--)
+      out[i - 1] -= out[i - 1 - layers];
+  }
+}
+
+// write the buffered rows, the last partial strip only if this is the end of the image
+static int _strips_flush(dt_imageio_tiff_strips_t *w, const gboolean last)
+{
+  const double start = dt_get_debug_wtime();
+  int err = 0;
+
+  if(!w->parallel)
+  {
+    for(uint32_t r = 0; r < w->n_rows && !err; r++)
+      err = TIFFWriteScanline(w->tif, w->rows + r * w->rowsize, w->y + r, 0) == -1;
+    w->y += w->n_rows;
+    w->n_rows = 0;
+    w->seconds += dt_get_debug_wtime() - start;
+    return err;
+  }
+
+  const uint32_t rps = w->rows_per_strip;
+  const uint32_t n_strips = last ? (w->n_rows + rps - 1) / rps : w->n_rows / rps;
+  if(n_strips == 0) return 0;
+
+  uint8_t **out = calloc(n_strips, sizeof(uint8_t *));
+  uLongf *len = calloc(n_strips, sizeof(uLongf));
+  if(!out || !len)
+  {
+    free(out);
+    free(len);
+    return 1;
+  }
+
+  const size_t rowsize = w->rowsize;
+  const int predictor = w->predictor;
+  const int bytes = w->d->bpp / 8;
+  const uint16_t layers = w->layers;
+  const int level = w->d->compresslevel;
+  const uint32_t n_rows = w->n_rows;
+  uint8_t *const rows = w->rows;
+
+  DT_OMP_FOR()
+  for(uint32_t k = 0; k < n_strips; k++)
+  {
+    const uint32_t first = k * rps;
+    const uint32_t strip_rows = MIN(rps, n_rows - first);
+    const size_t size = strip_rows * rowsize;
+    uint8_t *src = rows + first * rowsize;
+    uint8_t *predicted = NULL;
+    if(predictor != PREDICTOR_NONE)
+    {
+      predicted = malloc(size);
+      if(!predicted) continue;
+      for(uint32_t r = 0; r < strip_rows; r++)
+        _predict_row(src + r * rowsize, predicted + r * rowsize, rowsize, predictor, bytes, layers);
+      src = predicted;
+    }
+    uLongf dlen = compressBound(size);
+    out[k] = malloc(dlen);
+    if(out[k] && compress2(out[k], &dlen, src, size, level) == Z_OK)
+      len[k] = dlen;
+    free(predicted);
+  }
+
+  const uint32_t strip0 = w->y / rps;
+  for(uint32_t k = 0; k < n_strips; k++)
+  {
+    if(!err && (len[k] == 0 || TIFFWriteRawStrip(w->tif, strip0 + k, out[k], len[k]) == -1))
+      err = 1;
+    free(out[k]);
+  }
+  free(out);
+  free(len);
+
+  const uint32_t written = MIN(n_rows, n_strips * rps);
+  memmove(rows, rows + (size_t)written * rowsize, (size_t)(n_rows - written) * rowsize);
+  w->n_rows -= written;
+  w->y += written;
+  w->seconds += dt_get_debug_wtime() - start;
+  return err;
+}
+
+// append rows of the 4 channel buffer in_void to the image
+static int _strips_add(dt_imageio_tiff_strips_t *w, const void *in_void, const int rows)
+{
+  int done = 0;
+  while(done < rows)
+  {
+    if(w->n_rows == w->capacity && _strips_flush(w, FALSE))
+      return 1;
+
+    const int n = MIN(rows - done, (int)(w->capacity - w->n_rows));
+    uint8_t *const dst = w->rows + (size_t)w->n_rows * w->rowsize;
+    const dt_imageio_tiff_t *d = w->d;
+    const size_t rowsize = w->rowsize;
+    const uint16_t layers = w->layers;
+    DT_OMP_FOR()
+    for(int r = 0; r < n; r++)
+      _convert_row(d, in_void, done + r, layers, dst + r * rowsize);
+
+    w->n_rows += n;
+    done += n;
+  }
+  return 0;
+}
+
+static int _strips_finish(dt_imageio_tiff_strips_t *w)
+{
+  const int err = _strips_flush(w, TRUE);
+  if(!err)
+    dt_print(DT_DEBUG_PERF,
+             "[tiff] %s %.1f MB in %.3f secs (%.1f MB/s)\n",
+             w->parallel ? "compressed" : "wrote",
+             (double)w->rowsize * w->y / 1e6, w->seconds,
+             w->seconds > 0.0 ? (double)w->rowsize * w->y / 1e6 / w->seconds : 0.0);
+  return err || w->y != w->d->global.height;
+}
 
 int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
@@ -119,45 +445,6 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     goto exit;
   }
 
-  if(n_pages > 1)
-  {
-    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
-    TIFFSetField(tif, TIFFTAG_PAGENAME, _("image"));
-    TIFFSetField(tif, TIFFTAG_PAGENUMBER, 0, n_pages);
-  }
-  else
-    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, 0);
-
-  TIFFSetField(tif, TIFFTAG_DOCUMENTNAME, filename);
-
-  // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
-  // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
-  // "software vendors. This code should be considered obsolete. We recommend"
-  // "that TIFF implementations recognize and read the obsolete code but only"
-  // "write the official compression code (0x0008)."
-  // http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
-  // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
-  if(d->compress == 1)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_NONE);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-  }
-  else if(d->compress == 2)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
-    if(d->bpp == 32 || (d->bpp == 16 && d->pixelformat))
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
-    else
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-  }
-
-  if(profile != NULL)
-  {
-    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
-  }
-
 /* Howto check for a grayscale image?
    We test every pixel for differences between the rgb channels using specific thresholds
    for every precision. If there is such a pixel we keep it as an rgb image, otherwise
@@ -227,111 +514,20 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   if(d->shortfile && layers == 3)
     dt_control_log(_("not a B&W image, will not export as grayscale"));
 
-  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, layers);
-  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
-  TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT,
-               d->bpp == 32 || (d->bpp == 16 && d->pixelformat) ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
-  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32_t)d->global.width);
-  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)d->global.height);
-  if(layers == 3)
-    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-  else
-    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-
-  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-  TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
+  _set_image_tags(tif, d, filename, n_pages, profile, profile_len, layers);
 
   const int resolution = dt_conf_get_int("metadata/resolution");
-  TIFFSetField(tif, TIFFTAG_XRESOLUTION, (float)resolution);
-  TIFFSetField(tif, TIFFTAG_YRESOLUTION, (float)resolution);
-  TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
 
-  const size_t rowsize = (d->global.width * layers) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  dt_imageio_tiff_strips_t *strips = _strips_new(tif, d, layers);
+  if(!strips
+     || _strips_add(strips, in_void, d->global.height)
+     || _strips_finish(strips))
   {
+    _strips_free(strips);
     rc = 1;
     goto exit;
   }
-
-  if(d->bpp == 32)
-  {
-    for(int y = 0; y < d->global.height; y++)
-    {
-      float *in = (float *)in_void + (size_t)4 * y * d->global.width;
-      float *out = (float *)rowdata;
-
-      for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
-      {
-        memcpy(out, in, sizeof(float) * layers);
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-#ifdef HAVE_IMATH
-  else if(d->bpp == 16 && d->pixelformat)
-  {
-    for(int y = 0; y < d->global.height; y++)
-    {
-      float *in = (float *)in_void + (size_t)4 * y * d->global.width;
-      uint16_t *out = (uint16_t *)rowdata;
-
-      for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
-      {
-        for(int l = 0; l < layers; ++l) out[l] = imath_float_to_half(in[l]);
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-#endif
-  else if(d->bpp == 16 && !d->pixelformat)
-  {
-    for(int y = 0; y < d->global.height; y++)
-    {
-      uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->global.width;
-      uint16_t *out = (uint16_t *)rowdata;
-
-      for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
-      {
-        memcpy(out, in, sizeof(uint16_t) * layers);
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-  else // 8bpp
-  {
-    for(int y = 0; y < d->global.height; y++)
-    {
-      uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->global.width;
-      uint8_t *out = (uint8_t *)rowdata;
-
-      for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
-      {
-        memcpy(out, in, sizeof(uint8_t) * layers);
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
+  _strips_free(strips);
 
   rc = 0;
 
@@ -444,11 +640,13 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
           TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
         TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
 
-        if(w != d->global.width)
+        // the image went out in strips, only the mask pages need a row buffer
+        free(rowdata);
+        const size_t rowsize = (w * layers) * d->bpp / 8;
+        if((rowdata = malloc(rowsize)) == NULL)
         {
-          free(rowdata);
-          const size_t _rowsize = (w * layers) * d->bpp / 8;
-          rowdata = malloc(_rowsize);
+          rc = 1;
+          goto exit;
         }
 
         if(d->bpp == 32)
@@ -585,6 +783,112 @@ exit:
   return rc;
 }
 
+// state of an image being written band by band
+typedef struct dt_imageio_tiff_stream_t
+{
+  TIFF *tif;
+  uint8_t *profile;
+  dt_imageio_tiff_strips_t *strips;
+  char *filename;
+  void *exif;
+  int exif_len;
+} dt_imageio_tiff_stream_t;
+
+static void _stream_free(dt_imageio_tiff_stream_t *s)
+{
+  _strips_free(s->strips);
+  if(s->tif) TIFFClose(s->tif);
+  free(s->profile);
+  g_free(s->filename);
+  free(s);
+}
+
+void *write_begin(dt_imageio_module_data_t *d_tmp, const char *filename,
+                  dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                  void *exif, int exif_len, dt_imgid_t imgid, int num, int total,
+                  dt_dev_pixelpipe_t *pipe)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  // the grayscale check needs the whole image
+  if(d->shortfile) return NULL;
+
+  dt_imageio_tiff_stream_t *s = calloc(1, sizeof(dt_imageio_tiff_stream_t));
+  if(!s) return NULL;
+
+  uint32_t profile_len = 0;
+  cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
+  cmsSaveProfileToMem(out_profile, NULL, &profile_len);
+  if(profile_len > 0)
+  {
+    s->profile = malloc(profile_len);
+    if(!s->profile)
+    {
+      _stream_free(s);
+      return NULL;
+    }
+    cmsSaveProfileToMem(out_profile, s->profile, &profile_len);
+  }
+
+  // Create little endian tiff image
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+  s->tif = TIFFOpenW(wfilename, "wl");
+  g_free(wfilename);
+#else
+  s->tif = TIFFOpen(filename, "wl");
+#endif
+
+  if(!s->tif)
+  {
+    _stream_free(s);
+    return NULL;
+  }
+
+  const uint16_t layers = 3;
+  _set_image_tags(s->tif, d, filename, 1, s->profile, profile_len, layers);
+
+  s->strips = _strips_new(s->tif, d, layers);
+  if(!s->strips)
+  {
+    _stream_free(s);
+    return NULL;
+  }
+
+  s->filename = g_strdup(filename);
+  s->exif = exif;
+  s->exif_len = exif_len;
+  return s;
+}
+
+int write_rows(dt_imageio_module_data_t *d_tmp, void *handle, const void *in_void, const int rows)
+{
+  dt_imageio_tiff_stream_t *s = (dt_imageio_tiff_stream_t *)handle;
+  return _strips_add(s->strips, in_void, rows);
+}
+
+int write_finish(dt_imageio_module_data_t *d_tmp, void *handle, const gboolean abort)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  dt_imageio_tiff_stream_t *s = (dt_imageio_tiff_stream_t *)handle;
+
+  int rc = abort || _strips_finish(s->strips);
+
+  // close the file before adding exif data
+  TIFFClose(s->tif);
+  s->tif = NULL;
+
+  if(!rc && s->exif)
+  {
+    rc = dt_exif_write_blob(s->exif, s->exif_len, s->filename, d->compress > 0);
+    // Until we get symbolic error status codes, if rc is 1, return 0
+    rc = (rc == 1) ? 0 : 1;
+  }
+
+  _stream_free(s);
+  return rc;
+}
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_tiff_t) - sizeof(TIFF *);
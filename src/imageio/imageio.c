@@ -33,6 +33,7 @@
 #include "develop/blend.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "imageio/imageio_common.h"
 #include "imageio/imageio_module.h"
 #ifdef HAVE_OPENEXR
@@ -1003,6 +1004,286 @@ static double _get_pipescale(dt_dev_pixelpipe_t *pipe,
   return fmin(scalex, scaley);
 }
 
+// process the rows y .. y + height - 1 of the export
+static gboolean _export_process(dt_dev_pixelpipe_t *pipe,
+                                dt_develop_t *dev,
+                                const int y,
+                                const int width,
+                                const int height,
+                                const double scale,
+                                const gboolean hq_process,
+                                const int bpp)
+{
+  if(hq_process)
+  {
+    /*
+     * if high quality processing was requested, downsampling will be done
+     * at the very end of the pipe (just before border and watermark)
+     */
+    return dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y, width, height, scale);
+  }
+
+  // else, downsampling will be right after demosaic
+
+  // so we need to turn temporarily disable in-pipe late downsampling iop.
+
+  // find the finalscale module
+  dt_dev_pixelpipe_iop_t *finalscale = NULL;
+  {
+    for(const GList *nodes = g_list_last(pipe->nodes);
+        nodes;
+        nodes = g_list_previous(nodes))
+    {
+      dt_dev_pixelpipe_iop_t *node = nodes->data;
+      if(dt_iop_module_is(node->module->so, "finalscale"))
+      {
+        finalscale = node;
+        break;
+      }
+    }
+  }
+
+  if(finalscale) finalscale->enabled = FALSE;
+
+  // do the processing (8-bit with special treatment, to make sure
+  // we can use openmp further down):
+  const gboolean err = bpp == 8
+    ? dt_dev_pixelpipe_process(pipe, dev, 0, y, width, height, scale, DT_DEVICE_NONE)
+    : dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y, width, height, scale);
+
+  if(finalscale) finalscale->enabled = TRUE;
+
+  return err;
+}
+
+// downconversion of the pipe output to low-precision formats, in place
+static void _export_convert(uint8_t *const outbuf,
+                            const size_t npixels,
+                            const int bpp,
+                            const gboolean display_byteorder,
+                            const gboolean hq_process)
+{
+  if(bpp == 8)
+  {
+    if(display_byteorder)
+    {
+      if(hq_process)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < npixels; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
+          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
+          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      // else processing output was 8-bit already, and no need to swap order
+    }
+    else // need to flip
+    {
+      // ldr output: char
+      if(hq_process)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < npixels; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
+          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
+          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      else
+      { // !display_byteorder, need to swap:
+        uint8_t *const buf8 = outbuf;
+        DT_OMP_FOR()
+        // just flip byte order
+        for(size_t k = 0; k < npixels; k++)
+        {
+          uint8_t tmp = buf8[4 * k + 0];
+          buf8[4 * k + 0] = buf8[4 * k + 2];
+          buf8[4 * k + 2] = tmp;
+        }
+      }
+    }
+  }
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    float *buff = (float *)outbuf;
+    uint16_t *buf16 = (uint16_t *)outbuf;
+    for(size_t k = 0; k < npixels; k++)
+    {
+      // convert in place
+      for(int i = 0; i < 3; i++)
+        buf16[4 * k + i] = roundf(CLAMP(buff[4 * k + i] * 0xffff, 0, 0xffff));
+    }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+// rows per band of a streaming export: about 16 megapixels, but not too
+// thin as every band also processes the margins above and below it.
+static int _export_band_rows(const int width, const int height, const int margin)
+{
+  const int rows = MAX(MAX(256, 4 * margin), (16 << 20) / MAX(1, width));
+  return MIN(rows, height);
+}
+
+// bands only give the same result as the whole image if no module looks at
+// all of its input to set itself up and every module is either exact for any
+// region or can be processed in parts like tiling does. The neighbourhoods of
+// the latter, their tiling overlap, add up to the margin in rows every band is
+// processed with.
+static gboolean _export_pipe_streamable(dt_dev_pixelpipe_t *pipe,
+                                        const double scale,
+                                        int *margin)
+{
+  unsigned overlap = 0;
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    if(!piece->enabled) continue;
+    dt_iop_module_t *module = piece->module;
+    const int flags = module->flags();
+    const dt_develop_blend_params_t *const bldata = piece->blendop_data;
+    // refined masks are blurred after the module is done with its input
+    const gboolean refined_mask = bldata && bldata->mask_mode != DEVELOP_MASK_DISABLED
+      && (bldata->feathering_radius > 0.1f || bldata->blur_radius > 0.1f
+          || bldata->details != 0.0f);
+    const gboolean exact = piece->process_pixels_ready || piece->process_mosaic_ready
+      || (flags & IOP_FLAGS_ROI_EXACT);
+
+    const char *reason = NULL;
+    if((flags & IOP_FLAGS_IMAGE_STATISTICS) || (piece->request_histogram & DT_REQUEST_ON))
+      reason = "needs the whole image";
+    else if(!exact && !piece->process_tiling_ready)
+      reason = "can't be processed in parts";
+    else if(refined_mask)
+      reason = "refines its mask on the whole image";
+    if(reason)
+    {
+      dt_print(DT_DEBUG_IMAGEIO,
+               "[dt_imageio_export] `%s%s' %s, not streaming\n",
+               module->op, dt_iop_get_instance_id(module), reason);
+      return FALSE;
+    }
+    if(exact) continue;
+
+    // the full image regions give the largest overlap
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, piece, &piece->buf_in, &piece->buf_out, &tiling);
+    overlap += tiling.overlap;
+  }
+  // the overlaps are in pixels of the full image, fewer rows are needed when
+  // downscaling
+  *margin = (int)ceil(overlap * MAX(1.0, scale));
+  return TRUE;
+}
+
+// exports report their progress to the job set for the calling thread with
+// dt_imageio_export_set_progress_job(), each pipe run covers a range of it
+typedef struct _export_progress_t
+{
+  dt_job_t *job;
+  double from, to;
+} _export_progress_t;
+
+static GPrivate _export_progress;
+
+void dt_imageio_export_set_progress_job(dt_job_t *job)
+{
+  g_private_set(&_export_progress, job);
+}
+
+static void _export_set_progress(_export_progress_t *progress,
+                                 const double value)
+{
+  if(progress->job) dt_control_job_set_progress(progress->job, value);
+}
+
+static void _export_pipe_progress(void *data, const float fraction)
+{
+  _export_progress_t *progress = data;
+  _export_set_progress(progress, progress->from + (progress->to - progress->from) * fraction);
+}
+
+typedef struct _export_batch_t
+{
+  int depth;
+  dt_develop_t dev;       // module instances kept from image to image
+  gboolean dev_loaded;
+  GHashTable *styles;     // style name -> list of dt_style_item_t
+  int images;
+  double setup;
+  double processing;
+} _export_batch_t;
+
+static GPrivate _export_batch;
+
+static void _free_style_items(gpointer data)
+{
+  g_list_free_full(data, dt_style_item_free);
+}
+
+static gpointer _copy_style_item(gconstpointer src, gpointer data)
+{
+  return dt_style_item_copy(src);
+}
+
+void dt_imageio_export_batch_begin(void)
+{
+  _export_batch_t *batch = g_private_get(&_export_batch);
+  if(!batch)
+  {
+    batch = g_malloc0(sizeof(_export_batch_t));
+    batch->styles = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                          g_free, _free_style_items);
+    g_private_set(&_export_batch, batch);
+  }
+  batch->depth++;
+}
+
+void dt_imageio_export_batch_end(void)
+{
+  _export_batch_t *batch = g_private_get(&_export_batch);
+  if(!batch || --batch->depth > 0) return;
+
+  if(batch->dev_loaded)
+    dt_dev_cleanup(&batch->dev);
+  g_hash_table_destroy(batch->styles);
+  if(batch->images)
+    dt_print(DT_DEBUG_PERF,
+             "[export] batch of %d images: setup %.3fs, processing %.3fs per image\n",
+             batch->images, batch->setup / batch->images,
+             batch->processing / batch->images);
+  g_free(batch);
+  g_private_set(&_export_batch, NULL);
+}
+
+// the items of a style, read only once per batch. the caller owns the
+// returned copies as they are modified while applied.
+static GList *_export_style_items(_export_batch_t *batch, const char *name)
+{
+  if(!batch)
+    return dt_styles_get_item_list(name, FALSE, -1, TRUE);
+
+  GList *items = NULL;
+  if(!g_hash_table_lookup_extended(batch->styles, name, NULL, (gpointer *)&items))
+  {
+    items = dt_styles_get_item_list(name, FALSE, -1, TRUE);
+    g_hash_table_insert(batch->styles, g_strdup(name), items);
+  }
+  return g_list_copy_deep(items, _copy_style_item, NULL);
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder
 // flag + high-quality override
 gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
@@ -1028,11 +1309,24 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
                                       dt_export_metadata_t *metadata,
                                       const int history_end)
 {
-  dt_develop_t dev;
-  dt_dev_init(&dev, FALSE);
-  dt_dev_load_image(&dev, imgid);
+  const double start_wtime = dt_get_debug_wtime();
+  _export_batch_t *batch = thumbnail_export ? NULL : g_private_get(&_export_batch);
+  // loading the image takes the first tenth, writing it the last one
+  _export_progress_t progress = { .job = thumbnail_export ? NULL : g_private_get(&_export_progress),
+                                  .from = 0.1, .to = 0.9 };
+  dt_develop_t local_dev;
+  dt_develop_t *dev = batch ? &batch->dev : &local_dev;
+  const gboolean reused = batch && batch->dev_loaded;
+  if(reused)
+    dt_dev_load_next_image(dev, imgid);
+  else
+  {
+    dt_dev_init(dev, FALSE);
+    dt_dev_load_image(dev, imgid);
+  }
+  if(batch) batch->dev_loaded = TRUE;
   if(history_end != -1)
-    dt_dev_pop_history_items_ext(&dev, history_end);
+    dt_dev_pop_history_items_ext(dev, history_end);
 
   const gboolean buf_is_downscaled =
     (thumbnail_export && dt_conf_get_bool("ui/performance"));
@@ -1048,7 +1342,8 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
     dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid,
                         DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
 
-  const dt_image_t *img = &dev.image_storage;
+  const dt_image_t *img = &dev->image_storage;
+  _export_set_progress(&progress, progress.from);
 
   if(!buf.buf || !buf.width || !buf.height)
   {
@@ -1085,13 +1380,13 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
     goto error;
   }
 
-  const int final_history_end = history_end == -1 ? dev.history_end : history_end;
+  const int final_history_end = history_end == -1 ? dev->history_end : history_end;
   const gboolean use_style = !thumbnail_export && format_params->style[0] != '\0';
   const gboolean appending = format_params->style_append != FALSE;
   //  If a style is to be applied during export, add the iop params into the history
   if(use_style)
   {
-    GList *style_items = dt_styles_get_item_list(format_params->style, FALSE, -1, TRUE);
+    GList *style_items = _export_style_items(batch, format_params->style);
     if(!style_items)
     {
       dt_print(DT_DEBUG_ALWAYS,
@@ -1109,9 +1404,9 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
 
     GList *modules_used = NULL;
 
-    if(!appending) dt_dev_pop_history_items_ext(&dev, 0);
+    if(!appending) dt_dev_pop_history_items_ext(dev, 0);
 
-    dt_ioppr_update_for_style_items(&dev, style_items, appending);
+    dt_ioppr_update_for_style_items(dev, style_items, appending);
 
     for(GList *st_items = style_items; st_items; st_items = g_list_next(st_items))
     {
@@ -1125,7 +1420,7 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
         // get iop for this operation as we need the corresponding
         // default parameters
         const dt_iop_module_t *module =
-          dt_iop_get_module_from_list(dev.iop, st_item->operation);
+          dt_iop_get_module_from_list(dev->iop, st_item->operation);
         if(module)
         {
           st_item->params_size = module->params_size;
@@ -1144,7 +1439,7 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
 
       if(ok)
       {
-        dt_styles_apply_style_item(&dev, st_item, &modules_used, !autoinit && appending);
+        dt_styles_apply_style_item(dev, st_item, &modules_used, !autoinit && appending);
       }
     }
 
@@ -1152,15 +1447,15 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
     g_list_free_full(style_items, dt_style_item_free);
   }
   else if(history_end != -1)
-    dt_dev_pop_history_items_ext(&dev, final_history_end);
+    dt_dev_pop_history_items_ext(dev, final_history_end);
 
-  dt_ioppr_resync_modules_order(&dev);
+  dt_ioppr_resync_modules_order(dev);
 
   dt_dev_pixelpipe_set_icc(&pipe, icc_type, icc_filename, icc_intent);
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf,
+  dt_dev_pixelpipe_set_input(&pipe, dev, (float *)buf.buf,
                              buf.width, buf.height, buf.iscale);
-  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
-  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_create_nodes(&pipe, dev);
+  dt_dev_pixelpipe_synch_all(&pipe, dev);
 
   if(darktable.unmuted & DT_DEBUG_IMAGEIO)
   {
@@ -1194,11 +1489,12 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
       dt_dev_pixelpipe_disable_before(&pipe, filter + 5);
   }
 
-  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight,
+  dt_dev_pixelpipe_get_dimensions(&pipe, dev, pipe.iwidth, pipe.iheight,
                                   &pipe.processed_width,
                                   &pipe.processed_height);
 
   dt_show_times(&start, "[export] creating pixelpipe");
+  const double setup_wtime = dt_get_debug_wtime();
 
   // find output color profile for this image:
   gboolean sRGB = TRUE;
@@ -1206,7 +1502,7 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
   else if(icc_type == DT_COLORSPACE_NONE)
   {
     dt_iop_module_t *colorout = NULL;
-    for(GList *modules = dev.iop; modules; modules = g_list_next(modules))
+    for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
     {
       colorout = (dt_iop_module_t *)modules->data;
       if(colorout->get_p && strcmp(colorout->op, "colorout") == 0)
@@ -1244,7 +1540,7 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
   double scale = _get_pipescale(&pipe, width, height, max_scale);
   float origin[2] = { 0.0f, 0.0f };
 
-  if(dt_dev_distort_backtransform_plus(&dev, &pipe, 0.0,
+  if(dt_dev_distort_backtransform_plus(dev, &pipe, 0.0,
                                        DT_DEV_TRANSFORM_DIR_ALL, origin, 1))
   {
     if(width == 0) width = pipe.processed_width;
@@ -1278,133 +1574,7 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
            high_quality_processing || scale > 1.0f ? "yes" : "no");
 
   const int bpp = format->bpp(format_params);
-
-  dt_get_perf_times(&start);
   const gboolean hq_process = high_quality_processing || scale > 1.0f;
-  if(hq_process)
-  {
-    /*
-     * if high quality processing was requested, downsampling will be done
-     * at the very end of the pipe (just before border and watermark)
-     */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0,
-                                      processed_width, processed_height, scale);
-  }
-  else
-  {
-    // else, downsampling will be right after demosaic
-
-    // so we need to turn temporarily disable in-pipe late downsampling iop.
-
-    // find the finalscale module
-    dt_dev_pixelpipe_iop_t *finalscale = NULL;
-    {
-      for(const GList *nodes = g_list_last(pipe.nodes);
-          nodes;
-          nodes = g_list_previous(nodes))
-      {
-        dt_dev_pixelpipe_iop_t *node = nodes->data;
-        if(dt_iop_module_is(node->module->so, "finalscale"))
-        {
-          finalscale = node;
-          break;
-        }
-      }
-    }
-
-    if(finalscale) finalscale->enabled = FALSE;
-
-    // do the processing (8-bit with special treatment, to make sure
-    // we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0,
-                               processed_width, processed_height, scale, DT_DEVICE_NONE);
-    else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0,
-                                        processed_width, processed_height, scale);
-
-    if(finalscale) finalscale->enabled = TRUE;
-  }
-  dt_show_times(&start,
-                thumbnail_export
-                  ? "[dev_process_thumbnail] pixel pipeline processing"
-                  : "[dev_process_export] pixel pipeline processing");
-
-  uint8_t *outbuf = pipe.backbuf;
-  if(outbuf == NULL)
-  {
-    dt_print(DT_DEBUG_IMAGEIO,
-             "[dt_imageio_export_with_flags] no valid output buffer\n");
-    goto error;
-  }
-
-  // downconversion to low-precision formats:
-  if(bpp == 8)
-  {
-    if(display_byteorder)
-    {
-      if(hq_process)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
-          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
-          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
-    }
-    else // need to flip
-    {
-      // ldr output: char
-      if(hq_process)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
-          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
-          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-        DT_OMP_FOR()
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
-      }
-    }
-  }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++)
-          buf16[4 * k + i] = roundf(CLAMP(buff[4 * k + i] * 0xffff, 0, 0xffff));
-      }
-  }
-  // else output float, no further harm done to the pixels :)
 
   format_params->width = processed_width;
   format_params->height = processed_height;
@@ -1431,35 +1601,117 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
     md_flags_set = metadata ? (metadata->flags & meta_all) == meta_all : FALSE;
   }
 
+  uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes
+                                // max, but if original size is
+                                // close to that, adding new tags
+                                // could make it go over that... so
+                                // let it be and see what happens
+                                // when we write the image
+  int exif_len = 0;
   if(!ignore_exif && md_flags_set)
   {
-    uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes
-                                  // max, but if original size is
-                                  // close to that, adding new tags
-                                  // could make it go over that... so
-                                  // let it be and see what happens
-                                  // when we write the image
     char pathname[PATH_MAX] = { 0 };
     gboolean from_cache = TRUE;
     dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
 
     // last param is dng mode, it's false here
-    const int length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB,
-                                         processed_width, processed_height, FALSE);
+    exif_len = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB,
+                                 processed_width, processed_height, FALSE);
+  }
 
-    res = (format->write_image(format_params, filename, outbuf, icc_type,
-                              icc_filename, exif_profile, length, imgid,
-                              num, total, &pipe, export_masks)) != 0;
+  // large exports are processed in bands of rows, each band is handed
+  // to the format as soon as it is ready, so the whole image never has
+  // to be in memory.
+  int margin = 0;
+  const size_t stream_pixels = (size_t)dt_conf_get_int("export_streaming_megapixels") * 1000000;
+  const gboolean can_stream = !thumbnail_export
+    && !export_masks
+    && stream_pixels > 0
+    && (size_t)processed_width * processed_height > stream_pixels
+    && format->write_begin && format->write_rows && format->write_finish
+    && strcmp(format->mime(format_params), "memory")
+    && _export_pipe_streamable(&pipe, scale, &margin)
+    && _export_band_rows(processed_width, processed_height, margin) < processed_height;
+
+  void *stream = can_stream
+    ? format->write_begin(format_params, filename, icc_type, icc_filename,
+                          exif_profile, exif_len, imgid, num, total, &pipe)
+    : NULL;
+
+  if(progress.job)
+  {
+    pipe.progress = _export_pipe_progress;
+    pipe.progress_data = &progress;
+  }
+
+  dt_get_perf_times(&start);
+  if(stream)
+  {
+    const int band_rows = _export_band_rows(processed_width, processed_height, margin);
+    dt_print(DT_DEBUG_IMAGEIO,
+             "[dt_imageio_export] streaming imgid %d in bands of %d rows, %d rows margin\n",
+             imgid, band_rows, margin);
+    // the 8-bit pipe output is already converted, all others are float
+    const size_t pixel_size = bpp == 8 && !hq_process ? 4 : 4 * sizeof(float);
+
+    res = FALSE;
+    for(int y = 0; y < processed_height && !res; y += band_rows)
+    {
+      const int rows = MIN(band_rows, processed_height - y);
+      const int y0 = MAX(0, y - margin);
+      const int y1 = MIN(processed_height, y + rows + margin);
+      progress.from = 0.1 + 0.8 * y / processed_height;
+      progress.to = 0.1 + 0.8 * (y + rows) / processed_height;
+      res = _export_process(&pipe, dev, y0, processed_width, y1 - y0,
+                            scale, hq_process, bpp)
+        || pipe.backbuf == NULL;
+
+      if(res)
+        dt_print(DT_DEBUG_IMAGEIO,
+                 "[dt_imageio_export_with_flags] no valid output buffer for rows %d-%d\n",
+                 y, y + rows - 1);
+      else
+      {
+        // drop the margins
+        uint8_t *band = (uint8_t *)pipe.backbuf + (size_t)(y - y0) * processed_width * pixel_size;
+        _export_convert(band, (size_t)processed_width * rows,
+                        bpp, display_byteorder, hq_process);
+        res = format->write_rows(format_params, stream, band, rows) != 0;
+      }
+    }
+    res = (format->write_finish(format_params, stream, res) != 0) || res;
 
-    free(exif_profile);
+    dt_show_times(&start, "[dev_process_export] pixel pipeline processing and writing");
   }
   else
   {
+    _export_process(&pipe, dev, 0, processed_width, processed_height,
+                    scale, hq_process, bpp);
+    _export_set_progress(&progress, progress.to);
+    dt_show_times(&start,
+                  thumbnail_export
+                    ? "[dev_process_thumbnail] pixel pipeline processing"
+                    : "[dev_process_export] pixel pipeline processing");
+
+    uint8_t *outbuf = pipe.backbuf;
+    if(outbuf == NULL)
+    {
+      dt_print(DT_DEBUG_IMAGEIO,
+               "[dt_imageio_export_with_flags] no valid output buffer\n");
+      free(exif_profile);
+      goto error;
+    }
+
+    _export_convert(outbuf, (size_t)processed_width * processed_height,
+                    bpp, display_byteorder, hq_process);
+
     res = (format->write_image(format_params, filename, outbuf, icc_type,
-                              icc_filename, NULL, 0, imgid, num, total,
-                              &pipe, export_masks)) != 0;
+                               icc_filename, exif_profile, exif_len, imgid,
+                               num, total, &pipe, export_masks)) != 0;
   }
 
+  free(exif_profile);
+
   if(res)
     goto error;
 
@@ -1467,14 +1719,29 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
   if(copy_metadata
      && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP))
   {
-    dt_exif_xmp_attach_export(imgid, filename, metadata, &dev, &pipe);
+    dt_exif_xmp_attach_export(imgid, filename, metadata, dev, &pipe);
     // no need to cancel the export if this fail
   }
 
   dt_dev_pixelpipe_cleanup(&pipe);
-  dt_dev_cleanup(&dev);
+  if(!batch) dt_dev_cleanup(dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 
+  if(start_wtime > 0.0)
+  {
+    const double done_wtime = dt_get_wtime();
+    dt_print(DT_DEBUG_PERF,
+             "[export] imgid %d: setup %.3fs, processing %.3fs%s\n",
+             imgid, setup_wtime - start_wtime, done_wtime - setup_wtime,
+             reused ? " (modules reused)" : "");
+    if(batch)
+    {
+      batch->images++;
+      batch->setup += setup_wtime - start_wtime;
+      batch->processing += done_wtime - setup_wtime;
+    }
+  }
+
   if(!thumbnail_export && strcmp(format->mime(format_params), "memory")
     && !(format->flags(format_params) & FORMAT_FLAGS_NO_TMPFILE))
   {
@@ -1511,7 +1778,9 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
 error:
   dt_dev_pixelpipe_cleanup(&pipe);
 error_early:
-  dt_dev_cleanup(&dev);
+  // a failed image must not leave a half loaded develop to the next one
+  dt_dev_cleanup(dev);
+  if(batch) batch->dev_loaded = FALSE;
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 
   if(!thumbnail_export)
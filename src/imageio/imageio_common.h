@@ -126,6 +126,18 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid, const char *filena
                                  dt_export_metadata_t *metadata,
                                  const int history_end);
 
+/** exports of the calling thread between begin and end form a batch:
+ *  the module instances and the items of the applied style are kept
+ *  from one image to the next instead of being loaded for every image.
+ *  calls may be nested, the batch ends with the outermost end. */
+void dt_imageio_export_batch_begin(void);
+void dt_imageio_export_batch_end(void);
+
+struct _dt_job_t;
+/** exports of the calling thread report their progress to job, from
+ *  loading the image to handing it to the format. NULL stops it. */
+void dt_imageio_export_set_progress_job(struct _dt_job_t *job);
+
 size_t dt_imageio_write_pos(const int i,
                             const int j,
                             const int wd,
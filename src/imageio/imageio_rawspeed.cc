@@ -41,8 +41,22 @@
 #include "develop/imageop.h"
 #include "imageio/imageio_common.h"
 #include "imageio/imageio_rawspeed.h"
+#include <limits>
+#include <vector>
 #include <stdint.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/vfs.h>
+#elif defined(__APPLE__)
+#include <sys/mount.h>
+#endif
+
 // define this function, it is only declared in rawspeed:
 int rawspeed_get_number_of_processor_cores()
 {
@@ -55,6 +69,138 @@ int rawspeed_get_number_of_processor_cores()
 
 using namespace rawspeed;
 
+// the raw file as rawspeed sees it. files on local disks are mapped into memory,
+// which saves copying them into a heap buffer, others are read by rawspeed's FileReader.
+class dt_rawspeed_input_t
+{
+public:
+  explicit dt_rawspeed_input_t(const char *filename);
+  ~dt_rawspeed_input_t() { reset(); }
+  void reset();
+
+  Buffer buf;
+
+private:
+  decltype(std::declval<FileReader>().readFile().first) storage;
+  void *map = nullptr;
+  size_t map_size = 0;
+};
+
+#ifndef _WIN32
+// a mapped file that is truncated or whose server goes away kills us with SIGBUS
+// on the next access, so only files on local disks are mapped. the rest is read.
+static bool _is_local_file(const int fd)
+{
+#ifdef __linux__
+  struct statfs sfs;
+  if(fstatfs(fd, &sfs) != 0) return false;
+  switch((uint32_t)sfs.f_type)
+  {
+    case 0x6969:      // NFS
+    case 0x517b:      // SMB
+    case 0xff534d42:  // CIFS
+    case 0xfe534d42:  // SMB2
+    case 0x65735546:  // FUSE, e.g. sshfs
+    case 0x00c36400:  // Ceph
+    case 0x5346414f:  // AFS
+    case 0x73757245:  // Coda
+    case 0x01021997:  // 9p
+      return false;
+    default:
+      return true;
+  }
+#elif defined(__APPLE__)
+  struct statfs sfs;
+  return fstatfs(fd, &sfs) == 0 && (sfs.f_flags & MNT_LOCAL);
+#else
+  return false;
+#endif
+}
+#endif
+
+dt_rawspeed_input_t::dt_rawspeed_input_t(const char *filename)
+{
+  const double start = dt_get_debug_wtime();
+  size_t not_cached = 0;
+
+#ifndef _WIN32
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if(fd >= 0 && _is_local_file(fd) && fstat(fd, &st) == 0 && st.st_size > 0
+     && (uint64_t)st.st_size <= std::numeric_limits<Buffer::size_type>::max())
+  {
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED)
+      map = nullptr;
+    else
+      map_size = st.st_size;
+  }
+  if(fd >= 0) close(fd);
+
+  if(map)
+  {
+    madvise(map, map_size, MADV_WILLNEED);
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const uint8_t *data = static_cast<const uint8_t *>(map);
+
+#ifdef __linux__
+    // what isn't in the page cache yet, e.g. thanks to read-ahead, has to come from storage
+    const size_t pages = (map_size + page - 1) / page;
+    std::vector<unsigned char> resident(pages);
+    if(mincore(map, map_size, resident.data()) == 0)
+      for(size_t i = 0; i < pages; i++)
+        if(!(resident[i] & 1)) not_cached += page;
+#else
+    not_cached = map_size;
+#endif
+
+    // fault the file in under the read lock, so that loads running in
+    // parallel still don't fight over the disk
+    dt_pthread_mutex_lock(&darktable.readFile_mutex);
+    volatile uint8_t sink = 0;
+    for(size_t i = 0; i < map_size; i += page) sink ^= data[i];
+    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+
+    buf = Buffer(data, static_cast<Buffer::size_type>(map_size));
+  }
+  else
+#endif
+  {
+    FileReader f(filename);
+    dt_pthread_mutex_lock(&darktable.readFile_mutex);
+    try
+    {
+      auto [file_storage, file_buf] = f.readFile();
+      storage = std::move(file_storage);
+      buf = file_buf;
+    }
+    catch(...)
+    {
+      dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+      throw;
+    }
+    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+    not_cached = buf.getSize();
+  }
+
+  const double stalled = dt_get_debug_wtime() - start;
+  dt_print(DT_DEBUG_PERF,
+           "[rawspeed_open] %s %s: %.1f MB, %.1f MB not cached, stalled %.3f secs (%.1f MB/s)\n",
+           map ? "mapped" : "read", filename, buf.getSize() / 1e6, not_cached / 1e6, stalled,
+           stalled > 0.0 ? not_cached / 1e6 / stalled : 0.0);
+}
+
+void dt_rawspeed_input_t::reset()
+{
+  buf = Buffer();
+  storage.reset();
+#ifndef _WIN32
+  if(map) munmap(map, map_size);
+#endif
+  map = nullptr;
+  map_size = 0;
+}
+
 static dt_imageio_retval_t dt_imageio_open_rawspeed_sraw (dt_image_t *img,
                                                           const RawImage r,
                                                           dt_mipmap_buffer_t *buf);
@@ -173,17 +319,14 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img,
 
   char filen[PATH_MAX] = { 0 };
   snprintf(filen, sizeof(filen), "%s", filename);
-  FileReader f(filen);
 
   try
   {
     dt_rawspeed_load_meta();
 
-    dt_pthread_mutex_lock(&darktable.readFile_mutex);
-    auto [storage, storageBuf] = f.readFile();
-    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+    dt_rawspeed_input_t input(filen);
 
-    RawParser t(storageBuf);
+    RawParser t(input.buf);
     std::unique_ptr<RawDecoder> d = t.getDecoder(meta);
 
     if(!d.get()) return DT_IMAGEIO_UNSUPPORTED_FORMAT;
@@ -244,7 +387,7 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img,
 
     /* free auto pointers on spot */
     d.reset();
-    storage.reset();
+    input.reset();
 
     // Grab the WB
     for(int i = 0; i < 4; i++)
@@ -43,6 +43,8 @@ DAMAGE.
 
 #include <iostream>
 
+#include "common/atomic.h"
+
 /*******************************************************************
  * Hash table implementation for permutohedral lattice             *
  *                                                                 *
@@ -157,6 +159,15 @@ struct HashTablePermutohedralValue<4> {
     dt_aligned_pixel_t value;
 };
 
+/*******************************************************************
+ * Concurrent hash table for the permutohedral lattice              *
+ *                                                                 *
+ * All threads insert into one shared open-addressing table while  *
+ * splatting. A slot is claimed with a compare-and-swap, so there  *
+ * is no per-thread table to merge afterwards. Once splatting is   *
+ * done, the used slots are packed into dense key/value arrays and *
+ * the slot array maps keys to their dense index.                  *
+ *******************************************************************/
 template <int KD, int VD> class HashTablePermutohedral
 {
 public:
@@ -169,46 +180,31 @@ public:
     {
       DT_OMP_SIMD()
       for(int i = 0; i < KD; i++)
-	 key[i] = origin.key[i] + direction;
-      key[dim] = origin.key[dim] - direction * KD;
-      setHash();
+        key[i] = origin.key[i] + direction;
+      // the last coordinate is implicit, moving along it only shifts the others
+      if(dim < KD) key[dim] = origin.key[dim] - direction * KD;
     }
 
     Key(const Key &) = default; // let the compiler write the copy constructor
 
     Key &operator=(const Key &) = default;
 
-    void setKey(int idx, short val)
+    unsigned hash() const
     {
-      key[idx] = val;
-    }
-
-    void setHash()
-    {
-      size_t k = 0;
+      unsigned k = 0;
       for(int i = 0; i < KD; i++)
       {
         k += key[i];
         k *= 2531011;
       }
-      hash = (unsigned)k;
+      return k;
     }
 
     bool operator==(const Key &other) const
     {
-      if(hash != other.hash) return false;
-#if 1
       return memcmp(key, other.key, sizeof(key)) == 0;
-#else
-      for(int i = 0; i < KD; i++)
-      {
-        if(key[i] != other.key[i]) return false;
-      }
-      return true;
-#endif
     }
 
-    unsigned hash;    // cache the hash value for this key
     short key[KD];    // key is a KD-dimensional vector
   };
 
@@ -216,194 +212,201 @@ public:
   // Struct for an associated value
   typedef HashTablePermutohedralValue<VD> Value;
 
+  // slot states while splatting, a used slot holds the chunk owning it
+  static constexpr int EMPTY = -1;
+  static constexpr int BUSY = -2;
+
 public:
-  /* Constructor
-   *  kd_: the dimensionality of the position vectors on the hyperplane.
-   *  vd_: the dimensionality of the value vectors
-   */
-  HashTablePermutohedral(size_t num_entries = 0)
-  {
-    capacity = 0;
-    capacity_bits = 1;
-    alloc_entries = 0;
-    filled = 0;
-    entries = nullptr;
-    keys = nullptr;
-    values = nullptr;
-  }
+  HashTablePermutohedral() = default;
 
   HashTablePermutohedral(const HashTablePermutohedral &) = delete;
 
   ~HashTablePermutohedral()
   {
     delete[] entries;
+    delete[] slotKeys;
     delete[] keys;
-    delete[] values;
+    delete[] owners;
   }
 
   HashTablePermutohedral &operator=(const HashTablePermutohedral &) = delete;
 
-  // Returns the number of vectors stored.
+  // Returns the number of vectors stored, valid after compact().
   size_t size() const
   {
     return filled;
   }
 
-  size_t maxFill() const
+  size_t slots() const
   {
-    return alloc_entries;
+    return capacity;
   }
 
-  // Returns a pointer to the keys array.
+  // Returns a pointer to the dense keys array.
   const Key *getKeys() const
   {
     return keys;
   }
 
-  // Returns a pointer to the values array.
-  Value *getValues() const
+  // Returns the chunk owning each dense entry, valid until releaseOwners().
+  const int *getOwners() const
   {
-    return values;
+    return owners;
   }
 
-  /* Returns the index into the hash table for a given key.
-   *     key: a reference to the position vector.
-   *  create: a flag specifying whether an entry should be created,
-   *          should an entry with the given key not found.
+  /* prepare the table for the concurrent insertion of num_entries keys,
+   * dropping whatever it held before
    */
-  int lookupOffset(const Key &key, bool create = true)
+  void setSize(size_t num_entries)
   {
-    size_t h = key.hash & capacity_bits;
-    // Find the entry with the given key
-    while(1)
+    capacity = 1 << 15;
+    while(capacity < 2 * num_entries) capacity <<= 1;
+    capacity_bits = capacity - 1;
+    delete[] entries;
+    delete[] slotKeys;
+    entries = new dt_atomic_int[capacity];
+    slotKeys = new Key[capacity];
+    DT_OMP_FOR()
+    for(size_t i = 0; i < capacity; i++)
+      dt_atomic_set_int(&entries[i], EMPTY);
+    dt_atomic_set_int(&inserted, 0);
+    dt_atomic_set_int(&overflow, 0);
+    filled = 0;
+  }
+
+  /* Finds or creates the slot of a key, safe to be called from several threads.
+   * The slot remembers the lowest chunk of points which touched it. Returns -1
+   * if the table is full, newly created slots are counted in 'created'.
+   */
+  int insert(const Key &key, unsigned hash, int owner, int &created)
+  {
+    size_t h = hash & capacity_bits;
+    for(size_t probe = 0; probe < capacity; probe++)
     {
-      Entry e = entries[h];
-      // check if the cell is empty
-      if(e.keyIdx == -1)
+      int state = dt_atomic_get_int(&entries[h]);
+      if(state == EMPTY && dt_atomic_CAS_int(&entries[h], &state, BUSY))
       {
-        if(!create) return -1; // Return not found.
-        // Double hash table size if necessary
-        if(filled >= maxFill())
-        {
-          grow();
-        }
-        // need to create an entry. Store the given key.
-        keys[filled] = key;
-        entries[h].keyIdx = filled;
-        return filled++;
+        slotKeys[h] = key;
+        dt_atomic_set_int(&entries[h], owner);
+        created++;
+        return h;
+      }
+      // another thread may just be storing its key into this slot
+      while(state == BUSY) state = dt_atomic_get_int(&entries[h]);
+      if(slotKeys[h] == key)
+      {
+        while(state > owner && !dt_atomic_CAS_int(&entries[h], &state, owner)) {}
+        return h;
       }
-
-      // check if the cell has a matching key
-      if(keys[e.keyIdx] == key) return e.keyIdx;
 
       // increment the bucket with wraparound
       h = (h + 1) & capacity_bits;
     }
+    dt_atomic_set_int(&overflow, 1);
+    return -1;
   }
 
-  /* Looks up the value vector associated with a given key vector.
-   *        k : reference to the key vector to be looked up.
-   *   create : true if a non-existing key should be created.
+  /* Adds a thread's count of created slots to the total, flags the table as full
+   * once it goes beyond half of the slots to keep the probe sequences short.
    */
-  Value *lookup(const Key &k, bool create = true)
+  void addCreated(int created)
   {
-    int offset = lookupOffset(k, create);
-    return (offset < 0) ? nullptr : values + offset;
-  };
+    if(created && dt_atomic_add_int(&inserted, created) + created > (int)(capacity / 2))
+      dt_atomic_set_int(&overflow, 1);
+  }
 
-  /* Grows the size of the hash table */
-  void grow(int order = 1)
+  bool full()
   {
-    if(order > 0)
-    {
-      auto_grow++;
-      growExact(capacity << (order-1));
-    }
+    return dt_atomic_get_int(&overflow) != 0;
   }
 
-  /* initialize the hash table so that it can hold exactly num_entries without resizing */
-  void setSize(size_t num_entries)
+  size_t created()
   {
-    capacity = 1 << 15;
-    capacity_bits = 0x7fff;
-    if(num_entries == 0)
-      num_entries = capacity/2;
-    else
-    {
-      while (capacity < 2*num_entries)
-      {
-      capacity <<= 1;
-      capacity_bits = (capacity_bits << 1) | 1;
-      }
-    }
-    alloc_entries = num_entries;
-    filled = 0;
-    entries = new Entry[capacity];
-    keys = new Key[maxFill()];
-    values = new Value[maxFill()];
-    init_alloc = total_alloc = capacity * sizeof(Entry) + maxFill() * sizeof(Key) + maxFill() * sizeof(Value);
+    return dt_atomic_get_int(&inserted);
   }
 
-  /* grow the size of the hash table so that it can hold exactly num_entries
-   * without requiring resizing.  The actual index array will be rounded up
-   * to the next higher power of two.
+  /* Packs the used slots into the dense keys and owners arrays, in slot order.
+   * Afterwards the slots hold the dense index of their key.
    */
-  void growExact(size_t num_entries)
+  void compact()
   {
-    size_t oldCapacity = capacity;
-    while(capacity < num_entries * 2)
+    constexpr size_t block = 1 << 15; // divides the capacity
+    const size_t nblocks = capacity / block;
+    size_t *start = new size_t[nblocks + 1];
+    start[0] = 0;
+    DT_OMP_FOR()
+    for(size_t b = 0; b < nblocks; b++)
     {
-      capacity *= 2;
-      capacity_bits = (capacity_bits << 1) | 1;
+      size_t count = 0;
+      for(size_t h = b * block; h < (b + 1) * block; h++)
+        count += dt_atomic_get_int(&entries[h]) >= 0;
+      start[b + 1] = count;
     }
-    alloc_entries = num_entries;
+    for(size_t b = 0; b < nblocks; b++) start[b + 1] += start[b];
+    filled = start[nblocks];
 
-    // Migrate the value vectors.
-    Value *newValues = new Value[maxFill()];
-    std::copy(values, values + filled, newValues);
-    delete[] values;
-    values = newValues;
-
-    // Migrate the key vectors.
-    Key *newKeys = new Key[maxFill()];
-    std::copy(keys, keys + filled, newKeys);
     delete[] keys;
-    keys = newKeys;
-
-    Entry *newEntries = new Entry[capacity];
-
-    // Migrate the table of indices.
-    for(size_t i = 0; i < oldCapacity; i++)
-    {
-      if(entries[i].keyIdx == -1) continue;
-      size_t h = keys[entries[i].keyIdx].hash & capacity_bits;
-      while(newEntries[h].keyIdx != -1)
+    delete[] owners;
+    keys = new Key[filled];
+    owners = new int[filled];
+    DT_OMP_FOR()
+    for(size_t b = 0; b < nblocks; b++)
+    {
+      size_t idx = start[b];
+      for(size_t h = b * block; h < (b + 1) * block; h++)
       {
-        h = (h + 1) & capacity_bits;
+        const int owner = dt_atomic_get_int(&entries[h]);
+        if(owner < 0) continue;
+        keys[idx] = slotKeys[h];
+        owners[idx] = owner;
+        dt_atomic_set_int(&entries[h], idx++);
       }
-      newEntries[h] = entries[i];
     }
-    delete[] entries;
-    entries = newEntries;
-    total_alloc = capacity * sizeof(Entry) + maxFill() * sizeof(Key) + maxFill() * sizeof(Value);
+    delete[] start;
+    delete[] slotKeys;
+    slotKeys = nullptr;
   }
 
-private:
-  // Private struct for the hash table entries.
-  struct Entry
+  void releaseOwners()
   {
-    int keyIdx{ -1 };
-  };
+    delete[] owners;
+    owners = nullptr;
+  }
 
-  Key *keys;
-  Value *values;
-  Entry *entries;
-  size_t capacity, filled, alloc_entries;
-  unsigned long capacity_bits;
-public:
-  size_t init_alloc { 0 };
-  size_t total_alloc { 0 };
-  size_t auto_grow { 0 };
+  // Returns the dense index of a slot returned by insert(), valid after compact().
+  int denseIndex(int slot) const
+  {
+    return dt_atomic_get_int(&entries[slot]);
+  }
+
+  /* Returns the dense index of a given key or -1 if it is not in the table,
+   * valid after compact().
+   */
+  int lookupOffset(const Key &key, unsigned hash) const
+  {
+    size_t h = hash & capacity_bits;
+    // Find the entry with the given key
+    while(1)
+    {
+      const int idx = dt_atomic_get_int(&entries[h]);
+      // check if the cell is empty
+      if(idx == EMPTY) return -1;
+      // check if the cell has a matching key
+      if(keys[idx] == key) return idx;
+      // increment the bucket with wraparound
+      h = (h + 1) & capacity_bits;
+    }
+  }
+
+private:
+  dt_atomic_int *entries { nullptr }; // slot states while splatting, dense indices afterwards
+  Key *slotKeys { nullptr };          // keys by slot while splatting
+  Key *keys { nullptr };              // dense keys
+  int *owners { nullptr };            // dense owning chunks
+  size_t capacity { 0 }, filled { 0 };
+  size_t capacity_bits { 0 };
+  dt_atomic_int inserted { 0 };
+  dt_atomic_int overflow { 0 };
 };
 
 /******************************************************************
@@ -412,6 +415,11 @@ public:
  * PermutohedralLattice::splat(...) and                           *
  * PermutohedralLattic::slice() do almost all the work.           *
  *                                                                *
+ * The points are split into nThreads contiguous chunks. Every    *
+ * lattice point is owned by the first chunk touching it, the     *
+ * owner adds its contributions first and the other chunks follow *
+ * in order, so the result does not depend on thread timing.      *
+ *                                                                *
  ******************************************************************/
 template <int D, int VD> class PermutohedralLattice
 {
@@ -421,35 +429,26 @@ private:
   typedef typename HashTable::Key Key;
   typedef typename HashTable::Value Value;
 
+  // number of points for which the simplex is searched at once, with the
+  // points in the innermost dimension so the loops vectorize
+  static constexpr int BLOCK = 16;
+
 public:
   /* Constructor
-   *     d_ : dimensionality of key vectors
-   *    vd_ : dimensionality of value vectors
-   * nData_ : number of points in the input
+   *       nData_ : number of points in the input
+   *    nThreads_ : number of chunks the points are split into while splatting
+   *  grid_points : number of grid points covered by the input, used to size the table
    */
-  PermutohedralLattice(size_t nData_, size_t nThreads_ = 1, size_t grid_points = ~0L) : nData(nData_), nThreads(nThreads_)
+  PermutohedralLattice(size_t nData_, size_t nThreads_ = 1, size_t grid_points = ~0L)
+    : nData(nData_), nChunks(nThreads_ ? nThreads_ : 1)
   {
-    // Allocate storage for various arrays
-    float *scaleFactorTmp = new float[D];
-    int *canonicalTmp = new int[(D + 1) * (D + 1)];
-
     replay = new ReplayEntry[nData];
 
-    // compute the coordinates of the canonical simplex, in which
-    // the difference between a contained point and the zero
-    // remainder vertex is always in ascending order. (See pg.4 of paper.)
-    for(int i = 0; i <= D; i++)
-    {
-      for(int j = 0; j <= D - i; j++) canonicalTmp[i * (D + 1) + j] = i;
-      for(int j = D - i + 1; j <= D; j++) canonicalTmp[i * (D + 1) + j] = i - (D + 1);
-    }
-    canonical = canonicalTmp;
-
     // Compute parts of the rotation matrix E. (See pg.4-5 of paper.)
     for(int i = 0; i < D; i++)
     {
       // the diagonal entries for normalization
-      scaleFactorTmp[i] = 1.0f / (sqrtf((float)(i + 1) * (i + 2)));
+      scaleFactor[i] = 1.0f / (sqrtf((float)(i + 1) * (i + 2)));
 
       /* We presume that the user would like to do a Gaussian blur of standard deviation
        * 1 in each dimension (or a total variance of d, summed over dimensions.)
@@ -463,28 +462,19 @@ public:
        *
        * So we need to scale the space by (d+1)sqrt(2/3).
        */
-      scaleFactorTmp[i] *= (D + 1) * sqrtf(2.0 / 3);
+      scaleFactor[i] *= (D + 1) * sqrtf(2.0 / 3);
     }
-    scaleFactor = scaleFactorTmp;
-
-    size_t effective_MP = estimatedHashEntries(grid_points, nData);
-    size_t points = ((D+1) * nData) < effective_MP ? ((D+1) * nData) : effective_MP;
 
-    hashTables = new HashTable[nThreads];
-    for(size_t i = 0; i < nThreads; i++)
-    {
-       hashTables[i].setSize(points / nThreads);
-    }
+    const size_t effective_MP = estimatedHashEntries(grid_points, nData);
+    expectedEntries = ((D+1) * nData) < effective_MP ? ((D+1) * nData) : effective_MP;
   }
 
   PermutohedralLattice(const PermutohedralLattice &) = delete;
 
   ~PermutohedralLattice()
   {
-    delete[] scaleFactor;
     delete[] replay;
-    delete[] canonical;
-    delete[] hashTables;
+    dt_free_align(values);
   }
 
   PermutohedralLattice &operator=(const PermutohedralLattice &) = delete;
@@ -505,278 +495,415 @@ public:
     return ((D+1) * num_pixels) < eff_pixels ? ((D+1) * num_pixels) : eff_pixels;
   }
 
-  /* compute the expected bytes of storage needed */
+  /* compute the expected bytes of storage needed, not counting the replay array */
   static size_t estimatedBytes(size_t grid_points, size_t num_pixels)
   {
      size_t hash_entries = estimatedHashEntries(grid_points, num_pixels);
-     size_t round_up = 1;
+     size_t round_up = 1 << 15;
      while (round_up < 2*hash_entries) round_up <<= 1;
-     // we need to store not only the Key, Value, and Entry arrays, we
-     // also need an additional copy of the Value array while blurring
-     // and storage for the remapping array while merging
-     size_t mergesize = hash_entries * 2 * (sizeof(Value)+sizeof(Key)) + round_up * sizeof(int);
-     size_t blursize = hash_entries * (2*sizeof(Value)+sizeof(Key)) + (hash_entries+round_up) * sizeof(int);
-     return MAX(mergesize, blursize);
+     // while splatting the keys are stored by slot, then packed along with
+     // their owners. Blurring needs the packed keys and two copies of the values.
+     size_t splatsize = round_up * (sizeof(dt_atomic_int) + sizeof(Key))
+                        + hash_entries * (sizeof(Key) + sizeof(int));
+     size_t blursize = round_up * sizeof(dt_atomic_int) + hash_entries * (2*sizeof(Value)+sizeof(Key));
+     return MAX(splatsize, blursize);
   }
 
-  /* Performs splatting with given position and value vectors */
-  void splat(float *position, float *value, size_t replay_index, int thread_index = 0) const
+  /* Splats all points into the lattice. point(index, position, value) has to fill in
+   * the D position and VD value components of the given point. It is called from
+   * several threads and more than once for some points.
+   */
+  template <typename F> void splat(F point)
   {
-    DT_ALIGNED_PIXEL float elevated[D + 1];
-    DT_ALIGNED_PIXEL int greedy[D + 1];
-    DT_ALIGNED_PIXEL int rank[D + 1];
-    DT_ALIGNED_PIXEL float barycentric[D + 2];
-    Key key;
+    size_t *chunkDone = new size_t[nChunks];
+    size_t entries = expectedEntries;
+    int retries = 0;
+    while(!splatKeys(point, entries, chunkDone))
+    {
+      // the estimate was too small, extrapolate from the points we got through
+      size_t done = 0;
+      for(size_t c = 0; c < nChunks; c++) done += chunkDone[c];
+      const size_t needed = (size_t)(1.25 * hashTable.created() * nData / MAX(done, 1));
+      entries = MAX(2 * entries, needed);
+      retries++;
+    }
+    delete[] chunkDone;
+
+    hashTable.compact();
+    // the replay still points to slots, rewrite it to the packed entries
+    DT_OMP_FOR()
+    for(size_t i = 0; i < nData; i++)
+      for(int r = 0; r <= D; r++)
+        replay[i].offset[r] = hashTable.denseIndex(replay[i].offset[r]);
 
-    // first rotate position into the (d+1)-dimensional hyperplane
-    elevated[D] = -D * position[D - 1] * scaleFactor[D - 1];
-    for(int i = D - 1; i > 0; i--)
-      elevated[i]
-          = (elevated[i + 1] - i * position[i - 1] * scaleFactor[i - 1] + (i + 2) * position[i] * scaleFactor[i]);
-    elevated[0] = elevated[1] + 2 * position[0] * scaleFactor[0];
+    splatValues(point);
 
-    // prepare to find the closest lattice points
-    constexpr float scale = 1.0f / (D + 1);
+    dt_print(DT_DEBUG_MEMORY,
+      "[permutohedral] %lu entries in %lu slots (%lu expected, %d retries), "
+      "replay using %lu bytes for %lu points, values using %lu bytes\n",
+      hashTable.size(), hashTable.slots(), expectedEntries, retries,
+      (sizeof(ReplayEntry)*nData), nData, sizeof(Value) * hashTable.size());
+  }
 
-    // greedily search for the closest zero-colored lattice point
-    DT_OMP_SIMD()
-    for(size_t i = 0; i <= D; i++)
+  /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
+   * containing each position vector were calculated and stored in the splatting step.
+   * We may reuse this to accelerate the algorithm. (See pg. 6 in paper.)
+   */
+  void slice(float *col, size_t replay_index) const
+  {
+    Value::clear(col);
+    ReplayEntry &r = replay[replay_index];
+    for(int i = 0; i <= D; i++)
     {
-      float v = elevated[i] * scale;
-      float up = ceilf(v) * (D + 1);
-      float down = floorf(v) * (D + 1);
-
-      if(up - elevated[i] < elevated[i] - down)
-        greedy[i] = up;
-      else
-        greedy[i] = down;
+      values[r.offset[i]].addTo(col, r.weight[i]);
     }
-    int sum = 0;
-    for(size_t i = 0; i <= D; i++)
-       sum += greedy[i];
-
-    sum /= D + 1;
-
-    // rank differential to find the permutation between this simplex and the canonical one.
-    // (See pg. 3-4 in paper.)
-    memset(rank, 0, sizeof rank);
-    for(int i = 0; i < D; i++)
-      for(int j = i + 1; j <= D; j++)
-        if(elevated[i] - greedy[i] < elevated[j] - greedy[j])
-          rank[i]++;
-        else
-          rank[j]++;
+  }
 
-    if(sum > 0)
-    {
-      // sum too large - the point is off the hyperplane.
-      // need to bring down the ones with the smallest differential
-      for(int i = 0; i <= D; i++)
+  /* Slices n points at the given positions (D floats each) into col (VD floats each)
+   * without a replay, for points which were not splatted themselves. Lattice points
+   * which did not receive anything contribute nothing.
+   */
+  void slice(float *col, const float *position, size_t n) const
+  {
+    DT_ALIGNED_ARRAY float pos[D][BLOCK];
+    DT_ALIGNED_ARRAY int greedy[D + 1][BLOCK];
+    DT_ALIGNED_ARRAY int rank[D + 1][BLOCK];
+    DT_ALIGNED_ARRAY float barycentric[D + 2][BLOCK];
+    DT_ALIGNED_ARRAY int keys[D][BLOCK];
+    DT_ALIGNED_ARRAY unsigned hash[BLOCK];
+
+    for(size_t index = 0; index < n; index += BLOCK)
+    {
+      const int m = MIN((size_t)BLOCK, n - index);
+      for(int p = 0; p < BLOCK; p++)
+        for(int i = 0; i < D; i++)
+          pos[i][p] = p < m ? position[(index + p) * D + i] : 0.0f;
+      findSimplex(pos, greedy, rank, barycentric);
+
+      for(int p = 0; p < m; p++)
+        Value::clear(col + (index + p) * VD);
+      for(int remainder = 0; remainder <= D; remainder++)
       {
-        if(rank[i] >= D + 1 - sum)
+        vertexKeys(greedy, rank, remainder, keys, hash);
+        for(int p = 0; p < m; p++)
         {
-          greedy[i] -= D + 1;
-          rank[i] += sum - (D + 1);
+          Key key;
+          for(int i = 0; i < D; i++) key.key[i] = keys[i][p];
+          const int offset = hashTable.lookupOffset(key, hash[p]);
+          if(offset >= 0)
+            values[offset].addTo(col + (index + p) * VD, barycentric[remainder][p]);
         }
-        else
-          rank[i] += sum;
       }
     }
-    else if(sum < 0)
+  }
+
+  /* Performs a Gaussian blur along each projected axis in the hyperplane. */
+  void blur()
+  {
+    // Prepare arrays
+    const size_t size = hashTable.size();
+    Value *newValue = dt_calloc_align_type(Value, size);
+    Value *oldValue = values;
+    const Key *keyBase = hashTable.getKeys();
+    const Value zero{ 0 };
+    const Value *const zeroPtr = &zero;
+
+    dt_print(DT_DEBUG_MEMORY,
+      "[permutohedral] blur using %lu bytes for newValue\n",
+      (sizeof(Value)*size));
+
+    // For each of d+1 axes,
+    for(int j = 0; j <= D; j++)
     {
-      // sum too small - the point is off the hyperplane
-      // need to bring up the ones with largest differential
-      for(int i = 0; i <= D; i++)
+      DT_OMP_FOR()
+      // For each vertex in the lattice,
+      for(size_t i = 0; i < size; i++) // blur point i in dimension j
       {
-        if(rank[i] < -sum)
-        {
-          greedy[i] += D + 1;
-          rank[i] += (D + 1) + sum;
-        }
-        else
-          rank[i] += sum;
+        const Key &key = keyBase[i]; // keys to current vertex
+        // construct keys to the neighbors along the given axis.
+        const Key neighbor1(key, j, +1);
+        const Key neighbor2(key, j, -1);
+
+        const int o1 = hashTable.lookupOffset(neighbor1, neighbor1.hash()); // look up first neighbor
+        const int o2 = hashTable.lookupOffset(neighbor2, neighbor2.hash()); // look up second neighbor
+        const Value *vm1 = o1 >= 0 ? oldValue + o1 : zeroPtr;
+        const Value *vp1 = o2 >= 0 ? oldValue + o2 : zeroPtr;
+
+        // Mix values of the three vertices
+        newValue[i].mix(vm1, oldValue + i, vp1);
       }
+      std::swap(newValue, oldValue);
+      // the freshest data is now in oldValue, and newValue is ready to be written over
     }
 
-    // Compute barycentric coordinates (See pg.10 of paper.)
-    memset(barycentric, 0, sizeof barycentric);
-    for(int i = 0; i <= D; i++)
-    {
-      barycentric[D - rank[i]] += (elevated[i] - greedy[i]) * scale;
-      barycentric[D + 1 - rank[i]] -= (elevated[i] - greedy[i]) * scale;
-    }
-    barycentric[0] += 1.0f + barycentric[D + 1];
+    values = oldValue;
+    dt_free_align(newValue);
+  }
 
-    // Splat the value into each vertex of the simplex, with barycentric weights.
-    replay[replay_index].table = thread_index;
-    for(int remainder = 0; remainder <= D; remainder++)
-    {
-      // Compute the location of the lattice point explicitly (all but the last coordinate - it's redundant
-      // because they sum to zero)
-      for(int i = 0; i < D; i++) key.key[i] = greedy[i] + canonical[remainder * (D + 1) + rank[i]];
-      key.setHash();
+private:
+  size_t chunkStart(size_t c) const
+  {
+    return nData * c / nChunks;
+  }
 
-      // Retrieve pointer to the value at this vertex.
-      Value *val = hashTables[thread_index].lookup(key, true);
+  /* Finds the enclosing simplex of BLOCK points, returning its zero-remainder vertex,
+   * the rank of each coordinate and the barycentric weights. (See pg. 3-4 and 10 of paper.)
+   */
+  __DT_CLONE_TARGETS__
+  void findSimplex(const float position[D][BLOCK],
+                   int greedy[D + 1][BLOCK],
+                   int rank[D + 1][BLOCK],
+                   float barycentric[D + 2][BLOCK]) const
+  {
+    DT_ALIGNED_ARRAY float elevated[D + 1][BLOCK];
+    DT_ALIGNED_ARRAY int sum[BLOCK];
 
-      // Accumulate values with barycentric weight.
-      val->add(value, barycentric[remainder]);
+    // prepare to find the closest lattice points
+    constexpr float scale = 1.0f / (D + 1);
 
-      // Record this interaction to use later when slicing
-      replay[replay_index].offset[remainder] = val - hashTables[thread_index].getValues();
-      replay[replay_index].weight[remainder] = barycentric[remainder];
+    // first rotate position into the (d+1)-dimensional hyperplane
+    DT_OMP_SIMD()
+    for(int p = 0; p < BLOCK; p++)
+      elevated[D][p] = -D * position[D - 1][p] * scaleFactor[D - 1];
+    for(int i = D - 1; i > 0; i--)
+    {
+      DT_OMP_SIMD()
+      for(int p = 0; p < BLOCK; p++)
+        elevated[i][p] = (elevated[i + 1][p] - i * position[i - 1][p] * scaleFactor[i - 1]
+                          + (i + 2) * position[i][p] * scaleFactor[i]);
     }
-  }
+    DT_OMP_SIMD()
+    for(int p = 0; p < BLOCK; p++)
+      elevated[0][p] = elevated[1][p] + 2 * position[0][p] * scaleFactor[0];
 
-  /* Merge the multiple threads' hash tables into the totals. */
-  void merge_splat_threads()
-  {
-    if(nThreads <= 1) return;
-
-    /* Because growing the hash table is expensive, we want to avoid having to do it multiple times.
-     * Only a small percentage of entries in the individual hash tables have the same key, so we
-     * won't waste much space if we simply grow the destination table enough to hold the sum of the
-     * entries in the individual tables
-     */
-    size_t alloc_entries = hashTables[0].maxFill();
-    size_t total_bytes = 0;
-    size_t total_grows = hashTables[0].auto_grow;
-    size_t init_bytes = hashTables[0].init_alloc;
-    size_t total_entries = hashTables[0].size();
-    for(size_t i = 1; i < nThreads; i++)
-    {
-       alloc_entries += hashTables[i].maxFill();
-       total_entries += hashTables[i].size();
-       init_bytes += hashTables[i].init_alloc;
-       total_bytes += hashTables[i].total_alloc;
-       total_grows += hashTables[i].auto_grow;
-    }
-    hashTables[0].growExact(total_entries);
-    total_bytes += hashTables[0].total_alloc;
-    /* Merge the multiple hash tables into one, creating an offset remap table. */
-    int **offset_remap = new int *[nThreads];
-    size_t remap_bytes = 0;
-    for(size_t i = 1; i < nThreads; i++)
-    {
-      const Key *oldKeys = hashTables[i].getKeys();
-      const Value *oldVals = hashTables[i].getValues();
-      const size_t filled = hashTables[i].size();
-      offset_remap[i] = new int[filled];
-      remap_bytes += filled * sizeof(int);
-      for(size_t j = 0; j < filled; j++)
+    // greedily search for the closest zero-colored lattice point
+    DT_OMP_SIMD()
+    for(int p = 0; p < BLOCK; p++)
+      sum[p] = 0;
+    for(int i = 0; i <= D; i++)
+    {
+      DT_OMP_SIMD()
+      for(int p = 0; p < BLOCK; p++)
       {
-        Value *val = hashTables[0].lookup(oldKeys[j], true);
-        val->add(oldVals[j]);
-        offset_remap[i][j] = val - hashTables[0].getValues();
+        const float v = elevated[i][p] * scale;
+        const float up = ceilf(v) * (D + 1);
+        const float down = floorf(v) * (D + 1);
+        greedy[i][p] = up - elevated[i][p] < elevated[i][p] - down ? up : down;
+        sum[p] += greedy[i][p];
+        rank[i][p] = 0;
       }
     }
-    dt_print(DT_DEBUG_MEMORY,
-      "[permutohedral] hash tables %lu bytes (%lu initially), %lu entries, [permutohedral] tables grew %lu times, "
-      "replay using %lu bytes for %lu pixels, [permutohedral] fill factor %f%%, remap using %lu bytes\n",
-      total_bytes, init_bytes, total_entries, total_grows,
-      (sizeof(ReplayEntry)*nData), nData, (float)100.0f * total_entries / alloc_entries, remap_bytes);
 
-    /* Rewrite the offsets in the replay structure from the above generated table. */
-    DT_OMP_FOR(if(nData >= 100000))
-    for(size_t i = 0; i < nData; i++)
+    // rank differential to find the permutation between this simplex and the canonical one.
+    for(int i = 0; i < D; i++)
+      for(int j = i + 1; j <= D; j++)
+      {
+        DT_OMP_SIMD()
+        for(int p = 0; p < BLOCK; p++)
+        {
+          const int smaller = elevated[i][p] - greedy[i][p] < elevated[j][p] - greedy[j][p];
+          rank[i][p] += smaller;
+          rank[j][p] += 1 - smaller;
+        }
+      }
+
+    // if the sum is not zero the point is off the hyperplane: bring down the coordinates
+    // with the smallest differential if it is too large, bring up the ones with the
+    // largest differential if it is too small
+    for(int i = 0; i <= D; i++)
     {
-      if(replay[i].table > 0)
+      DT_OMP_SIMD()
+      for(int p = 0; p < BLOCK; p++)
       {
-        for(int dim = 0; dim <= D; dim++)
-          replay[i].offset[dim] = offset_remap[replay[i].table][replay[i].offset[dim]];
+        const int s = sum[p] / (D + 1);
+        const int shift = (s < 0 && rank[i][p] < -s) - (s > 0 && rank[i][p] >= D + 1 - s);
+        greedy[i][p] += shift * (D + 1);
+        rank[i][p] += s + shift * (D + 1);
       }
     }
 
-    for(size_t i = 1; i < nThreads; i++) delete[] offset_remap[i];
-    delete[] offset_remap;
+    // Compute barycentric coordinates, every rank occurs exactly once
+    for(int k = 0; k <= D + 1; k++)
+    {
+      DT_OMP_SIMD()
+      for(int p = 0; p < BLOCK; p++)
+      {
+        float b = 0.0f;
+        for(int i = 0; i <= D; i++)
+        {
+          const float delta = (elevated[i][p] - greedy[i][p]) * scale;
+          b += rank[i][p] == D - k ? delta : 0.0f;
+          b -= rank[i][p] == D + 1 - k ? delta : 0.0f;
+        }
+        barycentric[k][p] = b;
+      }
+    }
+    DT_OMP_SIMD()
+    for(int p = 0; p < BLOCK; p++)
+      barycentric[0][p] += 1.0f + barycentric[D + 1][p];
   }
 
-  /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
-   * containing each position vector were calculated and stored in the splatting step.
-   * We may reuse this to accelerate the algorithm. (See pg. 6 in paper.)
+  /* Computes the location of the vertex with the given remainder for BLOCK points,
+   * all but the last coordinate - it's redundant because they sum to zero.
    */
-  void slice(float *col, size_t replay_index) const
+  __DT_CLONE_TARGETS__
+  static void vertexKeys(const int greedy[D + 1][BLOCK],
+                         const int rank[D + 1][BLOCK],
+                         const int remainder,
+                         int keys[D][BLOCK],
+                         unsigned hash[BLOCK])
   {
-    const Value *base = hashTables[0].getValues();
-    Value::clear(col);
-    ReplayEntry &r = replay[replay_index];
-    for(int i = 0; i <= D; i++)
+    DT_OMP_SIMD()
+    for(int p = 0; p < BLOCK; p++)
     {
-      base[r.offset[i]].addTo(col, r.weight[i]);
+      unsigned h = 0;
+      for(int i = 0; i < D; i++)
+      {
+        // the canonical simplex has the coordinate 'remainder' for the D + 1 - remainder
+        // lowest ranks and 'remainder - (D + 1)' for the others. (See pg.4 of paper.)
+        const short k = greedy[i][p] + remainder - (rank[i][p] > D - remainder ? D + 1 : 0);
+        keys[i][p] = k;
+        h = (h + k) * 2531011;
+      }
+      hash[p] = h;
     }
   }
 
-  /* Performs a Gaussian blur along each projected axis in the hyperplane. */
-  void blur() const
+  /* Splats the keys of all points, stores the slot and barycentric weight of every
+   * vertex into the replay. Returns false if the table turned out to be too small.
+   */
+  template <typename F> bool splatKeys(F point, const size_t entries, size_t *chunkDone)
   {
-    // Prepare arrays
-    Value *newValue = new Value[hashTables[0].size()];
-    Value *oldValue = hashTables[0].getValues();
-    const Value *hashTableBase = oldValue;
-    const Key *keyBase = hashTables[0].getKeys();
-    const Value zero{ 0 };
-    const Value *const zeroPtr = &zero;
-
-    dt_print(DT_DEBUG_MEMORY,
-      "[permutohedral] blur using %lu bytes for newValue\n",
-      (sizeof(Value)*hashTables[0].size()));
-
-    // For each of d+1 axes,
-    for(int j = 0; j <= D; j++)
-    {
-      DT_OMP_FOR()
-      // For each vertex in the lattice,
-      for(size_t i = 0; i < hashTables[0].size(); i++) // blur point i in dimension j
+    hashTable.setSize(entries);
+
+    DT_OMP_FOR()
+    for(size_t c = 0; c < nChunks; c++)
+    {
+      DT_ALIGNED_ARRAY float position[D][BLOCK];
+      DT_ALIGNED_ARRAY int greedy[D + 1][BLOCK];
+      DT_ALIGNED_ARRAY int rank[D + 1][BLOCK];
+      DT_ALIGNED_ARRAY float barycentric[D + 2][BLOCK];
+      DT_ALIGNED_ARRAY int keys[D][BLOCK];
+      DT_ALIGNED_ARRAY unsigned hash[BLOCK];
+      float pos[D];
+      DT_ALIGNED_PIXEL float val[VD];
+
+      const size_t end = chunkStart(c + 1);
+      size_t index = chunkStart(c);
+      for(; index < end && !hashTable.full(); index += BLOCK)
       {
-        const Key &key = keyBase[i]; // keys to current vertex
-        // construct keys to the neighbors along the given axis.
-        Key neighbor1(key, j, +1);
-        Key neighbor2(key, j, -1);
-
-        const Value *oldVal = oldValue + i;
+        const int n = MIN((size_t)BLOCK, end - index);
+        for(int p = 0; p < BLOCK; p++)
+        {
+          if(p < n) point(index + p, pos, val);
+          for(int i = 0; i < D; i++)
+            position[i][p] = p < n ? pos[i] : 0.0f;
+        }
+        findSimplex(position, greedy, rank, barycentric);
 
-        const Value *vm1 = hashTables[0].lookup(neighbor1, false); // look up first neighbor
-        vm1 = vm1 ? vm1 - hashTableBase + oldValue : zeroPtr;
+        int created = 0;
+        for(int remainder = 0; remainder <= D; remainder++)
+        {
+          vertexKeys(greedy, rank, remainder, keys, hash);
+          for(int p = 0; p < n; p++)
+          {
+            Key key;
+            for(int i = 0; i < D; i++) key.key[i] = keys[i][p];
+            // Record this interaction to use later when splatting the values and slicing
+            replay[index + p].offset[remainder] = hashTable.insert(key, hash[p], c, created);
+            replay[index + p].weight[remainder] = barycentric[remainder][p];
+          }
+        }
+        hashTable.addCreated(created);
+      }
+      chunkDone[c] = MIN(index, end) - chunkStart(c);
+    }
 
-        const Value *vp1 = hashTables[0].lookup(neighbor2, false); // look up second neighbor
-        vp1 = vp1 ? vp1 - hashTableBase + oldValue : zeroPtr;
+    return !hashTable.full();
+  }
 
-        // Mix values of the three vertices
-        newValue[i].mix(vm1, oldVal, vp1);
+  /* Accumulates the values of all points with their barycentric weights. Every chunk
+   * first handles the lattice points it owns, then the ones shared with the chunk
+   * 'span' before it, for increasing spans. Such points are found at the start of
+   * a chunk only, so the later passes are short.
+   */
+  template <typename F> void splatValues(F point)
+  {
+    values = dt_calloc_align_type(Value, hashTable.size());
+    const int *owners = hashTable.getOwners();
+    size_t *spillEnd = new size_t[nChunks];
+    int *spillSpan = new int[nChunks];
+
+    DT_OMP_FOR()
+    for(size_t c = 0; c < nChunks; c++)
+    {
+      float pos[D];
+      DT_ALIGNED_PIXEL float val[VD];
+      spillEnd[c] = chunkStart(c);
+      spillSpan[c] = 0;
+      for(size_t i = chunkStart(c); i < chunkStart(c + 1); i++)
+      {
+        point(i, pos, val);
+        for(int r = 0; r <= D; r++)
+        {
+          const int offset = replay[i].offset[r];
+          const int span = (int)c - owners[offset];
+          if(span == 0)
+            values[offset].add(val, replay[i].weight[r]);
+          else
+          {
+            spillEnd[c] = i + 1;
+            spillSpan[c] = MAX(spillSpan[c], span);
+          }
+        }
       }
-      std::swap(newValue, oldValue);
-      // the freshest data is now in oldValue, and newValue is ready to be written over
     }
 
-    // depending where we ended up, we may have to copy data
-    if(oldValue != hashTableBase)
-    {
-      std::copy(oldValue, oldValue + hashTables[0].size(), hashTables[0].getValues());
-      delete[] oldValue;
-    }
-    else
+    int maxSpan = 0;
+    for(size_t c = 0; c < nChunks; c++) maxSpan = MAX(maxSpan, spillSpan[c]);
+
+    for(int span = 1; span <= maxSpan; span++)
     {
-      delete[] newValue;
+      // chunks c and c' only meet here at points owned by c - span == c' - span
+      DT_OMP_FOR()
+      for(size_t c = span; c < nChunks; c++)
+      {
+        float pos[D];
+        DT_ALIGNED_PIXEL float val[VD];
+        for(size_t i = chunkStart(c); i < spillEnd[c]; i++)
+        {
+          bool fetched = false;
+          for(int r = 0; r <= D; r++)
+          {
+            const int offset = replay[i].offset[r];
+            if((int)c - owners[offset] != span) continue;
+            if(!fetched) point(i, pos, val);
+            fetched = true;
+            values[offset].add(val, replay[i].weight[r]);
+          }
+        }
+      }
     }
+
+    delete[] spillEnd;
+    delete[] spillSpan;
+    hashTable.releaseOwners();
   }
 
-private:
   size_t nData;
-  size_t nThreads;
-  const float *scaleFactor;
-  const int *canonical;
+  size_t nChunks;
+  size_t expectedEntries;
+  float scaleFactor[D];
 
   // slicing is done by replaying splatting (ie storing the sparse matrix)
   struct ReplayEntry
   {
-    // since every dimension of a lattice point gets handled by the same thread,
-    // we only need to store the id of the hash table once, instead of for each dimension
-    int table;
     int offset[D + 1];
     float weight[D + 1];
   } * replay;
 
-  HashTable *hashTables;
+  HashTable hashTable;
+  Value *values { nullptr };
 };
 
 // clang-format off
@@ -784,4 +911,3 @@ private:
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
 // clang-format on
-
@@ -1,6 +1,6 @@
 /*
     This file is part of darktable,
-    Copyright (C) 2012-2023 darktable developers.
+    Copyright (C) 2012-2024 darktable developers.
 
     darktable is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -58,7 +58,15 @@ typedef struct dt_iop_bilat_params_t
   float midtone; // $MIN: 0.001 $MAX: 1.0 $DEFAULT: 0.5 $DESCRIPTION: "midtone range"
 } dt_iop_bilat_params_t;
 
-typedef dt_iop_bilat_params_t dt_iop_bilat_data_t;
+typedef struct dt_iop_bilat_data_t
+{
+  dt_iop_bilat_mode_t mode;
+  float sigma_r;
+  float sigma_s;
+  float detail;
+  float midtone;
+  dt_bilateral_t *grid; // kept while only the detail changes
+} dt_iop_bilat_data_t;
 
 typedef struct dt_iop_bilat_gui_data_t
 {
@@ -304,7 +312,16 @@ void commit_params(struct dt_iop_module_t *self,
 {
   dt_iop_bilat_params_t *p = (dt_iop_bilat_params_t *)p1;
   dt_iop_bilat_data_t *d = piece->data;
-  *d = *p;
+  d->mode = p->mode;
+  d->sigma_r = p->sigma_r;
+  d->sigma_s = p->sigma_s;
+  d->detail = p->detail;
+  d->midtone = p->midtone;
+  if(d->mode != s_mode_bilateral)
+  {
+    dt_bilateral_free(d->grid);
+    d->grid = NULL;
+  }
 
 #ifdef HAVE_OPENCL
   if(d->mode == s_mode_bilateral)
@@ -328,6 +345,8 @@ void cleanup_pipe(struct dt_iop_module_t *self,
                   dt_dev_pixelpipe_t *pipe,
                   dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_bilat_data_t *d = piece->data;
+  dt_bilateral_free(d->grid);
   free(piece->data);
   piece->data = NULL;
 }
@@ -351,13 +370,11 @@ void process(struct dt_iop_module_t *self,
 
   if(d->mode == s_mode_bilateral)
   {
-    dt_bilateral_t *b = dt_bilateral_init(roi_in->width, roi_in->height, sigma_s, sigma_r);
+    dt_bilateral_t *b = dt_bilateral_init_cached(&d->grid, piece, i, roi_in, sigma_s, sigma_r);
     if(b)
     {
-      dt_bilateral_splat(b, (float *)i);
-      dt_bilateral_blur(b);
       dt_bilateral_slice(b, (float *)i, (float *)o, d->detail);
-      dt_bilateral_free(b);
+      if(b != d->grid) dt_bilateral_free(b);
     }
     else
     {
@@ -119,6 +119,17 @@ static void _compute_sigmas(float sigma[5],
   sigma[4] = data->sigma[4];
 }
 
+// the preview pipes only splat one pixel per stride x stride block. The
+// lattice spacing follows the spatial sigma, so sampling it four times
+// per sigma hardly changes the result.
+static int _splat_stride(const dt_dev_pixelpipe_iop_t *piece,
+                         const float sigma_s)
+{
+  if(!(piece->pipe->type & (DT_DEV_PIXELPIPE_PREVIEW | DT_DEV_PIXELPIPE_THUMBNAIL)))
+    return 1;
+  return MAX(1, (int)(sigma_s / 4.0f));
+}
+
 void process(struct dt_iop_module_t *self,
              dt_dev_pixelpipe_iop_t *piece,
              const void *const ivoid,
@@ -249,49 +260,87 @@ void process(struct dt_iop_module_t *self,
   }
   else
   {
+    const int stride = _splat_stride(piece, fmaxf(sigma[0], sigma[1]));
     for(int k = 0; k < 5; k++) sigma[k] = 1.0f / sigma[k];
 
     const size_t grid_points =
       (height*sigma[0]) * (width*sigma[1]) * sigma[2] * sigma[3] * sigma[4];
-    PermutohedralLattice<5, 4> lattice(width * height, dt_get_num_threads(), grid_points);
+    // only the pixel in the middle of each stride x stride block gets splatted
+    const size_t splat_width = (width + stride - 1) / stride;
+    const size_t splat_height = (height + stride - 1) / stride;
+    PermutohedralLattice<5, 4> lattice(splat_width * splat_height, dt_get_num_threads(), grid_points);
 
     // splat into the lattice
-    DT_OMP_FOR(shared(lattice))
-    for(size_t j = 0; j < height; j++)
+    const float *const in = (const float *)ivoid;
+    lattice.splat([&](const size_t index, float *pos, float *val)
     {
-      const float *in = (const float *)ivoid + j * width * 4;
-      const int thread = dt_get_thread_num();
-      const size_t index = j * width;
-      for(size_t i = 0; i < width; i++)
-      {
-        float pos[5] = { i * sigma[0],
-                         j * sigma[1],
-                         in[0] * sigma[2],
-                         in[1] * sigma[3],
-                         in[2] * sigma[4] };
-        dt_aligned_pixel_t val = { in[0], in[1], in[2], 1.0f };
-        lattice.splat(pos, val, index + i, thread);
-        in += 4;
-      }
-    }
-
-    lattice.merge_splat_threads();
+      const size_t j = MIN(stride * (index / splat_width) + stride / 2, height - 1);
+      const size_t i = MIN(stride * (index % splat_width) + stride / 2, width - 1);
+      const float *pixel = in + 4 * (j * width + i);
+      pos[0] = i * sigma[0];
+      pos[1] = j * sigma[1];
+      pos[2] = pixel[0] * sigma[2];
+      pos[3] = pixel[1] * sigma[3];
+      pos[4] = pixel[2] * sigma[4];
+      val[0] = pixel[0];
+      val[1] = pixel[1];
+      val[2] = pixel[2];
+      val[3] = 1.0f;
+    });
 
     // blur the lattice
     lattice.blur();
 
     // slice from the lattice
     float *const out = (float*)ovoid;
-    DT_OMP_FOR(shared(lattice))
-    for(size_t index = 0; index < npixels; index++)
+    if(stride == 1)
     {
-      dt_aligned_pixel_t val;
-      lattice.slice(val, index);
-      for_each_channel(k)
-        val[k] /= val[3];
-      copy_pixel_nontemporal(out + 4*index, val);
+      DT_OMP_FOR(shared(lattice))
+      for(size_t index = 0; index < npixels; index++)
+      {
+        dt_aligned_pixel_t val;
+        lattice.slice(val, index);
+        for_each_channel(k)
+          val[k] /= val[3];
+        copy_pixel_nontemporal(out + 4*index, val);
+      }
+      dt_omploop_sfence();
+    }
+    else
+    {
+      // the pixels in between have no replay, look up their simplex again
+      size_t padded_size;
+      float *const positions = dt_alloc_perthread_float(5 * width, &padded_size);
+      DT_OMP_FOR(shared(lattice))
+      for(size_t j = 0; j < height; j++)
+      {
+        float *const pos = dt_get_perthread(positions, padded_size);
+        const float *row = in + 4 * j * width;
+        float *const outrow = out + 4 * j * width;
+        for(size_t i = 0; i < width; i++)
+        {
+          pos[5*i + 0] = i * sigma[0];
+          pos[5*i + 1] = j * sigma[1];
+          pos[5*i + 2] = row[4*i + 0] * sigma[2];
+          pos[5*i + 3] = row[4*i + 1] * sigma[3];
+          pos[5*i + 4] = row[4*i + 2] * sigma[4];
+        }
+        lattice.slice(outrow, pos, width);
+        for(size_t i = 0; i < width; i++)
+        {
+          float *const val = outrow + 4*i;
+          // keep pixels none of whose lattice points received anything
+          if(val[3] > 0.0f)
+          {
+            for_each_channel(k)
+              val[k] /= val[3];
+          }
+          else
+            copy_pixel(val, row + 4*i);
+        }
+      }
+      dt_free_align(positions);
     }
-    dt_omploop_sfence();
   }
 }
 
@@ -340,13 +389,14 @@ void tiling_callback(struct dt_iop_module_t *self,
   {
     // permutohedral needs LOTS of memory
     // start with the fixed memory requirements
-    tiling->factor = 2.0f /*input+output*/ + 52.0f/16.0f /*52 bytes per pixel for
-                                                           ReplayEntry array*/;
+    const int stride = _splat_stride(piece, fmaxf(sigma[0], sigma[1]));
+    tiling->factor = 2.0f /*input+output*/ + 48.0f/16.0f/(stride*stride) /*48 bytes per splatted
+                                                                           pixel for ReplayEntry array*/;
     // now try to estimate the variable needs for the hashtable based
     // on the current parameters
     size_t npixels = (size_t)roi_out->height * roi_out->width;
     size_t grid_points = (roi_out->height/sigma[0]) * (roi_out->width/sigma[1]) / sigma[2] / sigma[3] / sigma[4];
-    size_t hash_bytes = PermutohedralLattice<5, 4>::estimatedBytes(grid_points, npixels);
+    size_t hash_bytes = PermutohedralLattice<5, 4>::estimatedBytes(grid_points, npixels / (stride*stride));
     tiling->factor += (hash_bytes / (16.0f*npixels));
 
     dt_print(DT_DEBUG_MEMORY,
@@ -207,6 +207,9 @@ typedef struct dt_iop_channelmixer_rbg_data_t
   dt_adaptation_t adaptation;
   dt_illuminant_t illuminant_type;
   dt_iop_channelmixer_rgb_version_t version;
+  // set up by process_pixels_prepare() for the current profile of the pipe
+  dt_colormatrix_t RGB_to_XYZ;
+  dt_colormatrix_t XYZ_to_RGB;
 } dt_iop_channelmixer_rbg_data_t;
 
 typedef struct dt_iop_channelmixer_rgb_global_data_t
@@ -761,11 +764,9 @@ static inline void _luma_chroma(const dt_aligned_pixel_t input,
 }
 
 DT_OMP_DECLARE_SIMD(aligned(in, out, XYZ_to_RGB, RGB_to_XYZ, MIX : 64) aligned(illuminant, saturation, lightness, grey:16))
-static inline void _loop_switch(const float *const restrict in,
-                                float *const restrict out,
-                                const size_t width,
-                                const size_t height,
-                                const size_t ch,
+static inline void _loop_switch(const float *const in,
+                                float *const out,
+                                const size_t npixels,
                                 const dt_colormatrix_t XYZ_to_RGB,
                                 const dt_colormatrix_t RGB_to_XYZ,
                                 const dt_colormatrix_t MIX,
@@ -816,8 +817,7 @@ static inline void _loop_switch(const float *const restrict in,
   dt_colormatrix_t XYZ_to_RGB_trans;
   dt_colormatrix_transpose(XYZ_to_RGB_trans, XYZ_to_RGB);
 
-  DT_OMP_FOR()
-  for(size_t k = 0; k < height * width * 4; k += 4)
+  for(size_t k = 0; k < npixels * 4; k += 4)
   {
     // intermediate temp buffers
     dt_aligned_pixel_t temp_one;
@@ -972,7 +972,7 @@ static inline void _loop_switch(const float *const restrict in,
     }
 
     temp_two[3] = in[k + 3]; // alpha mask
-    copy_pixel_nontemporal(&out[k], temp_two);
+    copy_pixel(&out[k], temp_two);
   }
 }
 
@@ -2113,90 +2113,22 @@ static void _set_trouble_messages(struct dt_iop_module_t *self)
   }
 }
 
-void process(struct dt_iop_module_t *self,
-             dt_dev_pixelpipe_iop_t *piece,
-             const void *const restrict ivoid,
-             void *const restrict ovoid,
-             const dt_iop_roi_t *const roi_in,
-             const dt_iop_roi_t *const roi_out)
+gboolean process_pixels_prepare(struct dt_iop_module_t *self,
+                                dt_dev_pixelpipe_iop_t *piece)
 {
   dt_iop_channelmixer_rbg_data_t *data = piece->data;
   const struct dt_iop_order_iccprofile_info_t *const work_profile =
     dt_ioppr_get_pipe_current_profile_info(self, piece->pipe);
-  const struct dt_iop_order_iccprofile_info_t *const input_profile =
-    dt_ioppr_get_pipe_input_profile_info(piece->pipe);
-  dt_iop_channelmixer_rgb_gui_data_t *g = self->gui_data;
-
-  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/,
-                                        self, piece->colors,
-                                        ivoid, ovoid, roi_in, roi_out))
-    return; // image has been copied through to output and module's
-            // trouble flag has been updated
 
   if(piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW)
     _declare_cat_on_pipe(self, FALSE);
 
-  dt_colormatrix_t RGB_to_XYZ;
-  dt_colormatrix_t XYZ_to_RGB;
-  dt_colormatrix_t XYZ_to_CAM;
-
   // repack the matrices as flat AVX2-compliant matrice
   if(work_profile)
   {
     // work profile can't be fetched in commit_params since it is not yet initialised
-    memcpy(RGB_to_XYZ, work_profile->matrix_in, sizeof(RGB_to_XYZ));
-    memcpy(XYZ_to_RGB, work_profile->matrix_out, sizeof(XYZ_to_RGB));
-    memcpy(XYZ_to_CAM, input_profile->matrix_out, sizeof(XYZ_to_CAM));
-  }
-
-  assert(piece->colors == 4);
-  const size_t ch = 4;
-
-  const float *const restrict in = (const float *const restrict)ivoid;
-  float *const restrict out = (float *const restrict)ovoid;
-
-  // auto-detect WB upon request
-  if(self->dev->gui_attached && g)
-  {
-#ifdef AI_ACTIVATED
-    gboolean exit = FALSE;
-#endif
-    if(g->run_profile && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
-    {
-      dt_iop_gui_enter_critical_section(self);
-      _extract_color_checker(in, out, roi_in, g, RGB_to_XYZ,
-                             XYZ_to_RGB, XYZ_to_CAM, data->adaptation);
-      g->run_profile = FALSE;
-      dt_iop_gui_leave_critical_section(self);
-    }
-
-#ifdef AI_ACTIVATED
-    if(data->illuminant_type == DT_ILLUMINANT_DETECT_EDGES
-       || data->illuminant_type == DT_ILLUMINANT_DETECT_SURFACES)
-    {
-      if(piece->pipe->type & DT_DEV_PIXELPIPE_FULL)
-      {
-        // detection on full image only
-        dt_iop_gui_enter_critical_section(self);
-        // compute "AI" white balance.  We can use our output buffer
-        // as scratch space since we will be overwriting it afterwards
-        // anyway
-        _auto_detect_WB(in, out, data->illuminant_type, roi_in->width, roi_in->height,
-                        ch, RGB_to_XYZ, g->XYZ);
-        dt_dev_pixelpipe_cache_invalidate_later(piece->pipe, self->iop_order);
-        dt_iop_gui_leave_critical_section(self);
-      }
-
-      // passthrough pixels
-      dt_iop_image_copy_by_size(out, in, roi_in->width, roi_in->height, ch);
-
-      dt_control_log(_("auto-detection of white balance completed"));
-
-      exit = TRUE;
-    }
-
-    if(exit) return;
-#endif
+    memcpy(data->RGB_to_XYZ, work_profile->matrix_in, sizeof(data->RGB_to_XYZ));
+    memcpy(data->XYZ_to_RGB, work_profile->matrix_out, sizeof(data->XYZ_to_RGB));
   }
 
   if(data->illuminant_type == DT_ILLUMINANT_CAMERA)
@@ -2228,14 +2160,25 @@ void process(struct dt_iop_module_t *self,
       // just use whatever was defined in commit_params hoping the defaults work…
     }
   }
+  // without a profile the matrices are left from a previous run
+  return work_profile == NULL;
+}
+
+void process_pixels(struct dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const float *const in,
+                    float *const out,
+                    const size_t npixels)
+{
+  const dt_iop_channelmixer_rbg_data_t *const data = piece->data;
 
   // force loop unswitching in a controlled way
   switch(data->adaptation)
   {
     case DT_ADAPTATION_FULL_BRADFORD:
     {
-      _loop_switch(in, out, roi_out->width, roi_out->height, ch,
-                   XYZ_to_RGB, RGB_to_XYZ, data->MIX,
+      _loop_switch(in, out, npixels,
+                   data->XYZ_to_RGB, data->RGB_to_XYZ, data->MIX,
                    data->illuminant, data->saturation, data->lightness, data->grey,
                    data->p, data->gamut, data->clip, data->apply_grey,
                    DT_ADAPTATION_FULL_BRADFORD, data->version);
@@ -2243,8 +2186,8 @@ void process(struct dt_iop_module_t *self,
     }
     case DT_ADAPTATION_LINEAR_BRADFORD:
     {
-      _loop_switch(in, out, roi_out->width, roi_out->height, ch,
-                   XYZ_to_RGB, RGB_to_XYZ, data->MIX,
+      _loop_switch(in, out, npixels,
+                   data->XYZ_to_RGB, data->RGB_to_XYZ, data->MIX,
                    data->illuminant, data->saturation, data->lightness, data->grey,
                    data->p, data->gamut, data->clip, data->apply_grey,
                    DT_ADAPTATION_LINEAR_BRADFORD, data->version);
@@ -2252,8 +2195,8 @@ void process(struct dt_iop_module_t *self,
     }
     case DT_ADAPTATION_CAT16:
     {
-      _loop_switch(in, out, roi_out->width, roi_out->height, ch,
-                   XYZ_to_RGB, RGB_to_XYZ, data->MIX,
+      _loop_switch(in, out, npixels,
+                   data->XYZ_to_RGB, data->RGB_to_XYZ, data->MIX,
                    data->illuminant, data->saturation, data->lightness, data->grey,
                    data->p, data->gamut, data->clip, data->apply_grey,
                    DT_ADAPTATION_CAT16, data->version);
@@ -2261,8 +2204,8 @@ void process(struct dt_iop_module_t *self,
     }
     case DT_ADAPTATION_XYZ:
     {
-      _loop_switch(in, out, roi_out->width, roi_out->height, ch,
-                   XYZ_to_RGB, RGB_to_XYZ, data->MIX,
+      _loop_switch(in, out, npixels,
+                   data->XYZ_to_RGB, data->RGB_to_XYZ, data->MIX,
                    data->illuminant, data->saturation, data->lightness, data->grey,
                    data->p, data->gamut, data->clip, data->apply_grey,
                    DT_ADAPTATION_XYZ, data->version);
@@ -2270,8 +2213,8 @@ void process(struct dt_iop_module_t *self,
     }
     case DT_ADAPTATION_RGB:
     {
-      _loop_switch(in, out, roi_out->width, roi_out->height, ch,
-                   XYZ_to_RGB, RGB_to_XYZ, data->MIX,
+      _loop_switch(in, out, npixels,
+                   data->XYZ_to_RGB, data->RGB_to_XYZ, data->MIX,
                    data->illuminant, data->saturation, data->lightness, data->grey,
                    data->p, data->gamut, data->clip, data->apply_grey,
                    DT_ADAPTATION_RGB, data->version);
@@ -2283,12 +2226,91 @@ void process(struct dt_iop_module_t *self,
       break;
     }
   }
+}
+
+void process(struct dt_iop_module_t *self,
+             dt_dev_pixelpipe_iop_t *piece,
+             const void *const restrict ivoid,
+             void *const restrict ovoid,
+             const dt_iop_roi_t *const roi_in,
+             const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_channelmixer_rbg_data_t *data = piece->data;
+  const struct dt_iop_order_iccprofile_info_t *const work_profile =
+    dt_ioppr_get_pipe_current_profile_info(self, piece->pipe);
+  const struct dt_iop_order_iccprofile_info_t *const input_profile =
+    dt_ioppr_get_pipe_input_profile_info(piece->pipe);
+  dt_iop_channelmixer_rgb_gui_data_t *g = self->gui_data;
+
+  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/,
+                                        self, piece->colors,
+                                        ivoid, ovoid, roi_in, roi_out))
+    return; // image has been copied through to output and module's
+            // trouble flag has been updated
+
+  process_pixels_prepare(self, piece);
+
+  dt_colormatrix_t XYZ_to_CAM;
+  if(work_profile)
+    memcpy(XYZ_to_CAM, input_profile->matrix_out, sizeof(XYZ_to_CAM));
+
+  assert(piece->colors == 4);
+  const size_t ch = 4;
+
+  const float *const restrict in = (const float *const restrict)ivoid;
+  float *const restrict out = (float *const restrict)ovoid;
+
+  // auto-detect WB upon request
+  if(self->dev->gui_attached && g)
+  {
+#ifdef AI_ACTIVATED
+    gboolean exit = FALSE;
+#endif
+    if(g->run_profile && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+    {
+      dt_iop_gui_enter_critical_section(self);
+      _extract_color_checker(in, out, roi_in, g, data->RGB_to_XYZ,
+                             data->XYZ_to_RGB, XYZ_to_CAM, data->adaptation);
+      g->run_profile = FALSE;
+      dt_iop_gui_leave_critical_section(self);
+    }
+
+#ifdef AI_ACTIVATED
+    if(data->illuminant_type == DT_ILLUMINANT_DETECT_EDGES
+       || data->illuminant_type == DT_ILLUMINANT_DETECT_SURFACES)
+    {
+      if(piece->pipe->type & DT_DEV_PIXELPIPE_FULL)
+      {
+        // detection on full image only
+        dt_iop_gui_enter_critical_section(self);
+        // compute "AI" white balance.  We can use our output buffer
+        // as scratch space since we will be overwriting it afterwards
+        // anyway
+        _auto_detect_WB(in, out, data->illuminant_type, roi_in->width, roi_in->height,
+                        ch, data->RGB_to_XYZ, g->XYZ);
+        dt_dev_pixelpipe_cache_invalidate_later(piece->pipe, self->iop_order);
+        dt_iop_gui_leave_critical_section(self);
+      }
+
+      // passthrough pixels
+      dt_iop_image_copy_by_size(out, in, roi_in->width, roi_in->height, ch);
+
+      dt_control_log(_("auto-detection of white balance completed"));
+
+      exit = TRUE;
+    }
+
+    if(exit) return;
+#endif
+  }
+
+  dt_iop_process_pixels(self, piece, in, out, roi_out);
 
   // run dE validation at output
   if(self->dev->gui_attached && g)
     if(g->run_validation && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
     {
-      _validate_color_checker(out, roi_out, g, RGB_to_XYZ, XYZ_to_RGB, XYZ_to_CAM);
+      _validate_color_checker(out, roi_out, g, data->RGB_to_XYZ, data->XYZ_to_RGB, XYZ_to_CAM);
       g->run_validation = FALSE;
     }
 }
@@ -3145,6 +3167,17 @@ void commit_params(struct dt_iop_module_t *self,
     {
       piece->process_cl_ready = FALSE;
     }
+
+    // same for the point-wise path, the diagnoses need the full image
+    if(run_profile || run_validation
+#ifdef AI_ACTIVATED
+       || d->illuminant_type == DT_ILLUMINANT_DETECT_EDGES
+       || d->illuminant_type == DT_ILLUMINANT_DETECT_SURFACES
+#endif
+      )
+    {
+      piece->process_pixels_ready = FALSE;
+    }
   }
 
   // if this module has some mask applied we assume it's safe so give no warning
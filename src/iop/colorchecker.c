@@ -18,6 +18,7 @@
 
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces_inline_conversions.h"
+#include "common/colorspaces_lut3d.h"
 #include "common/math.h"
 #include "common/opencl.h"
 #include "common/exif.h"
@@ -105,6 +106,11 @@ typedef struct dt_iop_colorchecker_data_t
   float coeff_L[MAX_PATCHES+4];
   float coeff_a[MAX_PATCHES+4];
   float coeff_b[MAX_PATCHES+4];
+  // patch data as array of structs so we can vectorize operations
+  dt_aligned_pixel_t sources[MAX_PATCHES];
+  dt_aligned_pixel_t patches[MAX_PATCHES+1];
+  dt_aligned_pixel_t polynomial[3];
+  dt_colorspaces_lut3d_t *lut3d; // baked mapping, NULL if not accurate enough
 } dt_iop_colorchecker_data_t;
 
 typedef struct dt_iop_colorchecker_global_data_t
@@ -414,87 +420,72 @@ static inline float kernel(const dt_aligned_pixel_t x,
   return r2*fastlog(MAX(1e-8f,r2));
 }
 
-void process(struct dt_iop_module_t *self,
-             dt_dev_pixelpipe_iop_t *piece,
-             const void *const ivoid,
-             void *const ovoid,
-             const dt_iop_roi_t *const roi_in,
-             const dt_iop_roi_t *const roi_out)
+// direct evaluation of the thin plate spline, also used to bake d->lut3d
+static void _colorchecker_eval(const float *const in,
+                               float *const out,
+                               const size_t npixels,
+                               void *data)
 {
-  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/,
-                                        self, piece->colors,
-                                        ivoid, ovoid, roi_in, roi_out))
-    return;
-
-  const dt_iop_colorchecker_data_t *const data = piece->data;
-  const size_t npixels = (size_t)roi_out->height * (size_t)roi_out->width;
-  float *const restrict out = (float*)DT_IS_ALIGNED(ovoid);
-
-  // convert patch data from struct of arrays to array of structs so
-  // we can vectorize operations
-  const int num_patches = data->num_patches;
-  dt_aligned_pixel_t *sources = dt_alloc_align_type(dt_aligned_pixel_t, num_patches);
-  for(int i = 0; i < num_patches; i++)
-  {
-    sources[i][0] = data->source_Lab[3 * i];
-    sources[i][1] = data->source_Lab[3 * i + 1];
-    sources[i][2] = data->source_Lab[3 * i + 2];
-    sources[i][3] = 0.0f;
-  }
-  dt_aligned_pixel_t *patches = dt_alloc_align_type(dt_aligned_pixel_t, (num_patches + 1));
-  for(int i = 0; i <= num_patches; i++)
-  {
-    patches[i][0] = data->coeff_L[i];
-    patches[i][1] = data->coeff_a[i];
-    patches[i][2] = data->coeff_b[i];
-    patches[i][3] = 0.0f;
-  }
-  const dt_aligned_pixel_t polynomial_L =
-    { data->coeff_L[num_patches+1],
-      data->coeff_L[num_patches+2],
-      data->coeff_L[num_patches+3], 0.0f };
-  const dt_aligned_pixel_t polynomial_a =
-    { data->coeff_a[num_patches+1],
-      data->coeff_a[num_patches+2],
-      data->coeff_a[num_patches+3], 0.0f };
-  const dt_aligned_pixel_t polynomial_b =
-    { data->coeff_b[num_patches+1],
-      data->coeff_b[num_patches+2],
-      data->coeff_b[num_patches+3], 0.0f };
+  const dt_iop_colorchecker_data_t *const d = data;
+  const int num_patches = d->num_patches;
 
-  DT_OMP_FOR()
-  for(int k=0; k < npixels; k++)
+  for(size_t k = 0; k < npixels; k++)
   {
     dt_aligned_pixel_t inpx;
-    copy_pixel(inpx, ((float *)ivoid) + 4*k);
+    copy_pixel(inpx, in + 4*k);
 
     // polynomial part:
     dt_aligned_pixel_t poly_L, poly_a, poly_b;
     for_each_channel(c)
     {
-      poly_L[c] = (polynomial_L[c] * inpx[c]);
-      poly_a[c] = (polynomial_a[c] * inpx[c]);
-      poly_b[c] = (polynomial_b[c] * inpx[c]);
+      poly_L[c] = (d->polynomial[0][c] * inpx[c]);
+      poly_a[c] = (d->polynomial[1][c] * inpx[c]);
+      poly_b[c] = (d->polynomial[2][c] * inpx[c]);
     }
     dt_aligned_pixel_t sums = { poly_L[0] + poly_L[1] + poly_L[2],
-      				poly_a[0] + poly_a[1] + poly_a[2],
+                                poly_a[0] + poly_a[1] + poly_a[2],
                                 poly_b[0] + poly_b[1] + poly_b[2],
                                 0.0f };
     dt_aligned_pixel_t res;
     for_each_channel(c)
-      res[c] = patches[num_patches][c] + sums[c];
+      res[c] = d->patches[num_patches][c] + sums[c];
     for(int p=0; p < num_patches; p++)
     {
       // rbf from thin plate spline
-      const float phi = kernel(inpx, sources[p]);
+      const float phi = kernel(inpx, d->sources[p]);
       for_each_channel(c)
-        res[c] += patches[p][c] * phi;
+        res[c] += d->patches[p][c] * phi;
     }
-    copy_pixel_nontemporal(out + 4*k, res);
+    copy_pixel(out + 4*k, res);
+  }
+}
+
+void process(struct dt_iop_module_t *self,
+             dt_dev_pixelpipe_iop_t *piece,
+             const void *const ivoid,
+             void *const ovoid,
+             const dt_iop_roi_t *const roi_in,
+             const dt_iop_roi_t *const roi_out)
+{
+  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/,
+                                        self, piece->colors,
+                                        ivoid, ovoid, roi_in, roi_out))
+    return;
+
+  const dt_iop_colorchecker_data_t *const d = piece->data;
+  const size_t width = roi_out->width;
+  const float *const in = (const float*)ivoid;
+  float *const out = (float*)ovoid;
+
+  DT_OMP_FOR()
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const size_t k = 4 * width * j;
+    if(d->lut3d)
+      dt_colorspaces_lut3d_apply(d->lut3d, in + k, out + k, width, _colorchecker_eval, (void *)d);
+    else
+      _colorchecker_eval(in + k, out + k, width, (void *)d);
   }
-  dt_omploop_sfence();
-  dt_free_align(patches);
-  dt_free_align(sources);
 }
 
 
@@ -566,6 +557,9 @@ void commit_params(struct dt_iop_module_t *self,
   dt_iop_colorchecker_params_t *p = (dt_iop_colorchecker_params_t *)p1;
   dt_iop_colorchecker_data_t *d = piece->data;
 
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
+
   d->num_patches = MIN(MAX_PATCHES, p->num_patches);
   const unsigned N = MAX(0, d->num_patches);
   const unsigned N4 = N + 4;
@@ -792,20 +786,61 @@ void commit_params(struct dt_iop_module_t *self,
     free(A);
   }
   }
+
+  for(unsigned i = 0; i < N; i++)
+  {
+    for(int c = 0; c < 3; c++) d->sources[i][c] = d->source_Lab[3 * i + c];
+    d->sources[i][3] = 0.0f;
+  }
+  for(unsigned i = 0; i <= N; i++)
+  {
+    d->patches[i][0] = d->coeff_L[i];
+    d->patches[i][1] = d->coeff_a[i];
+    d->patches[i][2] = d->coeff_b[i];
+    d->patches[i][3] = 0.0f;
+  }
+  for(int c = 0; c < 3; c++)
+  {
+    d->polynomial[0][c] = d->coeff_L[N + 1 + c];
+    d->polynomial[1][c] = d->coeff_a[N + 1 + c];
+    d->polynomial[2][c] = d->coeff_b[N + 1 + c];
+  }
+  d->polynomial[0][3] = d->polynomial[1][3] = d->polynomial[2][3] = 0.0f;
+
+  // the cost of the direct evaluation grows with the number of
+  // patches, bake the mapping into a LUT once there are radial
+  // kernels. pixels outside of the usual Lab range still use the
+  // spline itself.
+  if(N > 4)
+  {
+    dt_hash_t hash = dt_hash(DT_INITHASH, "colorchecker", 12);
+    hash = dt_hash(hash, &d->num_patches, sizeof(d->num_patches));
+    hash = dt_hash(hash, d->sources, sizeof(dt_aligned_pixel_t) * N);
+    hash = dt_hash(hash, d->patches, sizeof(dt_aligned_pixel_t) * (N + 1));
+    hash = dt_hash(hash, d->polynomial, sizeof(d->polynomial));
+    const dt_aligned_pixel_t domain_min = { 0.0f, -128.0f, -128.0f, 0.0f };
+    const dt_aligned_pixel_t domain_max = { 100.0f, 128.0f, 128.0f, 0.0f };
+    // half a delta E 76, below what is visible
+    d->lut3d = dt_colorspaces_lut3d_get(hash, domain_min, domain_max,
+                                        DT_COLORSPACES_LUT3D_SHAPER_LINEAR, 0.5f,
+                                        _colorchecker_eval, d);
+  }
 }
 
 void init_pipe(struct dt_iop_module_t *self,
                dt_dev_pixelpipe_t *pipe,
                dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_colorchecker_data_t));
+  piece->data = dt_calloc1_align_type(dt_iop_colorchecker_data_t);
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self,
                   dt_dev_pixelpipe_t *pipe,
                   dt_dev_pixelpipe_iop_t *piece)
 {
-  free(piece->data);
+  dt_iop_colorchecker_data_t *d = piece->data;
+  dt_colorspaces_lut3d_release(d->lut3d);
+  dt_free_align(piece->data);
   piece->data = NULL;
 }
 
@@ -25,6 +25,7 @@
 #include "common/colormatrices.c"
 #include "common/colorspaces.h"
 #include "common/colorspaces_inline_conversions.h"
+#include "common/colorspaces_lut3d.h"
 #include "common/image_cache.h"
 #include "common/opencl.h"
 #include "control/control.h"
@@ -105,6 +106,7 @@ typedef struct dt_iop_colorin_data_t
   cmsHTRANSFORM *xform_cam_Lab;
   cmsHTRANSFORM *xform_cam_nrgb;
   cmsHTRANSFORM *xform_nrgb_Lab;
+  dt_colorspaces_lut3d_t *lut3d; // baked xform_cam_* transforms, NULL if not accurate enough
   float lut[3][LUT_SAMPLES];
   dt_colormatrix_t cmatrix;
   dt_colormatrix_t nmatrix;
@@ -1111,6 +1113,41 @@ static void process_cmatrix(struct dt_iop_module_t *self,
   }
 }
 
+// exact lcms path, also used to bake d->lut3d
+static void _transform_lcms(const float *const in,
+                            float *const out,
+                            const size_t npixels,
+                            void *data)
+{
+  const dt_iop_colorin_data_t *const d = data;
+
+  // convert to (L,a/L,b/L) to be able to change L without changing saturation.
+  if(!d->nrgb)
+  {
+    cmsDoTransform(d->xform_cam_Lab, in, out, npixels);
+  }
+  else
+  {
+    cmsDoTransform(d->xform_cam_nrgb, in, out, npixels);
+
+    for(size_t j = 0; j < npixels; j++)
+      dt_vector_clip(&out[4*j]);
+
+    cmsDoTransform(d->xform_nrgb_Lab, out, out, npixels);
+  }
+}
+
+static inline void _transform_row(const dt_iop_colorin_data_t *const d,
+                                  const float *const in,
+                                  float *const out,
+                                  const size_t width)
+{
+  if(d->lut3d)
+    dt_colorspaces_lut3d_apply(d->lut3d, in, out, width, _transform_lcms, (void *)d);
+  else
+    _transform_lcms(in, out, width, (void *)d);
+}
+
 // legacy processing (IOP versions 1 and 2, 2014 and earlier)
 static void process_lcms2_bm(struct dt_iop_module_t *self,
                              dt_dev_pixelpipe_iop_t *piece,
@@ -1135,20 +1172,7 @@ static void process_lcms2_bm(struct dt_iop_module_t *self,
       _apply_blue_mapping(in + 4*j, out + 4*j);
     }
 
-    // convert to (L,a/L,b/L) to be able to change L without changing saturation.
-    if(!d->nrgb)
-    {
-      cmsDoTransform(d->xform_cam_Lab, out, out, width);
-    }
-    else
-    {
-      cmsDoTransform(d->xform_cam_nrgb, out, out, width);
-
-      for(int j = 0; j < width; j++)
-        dt_vector_clip(&out[4*j]);
-
-      cmsDoTransform(d->xform_nrgb_Lab, out, out, width);
-    }
+    _transform_row(d, out, out, width);
   }
 }
 
@@ -1182,20 +1206,7 @@ static void process_lcms2_proper(struct dt_iop_module_t *self,
 
     float *out = (float *)ovoid + (size_t)4 * k * width;
 
-    // convert to (L,a/L,b/L) to be able to change L without changing saturation.
-    if(!d->nrgb)
-    {
-      cmsDoTransform(d->xform_cam_Lab, in, out, width);
-    }
-    else
-    {
-      cmsDoTransform(d->xform_cam_nrgb, in, out, width);
-
-      for(int j = 0; j < width; j++)
-        dt_vector_clip(&out[4*j]);
-
-      cmsDoTransform(d->xform_nrgb_Lab, out, out, width);
-    }
+    _transform_row(d, in, out, width);
   }
   dt_free_align(scratchlines);
 }
@@ -1335,6 +1346,8 @@ void commit_params(struct dt_iop_module_t *self,
     cmsDeleteTransform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
 
   dt_mark_colormatrix_invalid(&d->cmatrix[0][0]);
   dt_mark_colormatrix_invalid(&d->nmatrix[0][0]);
@@ -1559,6 +1572,24 @@ void commit_params(struct dt_iop_module_t *self,
     }
   }
 
+  // profiles without matrix + curves go through lcms, try to replace that by a baked LUT.
+  // input values above 1.0 are outside of the LUT and still use the exact transform.
+  if(d->xform_cam_Lab && !dt_is_valid_colormatrix(d->cmatrix[0][0])
+     && (!d->nrgb || (d->xform_cam_nrgb && d->xform_nrgb_Lab)))
+  {
+    dt_hash_t hash = dt_hash(DT_INITHASH, "colorin", 7);
+    hash = dt_colorspaces_lut3d_hash_profile(hash, d->input);
+    hash = dt_colorspaces_lut3d_hash_profile(hash, d->nrgb);
+    hash = dt_hash(hash, &p->intent, sizeof(p->intent));
+    hash = dt_hash(hash, &input_format, sizeof(input_format));
+    const dt_aligned_pixel_t domain_min = { 0.0f, 0.0f, 0.0f, 0.0f };
+    const dt_aligned_pixel_t domain_max = { 1.0f, 1.0f, 1.0f, 1.0f };
+    // half a delta E 76, below what is visible
+    d->lut3d = dt_colorspaces_lut3d_get(hash, domain_min, domain_max,
+                                        DT_COLORSPACES_LUT3D_SHAPER_CBRT, 0.5f,
+                                        _transform_lcms, d);
+  }
+
   d->nonlinearlut = FALSE;
 
   // now try to initialize unbounded mode:
@@ -1601,6 +1632,7 @@ void init_pipe(struct dt_iop_module_t *self,
   d->xform_cam_Lab = NULL;
   d->xform_cam_nrgb = NULL;
   d->xform_nrgb_Lab = NULL;
+  d->lut3d = NULL;
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self,
@@ -1624,6 +1656,8 @@ void cleanup_pipe(struct dt_iop_module_t *self,
     cmsDeleteTransform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
 
   free(piece->data);
   piece->data = NULL;
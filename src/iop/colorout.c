@@ -22,6 +22,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces.h"
 #include "common/colorspaces_inline_conversions.h"
+#include "common/colorspaces_lut3d.h"
 #include "common/dttypes.h"
 #include "common/imagebuf.h"
 #include "common/iop_profile.h"
@@ -55,6 +56,7 @@ typedef struct dt_iop_colorout_data_t
   float lut[3][LUT_SAMPLES];
   dt_colormatrix_t cmatrix;
   cmsHTRANSFORM *xform;
+  dt_colorspaces_lut3d_t *lut3d; // baked xform, NULL if not accurate enough
   float unbounded_coeffs[3][3]; // for extrapolation of shaper curves
 } dt_iop_colorout_data_t;
 
@@ -363,53 +365,13 @@ error:
 }
 #endif
 
-static void process_fastpath_apply_tonecurves(struct dt_iop_module_t *self,
-                                              dt_dev_pixelpipe_iop_t *piece,
-                                              void *const ovoid,
-                                              const dt_iop_roi_t *const roi_out)
-{
-  const dt_iop_colorout_data_t *const d = piece->data;
-
-  if(dt_is_valid_colormatrix(d->cmatrix[0][0]))
-  {
-    const size_t npixels = (size_t)roi_out->width * roi_out->height;
-    float *const restrict out = (float *const)ovoid;
-    // out is already converted to RGB from Lab.
-
-    // do we have any lut to apply, or is this a linear profile?
-    if((d->lut[0][0] >= 0.0f) && (d->lut[1][0] >= 0.0f) && (d->lut[2][0] >= 0.0f))
-    { // apply profile
-      DT_OMP_FOR()
-      for(size_t k = 0; k < 4 * npixels; k += 4)
-      {
-        for(int c = 0; c < 3; c++)
-        {
-          out[k + c] = (out[k + c] < 1.0f) ? _lerp_lut(d->lut[c], out[k + c])
-                                           : dt_iop_eval_exp(d->unbounded_coeffs[c], out[k + c]);
-        }
-      }
-    }
-    else if((d->lut[0][0] >= 0.0f) || (d->lut[1][0] >= 0.0f) || (d->lut[2][0] >= 0.0f))
-    { // apply profile
-      DT_OMP_FOR()
-      for(size_t k = 0; k < 4 * npixels; k += 4)
-      {
-        for(int c = 0; c < 3; c++)
-        {
-          if(d->lut[c][0] >= 0.0f)
-          {
-            out[k + c] = (out[k + c] < 1.0f) ? _lerp_lut(d->lut[c], out[k + c])
-                                             : dt_iop_eval_exp(d->unbounded_coeffs[c], out[k + c]);
-          }
-        }
-      }
-    }
-  }
-}
+// pixels per call of the lcms transform, bands are processed in place
+#define LCMS_CHUNK 256
 
-static void _transform_cmatrix_linear(const dt_iop_colorout_data_t *const d,
-                               float *restrict out,
-                               const float *restrict in,
+// the tone curves are applied in the same pass as the matrix
+static void _transform_cmatrix(const dt_iop_colorout_data_t *const d,
+                               const float *const in,
+                               float *const out,
                                const size_t npixels)
 {
   dt_colormatrix_t cmatrix;
@@ -418,7 +380,8 @@ static void _transform_cmatrix_linear(const dt_iop_colorout_data_t *const d,
   copy_pixel(cmatrix_0,cmatrix[0]);
   copy_pixel(cmatrix_1,cmatrix[1]);
   copy_pixel(cmatrix_2,cmatrix[2]);
-  DT_OMP_FOR()
+  // do we have any lut to apply, or is this a linear profile?
+  const gboolean curve[3] = { d->lut[0][0] >= 0.0f, d->lut[1][0] >= 0.0f, d->lut[2][0] >= 0.0f };
   for(size_t k = 0; k < npixels; k++)
   {
     // oddly, calling dt_Lab_to_linearRGB instead of doing the
@@ -430,125 +393,82 @@ static void _transform_cmatrix_linear(const dt_iop_colorout_data_t *const d,
     dt_aligned_pixel_t rgb;
     for_each_channel(r)
       rgb[r] = cmatrix_0[r] * XYZ[0] + cmatrix_1[r] * XYZ[1] + cmatrix_2[r] * XYZ[2];
-    copy_pixel_nontemporal(out + 4*k, rgb);
-  }
-  dt_omploop_sfence();
-}
-
-static void _transform_cmatrix_tonecurve(const dt_iop_colorout_data_t *const d,
-                                         float *restrict out,
-                                         const float *restrict in,
-                                         const size_t npixels)
-{
-  dt_colormatrix_t cmatrix;
-  transpose_3xSSE(d->cmatrix, cmatrix);
-  dt_aligned_pixel_t cmatrix_0, cmatrix_1, cmatrix_2;
-  copy_pixel(cmatrix_0,cmatrix[0]);
-  copy_pixel(cmatrix_1,cmatrix[1]);
-  copy_pixel(cmatrix_2,cmatrix[2]);
-  const float *const lut = &d->lut[0][0];
-  const float *coeffs = &d->unbounded_coeffs[0][0];
-  DT_OMP_FOR()
-  for(size_t k = 0; k < npixels; k++)
-  {
-    dt_aligned_pixel_t rgb; // using an aligned temporary variable lets the compiler optimize away interm. writes
-    dt_Lab_to_linearRGB(in + 4*k, cmatrix_0, cmatrix_1, cmatrix_2, rgb);
-    if(lut[0] >= 0.0f)
+    for(int c = 0; c < 3; c++)
     {
-      rgb[0] = (rgb[0] < 1.0f) ? _lerp_lut(lut, rgb[0])
-        : dt_iop_eval_exp(coeffs, rgb[0]);
+      if(curve[c])
+        rgb[c] = (rgb[c] < 1.0f) ? _lerp_lut(d->lut[c], rgb[c])
+                                 : dt_iop_eval_exp(d->unbounded_coeffs[c], rgb[c]);
     }
-    if(lut[LUT_SAMPLES] >= 0.0f)
-    {
-      rgb[1] = (rgb[1] < 1.0f) ? _lerp_lut(lut+LUT_SAMPLES, rgb[1])
-        : dt_iop_eval_exp(coeffs+3, rgb[1]);
-    }
-    if(lut[2*LUT_SAMPLES] >= 0.0f)
-    {
-      rgb[2] = (rgb[2] < 1.0f) ? _lerp_lut(lut+2*LUT_SAMPLES, rgb[2])
-        : dt_iop_eval_exp(coeffs+6, rgb[2]);
-    }
-    copy_pixel_nontemporal(out + 4*k, rgb);
+    copy_pixel(out + 4*k, rgb);
   }
-  dt_omploop_sfence();
 }
 
-static int _transform_cmatrix(const dt_iop_colorout_data_t *const d,
-                               float *restrict out,
-                               const float *restrict in,
-                               const size_t npixels)
+// exact transform, also used to bake d->lut3d
+static void _eval_lcms(const float *const in,
+                       float *const out,
+                       const size_t npixels,
+                       void *data)
 {
-  const gboolean is_linear = (d->lut[0][0] < 0.0f) || (d->lut[1][0] < 0.0f) || (d->lut[2][0] < 0.0f);
-//  const gboolean all_nonlin = (d->lut[0][0] >= 0.0f) || (d->lut[1][0] >= 0.0f) || (d->lut[2][0] >= 0.0f);
-  if(is_linear || 1) //TODO: integrate tonecurve in same pass as color matrix without major speed penalty
-  {
-    _transform_cmatrix_linear(d, out, in, npixels);
-  }
-  else
-  {
-    _transform_cmatrix_tonecurve(d, out, in, npixels);
-  }
-  return is_linear != 0; // not done if nonlinear, need to apply tonecurve
+  const dt_iop_colorout_data_t *const d = data;
+  cmsDoTransform(d->xform, in, out, npixels);
 }
 
 static void _transform_lcms(const dt_iop_colorout_data_t *const d,
-                            float *restrict out,
-                            const float *restrict in,
+                            const float *const in,
+                            float *const out,
                             const size_t npixels)
 {
-  const int gamutcheck = (d->mode == DT_PROFILE_GAMUTCHECK);
-  // figure out the number of pixels each thread needs to process,
-  // rounded up to a multiple of the CPU's cache line size
-  const size_t nthreads = dt_get_num_threads();
-  const size_t chunksize = dt_cacheline_chunks(npixels, nthreads);
-  DT_OMP_FOR()
-  for(size_t chunkstart = 0; chunkstart < npixels; chunkstart += chunksize)
+  const gboolean gamutcheck = (d->mode == DT_PROFILE_GAMUTCHECK);
+  static const dt_aligned_pixel_t cyan = { 0.0f, 1.0f, 1.0f, 0.0f };
+  // in and out may be the same buffer, go through a small one on the stack
+  dt_aligned_pixel_t tmp[LCMS_CHUNK];
+  for(size_t start = 0; start < npixels; start += LCMS_CHUNK)
   {
-    size_t count = MIN(chunkstart + chunksize, npixels) - chunkstart;
-    float *const outp = out + 4 * chunkstart;
+    const size_t count = MIN(LCMS_CHUNK, npixels - start);
+    const float *const inp = in + 4 * start;
+    for(size_t j = 0; j < count; j++)
+      tmp[j][3] = inp[4*j+3];
 
-    cmsDoTransform(d->xform, in + 4*chunkstart, outp, count);
+    if(d->lut3d)
+      dt_colorspaces_lut3d_apply(d->lut3d, inp, &tmp[0][0], count, _eval_lcms, (void *)d);
+    else
+      cmsDoTransform(d->xform, inp, tmp, count);
 
-    if(gamutcheck)
+    for(size_t j = 0; j < count; j++)
     {
-      static const dt_aligned_pixel_t cyan = { 0.0f, 1.0f, 1.0f, 0.0f };
-      for(int j = 0; j < count; j++)
-      {
-        if(outp[4*j+0] < 0.0f || outp[4*j+1] < 0.0f || outp[4*j+2] < 0.0f)
-        {
-          copy_pixel_nontemporal(outp + 4*j, cyan);
-        }
-      }
+      if(gamutcheck && (tmp[j][0] < 0.0f || tmp[j][1] < 0.0f || tmp[j][2] < 0.0f))
+        copy_pixel(out + 4 * (start + j), cyan);
+      else
+        copy_pixel(out + 4 * (start + j), tmp[j]);
     }
   }
-  dt_omploop_sfence();
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels(struct dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const float *const in,
+                    float *const out,
+                    const size_t npixels)
 {
-  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/, self, piece->colors,
-                                         ivoid, ovoid, roi_in, roi_out))
-    return;
   const dt_iop_colorout_data_t *const d = piece->data;
-  const size_t width = roi_out->width;
-  const size_t height = roi_out->height;
-  const size_t npixels = width * height;
-  float *const restrict out = (float *)ovoid;
 
   if(d->type == DT_COLORSPACE_LAB)
   {
-    dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, piece->colors);
+    if(in != out) memcpy(out, in, sizeof(float) * 4 * npixels);
   }
   else if(dt_is_valid_colormatrix(d->cmatrix[0][0]))
-  {
-    if (!_transform_cmatrix(d, out, (float*)ivoid, npixels))
-      process_fastpath_apply_tonecurves(self, piece, ovoid, roi_out);
-  }
+    _transform_cmatrix(d, in, out, npixels);
   else
-  {
-    _transform_lcms(d, out, (float*)ivoid, npixels);
-  }
+    _transform_lcms(d, in, out, npixels);
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/, self, piece->colors,
+                                         ivoid, ovoid, roi_in, roi_out))
+    return;
+  dt_iop_process_pixels(self, piece, (const float *)ivoid, (float *)ovoid, roi_out);
 }
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
@@ -578,6 +498,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     cmsDeleteTransform(d->xform);
     d->xform = NULL;
   }
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
   dt_mark_colormatrix_invalid(&d->cmatrix[0][0]);
   d->lut[0][0] = -1.0f;
   d->lut[1][0] = -1.0f;
@@ -734,9 +656,35 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     }
   }
 
+  // LUT based output profiles and softproofing go through lcms, try to replace that by a
+  // baked LUT. gamut check needs the exact out of gamut markers and force_lcms2 asks for
+  // the exact transform, so both keep using lcms.
+  dt_hash_t lut3d_hash = DT_INITHASH;
+  const gboolean want_lut3d = d->xform && d->mode != DT_PROFILE_GAMUTCHECK && !force_lcms2;
+  if(want_lut3d)
+  {
+    // hash the profiles while the display profile is still locked
+    lut3d_hash = dt_hash(lut3d_hash, "colorout", 8);
+    lut3d_hash = dt_colorspaces_lut3d_hash_profile(lut3d_hash, output);
+    lut3d_hash = dt_colorspaces_lut3d_hash_profile(lut3d_hash, softproof);
+    lut3d_hash = dt_hash(lut3d_hash, &out_intent, sizeof(out_intent));
+    lut3d_hash = dt_hash(lut3d_hash, &transformFlags, sizeof(transformFlags));
+    lut3d_hash = dt_hash(lut3d_hash, &output_format, sizeof(output_format));
+  }
+
   if(out_type == DT_COLORSPACE_DISPLAY || out_type == DT_COLORSPACE_DISPLAY2)
     pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
 
+  if(want_lut3d)
+  {
+    const dt_aligned_pixel_t domain_min = { 0.0f, -128.0f, -128.0f, 0.0f };
+    const dt_aligned_pixel_t domain_max = { 100.0f, 128.0f, 128.0f, 0.0f };
+    // half an 8 bit code value
+    d->lut3d = dt_colorspaces_lut3d_get(lut3d_hash, domain_min, domain_max,
+                                        DT_COLORSPACES_LUT3D_SHAPER_LINEAR, 1.0f / 512.0f,
+                                        _eval_lcms, d);
+  }
+
   // now try to initialize unbounded mode:
   // we do extrapolation for input values above 1.0f.
   // unfortunately we can only do this if we got the computation
@@ -778,6 +726,8 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
     cmsDeleteTransform(d->xform);
     d->xform = NULL;
   }
+  dt_colorspaces_lut3d_release(d->lut3d);
+  d->lut3d = NULL;
 
   free(piece->data);
   piece->data = NULL;
@@ -94,7 +94,7 @@ int default_group()
 int flags()
 {
   // a second instance might help to reduce artifacts when thick fringe needs to be removed
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_IMAGE_STATISTICS;
 }
 
 const char *deprecated_msg()
@@ -126,6 +126,119 @@ static inline float _xdivf(float d, int n)
 ////////////////////////////////////////////////////////////////
 
 
+// this allows to pass AMAZETS to the code. On some machines larger AMAZETS is faster
+// If AMAZETS is undefined it will be set to 160, which is the fastest on modern x86/64 machines
+#ifndef AMAZETS
+#define AMAZETS 160
+#endif
+// Tile size; the image is processed in square tiles to lower memory requirements and facilitate
+// multi-threading
+// We assure that Tile size is a multiple of 32 in the range [96;992]
+static constexpr int ts = (AMAZETS & 992) < 96 ? 96 : (AMAZETS & 992);
+static constexpr int tsh = ts / 2; // half of Tile size
+
+// The two passes below have no data dependent branches or neighbourhoods,
+// they are kept out of the tile loop so they can be cloned for the
+// available instruction sets and vectorized.
+
+// horizontal and vertical gradients
+__DT_CLONE_TARGETS__
+static void _amaze_gradients(const float *const __restrict__ cfa,
+                             float *const __restrict__ dirwts0,
+                             float *const __restrict__ dirwts1,
+                             float *const __restrict__ delhvsqsum,
+                             const int rr1,
+                             const int cc1)
+{
+  constexpr int v1 = ts, v2 = 2 * ts;
+  constexpr float eps = 1e-5;
+
+  for(int rr = 2; rr < rr1 - 2; rr++)
+  {
+    DT_OMP_SIMD()
+    for(int cc = 2; cc < cc1 - 2; cc++)
+    {
+      const int indx = rr * ts + cc;
+      const float delh = fabsf(cfa[indx + 1] - cfa[indx - 1]);
+      const float delv = fabsf(cfa[indx + v1] - cfa[indx - v1]);
+      dirwts0[indx]
+          = eps + fabsf(cfa[indx + v2] - cfa[indx]) + fabsf(cfa[indx] - cfa[indx - v2]) + delv;
+      dirwts1[indx] = eps + fabsf(cfa[indx + 2] - cfa[indx]) + fabsf(cfa[indx] - cfa[indx - 2]) + delh;
+      delhvsqsum[indx] = sqrf(delh) + sqrf(delv);
+    }
+  }
+}
+
+// adaptive weights for horizontal vs vertical G interpolation at R/B sites
+__DT_CLONE_TARGETS__
+static void _amaze_direction_weights(const float *const __restrict__ vcd,
+                                     const float *const __restrict__ hcd,
+                                     const float *const __restrict__ dgintv,
+                                     const float *const __restrict__ dginth,
+                                     const float *const __restrict__ dirwts0,
+                                     const float *const __restrict__ dirwts1,
+                                     float *const __restrict__ hvwt,
+                                     const uint32_t filters,
+                                     const int rr1,
+                                     const int cc1)
+{
+  constexpr int v1 = ts, v2 = 2 * ts, v3 = 3 * ts;
+  constexpr float epssq = 1e-10;
+
+  for(int rr = 6; rr < rr1 - 6; rr++)
+  {
+    const int cc0 = 6 + (FC(rr, 2, filters) & 1);
+    DT_OMP_SIMD()
+    for(int cc = cc0; cc < cc1 - 6; cc += 2)
+    {
+      const int indx = rr * ts + cc;
+
+      // compute colour difference variances in cardinal directions
+
+      const float uave = vcd[indx] + vcd[indx - v1] + vcd[indx - v2] + vcd[indx - v3];
+      const float dave = vcd[indx] + vcd[indx + v1] + vcd[indx + v2] + vcd[indx + v3];
+      const float lave = hcd[indx] + hcd[indx - 1] + hcd[indx - 2] + hcd[indx - 3];
+      const float rave = hcd[indx] + hcd[indx + 1] + hcd[indx + 2] + hcd[indx + 3];
+
+      // colour difference (G-R or G-B) variance in up/down/left/right directions
+      float Dgrbvvaru = sqrf(vcd[indx] - uave) + sqrf(vcd[indx - v1] - uave) + sqrf(vcd[indx - v2] - uave)
+                        + sqrf(vcd[indx - v3] - uave);
+      float Dgrbvvard = sqrf(vcd[indx] - dave) + sqrf(vcd[indx + v1] - dave) + sqrf(vcd[indx + v2] - dave)
+                        + sqrf(vcd[indx + v3] - dave);
+      float Dgrbhvarl = sqrf(hcd[indx] - lave) + sqrf(hcd[indx - 1] - lave) + sqrf(hcd[indx - 2] - lave)
+                        + sqrf(hcd[indx - 3] - lave);
+      float Dgrbhvarr = sqrf(hcd[indx] - rave) + sqrf(hcd[indx + 1] - rave) + sqrf(hcd[indx + 2] - rave)
+                        + sqrf(hcd[indx + 3] - rave);
+
+      const float hwt = dirwts1[indx - 1] / (dirwts1[indx - 1] + dirwts1[indx + 1]);
+      const float vwt = dirwts0[indx - v1] / (dirwts0[indx + v1] + dirwts0[indx - v1]);
+
+      const float vcdvar = epssq + vwt * Dgrbvvard + (1.f - vwt) * Dgrbvvaru;
+      const float hcdvar = epssq + hwt * Dgrbhvarr + (1.f - hwt) * Dgrbhvarl;
+
+      // compute fluctuations in up/down and left/right interpolations of colours
+      Dgrbvvaru = (dgintv[indx]) + (dgintv[indx - v1]) + (dgintv[indx - v2]);
+      Dgrbvvard = (dgintv[indx]) + (dgintv[indx + v1]) + (dgintv[indx + v2]);
+      Dgrbhvarl = (dginth[indx]) + (dginth[indx - 1]) + (dginth[indx - 2]);
+      Dgrbhvarr = (dginth[indx]) + (dginth[indx + 1]) + (dginth[indx + 2]);
+
+      const float vcdvar1 = epssq + vwt * Dgrbvvard + (1.f - vwt) * Dgrbvvaru;
+      const float hcdvar1 = epssq + hwt * Dgrbhvarr + (1.f - hwt) * Dgrbhvarl;
+
+      // determine adaptive weights for G interpolation
+      const float varwt = hcdvar / (vcdvar + hcdvar);
+      const float diffwt = hcdvar1 / (vcdvar1 + hcdvar1);
+
+      // if both agree on interpolation direction, choose the one with strongest directional
+      // discrimination;
+      // otherwise, choose the u/d and l/r difference fluctuation weights
+      hvwt[indx >> 1] = ((0.5 - varwt) * (0.5 - diffwt) > 0 && fabsf(0.5f - diffwt) < fabsf(0.5f - varwt))
+                        ? varwt
+                        : diffwt;
+    }
+  }
+}
+
 void amaze_demosaic(dt_dev_pixelpipe_iop_t *piece,
                        const float *const in,
                        float *out,
@@ -142,16 +255,6 @@ void amaze_demosaic(dt_dev_pixelpipe_iop_t *piece,
   const float clip_pt = dt_iop_get_processed_minimum(piece);
   const float clip_pt8 = 0.8f * clip_pt;
 
-// this allows to pass AMAZETS to the code. On some machines larger AMAZETS is faster
-// If AMAZETS is undefined it will be set to 160, which is the fastest on modern x86/64 machines
-#ifndef AMAZETS
-#define AMAZETS 160
-#endif
-  // Tile size; the image is processed in square tiles to lower memory requirements and facilitate
-  // multi-threading
-  // We assure that Tile size is a multiple of 32 in the range [96;992]
-  constexpr int ts = (AMAZETS & 992) < 96 ? 96 : (AMAZETS & 992);
-  constexpr int tsh = ts / 2; // half of Tile size
 
   // offset of R pixel within a Bayer quartet
   int ex, ey;
@@ -185,7 +288,7 @@ void amaze_demosaic(dt_dev_pixelpipe_iop_t *piece,
   }
 
   // shifts of pointer value to access pixels in vertical and diagonal directions
-  constexpr int v1 = ts, v2 = 2 * ts, v3 = 3 * ts, p1 = -ts + 1, p2 = -2 * ts + 2, p3 = -3 * ts + 3,
+  constexpr int v1 = ts, v2 = 2 * ts, p1 = -ts + 1, p2 = -2 * ts + 2, p3 = -3 * ts + 3,
                 m1 = ts + 1, m2 = 2 * ts + 2, m3 = 3 * ts + 3;
 
   // tolerance to avoid dividing by zero
@@ -404,16 +507,7 @@ void amaze_demosaic(dt_dev_pixelpipe_iop_t *piece,
 // end of tile initialization
 
 // horizontal and vertical gradients
-        for(int rr = 2; rr < rr1 - 2; rr++)
-          for(int cc = 2, indx = (rr)*ts + cc; cc < cc1 - 2; cc++, indx++)
-          {
-            const float delh = fabsf(cfa[indx + 1] - cfa[indx - 1]);
-            const float delv = fabsf(cfa[indx + v1] - cfa[indx - v1]);
-            dirwts0[indx]
-                = eps + fabsf(cfa[indx + v2] - cfa[indx]) + fabsf(cfa[indx] - cfa[indx - v2]) + delv;
-            dirwts1[indx] = eps + fabsf(cfa[indx + 2] - cfa[indx]) + fabsf(cfa[indx] - cfa[indx - 2]) + delh;
-            delhvsqsum[indx] = sqrf(delh) + sqrf(delv);
-          }
+        _amaze_gradients(cfa, dirwts0, dirwts1, delhvsqsum, rr1, cc1);
 
 // interpolate vertical and horizontal colour differences
 
@@ -646,60 +740,7 @@ void amaze_demosaic(dt_dev_pixelpipe_iop_t *piece,
         }
 
 
-        for(int rr = 6; rr < rr1 - 6; rr++)
-        {
-          for(int cc = 6 + (FC(rr, 2, filters) & 1), indx = rr * ts + cc; cc < cc1 - 6; cc += 2, indx += 2)
-          {
-
-            // compute colour difference variances in cardinal directions
-
-            const float uave = vcd[indx] + vcd[indx - v1] + vcd[indx - v2] + vcd[indx - v3];
-            const float dave = vcd[indx] + vcd[indx + v1] + vcd[indx + v2] + vcd[indx + v3];
-            const float lave = hcd[indx] + hcd[indx - 1] + hcd[indx - 2] + hcd[indx - 3];
-            const float rave = hcd[indx] + hcd[indx + 1] + hcd[indx + 2] + hcd[indx + 3];
-
-            // colour difference (G-R or G-B) variance in up/down/left/right directions
-            float Dgrbvvaru = sqrf(vcd[indx] - uave) + sqrf(vcd[indx - v1] - uave) + sqrf(vcd[indx - v2] - uave)
-                              + sqrf(vcd[indx - v3] - uave);
-            float Dgrbvvard = sqrf(vcd[indx] - dave) + sqrf(vcd[indx + v1] - dave) + sqrf(vcd[indx + v2] - dave)
-                              + sqrf(vcd[indx + v3] - dave);
-            float Dgrbhvarl = sqrf(hcd[indx] - lave) + sqrf(hcd[indx - 1] - lave) + sqrf(hcd[indx - 2] - lave)
-                              + sqrf(hcd[indx - 3] - lave);
-            float Dgrbhvarr = sqrf(hcd[indx] - rave) + sqrf(hcd[indx + 1] - rave) + sqrf(hcd[indx + 2] - rave)
-                              + sqrf(hcd[indx + 3] - rave);
-
-            const float hwt = dirwts1[indx - 1] / (dirwts1[indx - 1] + dirwts1[indx + 1]);
-            const float vwt = dirwts0[indx - v1] / (dirwts0[indx + v1] + dirwts0[indx - v1]);
-
-            const float vcdvar = epssq + vwt * Dgrbvvard + (1.f - vwt) * Dgrbvvaru;
-            const float hcdvar = epssq + hwt * Dgrbhvarr + (1.f - hwt) * Dgrbhvarl;
-
-            // compute fluctuations in up/down and left/right interpolations of colours
-            Dgrbvvaru = (dgintv[indx]) + (dgintv[indx - v1]) + (dgintv[indx - v2]);
-            Dgrbvvard = (dgintv[indx]) + (dgintv[indx + v1]) + (dgintv[indx + v2]);
-            Dgrbhvarl = (dginth[indx]) + (dginth[indx - 1]) + (dginth[indx - 2]);
-            Dgrbhvarr = (dginth[indx]) + (dginth[indx + 1]) + (dginth[indx + 2]);
-
-            float vcdvar1 = epssq + vwt * Dgrbvvard + (1.f - vwt) * Dgrbvvaru;
-            float hcdvar1 = epssq + hwt * Dgrbhvarr + (1.f - hwt) * Dgrbhvarl;
-
-            // determine adaptive weights for G interpolation
-            const float varwt = hcdvar / (vcdvar + hcdvar);
-            const float diffwt = hcdvar1 / (vcdvar1 + hcdvar1);
-
-            // if both agree on interpolation direction, choose the one with strongest directional
-            // discrimination;
-            // otherwise, choose the u/d and l/r difference fluctuation weights
-            if((0.5 - varwt) * (0.5 - diffwt) > 0 && fabsf(0.5f - diffwt) < fabsf(0.5f - varwt))
-            {
-              hvwt[indx >> 1] = varwt;
-            }
-            else
-            {
-              hvwt[indx >> 1] = diffwt;
-            }
-          }
-        }
+        _amaze_direction_weights(vcd, hcd, dgintv, dginth, dirwts0, dirwts1, hvwt, filters, rr1, cc1);
 
         // precompute nyquist
         for(int rr = 6; rr < rr1 - 6; rr++)
@@ -18,8 +18,10 @@
 
 // xtrans_interpolate adapted from dcraw 9.20
 
-// tile size, optimized to keep data in L2 cache
-#define TS 122
+// limits of the Markesteijn tile size, within them the rgb planes of a
+// tile are sized to stay in the L2 cache
+#define MARKESTEIJN_TS_MIN 96
+#define MARKESTEIJN_TS_MAX 256
 
 /** Lookup for allhex[], making sure that row/col aren't negative **/
 static inline const short *_hexmap(
@@ -37,21 +39,297 @@ static inline const short *_hexmap(
   return allhex[irow % 3][icol % 3];
 }
 
+// Every step of a pass reads the 4 rgb planes of that pass, all other
+// planes reuse memory or are only touched by a single step. Small tiles
+// spend more time on the overlapping borders, hence the lower limit.
+// The interpolation of red and blue tells a row from a column offset
+// by its parity, so the size must be even.
+static int _markesteijn_tile_size(void)
+{
+  const int ts = sqrtf((float)dt_get_l2_cache_size() / (4 * 3 * sizeof(float)));
+  return CLAMP(ts & ~1, MARKESTEIJN_TS_MIN, MARKESTEIJN_TS_MAX);
+}
+
 /*
-   Frank Markesteijn's algorithm for Fuji X-Trans sensors
+   The per-tile passes of Markesteijn after the colour interpolation
+   work on plain ts x ts planes with fixed neighbourhoods, so they are
+   written as straight row loops the compiler can vectorize, and cloned
+   for the available instruction sets.
 */
-static void xtrans_markesteijn_interpolate(
+
+/* Interpolate green horizontally, vertically, and along both diagonals: */
+// The CFA repeats every 6 columns and the hexagons every 3, so a row is
+// done in 6 column phases with a fixed colour f and fixed hexagon
+// offsets. Only greens are read, so the order of the writes does not
+// matter.
+__DT_CLONE_TARGETS__
+static void _markesteijn_green(
+        float (*const rgb)[3],
+        const float *const gmin,
+        const float *const gmax,
+        const int ts,
+        const int d0,
+        const short *const hex,
+        const int f,
+        const int start,
+        const int end)
+{
+  const size_t ts2 = (size_t)ts * ts;
+  const int h0 = hex[0], h1 = hex[1], h2 = hex[2], h3 = hex[3], h4 = hex[4], h5 = hex[5];
+  for(int i = start; i < end; i += 6)
+  {
+    const float (*const pix)[3] = rgb + i;
+    float color[4];
+    // TODO: these constants come from integer math constants in
+    // dcraw -- calculate them instead from interpolation math
+    color[0] = 0.6796875f * (pix[h1][1] + pix[h0][1])
+               - 0.1796875f * (pix[2 * h1][1] + pix[2 * h0][1]);
+    color[1] = 0.87109375f * pix[h3][1] + pix[h2][1] * 0.13f
+               + 0.359375f * (pix[0][f] - pix[-h2][f]);
+    color[2] = 0.640625f * pix[h4][1] + 0.359375f * pix[-2 * h4][1]
+               + 0.12890625f * (2 * pix[0][f] - pix[3 * h4][f] - pix[-3 * h4][f]);
+    color[3] = 0.640625f * pix[h5][1] + 0.359375f * pix[-2 * h5][1]
+               + 0.12890625f * (2 * pix[0][f] - pix[3 * h5][f] - pix[-3 * h5][f]);
+    for(int c = 0; c < 4; c++)
+      rgb[(c ^ d0) * ts2 + i][1] = CLAMPS(color[c], gmin[i], gmax[i]);
+  }
+}
+
+/* Recalculate green from interpolated values of closer pixels: */
+// same column phases as above
+__DT_CLONE_TARGETS__
+static void _markesteijn_recalc_green(
+        float (*const rgb)[3],
+        const float *const gmin,
+        const float *const gmax,
+        const int ts,
+        const int d0,
+        const short *const hex,
+        const int f,
+        const int start,
+        const int end)
+{
+  const size_t ts2 = (size_t)ts * ts;
+  for(int i = start; i < end; i += 6)
+    for(int d = 3; d < 6; d++)
+    {
+      float (*const rfx)[3] = rgb + ((d - 2) ^ d0) * ts2 + i;
+      const int h = hex[d];
+      const float val = rfx[-2 * h][1] + 2 * rfx[h][1] - rfx[-2 * h][f]
+                        - 2 * rfx[h][f] + 3 * rfx[0][f];
+      rfx[0][1] = CLAMPS(val / 3.0f, gmin[i], gmax[i]);
+    }
+}
+
+/* Convert to perceptual colorspace and differentiate in all directions:  */
+// Original dcraw algorithm uses CIELab as perceptual space (presumably
+// coming from original AHD) and converts taking camera matrix into
+// account. Now use YPbPr which requires much less code and is nearly
+// indistinguishable. It assumes the camera RGB is roughly linear.
+__DT_CLONE_TARGETS__
+static void _markesteijn_derivatives(
+        const float (*const rgb)[3],
+        float *const yuv,
+        float *const drv,
+        const int ts,
+        const unsigned ndir,
+        const int mrow,
+        const int mcol,
+        const int passes)
+{
+  const size_t ts2 = (size_t)ts * ts;
+  const int dir[4] = { 1, ts, ts + 1, ts - 1 };
+  const int pad_yuv = (passes == 1) ? 8 : 13;
+  const int pad_drv = (passes == 1) ? 9 : 14;
+
+  for(unsigned d = 0; d < ndir; ++d)
+  {
+    for(int row = pad_yuv; row < mrow - pad_yuv; row++)
+    {
+      const float (*const rx)[3] = rgb + d * ts2 + (size_t)row * ts;
+      float *const restrict y0 = yuv + (size_t)row * ts;
+      float *const restrict y1 = y0 + ts2;
+      float *const restrict y2 = y0 + 2 * ts2;
+      DT_OMP_SIMD()
+      for(int col = pad_yuv; col < mcol - pad_yuv; col++)
+      {
+        // use ITU-R BT.2020 YPbPr, which is great, but could use
+        // a better/simpler choice? note that imageop.h provides
+        // dt_iop_RGB_to_YCbCr which uses Rec. 601 conversion,
+        // which appears less good with specular highlights
+        const float y = 0.2627f * rx[col][0] + 0.6780f * rx[col][1] + 0.0593f * rx[col][2];
+        y0[col] = y;
+        y1[col] = (rx[col][2] - y) * 0.56433f;
+        y2[col] = (rx[col][0] - y) * 0.67815f;
+      }
+    }
+    // f can offset by a column (-1 or +1) and by a row (-ts or ts),
+    // the planes have enough padding for both
+    const int f = dir[d & 3];
+    for(int row = pad_drv; row < mrow - pad_drv; row++)
+    {
+      const float *const y0 = yuv + (size_t)row * ts;
+      const float *const y1 = y0 + ts2;
+      const float *const y2 = y0 + 2 * ts2;
+      float *const restrict dx = drv + d * ts2 + (size_t)row * ts;
+      DT_OMP_SIMD()
+      for(int col = pad_drv; col < mcol - pad_drv; col++)
+        dx[col] = sqrf(2 * y0[col] - y0[col + f] - y0[col - f])
+                  + sqrf(2 * y1[col] - y1[col + f] - y1[col - f])
+                  + sqrf(2 * y2[col] - y2[col + f] - y2[col - f]);
+    }
+  }
+}
+
+/* Build homogeneity maps from the derivatives:                   */
+// each direction counts the 3x3 neighbours whose derivative stays
+// within 8 times the smallest derivative of the pixel
+__DT_CLONE_TARGETS__
+static void _markesteijn_homogeneity(
+        const float *const drv,
+        uint8_t *const homo,
+        const int ts,
+        const unsigned ndir,
+        const int mrow,
+        const int mcol,
+        const int passes)
+{
+  const size_t ts2 = (size_t)ts * ts;
+  const int pad_homo = (passes == 1) ? 10 : 15;
+  memset(homo, 0, sizeof(uint8_t) * ndir * ts2);
+  for(int row = pad_homo; row < mrow - pad_homo; row++)
+  {
+    const size_t r = (size_t)row * ts;
+    float tr[MARKESTEIJN_TS_MAX];
+    DT_OMP_SIMD()
+    for(int col = pad_homo; col < mcol - pad_homo; col++)
+    {
+      float t = FLT_MAX;
+      for(unsigned d = 0; d < ndir; ++d)
+        t = (t > drv[d * ts2 + r + col]) ? drv[d * ts2 + r + col] : t;
+      tr[col] = t * 8;
+    }
+    for(unsigned d = 0; d < ndir; ++d)
+    {
+      const float *const here = drv + d * ts2 + r;
+      const float *const above = here - ts;
+      const float *const below = here + ts;
+      uint8_t *const restrict hm = homo + d * ts2 + r;
+      DT_OMP_SIMD()
+      for(int col = pad_homo; col < mcol - pad_homo; col++)
+      {
+        const float t = tr[col];
+        hm[col] = (above[col - 1] <= t) + (above[col] <= t) + (above[col + 1] <= t)
+                + (here[col - 1] <= t) + (here[col] <= t) + (here[col + 1] <= t)
+                + (below[col - 1] <= t) + (below[col] <= t) + (below[col + 1] <= t);
+      }
+    }
+  }
+}
+
+/* Build 5x5 sum of homogeneity maps for each pixel & direction */
+// the maps are zero outside of their padding and a sum never exceeds
+// 225, so the box sums fit into uint8_t
+__DT_CLONE_TARGETS__
+static void _markesteijn_homosum(
+        const uint8_t *const homo,
+        uint8_t *const homosum,
+        const int ts,
+        const unsigned ndir,
+        const int mrow,
+        const int mcol,
+        const int pad_tile)
+{
+  const size_t ts2 = (size_t)ts * ts;
+  for(unsigned d = 0; d < ndir; ++d)
+    for(int row = pad_tile; row < mrow - pad_tile; row++)
+    {
+      const uint8_t *const hm = homo + d * ts2 + (size_t)row * ts;
+      uint8_t colsum[MARKESTEIJN_TS_MAX];
+      DT_OMP_SIMD()
+      for(int col = pad_tile - 2; col < mcol - pad_tile + 2; col++)
+        colsum[col] = hm[col - 2 * ts] + hm[col - ts] + hm[col] + hm[col + ts] + hm[col + 2 * ts];
+      uint8_t *const restrict hs = homosum + d * ts2 + (size_t)row * ts;
+      DT_OMP_SIMD()
+      for(int col = pad_tile; col < mcol - pad_tile; col++)
+        hs[col] = colsum[col - 2] + colsum[col - 1] + colsum[col] + colsum[col + 1] + colsum[col + 2];
+    }
+}
+
+/* Average the most homogeneous pixels for the final result:       */
+// A direction takes part if its homogeneity is within 1/8 of the best
+// one; of the two passes for the same direction only the more
+// homogeneous survives.
+__DT_CLONE_TARGETS__
+static void _markesteijn_select(
+        float *const out,
+        const float (*const rgb)[3],
+        const uint8_t *const homosum,
+        const int ts,
+        const unsigned ndir,
+        const int width,
+        const int top,
+        const int left,
+        const int mrow,
+        const int mcol,
+        const int pad_tile)
+{
+  const size_t ts2 = (size_t)ts * ts;
+  for(int row = pad_tile; row < mrow - pad_tile; row++)
+  {
+    const size_t r = (size_t)row * ts;
+    uint8_t maxval[MARKESTEIJN_TS_MAX];
+    float avg[4][MARKESTEIJN_TS_MAX];
+    DT_OMP_SIMD()
+    for(int col = pad_tile; col < mcol - pad_tile; col++)
+    {
+      uint8_t m = 0;
+      for(unsigned d = 0; d < ndir; ++d)
+        m = MAX(m, homosum[d * ts2 + r + col]);
+      maxval[col] = m - (m >> 3);
+      for(int c = 0; c < 4; c++) avg[c][col] = 0.0f;
+    }
+    for(unsigned d = 0; d < ndir; ++d)
+    {
+      const uint8_t *const hs = homosum + d * ts2 + r;
+      // with 8 directions d and d^4 are the same direction of both passes
+      const uint8_t *const opp = homosum + (ndir > 4 ? d ^ 4 : d) * ts2 + r;
+      const float (*const px)[3] = rgb + d * ts2 + r;
+      DT_OMP_SIMD()
+      for(int col = pad_tile; col < mcol - pad_tile; col++)
+      {
+        const uint8_t hm = hs[col] < opp[col] ? 0 : hs[col];
+        const gboolean use = hm >= maxval[col];
+        avg[0][col] += use ? px[col][0] : 0.0f;
+        avg[1][col] += use ? px[col][1] : 0.0f;
+        avg[2][col] += use ? px[col][2] : 0.0f;
+        avg[3][col] += use ? 1.0f : 0.0f;
+      }
+    }
+    float *const o = out + 4 * ((size_t)width * (row + top) + left);
+    DT_OMP_SIMD()
+    for(int col = pad_tile; col < mcol - pad_tile; col++)
+      for(int c = 0; c < 3; c++)
+        o[4 * col + c] = avg[c][col] / avg[3][col];
+  }
+}
+
+/*
+   Frank Markesteijn's algorithm for Fuji X-Trans sensors,
+   on tiles of ts x ts pixels
+*/
+static void _xtrans_markesteijn_interpolate(
         float *out,
         const float *const in,
         const dt_iop_roi_t *const roi_out,
         const dt_iop_roi_t *const roi_in,
         const uint8_t (*const xtrans)[6],
-        const int passes)
+        const int passes,
+        const int ts)
 {
   static const short orth[12] = { 1, 0, 0, 1, -1, 0, 0, -1, 1, 0, 0, 1 },
                      patt[2][16] = { { 0, 1, 0, -1, 2, 0, -1, 0, 1, 1, 1, -1, 0, 0, 0, 0 },
-                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } },
-                     dir[4] = { 1, TS, TS + 1, TS - 1 };
+                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } };
 
   short allhex[3][3][8];
   // sgrow/sgcol is the offset in the sensor matrix of the solitary
@@ -61,8 +339,9 @@ static void xtrans_markesteijn_interpolate(
   const int width = roi_out->width;
   const int height = roi_out->height;
   const unsigned ndir = 4 << (passes > 1);
+  const size_t ts2 = (size_t)ts * ts;
 
-  const size_t buffer_size = (size_t)TS * TS * (ndir * 4 + 3) * sizeof(float);
+  const size_t buffer_size = ts2 * (ndir * 4 + 3) * sizeof(float);
   size_t padded_buffer_size;
   char *const all_buffers = (char *)dt_alloc_perthread(buffer_size, sizeof(char), &padded_buffer_size);
   if(!all_buffers)
@@ -93,41 +372,40 @@ static void xtrans_markesteijn_interpolate(
           {
             const int v = orth[d] * patt[g][c * 2] + orth[d + 1] * patt[g][c * 2 + 1];
             const int h = orth[d + 2] * patt[g][c * 2] + orth[d + 3] * patt[g][c * 2 + 1];
-            // offset within TSxTS buffer
-            allhex[row][col][c ^ (g * 2 & d)] = h + v * TS;
+            // offset within the ts x ts buffer
+            allhex[row][col][c ^ (g * 2 & d)] = h + v * ts;
           }
       }
 
   // extra passes propagates out errors at edges, hence need more padding
   const int pad_tile = (passes == 1) ? 12 : 17;
   DT_OMP_FOR()
-  // step through TSxTS cells of image, each tile overlapping the
+  // step through ts x ts cells of image, each tile overlapping the
   // prior as interpolation needs a substantial border
-  for(int top = -pad_tile; top < height - pad_tile; top += TS - (pad_tile*2))
+  for(int top = -pad_tile; top < height - pad_tile; top += ts - (pad_tile*2))
   {
     char *const buffer = dt_get_perthread(all_buffers, padded_buffer_size);
-    // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
-    float(*rgb)[TS][TS][3] = (float(*)[TS][TS][3])buffer;
-    // yuv points to 3 channel (Y, u, and v) TSxTS tiles
+    // rgb points to ndir ts x ts tiles of 3 channels (R, G, and B)
+    float (*rgb)[3] = (float(*)[3])buffer;
+    // yuv points to 3 channel (Y, u, and v) ts x ts tiles
     // note that channels come before tiles to allow for a
     // vectorization optimization when building drv[] from yuv[]
-    float (*const yuv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    // drv points to ndir TSxTS tiles, each a single channel of derivatives
-    float (*const drv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3 + 3) * sizeof(float));
+    float *const yuv = (float *)(buffer + ts2 * (ndir * 3) * sizeof(float));
+    // drv points to ndir ts x ts tiles, each a single channel of derivatives
+    float *const drv = (float *)(buffer + ts2 * (ndir * 3 + 3) * sizeof(float));
     // gmin and gmax reuse memory which is used later by yuv buffer;
-    // each points to a TSxTS tile of single channel data
-    float (*const gmin)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    float (*const gmax)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3 + 1) * sizeof(float));
+    // each points to a ts x ts tile of single channel data
+    float *const gmin = (float *)(buffer + ts2 * (ndir * 3) * sizeof(float));
+    float *const gmax = (float *)(buffer + ts2 * (ndir * 3 + 1) * sizeof(float));
     // homo and homosum reuse memory which is used earlier in the
-    // loop; each points to ndir single-channel TSxTS tiles
-    uint8_t (*const homo)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    uint8_t (*const homosum)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float)
-                                                            + TS * TS * ndir * sizeof(uint8_t));
+    // loop; each points to ndir single-channel ts x ts tiles
+    uint8_t *const homo = (uint8_t *)(buffer + ts2 * (ndir * 3) * sizeof(float));
+    uint8_t *const homosum = homo + ts2 * ndir;
 
-    for(int left = -pad_tile; left < width - pad_tile; left += TS - (pad_tile*2))
+    for(int left = -pad_tile; left < width - pad_tile; left += ts - (pad_tile*2))
     {
-      int mrow = MIN(top + TS, height + pad_tile);
-      int mcol = MIN(left + TS, width + pad_tile);
+      int mrow = MIN(top + ts, height + pad_tile);
+      int mcol = MIN(left + ts, width + pad_tile);
 
       // Copy current tile from in to image buffer. If border goes
       // beyond edges of image, fill with mirrored/interpolated edges.
@@ -135,7 +413,7 @@ static void xtrans_markesteijn_interpolate(
       for(int row = top; row < mrow; row++)
         for(int col = left; col < mcol; col++)
         {
-          float(*const pix) = rgb[0][row - top][col - left];
+          float *const pix = rgb[(size_t)(row - top) * ts + col - left];
           if((col >= 0) && (row >= 0) && (col < width) && (row < height))
           {
             const int f = FCxtrans(row, col, roi_in, xtrans);
@@ -179,7 +457,7 @@ static void xtrans_markesteijn_interpolate(
         }
 
       // duplicate rgb[0] to rgb[1], rgb[2], and rgb[3]
-      for(int c = 1; c <= 3; c++) memcpy(rgb[c], rgb[0], sizeof(*rgb));
+      for(int c = 1; c <= 3; c++) memcpy(rgb + c * ts2, rgb, sizeof(float) * 3 * ts2);
 
       // note that successive calculations are inset within the tile
       // so as to give enough border data, and there needs to be a 6
@@ -214,7 +492,7 @@ static void xtrans_markesteijn_interpolate(
           // red/blue pair)
           if(max == 0.0f)
           {
-            float (*const pix)[3] = &rgb[0][row - top][col - left];
+            const float (*const pix)[3] = rgb + (size_t)(row - top) * ts + col - left;
             const short *const hex = _hexmap(row,col,allhex);
             for(int c = 0; c < 6; c++)
             {
@@ -223,8 +501,8 @@ static void xtrans_markesteijn_interpolate(
               if(max < val) max = val;
             }
           }
-          gmin[row - top][col - left] = min;
-          gmax[row - top][col - left] = max;
+          gmin[(size_t)(row - top) * ts + col - left] = min;
+          gmax[(size_t)(row - top) * ts + col - left] = max;
           // handle vertical red/blue pairs
           switch((row - sgrow) % 3)
           {
@@ -245,25 +523,13 @@ static void xtrans_markesteijn_interpolate(
       // need a 3 pixel border here as 3*hex[] can have a 3 unit offset
       const int pad_g_interp = 3;
       for(int row = top + pad_g_interp; row < mrow - pad_g_interp; row++)
-        for(int col = left + pad_g_interp; col < mcol - pad_g_interp; col++)
+        for(int col = left + pad_g_interp; col < left + pad_g_interp + 6; col++)
         {
-          float color[8];
           const int f = FCxtrans(row, col, roi_in, xtrans);
           if(f == 1) continue;
-          float (*const pix)[3] = &rgb[0][row - top][col - left];
-          const short *const hex = _hexmap(row,col,allhex);
-          // TODO: these constants come from integer math constants in
-          // dcraw -- calculate them instead from interpolation math
-          color[0] = 0.6796875f * (pix[hex[1]][1] + pix[hex[0]][1])
-                     - 0.1796875f * (pix[2 * hex[1]][1] + pix[2 * hex[0]][1]);
-          color[1] = 0.87109375f * pix[hex[3]][1] + pix[hex[2]][1] * 0.13f
-                     + 0.359375f * (pix[0][f] - pix[-hex[2]][f]);
-          for(int c = 0; c < 2; c++)
-            color[2 + c] = 0.640625f * pix[hex[4 + c]][1] + 0.359375f * pix[-2 * hex[4 + c]][1]
-                           + 0.12890625f * (2 * pix[0][f] - pix[3 * hex[4 + c]][f] - pix[-3 * hex[4 + c]][f]);
-          for(int c = 0; c < 4; c++)
-            rgb[c ^ !((row - sgrow) % 3)][row - top][col - left][1]
-                = CLAMPS(color[c], gmin[row - top][col - left], gmax[row - top][col - left]);
+          const int r = (row - top) * ts - left;
+          _markesteijn_green(rgb, gmin, gmax, ts, !((row - sgrow) % 3), _hexmap(row, col, allhex), f,
+                             r + col, r + mcol - pad_g_interp);
         }
 
       for(int pass = 0; pass < passes; pass++)
@@ -272,8 +538,8 @@ static void xtrans_markesteijn_interpolate(
         {
           // if on second pass, copy rgb[0] to [3] into rgb[4] to [7],
           // and process that second set of buffers
-          memcpy(rgb + 4, rgb, sizeof(*rgb) * 4);
-          rgb += 4;
+          memcpy(rgb + 4 * ts2, rgb, sizeof(float) * 3 * 4 * ts2);
+          rgb += 4 * ts2;
         }
 
         /* Recalculate green from interpolated values of closer pixels: */
@@ -281,19 +547,13 @@ static void xtrans_markesteijn_interpolate(
         {
           const int pad_g_recalc = 6;
           for(int row = top + pad_g_recalc; row < mrow - pad_g_recalc; row++)
-            for(int col = left + pad_g_recalc; col < mcol - pad_g_recalc; col++)
+            for(int col = left + pad_g_recalc; col < left + pad_g_recalc + 6; col++)
             {
               const int f = FCxtrans(row, col, roi_in, xtrans);
               if(f == 1) continue;
-              const short *const hex = _hexmap(row,col,allhex);
-              for(int d = 3; d < 6; d++)
-              {
-                float(*rfx)[3] = &rgb[(d - 2) ^ !((row - sgrow) % 3)][row - top][col - left];
-                const float val = rfx[-2 * hex[d]][1]
-                            + 2 * rfx[hex[d]][1] - rfx[-2 * hex[d]][f]
-                            - 2 * rfx[hex[d]][f] + 3 * rfx[0][f];
-                rfx[0][1] = CLAMPS(val / 3.0f, gmin[row - top][col - left], gmax[row - top][col - left]);
-              }
+              const int r = (row - top) * ts - left;
+              _markesteijn_recalc_green(rgb, gmin, gmax, ts, !((row - sgrow) % 3),
+                                        _hexmap(row, col, allhex), f, r + col, r + mcol - pad_g_recalc);
             }
         }
 
@@ -302,7 +562,7 @@ static void xtrans_markesteijn_interpolate(
         for(int row = (top - sgrow + pad_rb_g + 2) / 3 * 3 + sgrow; row < mrow - pad_rb_g; row += 3)
           for(int col = (left - sgcol + pad_rb_g + 2) / 3 * 3 + sgcol; col < mcol - pad_rb_g; col += 3)
           {
-            float(*rfx)[3] = &rgb[0][row - top][col - left];
+            float (*rfx)[3] = rgb + (size_t)(row - top) * ts + col - left;
             int h = FCxtrans(row, col + 1, roi_in, xtrans);
             float diff[6] = { 0.0f };
             // interplated color: first index is red/blue, second is
@@ -314,7 +574,7 @@ static void xtrans_markesteijn_interpolate(
             // 3,5 to rgb[2], rgb[3] of best of interp hori/vert
             // results. Each pass which outputs moves on to the next
             // rgb[] for input of interp greens.
-            for(int i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2)
+            for(int i = 1, d = 0; d < 6; d++, i ^= ts ^ 1, h ^= 2)
             {
               // look 1 and 2 pixels distance from solitary green to
               // red then blue or blue then red
@@ -344,7 +604,7 @@ static void xtrans_markesteijn_interpolate(
                 const int d_out = d - ((d > 1) && (diff[d-1] < diff[d]));
                 rfx[0][0] = color[0][d_out] / 2.f;
                 rfx[0][2] = color[1][d_out] / 2.f;
-                rfx += TS * TS;
+                rfx += ts2;
               }
             }
           }
@@ -356,10 +616,10 @@ static void xtrans_markesteijn_interpolate(
           {
             const int f = 2 - FCxtrans(row, col, roi_in, xtrans);
             if(f == 1) continue;
-            float(*rfx)[3] = &rgb[0][row - top][col - left];
-            const int c = (row - sgrow) % 3 ? TS : 1;
-            const int h = 3 * (c ^ TS ^ 1);
-            for(int d = 0; d < 4; d++, rfx += TS * TS)
+            float (*rfx)[3] = rgb + (size_t)(row - top) * ts + col - left;
+            const int c = (row - sgrow) % 3 ? ts : 1;
+            const int h = 3 * (c ^ ts ^ 1);
+            for(int d = 0; d < 4; d++, rfx += ts2)
             {
               const int i = d > 1 || ((d ^ c) & 1) ||
                 ((fabsf(rfx[0][1]-rfx[c][1]) + fabsf(rfx[0][1]-rfx[-c][1])) <
@@ -376,9 +636,9 @@ static void xtrans_markesteijn_interpolate(
             for(int col = left + pad_g22; col < mcol - pad_g22; col++)
               if((col - sgcol) % 3)
               {
-                float(*rfx)[3] = &rgb[0][row - top][col - left];
+                float (*rfx)[3] = rgb + (size_t)(row - top) * ts + col - left;
                 const short *const hex = _hexmap(row,col,allhex);
-                for(unsigned d = 0; d < ndir; d += 2, rfx += TS * TS)
+                for(unsigned d = 0; d < ndir; d += 2, rfx += ts2)
                   if(hex[d] + hex[d + 1])
                   {
                     const float g = 3.f * rfx[0][1] - 2.f * rfx[hex[d]][1] - rfx[hex[d + 1]][1];
@@ -397,125 +657,38 @@ static void xtrans_markesteijn_interpolate(
 
       // jump back to the first set of rgb buffers (this is a nop
       // unless on the second pass)
-      rgb = (float(*)[TS][TS][3])buffer;
+      rgb = (float(*)[3])buffer;
       // from here on out, mainly are working within the current tile
       // rather than in reference to the image, so don't offset
       // mrow/mcol by top/left of tile
       mrow -= top;
       mcol -= left;
 
-      /* Convert to perceptual colorspace and differentiate in all directions:  */
-      // Original dcraw algorithm uses CIELab as perceptual space
-      // (presumably coming from original AHD) and converts taking
-      // camera matrix into account. Now use YPbPr which requires much
-      // less code and is nearly indistinguishable. It assumes the
-      // camera RGB is roughly linear.
-      for(unsigned d = 0; d < ndir; ++d)
-      {
-        const int pad_yuv = (passes == 1) ? 8 : 13;
-        for(int row = pad_yuv; row < mrow - pad_yuv; row++)
-          for(int col = pad_yuv; col < mcol - pad_yuv; col++)
-          {
-            const float *rx = rgb[d][row][col];
-            // use ITU-R BT.2020 YPbPr, which is great, but could use
-            // a better/simpler choice? note that imageop.h provides
-            // dt_iop_RGB_to_YCbCr which uses Rec. 601 conversion,
-            // which appears less good with specular highlights
-            const float y = 0.2627f * rx[0] + 0.6780f * rx[1] + 0.0593f * rx[2];
-            yuv[0][row][col] = y;
-            yuv[1][row][col] = (rx[2] - y) * 0.56433f;
-            yuv[2][row][col] = (rx[0] - y) * 0.67815f;
-          }
-        // Note that f can offset by a column (-1 or +1) and by a row
-        // (-TS or TS). The row-wise offsets cause the undefined
-        // behavior sanitizer to warn of an out of bounds index, but
-        // as yfx is multi-dimensional and there is sufficient
-        // padding, that is not actually so.
-        const int f = dir[d & 3];
-        const int pad_drv = (passes == 1) ? 9 : 14;
-        for(int row = pad_drv; row < mrow - pad_drv; row++)
-          for(int col = pad_drv; col < mcol - pad_drv; col++)
-          {
-            const float(*yfx)[TS][TS] = (float(*)[TS][TS]) & yuv[0][row][col];
-            drv[d][row][col] = sqrf(2 * yfx[0][0][0] - yfx[0][0][f] - yfx[0][0][-f])
-                               + sqrf(2 * yfx[1][0][0] - yfx[1][0][f] - yfx[1][0][-f])
-                               + sqrf(2 * yfx[2][0][0] - yfx[2][0][f] - yfx[2][0][-f]);
-          }
-      }
-
-      /* Build homogeneity maps from the derivatives:                   */
-      memset(homo, 0, sizeof(uint8_t) * ndir * TS * TS);
-      const int pad_homo = (passes == 1) ? 10 : 15;
-      for(int row = pad_homo; row < mrow - pad_homo; row++)
-        for(int col = pad_homo; col < mcol - pad_homo; col++)
-        {
-          float tr = FLT_MAX;
-          for(unsigned d = 0; d < ndir; ++d)
-            if(tr > drv[d][row][col]) tr = drv[d][row][col];
-          tr *= 8;
-          for(unsigned d = 0; d < ndir; ++d)
-            for(int v = -1; v <= 1; v++)
-              for(int h = -1; h <= 1; h++)
-                homo[d][row][col] += ((drv[d][row + v][col + h] <= tr) ? 1 : 0);
-        }
-
-      /* Build 5x5 sum of homogeneity maps for each pixel & direction */
-      for(unsigned d = 0; d < ndir; ++d)
-        for(int row = pad_tile; row < mrow - pad_tile; row++)
-        {
-          // start before first column where homo[d][row][col+2] != 0,
-          // so can know v5sum and homosum[d][row][col] will be 0
-          int col = pad_tile-5;
-          uint8_t v5sum[5] = { 0 };
-          homosum[d][row][col] = 0;
-          // calculate by rolling through column sums
-          for(col++; col < mcol - pad_tile; col++)
-          {
-            uint8_t colsum = 0;
-            for(int v = -2; v <= 2; v++) colsum += homo[d][row + v][col + 2];
-            homosum[d][row][col] = homosum[d][row][col - 1] - v5sum[col % 5] + colsum;
-            v5sum[col % 5] = colsum;
-          }
-        }
-
-      /* Average the most homogeneous pixels for the final result:       */
-      for(int row = pad_tile; row < mrow - pad_tile; row++)
-        for(int col = pad_tile; col < mcol - pad_tile; col++)
-        {
-          uint8_t hm[8] = { 0 };
-          uint8_t maxval = 0;
-          for(unsigned d = 0; d < ndir; ++d)
-          {
-            hm[d] = homosum[d][row][col];
-            maxval = (maxval < hm[d] ? hm[d] : maxval);
-          }
-          maxval -= maxval >> 3;
-          for(unsigned d = 0; d < ndir - 4; ++d)
-          {
-            if(hm[d] < hm[d + 4])
-              hm[d] = 0;
-            else if(hm[d] > hm[d + 4])
-              hm[d + 4] = 0;
-          }
-          dt_aligned_pixel_t avg = { 0.0f };
-          for(unsigned d = 0; d < ndir; ++d)
-          {
-            if(hm[d] >= maxval)
-            {
-              for(int c = 0; c < 3; c++) avg[c] += rgb[d][row][col][c];
-              avg[3]++;
-            }
-          }
-          for(int c = 0; c < 3; c++)
-            out[4 * (width * (row + top) + col + left) + c] = avg[c]/avg[3];
-        }
+      _markesteijn_derivatives((const float(*)[3])rgb, yuv, drv, ts, ndir, mrow, mcol, passes);
+      _markesteijn_homogeneity(drv, homo, ts, ndir, mrow, mcol, passes);
+      _markesteijn_homosum(homo, homosum, ts, ndir, mrow, mcol, pad_tile);
+      _markesteijn_select(out, (const float(*)[3])rgb, homosum, ts, ndir, width, top, left, mrow, mcol,
+                          pad_tile);
     }
   }
   dt_free_align(all_buffers);
 }
 
-#undef TS
+static void xtrans_markesteijn_interpolate(
+        float *out,
+        const float *const in,
+        const dt_iop_roi_t *const roi_out,
+        const dt_iop_roi_t *const roi_in,
+        const uint8_t (*const xtrans)[6],
+        const int passes)
+{
+  _xtrans_markesteijn_interpolate(out, in, roi_out, roi_in, xtrans, passes, _markesteijn_tile_size());
+}
+
+#undef MARKESTEIJN_TS_MIN
+#undef MARKESTEIJN_TS_MAX
 
+// tile size, optimized to keep data in L2 cache
 #define TS 122
 static void xtrans_fdc_interpolate(
         struct dt_iop_module_t *self,
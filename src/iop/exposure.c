@@ -521,6 +521,41 @@ error:
 }
 #endif
 
+static inline void _apply(const float *const in,
+                          float *const out,
+                          const size_t nfloats,
+                          const float black,
+                          const float scale)
+{
+  DT_OMP_SIMD()
+  for(size_t k = 0; k < nfloats; k++)
+  {
+    out[k] = (in[k] - black) * scale;
+  }
+}
+
+gboolean process_pixels_prepare(struct dt_iop_module_t *self,
+                                dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_iop_exposure_data_t *const d = piece->data;
+
+  _process_common_setup(self, piece);
+
+  for(int k = 0; k < 3; k++)
+    piece->pipe->dsc.processed_maximum[k] *= d->scale;
+  return FALSE;
+}
+
+void process_pixels(struct dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const float *const in,
+                    float *const out,
+                    const size_t npixels)
+{
+  const dt_iop_exposure_data_t *const d = piece->data;
+  _apply(in, out, 4 * npixels, d->black, d->scale);
+}
+
 void process(struct dt_iop_module_t *self,
              dt_dev_pixelpipe_iop_t *piece,
              const void *const i,
@@ -531,22 +566,27 @@ void process(struct dt_iop_module_t *self,
   const dt_iop_exposure_data_t *const d =
     (const dt_iop_exposure_data_t *const)piece->data;
 
-  _process_common_setup(self, piece);
+  process_pixels_prepare(self, piece);
 
   const int ch = piece->colors;
+  if(ch == 4)
+  {
+    dt_iop_process_pixels(self, piece, (const float *)i, (float *)o, roi_out);
+    return;
+  }
 
-  const float *const restrict in = (float*)i;
-  float *const restrict out = (float*)o;
-  const float black = d->black;
-  const float scale = d->scale;
-  const size_t npixels = (size_t)roi_out->width * roi_out->height;
-  DT_OMP_FOR_SIMD(aligned(in, out : 64))
-  for(size_t k = 0; k < ch * npixels; k++)
+  // raw data before demosaic, same arithmetic in chunks of the band size
+  const float *const in = (float*)i;
+  float *const out = (float*)o;
+  const size_t nfloats = (size_t)ch * roi_out->width * roi_out->height;
+  const size_t nchunks = (nfloats + 4 * DT_IOP_PIXELS_BAND - 1) / (4 * DT_IOP_PIXELS_BAND);
+  DT_OMP_FOR()
+  for(size_t c = 0; c < nchunks; c++)
   {
-    out[k] = (in[k] - black) * scale;
+    const size_t offset = c * 4 * DT_IOP_PIXELS_BAND;
+    _apply(in + offset, out + offset, MIN(4 * DT_IOP_PIXELS_BAND, nfloats - offset),
+           d->black, d->scale);
   }
-  for(int k = 0; k < 3; k++)
-    piece->pipe->dsc.processed_maximum[k] *= d->scale;
 }
 
 
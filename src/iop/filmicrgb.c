@@ -1401,8 +1401,8 @@ error:
 }
 
 
-static inline void filmic_split_v1(const float *const restrict in,
-                                   float *const restrict out,
+static inline void filmic_split_v1(const float *const in,
+                                   float *const out,
                                    const dt_iop_order_iccprofile_info_t *const work_profile,
                                    const dt_iop_filmicrgb_data_t *const data,
                                    const dt_iop_filmic_rgb_spline_t spline,
@@ -1412,10 +1412,9 @@ static inline void filmic_split_v1(const float *const restrict in,
   const dt_aligned_pixel_t output_power
     = { data->output_power, data->output_power, data->output_power, data->output_power };
 
-  DT_OMP_FOR()
   for(size_t k = 0; k < height * width * 4; k += 4)
   {
-    const float *const restrict pix_in = in + k;
+    const float *const pix_in = in + k;
     dt_aligned_pixel_t temp;
 
     // Log tone-mapping
@@ -1440,14 +1439,13 @@ static inline void filmic_split_v1(const float *const restrict in,
                                  spline.M4, spline.M5, spline.latitude_min, spline.latitude_max, spline.type);
     dt_vector_clip(pix_out);
     dt_vector_powf(pix_out, output_power, pix_out);
-    copy_pixel_nontemporal(out + k, pix_out);
+    copy_pixel(out + k, pix_out);
   }
-  dt_omploop_sfence();	// ensure that nontemporal writes complete before we attempt to read output
 }
 
 
-static inline void filmic_split_v2_v3(const float *const restrict in,
-                                      float *const restrict out,
+static inline void filmic_split_v2_v3(const float *const in,
+                                      float *const out,
                                       const dt_iop_order_iccprofile_info_t *const work_profile,
                                       const dt_iop_filmicrgb_data_t *const data,
                                       const dt_iop_filmic_rgb_spline_t spline,
@@ -1457,11 +1455,10 @@ static inline void filmic_split_v2_v3(const float *const restrict in,
   const dt_aligned_pixel_t output_power
     = { data->output_power, data->output_power, data->output_power, data->output_power };
 
-  // DO NOT REPLACE THE FOLLOWING BY "DT_OMP_FOR_SIMD" - doing so causes a small but measurable change in results
-  DT_OMP_FOR()
+  // DO NOT ADD "DT_OMP_SIMD" TO THE FOLLOWING - doing so causes a small but measurable change in results
   for(size_t k = 0; k < height * width * 4; k += 4)
   {
-    const float *const restrict pix_in = in + k;
+    const float *const pix_in = in + k;
     dt_aligned_pixel_t temp;
     for_each_channel(c,aligned(pix_in,temp))
       temp[c] = MAX(pix_in[c], NORM_MIN);
@@ -1488,22 +1485,20 @@ static inline void filmic_split_v2_v3(const float *const restrict in,
     }
     dt_vector_clip(pix_out);
     dt_vector_powf(pix_out, output_power, pix_out);
-    copy_pixel_nontemporal(out + k, pix_out);
+    copy_pixel(out + k, pix_out);
   }
-  dt_omploop_sfence();	// ensure that nontemporal writes complete before we attempt to read output
 }
 
 
-static inline void filmic_chroma_v1(const float *const restrict in, float *const restrict out,
+static inline void filmic_chroma_v1(const float *const in, float *const out,
                                     const dt_iop_order_iccprofile_info_t *const work_profile,
                                     const dt_iop_filmicrgb_data_t *const data,
                                     const dt_iop_filmic_rgb_spline_t spline, const int variant, const size_t width,
                                     const size_t height)
 {
-  DT_OMP_FOR()
   for(size_t k = 0; k < height * width * 4; k += 4)
   {
-    const float *const restrict pix_in = in + k;
+    const float *const pix_in = in + k;
 
     dt_aligned_pixel_t ratios = { 0.0f, 0.0f, 0.0f, 0.0f };
     float norm = MAX(get_pixel_norm(pix_in, variant, work_profile), NORM_MIN);
@@ -1544,14 +1539,13 @@ static inline void filmic_chroma_v1(const float *const restrict in, float *const
     dt_aligned_pixel_t pix_out;
     for_each_channel(c,aligned(ratios,pix_out))
       pix_out[c] = ratios[c] * norm;
-    copy_pixel_nontemporal(out + k, pix_out);
+    copy_pixel(out + k, pix_out);
   }
-  dt_omploop_sfence();	// ensure that nontemporal writes complete before we attempt to read output
 }
 
 
-static inline void filmic_chroma_v2_v3(const float *const restrict in,
-                                       float *const restrict out,
+static inline void filmic_chroma_v2_v3(const float *const in,
+                                       float *const out,
                                        const dt_iop_order_iccprofile_info_t *const work_profile,
                                        const dt_iop_filmicrgb_data_t *const data,
                                        const dt_iop_filmic_rgb_spline_t spline,
@@ -1560,10 +1554,9 @@ static inline void filmic_chroma_v2_v3(const float *const restrict in,
                                        const size_t height,
                                        const dt_iop_filmicrgb_colorscience_type_t colorscience_version)
 {
-  DT_OMP_FOR()
   for(size_t k = 0; k < 4 * height * width; k += 4)
   {
-    const float *const restrict pix_in = in + k;
+    const float *const pix_in = in + k;
     float norm = MAX(get_pixel_norm(pix_in, variant, work_profile), NORM_MIN);
 
     // Save the ratios
@@ -1618,9 +1611,8 @@ static inline void filmic_chroma_v2_v3(const float *const restrict in,
         pix_out[c] = CLIP(ratios[c] * norm);
       }
     }
-    copy_pixel_nontemporal(out + k, pix_out);
+    copy_pixel(out + k, pix_out);
   }
-  dt_omploop_sfence();	// ensure that nontemporal writes complete before we attempt to read output
 }
 
 
@@ -1849,8 +1841,8 @@ static inline void RGB_tone_mapping_v4(const dt_aligned_pixel_t pix_in,
   dt_vector_pow1(mapped, data->output_power, pix_out);
 }
 
-static inline void filmic_chroma_v4(const float *const restrict in,
-                                    float *const restrict out,
+static inline void filmic_chroma_v4(const float *const in,
+                                    float *const out,
                                     const dt_iop_order_iccprofile_info_t *const work_profile,
                                     const dt_iop_order_iccprofile_info_t *const export_profile,
                                     const dt_iop_filmicrgb_data_t *const data,
@@ -1878,10 +1870,9 @@ static inline void filmic_chroma_v4(const float *const restrict in,
   const float norm_min = exp_tonemapping_v2(0.f, data->grey_source, data->black_source, data->dynamic_range);
   const float norm_max = exp_tonemapping_v2(1.f, data->grey_source, data->black_source, data->dynamic_range);
 
-  DT_OMP_FOR()
   for(size_t k = 0; k < 4 * height * width; k += 4)
   {
-    const float *const restrict pix_in = in + k;
+    const float *const pix_in = in + k;
     dt_aligned_pixel_t pix_out;
     norm_tone_mapping_v4(pix_in, pix_out, variant, work_profile, data, spline,
                          norm_min, norm_max, display_black, display_white);
@@ -1897,13 +1888,12 @@ static inline void filmic_chroma_v4(const float *const restrict in,
     gamut_mapping(Ych_final, Ych_original, pix_out, input_matrix_trans, output_matrix, output_matrix_trans,
                   export_input_matrix_trans, export_output_matrix, export_output_matrix_trans,
                   display_black, display_white, data->saturation, use_output_profile);
-    copy_pixel_nontemporal(out + k, pix_out);
+    copy_pixel(out + k, pix_out);
   }
-  dt_omploop_sfence();	// ensure that nontemporal writes complete before we attempt to read output
 }
 
-static inline void filmic_split_v4(const float *const restrict in,
-                                   float *const restrict out,
+static inline void filmic_split_v4(const float *const in,
+                                   float *const out,
                                    const dt_iop_order_iccprofile_info_t *const work_profile,
                                    const dt_iop_order_iccprofile_info_t *const export_profile,
                                    const dt_iop_filmicrgb_data_t *const data,
@@ -1929,10 +1919,9 @@ static inline void filmic_split_v4(const float *const restrict in,
                                  export_input_matrix_trans, export_output_matrix, export_output_matrix_trans,
                                  work_profile, export_profile);
 
-  DT_OMP_FOR()
   for(size_t k = 0; k < 4 * height * width; k += 4)
   {
-    const float *const restrict pix_in = in + k;
+    const float *const pix_in = in + k;
     dt_aligned_pixel_t pix_out;
 
     RGB_tone_mapping_v4(pix_in, pix_out, data, spline, display_black, display_white);
@@ -1950,13 +1939,12 @@ static inline void filmic_split_v4(const float *const restrict in,
     gamut_mapping(Ych_final, Ych_original, pix_out, input_matrix_trans, output_matrix, output_matrix_trans,
                   export_input_matrix_trans, export_output_matrix, export_output_matrix_trans,
                   display_black, display_white, data->saturation, use_output_profile);
-    copy_pixel_nontemporal(out + k, pix_out);
+    copy_pixel(out + k, pix_out);
   }
-  dt_omploop_sfence();	// ensure that nontemporal writes complete before we attempt to read output
 }
 
 
-static inline void filmic_v5(const float *const restrict in, float *const restrict out,
+static inline void filmic_v5(const float *const in, float *const out,
                                     const dt_iop_order_iccprofile_info_t *const work_profile,
                                     const dt_iop_order_iccprofile_info_t *const export_profile,
                                     const dt_iop_filmicrgb_data_t *const data,
@@ -1981,10 +1969,9 @@ static inline void filmic_v5(const float *const restrict in, float *const restri
   const float norm_min = exp_tonemapping_v2(0.f, data->grey_source, data->black_source, data->dynamic_range);
   const float norm_max = exp_tonemapping_v2(1.f, data->grey_source, data->black_source, data->dynamic_range);
 
-  DT_OMP_FOR()
   for(size_t k = 0; k < height * width * 4; k += 4)
   {
-    const float *const restrict pix_in = in + k;
+    const float *const pix_in = in + k;
 
     dt_aligned_pixel_t max_rgb = { 0.f };
     dt_aligned_pixel_t naive_rgb = { 0.f };
@@ -2011,9 +1998,8 @@ static inline void filmic_v5(const float *const restrict in, float *const restri
     gamut_mapping(Ych_final, Ych_original, pix_out, input_matrix_trans, output_matrix, output_matrix_trans,
                   export_input_matrix_trans, export_output_matrix, export_output_matrix_trans,
                   display_black, display_white, 0.0f, use_output_profile);
-    copy_pixel_nontemporal(out + k, pix_out);
+    copy_pixel(out + k, pix_out);
   }
-  dt_omploop_sfence();	// ensure that nontemporal writes complete before we attempt to read output
 }
 
 
@@ -2094,6 +2080,52 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   return;
 }
 
+void process_pixels(dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const float *const in,
+                    float *const out,
+                    const size_t npixels)
+{
+  const dt_iop_filmicrgb_data_t *const data = piece->data;
+  const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(piece->pipe);
+  const dt_iop_order_iccprofile_info_t *const export_profile = dt_ioppr_get_pipe_output_profile_info(piece->pipe);
+
+  const float white_display = powf(data->spline.y[4], data->output_power);
+  const float black_display = powf(data->spline.y[0], data->output_power);
+
+  if(data->version == DT_FILMIC_COLORSCIENCE_V5)
+  {
+    filmic_v5(in, out, work_profile, export_profile, data, data->spline, npixels, 1, black_display, white_display);
+  }
+  else
+  {
+    if(data->preserve_color == DT_FILMIC_METHOD_NONE)
+    {
+      // no chroma preservation
+      if(data->version == DT_FILMIC_COLORSCIENCE_V1)
+        filmic_split_v1(in, out, work_profile, data, data->spline, npixels, 1);
+      else if(data->version == DT_FILMIC_COLORSCIENCE_V2 || data->version == DT_FILMIC_COLORSCIENCE_V3)
+        filmic_split_v2_v3(in, out, work_profile, data, data->spline, npixels, 1);
+      else if(data->version == DT_FILMIC_COLORSCIENCE_V4)
+        filmic_split_v4(in, out, work_profile, export_profile, data, data->spline,
+                        data->preserve_color, npixels, 1,
+                        data->version, black_display, white_display);
+    }
+    else
+    {
+      // chroma preservation
+      if(data->version == DT_FILMIC_COLORSCIENCE_V1)
+        filmic_chroma_v1(in, out, work_profile, data, data->spline, data->preserve_color, npixels, 1);
+      else if(data->version == DT_FILMIC_COLORSCIENCE_V2 || data->version == DT_FILMIC_COLORSCIENCE_V3)
+        filmic_chroma_v2_v3(in, out, work_profile, data, data->spline, data->preserve_color, npixels, 1, data->version);
+      else if(data->version == DT_FILMIC_COLORSCIENCE_V4)
+        filmic_chroma_v4(in, out, work_profile, export_profile, data, data->spline,
+                         data->preserve_color, npixels, 1,
+                         data->version, black_display, white_display);
+    }
+  }
+}
+
 void process(dt_iop_module_t *self,
              dt_dev_pixelpipe_iop_t *piece,
              const void *const restrict ivoid,
@@ -2107,7 +2139,6 @@ void process(dt_iop_module_t *self,
 
   const dt_iop_filmicrgb_data_t *const data = piece->data;
   const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(piece->pipe);
-  const dt_iop_order_iccprofile_info_t *const export_profile = dt_ioppr_get_pipe_output_profile_info(piece->pipe);
 
   /** The log2(x) -> -INF when x -> 0
    * thus very low values (noise) will get even lower, resulting in noise negative amplification,
@@ -2194,43 +2225,7 @@ void process(dt_iop_module_t *self,
 
   dt_free_align(mask);
 
-  const float white_display = powf(data->spline.y[4], data->output_power);
-  const float black_display = powf(data->spline.y[0], data->output_power);
-
-  if(data->version == DT_FILMIC_COLORSCIENCE_V5)
-  {
-    filmic_v5(in, out, work_profile, export_profile, data, data->spline, roi_out->width,
-              roi_out->height, black_display, white_display);
-  }
-  else
-  {
-    if(data->preserve_color == DT_FILMIC_METHOD_NONE)
-    {
-      // no chroma preservation
-      if(data->version == DT_FILMIC_COLORSCIENCE_V1)
-        filmic_split_v1(in, out, work_profile, data, data->spline, roi_out->width, roi_in->height);
-      else if(data->version == DT_FILMIC_COLORSCIENCE_V2 || data->version == DT_FILMIC_COLORSCIENCE_V3)
-        filmic_split_v2_v3(in, out, work_profile, data, data->spline, roi_out->width, roi_in->height);
-      else if(data->version == DT_FILMIC_COLORSCIENCE_V4)
-        filmic_split_v4(in, out, work_profile, export_profile, data, data->spline,
-                        data->preserve_color, roi_out->width, roi_out->height,
-                        data->version, black_display, white_display);
-    }
-    else
-    {
-      // chroma preservation
-      if(data->version == DT_FILMIC_COLORSCIENCE_V1)
-        filmic_chroma_v1(in, out, work_profile, data, data->spline, data->preserve_color, roi_out->width,
-                        roi_out->height);
-      else if(data->version == DT_FILMIC_COLORSCIENCE_V2 || data->version == DT_FILMIC_COLORSCIENCE_V3)
-        filmic_chroma_v2_v3(in, out, work_profile, data, data->spline, data->preserve_color, roi_out->width,
-                            roi_out->height, data->version);
-      else if(data->version == DT_FILMIC_COLORSCIENCE_V4)
-        filmic_chroma_v4(in, out, work_profile, export_profile, data, data->spline,
-                         data->preserve_color, roi_out->width, roi_out->height,
-                         data->version, black_display, white_display);
-    }
-  }
+  dt_iop_process_pixels(self, piece, in, out, roi_out);
 
   dt_free_align(reconstructed);
 }
@@ -3120,6 +3115,10 @@ void commit_params(dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_
   d->reconstruct_grey_vs_color = (p->reconstruct_grey_vs_color / 100.0f + 1.f) / 2.f;
 
   d->enable_highlight_reconstruction = p->enable_highlight_reconstruction;
+
+  // the highlight reconstruction works on the whole image, the fast pipe skips it
+  if(d->enable_highlight_reconstruction && !(pipe->type & DT_DEV_PIXELPIPE_FAST))
+    piece->process_pixels_ready = FALSE;
 }
 
 void gui_focus(struct dt_iop_module_t *self, gboolean in)
@@ -51,7 +51,8 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_HIDDEN | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_FENCE | IOP_FLAGS_UNSAFE_COPY;
+  return IOP_FLAGS_HIDDEN | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_FENCE | IOP_FLAGS_UNSAFE_COPY
+    | IOP_FLAGS_ROI_EXACT;
 }
 
 dt_iop_colorspace_type_t default_colorspace(dt_iop_module_t *self,
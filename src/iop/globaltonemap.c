@@ -70,6 +70,7 @@ typedef struct dt_iop_global_tonemap_data_t
     float max_light; // cd/m2
   } drago;
   float detail;
+  dt_bilateral_t *grid; // kept while only the operator or detail change
 } dt_iop_global_tonemap_data_t;
 
 typedef struct dt_iop_global_tonemap_gui_data_t
@@ -107,7 +108,8 @@ const char *deprecated_msg()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_DEPRECATED
+    | IOP_FLAGS_IMAGE_STATISTICS;
 }
 
 int default_group()
@@ -300,9 +302,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   dt_bilateral_t *b = NULL;
   if(data->detail != 0.0f)
   {
-    b = dt_bilateral_init(roi_in->width, roi_in->height, sigma_s, sigma_r);
     // get detail from unchanged input buffer
-    dt_bilateral_splat(b, (float *)ivoid);
+    b = dt_bilateral_init_cached(&data->grid, piece, ivoid, roi_in, sigma_s, sigma_r);
   }
 
   switch(data->operator)
@@ -318,12 +319,11 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       break;
   }
 
-  if(data->detail != 0.0f)
+  if(b)
   {
-    dt_bilateral_blur(b);
     // and apply it to output buffer after logscale
     dt_bilateral_slice_to_output(b, (float *)ivoid, (float *)ovoid, data->detail);
-    dt_bilateral_free(b);
+    if(b != data->grid) dt_bilateral_free(b);
   }
 }
 
@@ -553,6 +553,11 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   d->drago.bias = p->drago.bias;
   d->drago.max_light = p->drago.max_light;
   d->detail = p->detail;
+  if(d->detail == 0.0f)
+  {
+    dt_bilateral_free(d->grid);
+    d->grid = NULL;
+  }
 
   // drago needs the maximum L-value of the whole image so it must not use tiling
   if(d->operator == OPERATOR_DRAGO) piece->process_tiling_ready = FALSE;
@@ -570,6 +575,8 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_global_tonemap_data_t *d = piece->data;
+  dt_bilateral_free(d->grid);
   free(piece->data);
   piece->data = NULL;
 }
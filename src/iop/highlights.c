@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "bauhaus/bauhaus.h"
+#include "common/analysis_cache.h"
 #include "common/box_filters.h"
 #include "common/bspline.h"
 #include "common/opencl.h"
@@ -315,9 +316,16 @@ int legacy_params(dt_iop_module_t *self,
   return 1;
 }
 
-static dt_aligned_pixel_t img_oppchroma;
-static gboolean img_oppclipped = TRUE;
-static dt_hash_t img_opphash = ULLONG_MAX;
+// chrominance correction of inpaint opposed, kept in the analysis cache
+typedef struct _opposed_chroma_t
+{
+  dt_aligned_pixel_t chroma;
+  gboolean clipped;
+} _opposed_chroma_t;
+
+#define OPPOSED_CHROMA_NAME "highlights opposed"
+// bump if the chrominance maths change, persistent entries are invalid then
+#define OPPOSED_CHROMA_VERSION 1
 
 #include "hlreconstruct/segmentation.c"
 #include "hlreconstruct/segbased.c"
@@ -668,6 +676,52 @@ static void process_clip(dt_iop_module_t *self,
   }
 }
 
+void process_mosaic_prepare(struct dt_iop_module_t *self,
+                            dt_dev_pixelpipe_iop_t *piece)
+{
+  // clipping notifies the pipeline that the white point has changed
+  const float m = dt_iop_get_processed_maximum(piece);
+  for_three_channels(k) piece->pipe->dsc.processed_maximum[k] = m;
+}
+
+// clip mode only, see process_clip()
+void process_mosaic(struct dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const void *const ivoid,
+                    float *const out,
+                    const dt_iop_roi_t *const roi_in,
+                    const dt_iop_roi_t *const roi_out,
+                    const int row,
+                    const int rows)
+{
+  const dt_iop_highlights_data_t *data = piece->data;
+  const float *const in = (const float *const)ivoid;
+  const uint32_t filters = piece->dsc_in.filters;
+  const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])piece->dsc_in.xtrans;
+  const gboolean is_xtrans = (filters == 9u);
+
+  // the processed minimum process() sees
+  const float clip = data->clip * fmaxf(1.0f, fminf(piece->dsc_in.processed_maximum[0],
+                                                    fminf(piece->dsc_in.processed_maximum[1],
+                                                          piece->dsc_in.processed_maximum[2])));
+  const dt_dev_chroma_t *chr = &self->dev->chroma;
+  dt_aligned_pixel_t clips = { clip, clip, clip, clip};
+  if(dt_dev_is_D65_chroma(self->dev) && chr->late_correction)
+  {
+    for_each_channel(c) clips[c] *= chr->as_shot[c] / chr->D65coeffs[c];
+  }
+
+  for(int j = row; j < row + rows; j++)
+  {
+    const size_t p = (size_t)j * roi_out->width;
+    for(int i = 0; i < roi_out->width; i++)
+    {
+      const int c = is_xtrans ? FCxtrans(j, i, roi_in, xtrans) : FC(j, i, filters);
+      out[p + i] = fminf(in[p + i], clips[c]);
+    }
+  }
+}
+
 static void process_visualize(dt_dev_pixelpipe_iop_t *piece,
                               const void *const ivoid,
                               void *const ovoid,
@@ -909,11 +963,19 @@ void commit_params(struct dt_iop_module_t *self,
   if((d->mode == DT_IOP_HIGHLIGHTS_SEGMENTS) || (d->mode == DT_IOP_HIGHLIGHTS_OPPOSED))
     piece->process_tiling_ready = FALSE;
 
+  // only clipping works sensel by sensel on the mosaic
+  if(d->mode != DT_IOP_HIGHLIGHTS_CLIP || linear)
+    piece->process_mosaic_ready = FALSE;
+
   const gboolean fullpipe = piece->pipe->type & DT_DEV_PIXELPIPE_FULL;
 
   dt_iop_highlights_gui_data_t *g = self->gui_data;
   if(g && (g->hlr_mask_mode == DT_HIGHLIGHTS_MASK_CLIPPED) && linear && fullpipe)
     piece->process_cl_ready = FALSE;
+
+  // the mask visualization is done by process()
+  if(g && (g->hlr_mask_mode != DT_HIGHLIGHTS_MASK_OFF) && fullpipe)
+    piece->process_mosaic_ready = FALSE;
 }
 
 void init_global(dt_iop_module_so_t *module)
@@ -51,10 +51,38 @@ static dt_hash_t _opposed_parhash(dt_dev_pixelpipe_iop_t *piece)
 
 static dt_hash_t _opposed_hash(dt_dev_pixelpipe_iop_t *piece)
 {
+  const int version = OPPOSED_CHROMA_VERSION;
   dt_hash_t hash = _opposed_parhash(piece);
+  hash = dt_hash(hash, &version, sizeof(version));
   return dt_hash(hash, &piece->pipe->image.id, sizeof(piece->pipe->image.id));
 }
 
+// pipes working on the complete sensor data provide the chrominance for all pipes of the image
+static inline gboolean _opposed_provides_chroma(const dt_dev_pixelpipe_t *pipe)
+{
+  return pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_EXPORT);
+}
+
+static inline gboolean _opposed_get_chroma(dt_dev_pixelpipe_iop_t *piece,
+                                           const dt_hash_t hash,
+                                           _opposed_chroma_t *chroma)
+{
+  return dt_analysis_cache_get(piece->pipe->image.id, OPPOSED_CHROMA_NAME, hash,
+                               chroma, sizeof(_opposed_chroma_t));
+}
+
+static inline void _opposed_put_chroma(dt_dev_pixelpipe_iop_t *piece,
+                                       const dt_hash_t hash,
+                                       const dt_aligned_pixel_t chrominance,
+                                       const gboolean clipped)
+{
+  _opposed_chroma_t chroma = { .clipped = clipped };
+  for_three_channels(c)
+    chroma.chroma[c] = chrominance[c];
+  dt_analysis_cache_put(piece->pipe->image.id, OPPOSED_CHROMA_NAME, hash,
+                        &chroma, sizeof(_opposed_chroma_t));
+}
+
 static inline float _calc_linear_refavg(const float *in, const int color)
 {
   const dt_aligned_pixel_t ins = { powf(fmaxf(0.0f, in[0]), 1.0f / HL_POWERF),
@@ -237,12 +265,13 @@ static float *_process_opposed(
 
   const dt_hash_t opphash = _opposed_hash(piece);
   dt_aligned_pixel_t chrominance = {0.0f, 0.0f, 0.0f, 0.0f};
+  _opposed_chroma_t cached;
 
-  if(opphash == img_opphash)
+  if(_opposed_get_chroma(piece, opphash, &cached))
   {
     for_three_channels(c)
-      chrominance[c] = img_oppchroma[c];
-    if(!img_oppclipped && !keep)
+      chrominance[c] = cached.chroma[c];
+    if(!cached.clipped && !keep)
     {
       dt_iop_copy_image_roi(output, input, 1, roi_in, roi_out);
       return NULL;
@@ -325,21 +354,17 @@ static float *_process_opposed(
           chrominance[c] = (cnts[c] > 100.0f) ? sums[c] / cnts[c] : 0.0f;
       }
 
-      if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
-      {
-        for_three_channels(c)
-          img_oppchroma[c] = chrominance[c];
-        img_opphash = opphash;
-        img_oppclipped = anyclipped;
-      }
+      const gboolean provides = _opposed_provides_chroma(piece->pipe);
+      if(provides)
+        _opposed_put_chroma(piece, opphash, chrominance, anyclipped);
 
       dt_print_pipe(DT_DEBUG_PIPE,
           "opposed chroma", piece->pipe, self, DT_DEVICE_CPU, roi_in, roi_out,
           "RGB %3.4f %3.4f %3.4f hash=%" PRIx64 "%s%s\n",
           chrominance[0], chrominance[1], chrominance[2],
           _opposed_parhash(piece),
-          piece->pipe->type == DT_DEV_PIXELPIPE_FULL ? ", saved" : "",
-          img_oppclipped ? "" : ", unclipped");
+          provides ? ", saved" : "",
+          anyclipped ? "" : ", unclipped");
     }
     dt_free_align(mask);
   }
@@ -443,7 +468,9 @@ static cl_int process_opposed_cl(
   const int msize = dt_round_size((size_t) (mwidth+1) * (mheight+1), 16);
 
   const dt_hash_t opphash = _opposed_hash(piece);
-  const int fastcopymode = (opphash == img_opphash) && !img_oppclipped;
+  _opposed_chroma_t cached;
+  const gboolean valid = _opposed_get_chroma(piece, opphash, &cached);
+  const int fastcopymode = valid && !cached.clipped;
 
   if(!fastcopymode)
   {
@@ -459,10 +486,10 @@ static cl_int process_opposed_cl(
 
   dt_aligned_pixel_t chrominance = {0.0f, 0.0f, 0.0f, 0.0f};
 
-  if(opphash == img_opphash)
+  if(valid)
   {
     for_three_channels(c)
-      chrominance[c] = img_oppchroma[c];
+      chrominance[c] = cached.chroma[c];
   }
   else
   {
@@ -524,21 +551,17 @@ static cl_int process_opposed_cl(
     for_three_channels(c)
       chrominance[c] = (cnts[c] > 100.0f) ? sums[c] / cnts[c] : 0.0f;
 
-    if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
-    {
-      for_three_channels(c)
-        img_oppchroma[c] = chrominance[c];
-      img_opphash = opphash;
-      img_oppclipped = clipped > 0.0f;
-    }
+    const gboolean provides = _opposed_provides_chroma(piece->pipe);
+    if(provides)
+      _opposed_put_chroma(piece, opphash, chrominance, clipped > 0.0f);
 
     dt_print_pipe(DT_DEBUG_PIPE,
         "opposed chroma", piece->pipe, self, piece->pipe->devid, roi_in, roi_out,
         "RGB %3.4f %3.4f %3.4f hash=%" PRIx64 "%s%s\n",
         chrominance[0], chrominance[1], chrominance[2],
         _opposed_parhash(piece),
-        piece->pipe->type == DT_DEV_PIXELPIPE_FULL ? ", saved" : "",
-        img_oppclipped ? "" : ", unclipped");
+        provides ? ", saved" : "",
+        clipped > 0.0f ? "" : ", unclipped");
   }
 
   err = DT_OPENCL_SYSMEM_ALLOCATION;
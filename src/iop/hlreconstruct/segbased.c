@@ -576,18 +576,9 @@ static void _process_segmentation(dt_dev_pixelpipe_iop_t *piece,
   for(int p = 0; p < HL_RGB_PLANES; p++)
     dt_segments_combine(&isegments[p], data->combine);
 
-  if(dt_get_num_threads() >= HL_RGB_PLANES)
-  {
-    DT_OMP_PRAGMA(parallel num_threads(HL_RGB_PLANES))
-    {
-      dt_segmentize_plane(&isegments[dt_get_thread_num()]);
-    }
-  }
-  else
-  {
-    for(int p = 0; p < HL_RGB_PLANES; p++)
-      dt_segmentize_plane(&isegments[p]);
-  }
+  // segmentizing is parallel internally
+  for(int p = 0; p < HL_RGB_PLANES; p++)
+    dt_segmentize_plane(&isegments[p]);
 
   for(int p = 0; p < HL_RGB_PLANES; p++)
     _calc_plane_candidates(plane[p], refavg[p], &isegments[p], cube_coeffs[p], data->candidating);
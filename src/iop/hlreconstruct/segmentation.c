@@ -1,6 +1,6 @@
 /*
     This file is part of darktable,
-    Copyright (C) 2022-2023 darktable developers.
+    Copyright (C) 2022-2024 darktable developers.
 
     darktable is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -26,6 +26,9 @@
    - marks the segment border locations.
 
    Hanno Schwalm 2022/05
+
+   The morphological operations now work on bit-packed rows and the segments are found by
+   a parallel union-find labeling giving the same results as the floodfill.
 */
 
 #define DT_SEG_ID_MASK 0x40000
@@ -39,7 +42,6 @@ typedef struct dt_pos_t
 typedef struct dt_iop_segmentation_t
 {
   uint32_t *data; // holding segment id's for every location
-  uint32_t *tmp;  // pointer to temporary buffer used for morphological operations
   int *size;      // size of each segment
   int *xmin;      // bounding rectangle for each segment
   int *xmax;
@@ -101,198 +103,144 @@ static inline uint32_t _get_segment_id(dt_iop_segmentation_t *seg, const size_t
   return ((id < seg->nr) && (id > 1)) ? id : 0;
 }
 
-static inline int _test_dilate(const uint32_t *img, const size_t i, const size_t w1, const int radius)
+/* The structuring elements for the morphological operations as the first and last column
+   offset for every row offset -8 .. 8, an empty row has a last offset smaller than the first one.
+   Eroding uses the same elements as dilating for the radius up to 5.
+*/
+static const int8_t _morph_extent[8][17][2] =
 {
-  int retval = 0;
-  retval = img[i-w1-1] | img[i-w1] | img[i-w1+1] |
-           img[i-1]    | img[i]    | img[i+1] |
-           img[i+w1-1] | img[i+w1] | img[i+w1+1];
-  if(retval || (radius < 2)) return retval;
-
-  const size_t w2 = 2*w1;
-  retval = img[i-w2-1] | img[i-w2]   | img[i-w2+1] |
-           img[i-w1-2] | img[i-w1+2] |
-           img[i-2]    | img[i+2] |
-           img[i+w1-2] | img[i+w1+2] |
-           img[i+w2-1] | img[i+w2]   | img[i+w2+1];
-  if(retval || (radius < 3)) return retval;
-
-  const size_t w3 = 3*w1;
-  retval = img[i-w3-2] | img[i-w3-1] | img[i-w3] | img[i-w3+1] | img[i-w3+2] |
-           img[i-w2-3] | img[i-w2-2] | img[i-w2+2] | img[i-w2+3] |
-           img[i-w1-3] | img[i-w1+3] |
-           img[i-3]    | img[i+3]    |
-           img[i+w1-3] | img[i+w1+3] |
-           img[i+w2-3] | img[i+w2-2] | img[i+w2+2] | img[i+w2+3] |
-           img[i+w3-2] | img[i+w3-1] | img[i+w3] | img[i+w3+1] | img[i+w3+2]; 
-  if(retval || (radius < 4)) return retval;
-
-  const size_t w4 = 4*w1;
-  retval = img[i-w4-2] | img[i-w4-1] | img[i-w4] | img[i-w4+1] | img[i-w4+2] |
-           img[i-w3-3] | img[i-w3+3] |
-           img[i-w2-4] | img[i-w2+4] |
-           img[i-w1-4] | img[i-w1+4] |
-           img[i-4]    | img[i+4] |
-           img[i+w1-4] | img[i+w1+4] |
-           img[i+w2-4] | img[i+w2+4] |
-           img[i+w3-3] | img[i+w3+3] |
-           img[i+w4-2] | img[i+w4-1] | img[i+w4] | img[i+w4+1] | img[i+w4+2];
-  if(retval || (radius < 5)) return retval;
-
-  const size_t w5 = 5*w1;
-  retval = img[i-w5-2] | img[i-w5-1] | img[i-w5] | img[i-w5+1] | img[i-w5+2] |
-           img[i-w4-4] | img[i-w4-3] | img[i-w4+3] | img[i-w4+4] |
-           img[i-w3-4] | img[i-w3+4] |
-           img[i-w2-5] | img[i-w2+5] |
-           img[i-w1-5] | img[i-w1+5] |
-           img[i-5]    | img[i+5] |
-           img[i+w1-5] | img[i+w1+5] |
-           img[i+w2-5] | img[i+w2+5] |
-           img[i+w3-4] | img[i+w3+4] |
-           img[i+w4-4] | img[i+w4-3] | img[i+w4+3] | img[i+w4+4] |
-           img[i+w5-2] | img[i+w5-1] | img[i+w5] | img[i+w5+1] | img[i+w5+2]; 
-  if(retval || (radius < 6)) return retval;
-
-  const size_t w6 = 6*w1;
-  retval = img[i-w6-2] | img[i-w6-1] | img[i-w6] | img[i-w6+1] | img[i-w6+2] |
-           img[i-w5-4] | img[i-w5-3] | img[i-w5+3] | img[i-w5+4] |
-           img[i-w4-5] | img[i-w4+5] |
-           img[i-w3-5] | img[i-w3+5] |
-           img[i-w2-6] | img[i-w2+6] |
-           img[i-w1-6] | img[i-w1+6] |
-           img[i-6]    | img[i+6] |
-           img[i+w1-6] | img[i+w1+6] |
-           img[i+w2-6] | img[i+w2+6] |
-           img[i+w3-5] | img[i+w3+5] |
-           img[i+w4-5] | img[i+w4+5] |
-           img[i+w5-4] | img[i+w5-3] | img[i+w5+3] | img[i+w5+4] |
-           img[i+w6-2] | img[i+w6-1] | img[i+w6] | img[i+w6+1] | img[i+w6+2] ;
-  if(retval || (radius < 7)) return retval;
-
-  const size_t w7 = 7*w1;
-  retval = img[i-w7-3] | img[i-w7-2] | img[i-w7-1] | img[i-w7] | img[i-w7+1] | img[i-w7+2] | img[i-w7+3] |
-           img[i-w6-4] | img[i-w6-3] | img[i-w6+3] | img[i-w6+4] |
-           img[i-w5-6] | img[i-w5-5] | img[i-w5+5] | img[i-w5+6] |
-           img[i-w4-6] | img[i-w4+6] |
-           img[i-w3-7] | img[i-w3-6] | img[i-w3+6] | img[i-w3+7] |
-           img[i-w2-7] | img[i-w2+7] |
-           img[i-w1-7] | img[i-w1+7] |
-           img[i-7]    | img[i+7] |
-           img[i+w1-7] | img[i+w1+7] |
-           img[i+w2-7] | img[i+w2+7] |
-           img[i+w3-7] | img[i+w3-6] | img[i+w3+6] | img[i+w3+7] |
-           img[i+w4-6] | img[i+w4+6] |
-           img[i+w5-6] | img[i+w5-5] | img[i+w5+5] | img[i+w5+6] |
-           img[i+w6-4] | img[i+w6-3] | img[i+w6+3] | img[i+w6+4] |
-           img[i+w7-3] | img[i+w7-2] | img[i+w7-1] | img[i+w7] | img[i+w7+1] | img[i+w7+2] | img[i+w7+3];
-  if(retval || (radius < 8)) return retval;
-
-  const size_t w8 = 8*w1;
-  retval = img[i-w8-4] | img[i-w8-3] | img[i-w8-2] | img[i-w8-1] | img[i-w8] | img[i-w8+1] | img[i-w8+2] | img[i-w8+3] | img[i-w8+4] |
-           img[i-w7-6] | img[i-w7-5] | img[i-w7-4] | img[i-w7+4] | img[i-w7+5] | img[i-w7+6] |
-           img[i-w6-6] | img[i-w6-5] | img[i-w6+5] | img[i-w6+6] |
-           img[i-w5-7] | img[i-w5+6] |
-           img[i-w4-8] | img[i-w4-7] | img[i-w4+7] | img[i-w4+8] |
-           img[i-w3-8] | img[i-w3-7] | img[i-w3+7] | img[i-w3+8] |
-           img[i-w2-8] | img[i-w2+8] |
-           img[i-w1-8] | img[i-w1+8] |
-           img[i-8]    | img[i+8] |
-           img[i+w1-8] | img[i+w1+8] |
-           img[i+w2-8] | img[i+w2+8] |
-           img[i+w3-8] | img[i+w3-7] | img[i+w3+7] | img[i+w3+8] |
-           img[i+w4-8] | img[i+w4-7] | img[i+w4+7] | img[i+w4+8] |
-           img[i+w5-7] | img[i+w5+7] |
-           img[i+w6-6] | img[i+w6-5] | img[i+w6+5] | img[i+w6+6] |
-           img[i+w7-6] | img[i+w7-5] | img[i+w7-4] | img[i+w7+4] | img[i+w7+5] | img[i-w7+6] |
-           img[i+w8-4] | img[i+w8-3] | img[i+w8-2] | img[i+w8-1] | img[i+w8] | img[i+w8+1] | img[i+w8+2] | img[i+w8+3] | img[i+w8+4];
-  return retval;
+  { { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, {-1, 1}, {-1, 1}, {-1, 1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1} },
+  { { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, {-1, 1}, {-2, 2}, {-2, 2}, {-2, 2}, {-1, 1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1} },
+  { { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, {-2, 2}, {-3, 3}, {-3, 3}, {-3, 3}, {-3, 3}, {-3, 3}, {-2, 2}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1} },
+  { { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1}, {-2, 2}, {-3, 3}, {-4, 4}, {-4, 4}, {-4, 4}, {-4, 4}, {-4, 4}, {-3, 3}, {-2, 2}, { 0,-1}, { 0,-1}, { 0,-1}, { 0,-1} },
+  { { 0,-1}, { 0,-1}, { 0,-1}, {-2, 2}, {-4, 4}, {-4, 4}, {-5, 5}, {-5, 5}, {-5, 5}, {-5, 5}, {-5, 5}, {-4, 4}, {-4, 4}, {-2, 2}, { 0,-1}, { 0,-1}, { 0,-1} },
+  { { 0,-1}, { 0,-1}, {-2, 2}, {-4, 4}, {-5, 5}, {-5, 5}, {-6, 6}, {-6, 6}, {-6, 6}, {-6, 6}, {-6, 6}, {-5, 5}, {-5, 5}, {-4, 4}, {-2, 2}, { 0,-1}, { 0,-1} },
+  { { 0,-1}, {-3, 3}, {-4, 4}, {-6, 6}, {-6, 6}, {-7, 7}, {-7, 7}, {-7, 7}, {-7, 7}, {-7, 7}, {-7, 7}, {-7, 7}, {-6, 6}, {-6, 6}, {-4, 4}, {-3, 3}, { 0,-1} },
+  { {-4, 4}, {-6, 6}, {-6, 6}, {-7, 6}, {-8, 8}, {-8, 8}, {-8, 8}, {-8, 8}, {-8, 8}, {-8, 8}, {-8, 8}, {-8, 8}, {-8, 8}, {-7, 7}, {-6, 6}, {-6, 5}, {-4, 4} },
+};
+
+/* The morphological operations work on bit-packed planes, every row holds `words` 64bit words
+   with the location x at bit x%64 of word x/64. So we test 64 locations at once.
+*/
+static inline uint64_t _shifted_word(const uint64_t *b, const size_t j, const size_t words, const int k)
+{
+  // word j of the row holding the bits of location x+k
+  if(k > 0)
+    return (b[j] >> k) | (j + 1 < words ? b[j+1] << (64 - k) : 0);
+  else if(k < 0)
+    return (b[j] << -k) | (j > 0 ? b[j-1] >> (64 + k) : 0);
+  return b[j];
 }
 
-static inline void _dilating(const uint32_t *img,
-                             uint32_t *o,
-                             const int w1,
+static void _bits_pack(const uint32_t *img,
+                       uint64_t *b,
+                       const int width,
+                       const int height,
+                       const size_t words)
+{
+  DT_OMP_FOR()
+  for(int row = 0; row < height; row++)
+  {
+    const uint32_t *s = img + (size_t)row * width;
+    uint64_t *d = b + (size_t)row * words;
+    for(size_t j = 0; j < words; j++)
+    {
+      const int x = 64 * j;
+      const int n = MIN(64, width - x);
+      uint64_t v = 0;
+      for(int k = 0; k < n; k++)
+        v |= (uint64_t)(s[x+k] != 0) << k;
+      d[j] = v;
+    }
+  }
+}
+
+static void _bits_unpack(const uint64_t *b,
+                         uint32_t *img,
+                         const int width,
+                         const int height,
+                         const size_t words,
+                         const int border)
+{
+  DT_OMP_FOR()
+  for(int row = border; row < height - border; row++)
+  {
+    const uint64_t *s = b + (size_t)row * words;
+    uint32_t *d = img + (size_t)row * width;
+    for(int col = border; col < width - border; col++)
+      d[col] = (s[col / 64] >> (col % 64)) & 1;
+  }
+}
+
+static void _bits_borderfill(uint64_t *b,
+                             const int width,
                              const int height,
-                             const int border,
-                             const int radius)
+                             const size_t words,
+                             const int border)
 {
-  DT_OMP_FOR(collapse(2))
+  // same locations as _intimage_borderfill()
+  for(int row = 0; row < border; row++)
+  {
+    for(size_t j = 0; j < words; j++)
+      b[(size_t)row * words + j] = b[(size_t)(row + height - border - 1) * words + j] = ~(uint64_t)0;
+  }
   for(int row = border; row < height - border; row++)
   {
-    for(int col = border; col < w1 - border; col++)
+    uint64_t *d = b + (size_t)row * words;
+    for(int col = 0; col < border; col++)
     {
-      const size_t i = (size_t)row*w1 + col;
-      o[i] = _test_dilate(img, i, w1, radius) ? 1 : 0;
+      d[col / 64] |= (uint64_t)1 << (col % 64);
+      d[(width - border + col) / 64] |= (uint64_t)1 << ((width - border + col) % 64);
     }
   }
 }
 
-static inline int _test_erode(const uint32_t *img, const size_t i, const size_t w1, const int radius)
+static void _dilating(const uint64_t *img,
+                      uint64_t *o,
+                      const size_t words,
+                      const int height,
+                      const int border,
+                      const int radius)
 {
-  int retval = 1;
-  retval =     img[i-w1-1] & img[i-w1] & img[i-w1+1] &
-               img[i-1]    & img[i]    & img[i+1] &
-               img[i+w1-1] & img[i+w1] & img[i+w1+1];
-  if((retval == 0) || (radius < 2)) return retval;
-
-  const size_t w2 = 2*w1;
-  retval = img[i-w2-1] & img[i-w2]   & img[i-w2+1] &
-           img[i-w1-2] & img[i-w1+2] &
-           img[i-2]    & img[i+2] &
-           img[i+w1-2] & img[i+w1+2] &
-           img[i+w2-1] & img[i+w2]   & img[i+w2+1];
-  if((retval == 0) || (radius < 3)) return retval;
-
-  const size_t w3 = 3*w1;
-  retval = img[i-w3-2] & img[i-w3-1] & img[i-w3] & img[i-w3+1] & img[i-w3+2] &
-           img[i-w2-3] & img[i-w2-2] & img[i-w2+2] & img[i-w2+3] &
-           img[i-w1-3] & img[i-w1+3] &
-           img[i-3]    & img[i+3]    &
-           img[i+w1-3] & img[i+w1+3] &
-           img[i+w2-3] & img[i+w2-2] & img[i+w2+2] & img[i+w2+3] &
-           img[i+w3-2] & img[i+w3-1] & img[i+w3] & img[i+w3+1] & img[i+w3+2]; 
-  if((retval == 0) || (radius < 4)) return retval;
-
-  const size_t w4 = 4*w1;
-  retval = img[i-w4-2] & img[i-w4-1] & img[i-w4] & img[i-w4+1] & img[i-w4+2] &
-           img[i-w3-3] & img[i-w3+3] &
-           img[i-w2-4] & img[i-w2+4] &
-           img[i-w1-4] & img[i-w1+4] &
-           img[i-4]    & img[i+4] &
-           img[i+w1-4] & img[i+w1+4] & 
-           img[i+w2-4] & img[i+w2+4] & 
-           img[i+w3-3] & img[i+w3+3] &
-           img[i+w4-2] & img[i+w4-1] & img[i+w4] & img[i+w4+1] & img[i+w4+2]; 
-  if((retval == 0) || (radius < 5)) return retval;
-
-  const size_t w5 = 5*w1;
-  retval = img[i-w5-2] & img[i-w5-1] & img[i-w5] & img[i-w5+1] & img[i-w5+2] &
-           img[i-w4-4] & img[i-w4-3] & img[i-w4+3] & img[i-w4+4] &
-           img[i-w3-4] & img[i-w3+4] &
-           img[i-w2-5] & img[i-w2+5] &
-           img[i-w1-5] & img[i-w1+5] &
-           img[i-5]    & img[i+5] &
-           img[i+w1-5] & img[i+w1+5] &
-           img[i+w2-5] & img[i+w2+5] &
-           img[i+w3-4] & img[i+w3+4] &
-           img[i+w4-4] & img[i+w4-3] & img[i+w4+3] & img[i+w4+4] &
-           img[i+w5-2] & img[i+w5-1] & img[i+w5] & img[i+w5+1] & img[i+w5+2]; 
-  return retval;
+  const int8_t (*extent)[2] = _morph_extent[radius-1];
+  DT_OMP_FOR()
+  for(int row = border; row < height - border; row++)
+  {
+    for(size_t j = 0; j < words; j++)
+    {
+      uint64_t retval = 0;
+      for(int dy = -radius; dy <= radius; dy++)
+      {
+        const uint64_t *b = img + (size_t)(row + dy) * words;
+        for(int k = extent[dy+8][0]; k <= extent[dy+8][1]; k++)
+          retval |= _shifted_word(b, j, words, k);
+      }
+      o[(size_t)row * words + j] = retval;
+    }
+  }
 }
 
-static inline void _eroding(const uint32_t *img,
-                            uint32_t *o,
-                            const int w1,
-                            const int height,
-                            const int border,
-                            const int radius)
+static void _eroding(const uint64_t *img,
+                     uint64_t *o,
+                     const size_t words,
+                     const int height,
+                     const int border,
+                     const int radius)
 {
-  DT_OMP_FOR(collapse(2))
+  const int8_t (*extent)[2] = _morph_extent[radius-1];
+  DT_OMP_FOR()
   for(int row = border; row < height - border; row++)
   {
-    for(int col = border; col < w1 - border; col++)
+    for(size_t j = 0; j < words; j++)
     {
-      const size_t i = (size_t)row*w1 + col; 
-      o[i] = _test_erode(img, i, w1, radius) ? 1 : 0;
+      uint64_t retval = ~(uint64_t)0;
+      for(int dy = -radius; dy <= radius; dy++)
+      {
+        const uint64_t *b = img + (size_t)(row + dy) * words;
+        for(int k = extent[dy+8][0]; k <= extent[dy+8][1]; k++)
+          retval &= _shifted_word(b, j, words, k);
+      }
+      o[(size_t)row * words + j] = retval;
     }
   }
 }
@@ -544,10 +492,10 @@ static gboolean _floodfill_segmentize(int yin,
   return success;
 }
 
-// User interface
-void dt_segmentize_plane(dt_iop_segmentation_t *seg)
+// the reference segmentation, also used as fallback if we can't allocate the labeling buffer
+static void _segmentize_floodfill(dt_iop_segmentation_t *seg)
 {
-  dt_ff_stack_t stack;  
+  dt_ff_stack_t stack;
   const int width = seg->width;
   const int height = seg->height;
   stack.size = (size_t)width * height / 32;
@@ -582,6 +530,311 @@ void dt_segmentize_plane(dt_iop_segmentation_t *seg)
   dt_free_align(stack.el);
 }
 
+/* Union-find for the parallel segmentation working on the runs of segment locations in
+   the rows. A parent always has a smaller index than its children so the root is the first
+   run of a segment in raster order, that is exactly where the floodfill would have started.
+*/
+static inline uint32_t _uf_find(uint32_t *parent, uint32_t i)
+{
+  while(parent[i] != i)
+  {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+static inline void _uf_union(uint32_t *parent, const uint32_t a, const uint32_t b)
+{
+  const uint32_t ra = _uf_find(parent, a);
+  const uint32_t rb = _uf_find(parent, b);
+  if(ra < rb)
+    parent[rb] = ra;
+  else if(rb < ra)
+    parent[ra] = rb;
+}
+
+typedef struct dt_seg_runs_t
+{
+  int *rbase;        // index of the first run for every row, the runs are in raster order
+  int *x0;           // first and last+1 column of every run
+  int *x1;
+  uint32_t *parent;
+  int *label;        // size of a segment for the root run, later the segment id for all runs
+  int *xmin;         // bounding rectangle of the border markings next to every run
+  int *xmax;
+  int *ymin;
+  int *ymax;
+} dt_seg_runs_t;
+
+// 4-connected runs of a row and the row above share a column
+static void _link_runs(dt_seg_runs_t *r, const int row)
+{
+  int i = r->rbase[row-1];
+  int j = r->rbase[row];
+  while(i < r->rbase[row] && j < r->rbase[row+1])
+  {
+    if(r->x1[i] > r->x0[j] && r->x1[j] > r->x0[i])
+      _uf_union(r->parent, i, j);
+    if(r->x1[i] < r->x1[j])
+      i++;
+    else
+      j++;
+  }
+}
+
+static inline void _mark_location(uint32_t *d,
+                                  const size_t i,
+                                  const int row,
+                                  const int col,
+                                  const int width,
+                                  const int height,
+                                  const int border)
+{
+  if(d[i] != 0) return;
+
+  uint32_t m = DT_SEG_ID_MASK;
+  if(row > border + 1 && row + 1 < height - border && d[i+width] > 1)
+    m = MIN(m, d[i+width]);
+  if(row < height - border - 2 && row > border && d[i-width] > 1)
+    m = MIN(m, d[i-width]);
+  if(col < width - border - 2 && col > border && d[i-1] > 1)
+    m = MIN(m, d[i-1]);
+  if(col > border + 1 && col + 1 < width - border && d[i+1] > 1)
+    m = MIN(m, d[i+1]);
+  // markings have the mask bit set so they are never found here
+  if(m < DT_SEG_ID_MASK)
+    d[i] = DT_SEG_ID_MASK | m;
+}
+
+// mark the free locations of a row above and below the runs of the neighbour rows and besides its own runs
+static void _mark_row(uint32_t *d,
+                      const dt_seg_runs_t *r,
+                      const int row,
+                      const int width,
+                      const int height,
+                      const int border)
+{
+  const size_t o = (size_t)width * row;
+  for(int nrow = MAX(border, row - 1); nrow <= MIN(height - border - 1, row + 1); nrow++)
+  {
+    for(int k = r->rbase[nrow - border]; k < r->rbase[nrow - border + 1]; k++)
+    {
+      if(r->label[k] < 2) continue;
+      if(nrow != row)
+      {
+        for(int col = r->x0[k]; col < r->x1[k]; col++)
+          _mark_location(d, o + col, row, col, width, height, border);
+      }
+      else
+      {
+        if(r->x0[k] > border)
+          _mark_location(d, o + r->x0[k] - 1, row, r->x0[k] - 1, width, height, border);
+        if(r->x1[k] < width - border)
+          _mark_location(d, o + r->x1[k], row, r->x1[k], width, height, border);
+      }
+    }
+  }
+}
+
+static inline void _run_box(const dt_seg_runs_t *r, const int k, const int col, const int row)
+{
+  r->xmin[k] = MIN(r->xmin[k], col);
+  r->xmax[k] = MAX(r->xmax[k], col);
+  r->ymin[k] = MIN(r->ymin[k], row);
+  r->ymax[k] = MAX(r->ymax[k], row);
+}
+
+// rows per band for the parallel labeling
+#define DT_SEG_BAND_ROWS 32
+
+// User interface
+void dt_segmentize_plane(dt_iop_segmentation_t *seg)
+{
+  /* The segments are found by a 4-connected component labeling of the runs of segment
+     locations in every row, all per-location work is done in parallel.
+     Ids, sizes, border markings and bounding rectangles are identical to the floodfill; the
+     floodfill treated the upper neighbours of some locations next to the frame border slightly
+     different depending on the fill order.
+     As the rows are indexed from the frame border in `rbase` we use `row - border` there.
+  */
+  const int width = seg->width;
+  const int height = seg->height;
+  const int border = seg->border;
+  const size_t wd = width;
+  const int rows = MAX(0, height - 2 * border);
+  uint32_t *d = seg->data;
+
+  const double start = dt_get_debug_wtime();
+
+  dt_seg_runs_t r = { NULL };
+  r.rbase = dt_alloc_align_int(rows + 1);
+  if(!r.rbase)
+  {
+    _segmentize_floodfill(seg);
+    return;
+  }
+
+  DT_OMP_FOR()
+  for(int row = 0; row < rows; row++)
+  {
+    const uint32_t *s = d + wd * (row + border);
+    int n = 0;
+    for(int col = border; col < width - border; col++)
+      n += (s[col] == 1) && (col == border || s[col-1] != 1);
+    r.rbase[row + 1] = n;
+  }
+  r.rbase[0] = 0;
+  for(int row = 0; row < rows; row++)
+    r.rbase[row + 1] += r.rbase[row];
+  const int runs = r.rbase[rows];
+
+  int *rdata = dt_alloc_align_int(8 * (size_t)MAX(1, runs));
+  if(!rdata)
+  {
+    dt_free_align(r.rbase);
+    _segmentize_floodfill(seg);
+    return;
+  }
+  r.x0 = rdata;
+  r.x1 = r.x0 + runs;
+  r.parent = (uint32_t *)(r.x1 + runs);
+  r.label = (int *)(r.parent + runs);
+  r.xmin = r.label + runs;
+  r.xmax = r.xmin + runs;
+  r.ymin = r.xmax + runs;
+  r.ymax = r.ymin + runs;
+
+  DT_OMP_FOR()
+  for(int row = 0; row < rows; row++)
+  {
+    const uint32_t *s = d + wd * (row + border);
+    int k = r.rbase[row];
+    for(int col = border; col < width - border; col++)
+    {
+      if(s[col] != 1) continue;
+      r.x0[k] = col;
+      while(col < width - border && s[col] == 1)
+        col++;
+      r.x1[k] = col;
+      r.parent[k] = k;
+      k++;
+    }
+  }
+
+  // link the runs in bands of rows, the bands are linked afterwards
+  const int bands = (rows + DT_SEG_BAND_ROWS - 1) / DT_SEG_BAND_ROWS;
+  DT_OMP_FOR()
+  for(int band = 0; band < bands; band++)
+  {
+    for(int row = band * DT_SEG_BAND_ROWS + 1; row < MIN(rows, (band + 1) * DT_SEG_BAND_ROWS); row++)
+      _link_runs(&r, row);
+  }
+  for(int band = 1; band < bands; band++)
+    _link_runs(&r, band * DT_SEG_BAND_ROWS);
+
+  // flatten in raster order, the parent has a final root already so we also get the sizes
+  for(int k = 0; k < runs; k++)
+  {
+    const uint32_t root = r.parent[r.parent[k]];
+    r.parent[k] = root;
+    if(root == (uint32_t)k)
+      r.label[k] = 0;
+    r.label[root] += r.x1[k] - r.x0[k];
+  }
+
+  // segments get their id in raster order of their roots, too small ones are left as they are
+  int id = 2;
+  for(int row = 0; row < rows; row++)
+  {
+    for(int k = r.rbase[row]; k < r.rbase[row + 1]; k++)
+    {
+      if(r.parent[k] != (uint32_t)k)
+        r.label[k] = r.label[r.parent[k]];
+      else if(r.label[k] > 3 && id < seg->slots - 2)
+      {
+        _clear_segment_slot(seg, id);
+        seg->size[id] = r.label[k];
+        seg->xmin[id] = seg->xmax[id] = r.x0[k];
+        seg->ymin[id] = seg->ymax[id] = row + border;
+        r.label[k] = id++;
+      }
+      else
+        r.label[k] = 1;
+    }
+  }
+  seg->nr = id;
+  _clear_segment_slot(seg, id);
+
+  DT_OMP_FOR()
+  for(int row = 0; row < rows; row++)
+  {
+    uint32_t *s = d + wd * (row + border);
+    for(int k = r.rbase[row]; k < r.rbase[row + 1]; k++)
+    {
+      for(int col = r.x0[k]; col < r.x1[k]; col++)
+        s[col] = r.label[k];
+    }
+  }
+
+  /* A free location next to segments is marked as border of the one with lowest id.
+     Marking a row reads the rows above and below so we do the even and odd rows separately.
+  */
+  for(int odd = 0; odd < 2; odd++)
+  {
+    DT_OMP_FOR()
+    for(int row = odd; row < rows; row += 2)
+    {
+      _mark_row(d, &r, row + border, width, height, border);
+    }
+  }
+
+  // the bounding rectangle of every segment holds the markings next to its runs
+  DT_OMP_FOR()
+  for(int row = border; row < height - border; row++)
+  {
+    for(int k = r.rbase[row - border]; k < r.rbase[row - border + 1]; k++)
+    {
+      r.xmin[k] = r.ymin[k] = INT_MAX;
+      r.xmax[k] = r.ymax[k] = INT_MIN;
+      if(r.label[k] < 2) continue;
+
+      const uint32_t mark = DT_SEG_ID_MASK | r.label[k];
+      for(int nrow = row - 1; nrow <= row + 1; nrow += 2)
+      {
+        const uint32_t *s = d + wd * nrow;
+        for(int col = r.x0[k]; col < r.x1[k]; col++)
+          if(s[col] == mark) _run_box(&r, k, col, nrow);
+      }
+      const uint32_t *s = d + wd * row;
+      if(s[r.x0[k] - 1] == mark) _run_box(&r, k, r.x0[k] - 1, row);
+      if(s[r.x1[k]] == mark) _run_box(&r, k, r.x1[k], row);
+    }
+  }
+
+  for(int k = 0; k < runs; k++)
+  {
+    const int sid = r.label[k];
+    if(sid < 2 || r.xmin[k] > r.xmax[k]) continue;
+    seg->xmin[sid] = MIN(seg->xmin[sid], r.xmin[k]);
+    seg->xmax[sid] = MAX(seg->xmax[sid], r.xmax[k]);
+    seg->ymin[sid] = MIN(seg->ymin[sid], r.ymin[k]);
+    seg->ymax[sid] = MAX(seg->ymax[sid], r.ymax[k]);
+  }
+
+  dt_free_align(rdata);
+  dt_free_align(r.rbase);
+
+  if(id >= (seg->slots - 2))
+    dt_print(DT_DEBUG_ALWAYS, "[segmentize_plane] %ix%i number of segments exceeds maximum=%i\n",
+             (int)width, (int)height, seg->slots);
+
+  dt_print(DT_DEBUG_PERF, "[segmentize_plane] %ix%i, %i runs, %i segments in %.3fs\n",
+           width, height, runs, id - 2, dt_get_debug_wtime() - start);
+}
+
+#undef DT_SEG_BAND_ROWS
+
 void dt_segments_combine(dt_iop_segmentation_t *seg, const int radius)
 {
   uint32_t *img = seg->data;
@@ -590,22 +843,36 @@ void dt_segments_combine(dt_iop_segmentation_t *seg, const int radius)
   const int border = seg->border;
   _intimage_borderfill(img, width, height, 0, border);
 
-  _dilating(img, seg->tmp, width, height, border, radius);
+  const size_t words = (width + 63) / 64;
+  uint64_t *bits = dt_alloc_align_type(uint64_t, words * height);
+  uint64_t *tmp = dt_alloc_align_type(uint64_t, words * height);
+  if(!bits || !tmp)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[segments_combine] can't allocate morphology buffers\n");
+    dt_free_align(bits);
+    dt_free_align(tmp);
+    return;
+  }
+
+  _bits_pack(img, bits, width, height, words);
+  _dilating(bits, tmp, words, height, border, radius);
   if(radius > 3)
   {
-    _intimage_borderfill(seg->tmp, width, height, 1, border);
-    _eroding(seg->tmp, img, width, height, border, radius-3);
+    _bits_borderfill(tmp, width, height, words, border);
+    _eroding(tmp, bits, words, height, border, radius-3);
+    _bits_unpack(bits, img, width, height, words, border);
   }
   else
-    memcpy(img, seg->tmp, (size_t) width * height * sizeof(uint32_t));
+    _bits_unpack(tmp, img, width, height, words, border);
 
+  dt_free_align(bits);
+  dt_free_align(tmp);
   _intimage_borderfill(img, width, height, 0, border);
 }
 
 void dt_segmentation_free_struct(dt_iop_segmentation_t *seg)
 {
   dt_free_align(seg->data);
-  dt_free_align(seg->tmp);
   dt_free_align(seg->size);
   dt_free_align(seg->xmin);
   dt_free_align(seg->ymin);
@@ -628,7 +895,6 @@ gboolean dt_segmentation_init_struct(dt_iop_segmentation_t *seg,
   const size_t bsize = (size_t) width * height * sizeof(uint32_t);
 
   seg->data =   dt_calloc_aligned(bsize);
-  seg->tmp =    dt_alloc_aligned(bsize);
   seg->size =   dt_alloc_align_int(slots);
   seg->xmin =   dt_alloc_align_int(slots);
   seg->xmax =   dt_alloc_align_int(slots);
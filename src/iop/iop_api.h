@@ -272,6 +272,39 @@ DEFAULT(void, process_tiling, struct dt_iop_module_t *self,
                               const struct dt_iop_roi_t *const roi_in,
                               const struct dt_iop_roi_t *const roi_out,
                               const int bpp);
+/** point-wise variant of process() for modules mapping each 4-channel float pixel on its
+ *  own with roi_in == roi_out. the pipe may run a chain of such modules band by band
+ *  instead of one full-buffer pass per module, the bands are in the module's input
+ *  colorspace. process_pixels_prepare() is called once per run in pipe order and does
+ *  whatever process() does besides the pixel loop. process_pixels() is called concurrently
+ *  on disjoint bands, must not start threads itself and has to allow in == out.
+ *  process() should do its pixel loop with dt_iop_process_pixels() so both give the same
+ *  bits, commit_params() clears piece->process_pixels_ready if the parameters need more
+ *  than the pixel itself. process_pixels_prepare() returns TRUE if the module can't be
+ *  set up for this run, the pipe then processes the modules one by one. */
+OPTIONAL(gboolean, process_pixels_prepare, struct dt_iop_module_t *self,
+                                           struct dt_dev_pixelpipe_iop_t *piece);
+OPTIONAL(void, process_pixels, struct dt_iop_module_t *self,
+                               struct dt_dev_pixelpipe_iop_t *piece,
+                               const float *const in,
+                               float *const out,
+                               const size_t npixels);
+/** the same for modules working on the single-channel raw mosaic where every sensel only
+ *  depends on the input sensel at the same position. process_mosaic() computes the rows
+ *  row .. row + rows - 1 of roi_out, the first module of a run may crop, for all others
+ *  roi_in == roi_out and in == out. the piece's dsc_in is the format process() would see
+ *  as input. commit_params() clears piece->process_mosaic_ready if the parameters need
+ *  process() itself. */
+OPTIONAL(void, process_mosaic_prepare, struct dt_iop_module_t *self,
+                                       struct dt_dev_pixelpipe_iop_t *piece);
+OPTIONAL(void, process_mosaic, struct dt_iop_module_t *self,
+                               struct dt_dev_pixelpipe_iop_t *piece,
+                               const void *const in,
+                               float *const out,
+                               const struct dt_iop_roi_t *const roi_in,
+                               const struct dt_iop_roi_t *const roi_out,
+                               const int row,
+                               const int rows);
 
 #ifdef HAVE_OPENCL
 /** the opencl equivalent of process().
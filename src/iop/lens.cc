@@ -209,6 +209,8 @@ typedef struct dt_iop_lens_global_data_t
   int kernel_md_vignette;
   int kernel_md_correct;
   lfDatabase *db;
+  dt_pthread_mutex_t map_lock;
+  GList *maps; // coordinate maps shared by all pipes, most recently used first
 } dt_iop_lens_global_data_t;
 
 typedef struct dt_iop_lens_data_t
@@ -1001,6 +1003,293 @@ static lfModifier * _get_modifier(int *mods_done,
   return mod;
 }
 
+/* Coordinate maps for the geometric corrections.
+ *
+ * Lensfun is only evaluated on a sparse grid of the (scaled) image, the
+ * per pixel coordinates are bilinearly interpolated from that grid. After
+ * building, the map is compared against Lensfun in the centre of every grid
+ * cell, the grid is refined until the largest deviation is below
+ * DT_IOP_LENS_MAP_TOLERANCE pixels. If that fails, or Lensfun returns
+ * non-finite coordinates, the exact per pixel path is used.
+ *
+ * The maps only depend on the lens parameters and the scaled image size, so
+ * they are shared by all pipes and images of the same shoot.
+ */
+#define DT_IOP_LENS_MAP_TOLERANCE 0.05f
+#define DT_IOP_LENS_MAP_STEP_MAX 16
+#define DT_IOP_LENS_MAP_STEP_MIN 4
+#define DT_IOP_LENS_MAP_CACHED 4
+
+#define DT_IOP_LENS_GEOMETRY_MODS (LF_MODIFY_TCA        \
+                                   | LF_MODIFY_DISTORTION \
+                                   | LF_MODIFY_GEOMETRY   \
+                                   | LF_MODIFY_SCALE)
+
+typedef struct dt_iop_lens_map_t
+{
+  dt_hash_t hash;
+  int width, height;
+  int step, nx, ny;
+  float *grid; // nx * ny nodes of 6 floats as ApplySubpixelGeometryDistortion() writes them, NULL if not accurate
+  int refcount;
+} dt_iop_lens_map_t;
+
+static dt_hash_t _map_hash(const dt_iop_lens_data_t *d,
+                           const int mods_done,
+                           const int w,
+                           const int h,
+                           const gboolean inverse)
+{
+  dt_hash_t hash = DT_INITHASH;
+  if(d->lens->Maker) hash = dt_hash(hash, d->lens->Maker, strlen(d->lens->Maker));
+  if(d->lens->Model) hash = dt_hash(hash, d->lens->Model, strlen(d->lens->Model));
+  const int geometry_mods = mods_done & DT_IOP_LENS_GEOMETRY_MODS;
+  const int lens_type = d->lens->Type;
+  const int target_geom = d->target_geom;
+  hash = dt_hash(hash, &lens_type, sizeof(lens_type));
+  hash = dt_hash(hash, &geometry_mods, sizeof(geometry_mods));
+  hash = dt_hash(hash, &w, sizeof(w));
+  hash = dt_hash(hash, &h, sizeof(h));
+  hash = dt_hash(hash, &inverse, sizeof(inverse));
+  hash = dt_hash(hash, &d->crop, sizeof(d->crop));
+  hash = dt_hash(hash, &d->focal, sizeof(d->focal));
+  hash = dt_hash(hash, &d->scale, sizeof(d->scale));
+  hash = dt_hash(hash, &target_geom, sizeof(target_geom));
+  hash = dt_hash(hash, &d->tca_override, sizeof(d->tca_override));
+  if(d->tca_override)
+    hash = dt_hash(hash, d->custom_tca.Terms, 2 * sizeof(float));
+  return hash;
+}
+
+static inline void _map_sample(const dt_iop_lens_map_t *map,
+                               const float x,
+                               const float y,
+                               float *const out)
+{
+  const float fx = x / map->step;
+  const float fy = y / map->step;
+  const int ix = CLAMP((int)fx, 0, map->nx - 2);
+  const int iy = CLAMP((int)fy, 0, map->ny - 2);
+  const float wx = fx - ix;
+  const float wy = fy - iy;
+
+  const float *const n00 = map->grid + 6 * ((size_t)iy * map->nx + ix);
+  const float *const n01 = n00 + 6;
+  const float *const n10 = n00 + 6 * map->nx;
+  const float *const n11 = n10 + 6;
+  for(int k = 0; k < 6; k++)
+  {
+    const float top = n00[k] + wx * (n01[k] - n00[k]);
+    const float bottom = n10[k] + wx * (n11[k] - n10[k]);
+    out[k] = top + wy * (bottom - top);
+  }
+}
+
+static inline gboolean _map_covers(const dt_iop_lens_map_t *map,
+                                   const float x0,
+                                   const float y0,
+                                   const float x1,
+                                   const float y1)
+{
+  return x0 >= 0.0f && y0 >= 0.0f
+    && x1 <= (float)(map->nx - 1) * map->step
+    && y1 <= (float)(map->ny - 1) * map->step;
+}
+
+static gboolean _map_build_step(dt_iop_lens_map_t *map,
+                                const lfModifier *modifier,
+                                const int step)
+{
+  const int nx = (map->width - 1) / step + 2;
+  const int ny = (map->height - 1) / step + 2;
+  float *const grid = dt_alloc_align_float((size_t)6 * nx * ny);
+  if(!grid) return FALSE;
+
+  DT_OMP_FOR(shared(modifier))
+  for(int j = 0; j < ny; j++)
+    for(int i = 0; i < nx; i++)
+      modifier->ApplySubpixelGeometryDistortion(i * step, j * step, 1, 1,
+                                                grid + 6 * ((size_t)j * nx + i));
+
+  map->step = step;
+  map->nx = nx;
+  map->ny = ny;
+  map->grid = grid;
+
+  // compare against Lensfun in the cell centres, the points furthest from the nodes
+  float max_error = 0.0f;
+  DT_OMP_FOR(reduction(max: max_error) shared(modifier))
+  for(int j = 0; j < ny - 1; j++)
+    for(int i = 0; i < nx - 1; i++)
+    {
+      const float x = (i + 0.5f) * step;
+      const float y = (j + 0.5f) * step;
+      float DT_ALIGNED_ARRAY exact[6];
+      float DT_ALIGNED_ARRAY approx[6];
+      modifier->ApplySubpixelGeometryDistortion(x, y, 1, 1, exact);
+      _map_sample(map, x, y, approx);
+      for(int k = 0; k < 6; k++)
+      {
+        const float err = fabsf(approx[k] - exact[k]);
+        // also catches non-finite nodes
+        max_error = fmaxf(max_error, isfinite(err) ? err : INFINITY);
+      }
+    }
+
+  if(max_error <= DT_IOP_LENS_MAP_TOLERANCE) return TRUE;
+
+  dt_free_align(grid);
+  map->grid = NULL;
+  return FALSE;
+}
+
+static dt_iop_lens_map_t *_map_build(const dt_hash_t hash,
+                                     const int w,
+                                     const int h,
+                                     const lfModifier *modifier)
+{
+  dt_iop_lens_map_t *map = (dt_iop_lens_map_t *)calloc(1, sizeof(dt_iop_lens_map_t));
+  map->hash = hash;
+  map->width = w;
+  map->height = h;
+
+  const double start = dt_get_wtime();
+  for(int step = DT_IOP_LENS_MAP_STEP_MAX; step >= DT_IOP_LENS_MAP_STEP_MIN; step /= 2)
+    if(_map_build_step(map, modifier, step)) break;
+
+  dt_print(DT_DEBUG_PERF,
+           "[lens] coordinate map %dx%d %s, step %d, took %.3fs\n",
+           w, h, map->grid ? "built" : "not accurate enough",
+           map->step, dt_get_wtime() - start);
+  return map;
+}
+
+static void _map_free(dt_iop_lens_map_t *map)
+{
+  if(!map) return;
+  dt_free_align(map->grid);
+  free(map);
+}
+
+static void _map_evict_unused(dt_iop_lens_global_data_t *gd)
+{
+  // the list is ordered by last use, drop unused maps from the tail
+  guint length = g_list_length(gd->maps);
+  GList *iter = g_list_last(gd->maps);
+  while(iter && length > DT_IOP_LENS_MAP_CACHED)
+  {
+    GList *prev = g_list_previous(iter);
+    dt_iop_lens_map_t *map = (dt_iop_lens_map_t *)iter->data;
+    if(map->refcount == 0)
+    {
+      gd->maps = g_list_delete_link(gd->maps, iter);
+      _map_free(map);
+      length--;
+    }
+    iter = prev;
+  }
+}
+
+// look up the map for the given key, if modifier is not NULL a missing map is built.
+// returns NULL if there is no accurate map, release with _map_release().
+static dt_iop_lens_map_t *_map_get(dt_iop_module_t *self,
+                                   const dt_hash_t hash,
+                                   const int w,
+                                   const int h,
+                                   const lfModifier *modifier)
+{
+  dt_iop_lens_global_data_t *gd = (dt_iop_lens_global_data_t *)self->global_data;
+  dt_iop_lens_map_t *map = NULL;
+
+  dt_pthread_mutex_lock(&gd->map_lock);
+  for(int pass = 0; pass < 2 && !map; pass++)
+  {
+    for(GList *iter = gd->maps; iter; iter = g_list_next(iter))
+    {
+      dt_iop_lens_map_t *cached = (dt_iop_lens_map_t *)iter->data;
+      if(cached->hash == hash)
+      {
+        map = cached;
+        gd->maps = g_list_delete_link(gd->maps, iter);
+        break;
+      }
+    }
+    if(map || !modifier || pass) break;
+
+    // build without holding the lock, another pipe might have been faster afterwards
+    dt_pthread_mutex_unlock(&gd->map_lock);
+    dt_iop_lens_map_t *built = _map_build(hash, w, h, modifier);
+    dt_pthread_mutex_lock(&gd->map_lock);
+
+    for(GList *iter = gd->maps; iter && built; iter = g_list_next(iter))
+      if(((dt_iop_lens_map_t *)iter->data)->hash == hash)
+      {
+        _map_free(built);
+        built = NULL;
+      }
+    if(built) gd->maps = g_list_prepend(gd->maps, built);
+  }
+
+  if(map)
+  {
+    // failed maps stay in the cache so they are not built again
+    gd->maps = g_list_prepend(gd->maps, map);
+    if(map->grid)
+      map->refcount++;
+    else
+      map = NULL;
+  }
+  _map_evict_unused(gd);
+  dt_pthread_mutex_unlock(&gd->map_lock);
+  return map;
+}
+
+static void _map_release(dt_iop_module_t *self, dt_iop_lens_map_t *map)
+{
+  if(!map) return;
+  dt_iop_lens_global_data_t *gd = (dt_iop_lens_global_data_t *)self->global_data;
+  dt_pthread_mutex_lock(&gd->map_lock);
+  map->refcount--;
+  _map_evict_unused(gd);
+  dt_pthread_mutex_unlock(&gd->map_lock);
+}
+
+// get a map covering the given roi, NULL if the exact path has to be used
+static dt_iop_lens_map_t *_map_get_roi(dt_iop_module_t *self,
+                                       const dt_iop_lens_data_t *d,
+                                       const lfModifier *modifier,
+                                       const int mods_done,
+                                       const int w,
+                                       const int h,
+                                       const dt_iop_roi_t *const roi)
+{
+  dt_iop_lens_map_t *map =
+    _map_get(self, _map_hash(d, mods_done, w, h, d->inverse), w, h, modifier);
+  if(map && !_map_covers(map, roi->x, roi->y,
+                         roi->x + roi->width - 1, roi->y + roi->height - 1))
+  {
+    _map_release(self, map);
+    map = NULL;
+  }
+  return map;
+}
+
+static inline void _distort_row(const dt_iop_lens_map_t *map,
+                                const lfModifier *modifier,
+                                const int x,
+                                const int y,
+                                const int width,
+                                float *const buf)
+{
+  if(map)
+  {
+    for(int i = 0; i < width; i++)
+      _map_sample(map, x + i, y, buf + 6 * i);
+  }
+  else
+    modifier->ApplySubpixelGeometryDistortion(x, y, width, 1, buf);
+}
+
 static float _get_autoscale_lf(dt_iop_module_t *self,
                                dt_iop_lens_params_t *p,
                                const lfCamera *camera)
@@ -1103,13 +1392,15 @@ static void _process_lf(dt_iop_module_t *self,
 
       size_t padded_bufsize;
       float *const buf = dt_alloc_perthread_float(bufsize, &padded_bufsize);
+      dt_iop_lens_map_t *map = _map_get_roi(self, d, modifier, modflags,
+                                            orig_w, orig_h, roi_out);
 
-      DT_OMP_FOR(dt_omp_sharedconst(buf) shared(modifier))
+      DT_OMP_FOR(dt_omp_sharedconst(buf) shared(modifier, map))
       for(int y = 0; y < roi_out->height; y++)
       {
         float *bufptr = (float*)dt_get_perthread(buf, padded_bufsize);
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y,
-                                                  roi_out->width, 1, bufptr);
+        _distort_row(map, modifier, roi_out->x, roi_out->y + y,
+                     roi_out->width, bufptr);
 
         // reverse transform the global coords from lf to our buffer
         float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
@@ -1160,6 +1451,7 @@ static void _process_lf(dt_iop_module_t *self,
           }
         }
       }
+      _map_release(self, map);
       dt_free_align(buf);
     }
     else
@@ -1213,15 +1505,15 @@ static void _process_lf(dt_iop_module_t *self,
       const size_t buf2size = (size_t)roi_out->width * 2 * 3;
       size_t padded_buf2size;
       float *const buf2 = dt_alloc_perthread_float(buf2size, &padded_buf2size);
+      dt_iop_lens_map_t *map = _map_get_roi(self, d, modifier, modflags,
+                                            orig_w, orig_h, roi_out);
 
-      DT_OMP_FOR(dt_omp_sharedconst(buf2) shared(buf, modifier))
+      DT_OMP_FOR(dt_omp_sharedconst(buf2) shared(buf, modifier, map))
       for(int y = 0; y < roi_out->height; y++)
       {
         float *buf2ptr = (float*)dt_get_perthread(buf2, padded_buf2size);
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x,
-                                                  roi_out->y + y,
-                                                  roi_out->width,
-                                                  1, buf2ptr);
+        _distort_row(map, modifier, roi_out->x, roi_out->y + y,
+                     roi_out->width, buf2ptr);
         // reverse transform the global coords from lf to our buffer
         float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
         for(int x = 0; x < roi_out->width; x++, buf2ptr += 6, out += ch)
@@ -1273,6 +1565,7 @@ static void _process_lf(dt_iop_module_t *self,
           }
         }
       }
+      _map_release(self, map);
       dt_free_align(buf2);
     }
     else
@@ -1306,6 +1599,7 @@ static int _process_cl_lf(struct dt_iop_module_t *self,
 
   float *tmpbuf = NULL;
   lfModifier *modifier = NULL;
+  dt_iop_lens_map_t *map = NULL;
 
   const int devid = piece->pipe->devid;
   const int iwidth = roi_in->width;
@@ -1384,13 +1678,13 @@ static int _process_cl_lf(struct dt_iop_module_t *self,
                    | LF_MODIFY_GEOMETRY
                    | LF_MODIFY_SCALE))
     {
-      DT_OMP_FOR(dt_omp_sharedconst(raw_monochrome) shared(tmpbuf, d, modifier))
+      map = _map_get_roi(self, d, modifier, modflags, orig_w, orig_h, roi_out);
+      DT_OMP_FOR(dt_omp_sharedconst(raw_monochrome) shared(tmpbuf, d, modifier, map))
       for(int y = 0; y < roi_out->height; y++)
       {
         float *pi = tmpbuf + (size_t)y * tmpbufwidth;
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x,
-                                                  roi_out->y + y,
-                                                  roi_out->width, 1, pi);
+        _distort_row(map, modifier, roi_out->x, roi_out->y + y,
+                     roi_out->width, pi);
       }
 
       err = dt_opencl_write_buffer_to_device(devid, tmpbuf,
@@ -1497,13 +1791,13 @@ static int _process_cl_lf(struct dt_iop_module_t *self,
                    | LF_MODIFY_GEOMETRY
                    | LF_MODIFY_SCALE))
     {
-      DT_OMP_FOR(dt_omp_sharedconst(raw_monochrome) shared(tmpbuf, d, modifier))
+      map = _map_get_roi(self, d, modifier, modflags, orig_w, orig_h, roi_out);
+      DT_OMP_FOR(dt_omp_sharedconst(raw_monochrome) shared(tmpbuf, d, modifier, map))
       for(int y = 0; y < roi_out->height; y++)
       {
         float *pi = tmpbuf + (size_t)y * tmpbufwidth;
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x,
-                                                  roi_out->y + y,
-                                                  roi_out->width, 1, pi);
+        _distort_row(map, modifier, roi_out->x, roi_out->y + y,
+                     roi_out->width, pi);
       }
 
       err = dt_opencl_write_buffer_to_device(devid, tmpbuf,
@@ -1530,6 +1824,7 @@ error:
   dt_opencl_release_mem_object(dev_tmp);
   dt_opencl_release_mem_object(dev_tmpbuf);
   dt_free_align(tmpbuf);
+  _map_release(self, map);
   if(modifier != NULL) delete modifier;
   return err;
 }
@@ -1575,17 +1870,23 @@ static gboolean _distort_transform_lf(dt_iop_module_t *self,
                  | LF_MODIFY_GEOMETRY
                  | LF_MODIFY_SCALE))
   {
+    // only use a map if a pipe already built one, not worth it for a few points
+    dt_iop_lens_map_t *map =
+      _map_get(self, _map_hash(d, modflags, orig_w, orig_h, !d->inverse), orig_w, orig_h, NULL);
 
-    DT_OMP_FOR(if(points_count > 100))
+    DT_OMP_FOR(if(points_count > 100) shared(map))
     for(size_t i = 0; i < points_count * 2; i += 2)
     {
       float DT_ALIGNED_ARRAY buf[6];
-      modifier->ApplySubpixelGeometryDistortion(points[i],
-                                                points[i + 1],
-                                                1, 1, buf);
+      if(map && _map_covers(map, points[i], points[i + 1], points[i], points[i + 1]))
+        _map_sample(map, points[i], points[i + 1], buf);
+      else
+        modifier->ApplySubpixelGeometryDistortion(points[i],
+                                                  points[i + 1], 1, 1, buf);
       points[i] = buf[0];
       points[i + 1] = buf[3];
     }
+    _map_release(self, map);
   }
 
   delete modifier;
@@ -1616,16 +1917,23 @@ static gboolean _distort_backtransform_lf(dt_iop_module_t *self,
                  | LF_MODIFY_GEOMETRY
                  | LF_MODIFY_SCALE))
   {
+    // only use a map if a pipe already built one, not worth it for a few points
+    dt_iop_lens_map_t *map =
+      _map_get(self, _map_hash(d, modflags, orig_w, orig_h, d->inverse), orig_w, orig_h, NULL);
 
-    DT_OMP_FOR(if(points_count > 100))
+    DT_OMP_FOR(if(points_count > 100) shared(map))
     for(size_t i = 0; i < points_count * 2; i += 2)
     {
       float DT_ALIGNED_ARRAY buf[6];
-      modifier->ApplySubpixelGeometryDistortion(points[i],
-                                                points[i + 1], 1, 1, buf);
+      if(map && _map_covers(map, points[i], points[i + 1], points[i], points[i + 1]))
+        _map_sample(map, points[i], points[i + 1], buf);
+      else
+        modifier->ApplySubpixelGeometryDistortion(points[i],
+                                                  points[i + 1], 1, 1, buf);
       points[i] = buf[0];
       points[i + 1] = buf[3];
     }
+    _map_release(self, map);
   }
 
   delete modifier;
@@ -1677,12 +1985,15 @@ static void _distort_mask_lf(struct dt_iop_module_t *self,
   size_t padded_bufsize;
   float *const buf = dt_alloc_perthread_float(bufsize, &padded_bufsize);
 
-  DT_OMP_FOR(dt_omp_sharedconst(buf) shared(modifier))
+  dt_iop_lens_map_t *map = _map_get_roi(self, d, modifier, modflags,
+                                        orig_w, orig_h, roi_out);
+
+  DT_OMP_FOR(dt_omp_sharedconst(buf) shared(modifier, map))
   for(int y = 0; y < roi_out->height; y++)
   {
     float *bufptr = (float*)dt_get_perthread(buf, padded_bufsize);
-    modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y,
-                                              roi_out->width, 1, bufptr);
+    _distort_row(map, modifier, roi_out->x, roi_out->y + y,
+                 roi_out->width, bufptr);
 
     // reverse transform the global coords from lf to our buffer
     float *_out = out + (size_t)y * roi_out->width;
@@ -1702,6 +2013,7 @@ static void _distort_mask_lf(struct dt_iop_module_t *self,
                                               roi_in->width));
     }
   }
+  _map_release(self, map);
   dt_free_align(buf);
   delete modifier;
 }
@@ -1883,6 +2195,7 @@ static void _commit_params_lf(struct dt_iop_module_t *self,
         if(d->lens->CalibTCA)
           while(d->lens->CalibTCA[0]) d->lens->RemoveCalibTCA(0);
         d->lens->AddCalibTCA(&tca);
+        d->custom_tca = tca;
 #endif
       }
       lf_free(lens);
@@ -3375,6 +3688,9 @@ void init_global(dt_iop_module_so_t *module)
   lfDatabase *dt_iop_lensfun_db = new lfDatabase;
   gd->db = (lfDatabase *)dt_iop_lensfun_db;
 
+  dt_pthread_mutex_init(&gd->map_lock, NULL);
+  gd->maps = NULL;
+
 #if defined(__MACH__) || defined(__APPLE__)
 #else
   if(dt_iop_lensfun_db->Load() != LF_NO_ERROR)
@@ -3612,6 +3928,10 @@ void cleanup_global(dt_iop_module_so_t *module)
   lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
   delete dt_iop_lensfun_db;
 
+  g_list_free_full(gd->maps, (GDestroyNotify)_map_free);
+  gd->maps = NULL;
+  dt_pthread_mutex_destroy(&gd->map_lock);
+
   dt_opencl_free_kernel(gd->kernel_lens_distort_bilinear);
   dt_opencl_free_kernel(gd->kernel_lens_distort_bicubic);
   dt_opencl_free_kernel(gd->kernel_lens_distort_lanczos2);
@@ -263,6 +263,19 @@ typedef struct
   int warp_kernel;
 } dt_iop_liquify_global_data_t;
 
+typedef struct
+{
+  dt_iop_liquify_params_t params;
+
+  // distortion map of the last process() call, see _update_distortion_map()
+  dt_pthread_mutex_t lock;
+  float complex *map;
+  cairo_rectangle_int_t map_extent;
+  dt_liquify_warp_t *warps;    ///< the warps stamped into map
+  int n_warps;
+  GHashTable *lookup_tables;   ///< warp intensity tables, see _get_lookup_table()
+} dt_iop_liquify_data_t;
+
 typedef struct
 {
   int node_index; // last node index inserted
@@ -891,12 +904,46 @@ static void compute_round_stamp_extent(cairo_rectangle_int_t *const restrict sta
   const int iradius = round(cabsf(warp->radius - warp->point));
   assert(iradius > 0);
 
-  stamp_extent->x = stamp_extent->y = -iradius;
-  stamp_extent->x += crealf(warp->point);
-  stamp_extent->y += cimagf(warp->point);
+  // centered on the pixel the stamp is applied to, see _apply_round_stamp()
+  stamp_extent->x = (int)round(crealf(warp->point)) - iradius;
+  stamp_extent->y = (int)round(cimagf(warp->point)) - iradius;
   stamp_extent->width = stamp_extent->height = 2 * iradius + 1;
 }
 
+/*
+  The warp intensity tables only depend on the radius and the two
+  control values, warps interpolated along a path mostly share them.
+*/
+
+static GHashTable *_lookup_tables_new(void)
+{
+  return g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, dt_free_align_ptr);
+}
+
+static const float *_get_lookup_table(GHashTable *tables,
+                                      const dt_liquify_warp_t *const warp)
+{
+  const int table_size = round(cabsf(warp->radius - warp->point)) * LOOKUP_OVERSAMPLE;
+  dt_hash_t key = dt_hash(DT_INITHASH, &table_size, sizeof(table_size));
+  key = dt_hash(key, &warp->control1, sizeof(warp->control1));
+  key = dt_hash(key, &warp->control2, sizeof(warp->control2));
+
+  float *table = g_hash_table_lookup(tables, &key);
+  if(!table)
+  {
+    table = build_lookup_table(table_size, warp->control1, warp->control2);
+    if(!table)
+    {
+      dt_print(DT_DEBUG_ALWAYS,"[liquify] out of memory, round stamp skipped\n");
+      return NULL;
+    }
+    dt_hash_t *k = g_new(dt_hash_t, 1);
+    *k = key;
+    g_hash_table_insert(tables, k, table);
+  }
+  return table;
+}
+
 /*
   Compute a round(circular) stamp.
 
@@ -914,15 +961,28 @@ static void compute_round_stamp_extent(cairo_rectangle_int_t *const restrict sta
   circumference get no warp. Between center and circumference the
   warp magnitude follows a curve with maximum at radius / 0.5
 
-  Our stamp is stored in a rectangular region.
+  Our stamp is stored in a rectangular region, only the part inside
+  @a clip is added to the global map.
 */
 
-static void apply_round_stamp(const dt_liquify_warp_t *const restrict warp,
-                              float complex *global_map,
-                              const cairo_rectangle_int_t *const restrict global_map_extent)
+static void _apply_round_stamp(const dt_liquify_warp_t *const restrict warp,
+                               const float *const restrict lookup_table,
+                               float complex *const restrict global_map,
+                               const cairo_rectangle_int_t *const restrict global_map_extent,
+                               const cairo_rectangle_int_t *const restrict clip)
 {
-  const size_t iradius = round(cabsf(warp->radius - warp->point));
-  assert(iradius > 0);
+  cairo_rectangle_int_t stamp;
+  compute_round_stamp_extent(&stamp, warp);
+
+  const int x0 = MAX(stamp.x, clip->x);
+  const int x1 = MIN(stamp.x + stamp.width, clip->x + clip->width);
+  const int y0 = MAX(stamp.y, clip->y);
+  const int y1 = MIN(stamp.y + stamp.height, clip->y + clip->height);
+  if(x0 >= x1 || y0 >= y1) return;
+
+  const int iradius = stamp.width / 2;
+  const int center_x = stamp.x + iradius;
+  const int center_y = stamp.y + iradius;
 
   // 0.5 is factored in so the warp starts to degenerate when the
   // strength arrow crosses the warp radius.
@@ -933,78 +993,106 @@ static void apply_round_stamp(const dt_liquify_warp_t *const restrict warp,
     = cabsf(strength) * (warp->type == DT_LIQUIFY_WARP_TYPE_RADIAL_SHRINK ? -1.0f : 1.0f);
 
   // lookup table: map of distance from center point => warp
-  const size_t table_size = iradius * LOOKUP_OVERSAMPLE;
-  const float *const restrict lookup_table =
-    build_lookup_table(table_size, warp->control1, warp->control2);
-  if(!lookup_table)
+  const int table_size = iradius * LOOKUP_OVERSAMPLE;
+  const size_t global_width = global_map_extent->width;
+
+  for(int y = y0; y < y1; y++)
   {
-    dt_free_align((void*)lookup_table);
-    dt_print(DT_DEBUG_ALWAYS,"[liquify] out of memory, round stamp skipped\n");
-    return;
-  }
+    const int dy = y - center_y;
+    const float dy2 = (float)dy * dy;
+    float complex *const row
+      = global_map + (size_t)(y - global_map_extent->y) * global_width - global_map_extent->x;
 
-  // point into the global distortion map at the center of the circle
-  const size_t global_width = global_map_extent->width;
-  const size_t stamp_x = (size_t) round(crealf(warp->point));
-  const size_t stamp_y = (size_t) round(cimagf(warp->point));
-  float complex *const center
-    = (global_map
-       + (stamp_y - global_map_extent->y) * global_width
-       + stamp_x - global_map_extent->x);
-
-  // The expensive operation here is hypotf ().  By dividing the
-  // circle in quadrants and doing only the inside we have to calculate
-  // hypotf only for PI / 16 = 0.196 of the stamp area.
-  // We don't do octants to avoid false sharing of cache lines between threads.
-  DT_OMP_FOR(dt_omp_sharedconst(LOOKUP_OVERSAMPLE))
-  for(size_t y = 0; y <= iradius; y++)
-  {
-    const float complex y_i = y * I;
-    const float y2 = y*y;
-    for(size_t x = 0; x <= iradius; x++)
+    for(int x = x0; x < x1; x++)
     {
+      const int dx = x - center_x;
       // faster than hypotf(), and we know we won't have overflow or denormals
-      const float dist = sqrtf((float)x*x + y2);
-      const size_t idist = round(dist * LOOKUP_OVERSAMPLE);
+      const float dist = sqrtf((float)dx * dx + dy2);
+      const int idist = round(dist * LOOKUP_OVERSAMPLE);
       if(idist >= table_size)
-        // idist will only grow bigger in this row
-        break;
-
-      // pointers into the 4 quadrants of the circle
-      // quadrant count is ccw from positive x-axis
-      float complex *const q1 = center - y * global_width + x;
-      float complex *const q2 = center - y * global_width - x;
-      float complex *const q3 = center + y * global_width - x;
-      float complex *const q4 = center + y * global_width + x;
+        continue;
 
       if(warp->type == DT_LIQUIFY_WARP_TYPE_LINEAR)
-      {
-        const float complex w_strength = -strength * lookup_table[idist];
-        *q1 += w_strength;
-        if(x!=0)
-          *q2 += w_strength;
-        if(x!=0&&y!=0)
-          *q3 += w_strength;
-        if(y!=0)
-          *q4 += w_strength;
-      }
+        row[x] += -strength * lookup_table[idist];
       else
-      {
         // DT_LIQUIFY_WARP_TYPE_RADIAL_GROW or _SHRINK
         // abs_strength is negative for _SHRINK
-        const float abs_lookup = abs_strength * lookup_table[idist] / iradius;
-        *q1 -= abs_lookup * (x - y_i);
-        if(x!=0)
-          *q2 += abs_lookup * (x + y_i);
-        if(x!=0&&y!=0)
-          *q3 += abs_lookup * (x - y_i);
-        if(y!=0)
-          *q4 -= abs_lookup * (x + y_i);
-      }
+        row[x] -= abs_strength * lookup_table[idist] / iradius * (dx + dy * I);
+    }
+  }
+}
+
+// height of the bands the map is split into for stamping
+#define STAMP_BAND_HEIGHT 32
+
+/*
+  Clear the given region of the global map and stamp all warps into
+  it. The work is split into bands of rows, every band adds the warps
+  touching it in list order. So there are no races between the
+  threads and the sums don't depend on the number of threads.
+*/
+
+static void _stamp_warps(const dt_liquify_warp_t *const warps,
+                         const int n_warps,
+                         GHashTable *lookup_tables,
+                         float complex *const map,
+                         const cairo_rectangle_int_t *const map_extent,
+                         const cairo_region_t *region)
+{
+  GArray *bands = g_array_new(FALSE, FALSE, sizeof(cairo_rectangle_int_t));
+  for(int k = 0; k < cairo_region_num_rectangles(region); k++)
+  {
+    cairo_rectangle_int_t r;
+    cairo_region_get_rectangle(region, k, &r);
+    for(int y = r.y; y < r.y + r.height; y += STAMP_BAND_HEIGHT)
+    {
+      const cairo_rectangle_int_t band =
+        { r.x, y, r.width, MIN(STAMP_BAND_HEIGHT, r.y + r.height - y) };
+      g_array_append_val(bands, band);
     }
   }
 
-  dt_free_align((void*) lookup_table);
+  // fetch the lookup tables up-front, the table cache is not thread-safe.
+  // warps without table are outside of the region and skipped.
+  const float **tables = calloc(n_warps, sizeof(float *));
+  for(int k = 0; k < n_warps; k++)
+  {
+    cairo_rectangle_int_t r;
+    compute_round_stamp_extent(&r, &warps[k]);
+    if(cairo_region_contains_rectangle(region, &r) != CAIRO_REGION_OVERLAP_OUT)
+      tables[k] = _get_lookup_table(lookup_tables, &warps[k]);
+  }
+
+  const cairo_rectangle_int_t *const band_rects = (cairo_rectangle_int_t *)bands->data;
+  const int n_bands = bands->len;
+
+  DT_OMP_FOR()
+  for(int b = 0; b < n_bands; b++)
+  {
+    const cairo_rectangle_int_t *const band = &band_rects[b];
+    for(int y = band->y; y < band->y + band->height; y++)
+      memset(map + (size_t)(y - map_extent->y) * map_extent->width + band->x - map_extent->x,
+             0, sizeof(float complex) * band->width);
+
+    for(int k = 0; k < n_warps; k++)
+      if(tables[k])
+        _apply_round_stamp(&warps[k], tables[k], map, map_extent, band);
+  }
+
+  free(tables);
+  g_array_free(bands, TRUE);
+}
+
+#undef STAMP_BAND_HEIGHT
+
+static dt_liquify_warp_t *_warps_from_list(const GSList *list, int *n_warps)
+{
+  *n_warps = g_slist_length((GSList *)list);
+  dt_liquify_warp_t *warps = malloc(sizeof(dt_liquify_warp_t) * MAX(1, *n_warps));
+  int k = 0;
+  for(const GSList *i = list; i; i = g_slist_next(i))
+    warps[k++] = *(dt_liquify_warp_t *)i->data;
+  return warps;
 }
 
 /*
@@ -1118,15 +1206,22 @@ static float complex *create_global_distortion_map(const cairo_rectangle_int_t *
 
   // allocate distortion map big enough to contain all paths
   float complex *map = dt_alloc_align_type(float complex, mapsize);
-  memset(map, 0, sizeof(float complex) * mapsize);
-
-  // build map
-  for(const GSList *i = interpolated; i; i = g_slist_next(i))
+  if(!map)
   {
-    const dt_liquify_warp_t *warp = ((dt_liquify_warp_t *) i->data);
-    apply_round_stamp(warp, map, map_extent);
+    dt_print(DT_DEBUG_ALWAYS,"[liquify] out of memory, distortion map skipped\n");
+    return NULL;
   }
 
+  // build map
+  int n_warps = 0;
+  dt_liquify_warp_t *warps = _warps_from_list(interpolated, &n_warps);
+  GHashTable *lookup_tables = _lookup_tables_new();
+  cairo_region_t *region = cairo_region_create_rectangle(map_extent);
+  _stamp_warps(warps, n_warps, lookup_tables, map, map_extent, region);
+  cairo_region_destroy(region);
+  g_hash_table_destroy(lookup_tables);
+  free(warps);
+
   if(inverted)
   {
     float complex * const imap = dt_alloc_align_type(float complex, mapsize);
@@ -1192,7 +1287,7 @@ static void _build_global_distortion_map(struct dt_iop_module_t *module,
 {
   // copy params
   dt_iop_liquify_params_t copy_params;
-  memcpy(&copy_params, (dt_iop_liquify_params_t *)piece->data,
+  memcpy(&copy_params, &((dt_iop_liquify_data_t *)piece->data)->params,
          sizeof(dt_iop_liquify_params_t));
 
   distort_paths_raw_to_piece(module, piece->pipe, scale, &copy_params);
@@ -1207,6 +1302,148 @@ static void _build_global_distortion_map(struct dt_iop_module_t *module,
   g_list_free_full(interpolated, free);
 }
 
+static dt_hash_t _warp_hash(const dt_liquify_warp_t *const warp)
+{
+  const gboolean interpolated = warp->status & DT_LIQUIFY_STATUS_INTERPOLATED;
+  dt_hash_t hash = dt_hash(DT_INITHASH, &warp->point, sizeof(warp->point));
+  hash = dt_hash(hash, &warp->strength, sizeof(warp->strength));
+  hash = dt_hash(hash, &warp->radius, sizeof(warp->radius));
+  hash = dt_hash(hash, &warp->control1, sizeof(warp->control1));
+  hash = dt_hash(hash, &warp->control2, sizeof(warp->control2));
+  hash = dt_hash(hash, &warp->type, sizeof(warp->type));
+  return dt_hash(hash, &interpolated, sizeof(interpolated));
+}
+
+static void _count_warp(GHashTable *count, const dt_liquify_warp_t *const warp, const int delta)
+{
+  dt_hash_t *key = g_new(dt_hash_t, 1);
+  *key = _warp_hash(warp);
+  const int n = GPOINTER_TO_INT(g_hash_table_lookup(count, key));
+  g_hash_table_insert(count, key, GINT_TO_POINTER(n + delta));
+}
+
+// the region covered by the warps found in only one of the two lists
+
+static cairo_region_t *_changed_region(const dt_liquify_warp_t *const old_warps,
+                                       const int n_old,
+                                       const dt_liquify_warp_t *const new_warps,
+                                       const int n_new)
+{
+  cairo_region_t *changed = cairo_region_create();
+  GHashTable *count = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+  for(int k = 0; k < n_old; k++)
+    _count_warp(count, &old_warps[k], 1);
+
+  for(int k = 0; k < n_new; k++)
+  {
+    const dt_hash_t key = _warp_hash(&new_warps[k]);
+    if(GPOINTER_TO_INT(g_hash_table_lookup(count, &key)) > 0)
+      _count_warp(count, &new_warps[k], -1);
+    else
+    {
+      cairo_rectangle_int_t r;
+      compute_round_stamp_extent(&r, &new_warps[k]);
+      cairo_region_union_rectangle(changed, &r);
+    }
+  }
+
+  // whatever is left of the old warps has been removed or modified
+  for(int k = 0; k < n_old; k++)
+  {
+    const dt_hash_t key = _warp_hash(&old_warps[k]);
+    if(GPOINTER_TO_INT(g_hash_table_lookup(count, &key)) > 0)
+    {
+      _count_warp(count, &old_warps[k], -1);
+      cairo_rectangle_int_t r;
+      compute_round_stamp_extent(&r, &old_warps[k]);
+      cairo_region_union_rectangle(changed, &r);
+    }
+  }
+
+  g_hash_table_destroy(count);
+  return changed;
+}
+
+/*
+  Get the distortion map of the piece for process() and friends. The
+  map is kept in the piece data, if its extent didn't change only the
+  regions touched by warps added, removed or modified since the last
+  call are stamped again. Dragging a node thus only costs the area
+  of the path it belongs to. Must be called with the data lock held,
+  the map stays valid until the lock is released.
+*/
+
+static const float complex *_update_distortion_map(struct dt_iop_module_t *module,
+                                                   dt_dev_pixelpipe_iop_t *piece,
+                                                   const float scale,
+                                                   const dt_iop_roi_t *roi,
+                                                   cairo_rectangle_int_t *map_extent)
+{
+  dt_iop_liquify_data_t *d = piece->data;
+
+  dt_iop_liquify_params_t copy_params;
+  memcpy(&copy_params, &d->params, sizeof(dt_iop_liquify_params_t));
+
+  distort_paths_raw_to_piece(module, piece->pipe, scale, &copy_params);
+
+  GList *interpolated = interpolate_paths(&copy_params);
+  GSList *interpolated_in_roi = _get_map_extent(roi, interpolated, map_extent);
+  int n_warps = 0;
+  dt_liquify_warp_t *warps = _warps_from_list(interpolated_in_roi, &n_warps);
+  g_slist_free(interpolated_in_roi);
+  g_list_free_full(interpolated, free);
+
+  const size_t mapsize = (size_t)map_extent->width * map_extent->height;
+  if(mapsize == 0)
+  {
+    free(warps);
+    return NULL;
+  }
+
+  cairo_region_t *dirty = NULL;
+  if(d->map && !memcmp(&d->map_extent, map_extent, sizeof(cairo_rectangle_int_t)))
+  {
+    dirty = _changed_region(d->warps, d->n_warps, warps, n_warps);
+    cairo_region_intersect_rectangle(dirty, map_extent);
+  }
+  else
+  {
+    dt_free_align(d->map);
+    d->map = dt_alloc_align_type(float complex, mapsize);
+    if(!d->map)
+    {
+      free(warps);
+      dt_print(DT_DEBUG_ALWAYS,"[liquify] out of memory, distortion map skipped\n");
+      return NULL;
+    }
+    d->map_extent = *map_extent;
+    dirty = cairo_region_create_rectangle(map_extent);
+  }
+
+  // a fragmented region isn't worth the overhead of many small bands
+  if(cairo_region_num_rectangles(dirty) > 64)
+  {
+    cairo_rectangle_int_t r;
+    cairo_region_get_extents(dirty, &r);
+    cairo_region_destroy(dirty);
+    dirty = cairo_region_create_rectangle(&r);
+  }
+
+  if(!cairo_region_is_empty(dirty))
+  {
+    if(g_hash_table_size(d->lookup_tables) > 1024)
+      g_hash_table_remove_all(d->lookup_tables);
+    _stamp_warps(warps, n_warps, d->lookup_tables, d->map, map_extent, dirty);
+  }
+  cairo_region_destroy(dirty);
+
+  free(d->warps);
+  d->warps = warps;
+  d->n_warps = n_warps;
+  return d->map;
+}
+
 void modify_roi_in(struct dt_iop_module_t *module,
                     struct dt_dev_pixelpipe_iop_t *piece,
                     const dt_iop_roi_t *roi_out,
@@ -1376,24 +1613,22 @@ void distort_mask(struct dt_iop_module_t *self,
   // 1. copy the whole image (we'll change only a small part of it)
   dt_iop_copy_image_roi(out, in, 1, roi_in, roi_out);
 
-  // 2. build the distortion map
+  // 2. get the distortion map
+  dt_iop_liquify_data_t *d = piece->data;
   cairo_rectangle_int_t map_extent;
-  float complex *map = NULL;
-  _build_global_distortion_map(self, piece, roi_in->scale,
-                               roi_out, &map_extent, FALSE, &map);
-  if(map == NULL)
-    return;
+  dt_pthread_mutex_lock(&d->lock);
+  const float complex *map = _update_distortion_map(self, piece, roi_in->scale,
+                                                    roi_out, &map_extent);
 
   // 3. apply the map
-  if(map_extent.width != 0 && map_extent.height != 0)
+  if(map)
   {
     const int ch = piece->colors;
     piece->colors = 1;
     _apply_global_distortion_map(self, piece, in, out, roi_in, roi_out, map, &map_extent);
     piece->colors = ch;
   }
-
-  dt_free_align((void *) map);
+  dt_pthread_mutex_unlock(&d->lock);
 }
 
 void process(struct dt_iop_module_t *module,
@@ -1409,19 +1644,17 @@ void process(struct dt_iop_module_t *module,
   // 1. copy the whole image (we'll change only a small part of it)
   dt_iop_copy_image_roi(out, in, piece->colors, roi_in, roi_out);
 
-  // 2. build the distortion map
+  // 2. get the distortion map
+  dt_iop_liquify_data_t *d = piece->data;
   cairo_rectangle_int_t map_extent;
-  float complex *map = NULL;
-  _build_global_distortion_map(module, piece, roi_in->scale,
-                               roi_out, &map_extent, FALSE, &map);
-  if(map == NULL)
-    return;
+  dt_pthread_mutex_lock(&d->lock);
+  const float complex *map = _update_distortion_map(module, piece, roi_in->scale,
+                                                    roi_out, &map_extent);
 
   // 3. apply the map
-  if(map_extent.width != 0 && map_extent.height != 0)
+  if(map)
     _apply_global_distortion_map(module, piece, in, out, roi_in, roi_out, map, &map_extent);
-
-  dt_free_align((void *)map);
+  dt_pthread_mutex_unlock(&d->lock);
 }
 
 #ifdef HAVE_OPENCL
@@ -1575,20 +1808,18 @@ int process_cl(struct dt_iop_module_t *module,
     if(err != CL_SUCCESS) return err;
   }
 
-  // 2. build the distortion map
+  // 2. get the distortion map
+  dt_iop_liquify_data_t *d = piece->data;
   cairo_rectangle_int_t map_extent;
-  float complex *map = NULL;
-  _build_global_distortion_map(module, piece, roi_in->scale,
-                               roi_out, &map_extent, FALSE, &map);
-
-  if(map == NULL)
-    return CL_SUCCESS;
+  dt_pthread_mutex_lock(&d->lock);
+  const float complex *map = _update_distortion_map(module, piece, roi_in->scale,
+                                                    roi_out, &map_extent);
 
   // 3. apply the map
-  if(map_extent.width != 0 && map_extent.height != 0)
+  if(map)
     err = _apply_global_distortion_map_cl(module, piece, dev_in,
                                           dev_out, roi_in, roi_out, map, &map_extent);
-  dt_free_align((void *) map);
+  dt_pthread_mutex_unlock(&d->lock);
   return err;
 }
 
@@ -1612,6 +1843,39 @@ void cleanup_global(dt_iop_module_so_t *module)
   module->data = NULL;
 }
 
+void init_pipe(struct dt_iop_module_t *self,
+               dt_dev_pixelpipe_t *pipe,
+               dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_liquify_data_t *d = calloc(1, sizeof(dt_iop_liquify_data_t));
+  dt_pthread_mutex_init(&d->lock, NULL);
+  d->lookup_tables = _lookup_tables_new();
+  piece->data = d;
+}
+
+void cleanup_pipe(struct dt_iop_module_t *self,
+                  dt_dev_pixelpipe_t *pipe,
+                  dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_liquify_data_t *d = piece->data;
+  dt_free_align(d->map);
+  free(d->warps);
+  g_hash_table_destroy(d->lookup_tables);
+  dt_pthread_mutex_destroy(&d->lock);
+  free(d);
+  piece->data = NULL;
+}
+
+void commit_params(struct dt_iop_module_t *self,
+                   dt_iop_params_t *p1,
+                   dt_dev_pixelpipe_t *pipe,
+                   dt_dev_pixelpipe_iop_t *piece)
+{
+  // the distortion map is kept, the next run updates it from the new warps
+  dt_iop_liquify_data_t *d = piece->data;
+  memcpy(&d->params, p1, sizeof(dt_iop_liquify_params_t));
+}
+
 // calculate the dot product of 2 vectors.
 
 static float cdot(const float complex p0, const float complex p1)
@@ -1,6 +1,6 @@
 /*
   This file is part of darktable,
-  Copyright (C) 2011-2023 darktable developers.
+  Copyright (C) 2011-2024 darktable developers.
 
   darktable is free software: you can redistribute it and/or modify
   it under the terms of the GNU General Public License as published by
@@ -87,6 +87,7 @@ typedef struct dt_iop_lowpass_data_t
   float cunbounded_coeffs[3]; // approximation for extrapolation of contrast curve
   float ltable[0x10000];      // precomputed look-up table for brightness curve
   float lunbounded_coeffs[3]; // approximation for extrapolation of brightness curve
+  dt_bilateral_t *grid;       // kept while only the curves and saturation change
 } dt_iop_lowpass_data_t;
 
 typedef struct dt_iop_lowpass_global_data_t
@@ -422,16 +423,14 @@ void process(struct dt_iop_module_t *self,
     const float sigma_s = sigma;
     const float detail = -1.0f; // we want the bilateral base layer
 
-    dt_bilateral_t *b = dt_bilateral_init(width, height, sigma_s, sigma_r);
+    dt_bilateral_t *b = dt_bilateral_init_cached(&data->grid, piece, in, roi_in, sigma_s, sigma_r);
     if(!b)
     {
       dt_iop_copy_image_roi(out, in, piece->colors, roi_in, roi_out);
       return;
     }
-    dt_bilateral_splat(b, in);
-    dt_bilateral_blur(b);
     dt_bilateral_slice(b, in, out, detail);
-    dt_bilateral_free(b);
+    if(b != data->grid) dt_bilateral_free(b);
   }
 
   const size_t npixels = width * height;
@@ -469,6 +468,11 @@ void commit_params(struct dt_iop_module_t *self,
   d->saturation = p->saturation;
   d->lowpass_algo = p->lowpass_algo;
   d->unbound = p->unbound;
+  if(d->lowpass_algo != LOWPASS_ALGO_BILATERAL)
+  {
+    dt_bilateral_free(d->grid);
+    d->grid = NULL;
+  }
 
 #ifdef HAVE_OPENCL
   if(d->lowpass_algo == LOWPASS_ALGO_BILATERAL)
@@ -539,6 +543,8 @@ void cleanup_pipe(struct dt_iop_module_t *self,
                   dt_dev_pixelpipe_t *pipe,
                   dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_lowpass_data_t *d = piece->data;
+  dt_bilateral_free(d->grid);
   free(piece->data);
   piece->data = NULL;
 }
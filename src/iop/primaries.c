@@ -64,6 +64,12 @@ typedef struct dt_iop_primaries_gui_data_t
   const dt_iop_order_iccprofile_info_t *painted_work_profile, *painted_display_profile;
 } dt_iop_primaries_gui_data_t;
 
+typedef struct dt_iop_primaries_data_t
+{
+  dt_iop_primaries_params_t params;
+  dt_colormatrix_t matrix; // set up by process_pixels_prepare() for the pipe's work profile
+} dt_iop_primaries_data_t;
+
 typedef struct dt_iop_primaries_global_data_t
 {
   int kernel_primaries;
@@ -125,6 +131,31 @@ static void _calculate_adjustment_matrix
   dt_colormatrix_mul(matrix, RGB_TO_XYZ, pipe_work_profile->matrix_out_transposed);
 }
 
+gboolean process_pixels_prepare(struct dt_iop_module_t *self,
+                                dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_primaries_data_t *d = piece->data;
+  _calculate_adjustment_matrix(&d->params, dt_ioppr_get_pipe_work_profile_info(piece->pipe),
+                               d->matrix);
+  return FALSE;
+}
+
+void process_pixels(struct dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const float *const in,
+                    float *const out,
+                    const size_t npixels)
+{
+  const dt_iop_primaries_data_t *const d = piece->data;
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    dt_aligned_pixel_t pixel;
+    dt_apply_transposed_color_matrix(in + k, d->matrix, pixel);
+    pixel[3] = in[k + 3];
+    copy_pixel(out + k, pixel);
+  }
+}
+
 void process(struct dt_iop_module_t *self,
              dt_dev_pixelpipe_iop_t *piece,
              const void *const ivoid,
@@ -132,27 +163,13 @@ void process(struct dt_iop_module_t *self,
              const dt_iop_roi_t *const roi_in,
              const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_primaries_params_t *params = piece->data;
-
   if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/, self,
                                         piece->colors, ivoid, ovoid, roi_in,
                                         roi_out))
     return;
 
-  const dt_iop_order_iccprofile_info_t *pipe_work_profile =
-    dt_ioppr_get_pipe_work_profile_info(piece->pipe);
-  dt_colormatrix_t matrix;
-  _calculate_adjustment_matrix(params, pipe_work_profile, matrix);
-
-  DT_OMP_FOR(shared(matrix))
-  for(size_t k = 0; k < 4 * roi_out->width * roi_out->height; k += 4)
-  {
-    const float *const restrict in = ((const float *)ivoid) + k;
-    float *const restrict out = ((float *)ovoid) + k;
-
-    dt_apply_transposed_color_matrix(in, matrix, out);
-    out[3] = in[3];
-  }
+  process_pixels_prepare(self, piece);
+  dt_iop_process_pixels(self, piece, (const float *)ivoid, (float *)ovoid, roi_out);
 }
 
 #ifdef HAVE_OPENCL
@@ -163,7 +180,7 @@ int process_cl(struct dt_iop_module_t *self,
                const dt_iop_roi_t *const roi_in,
                const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_primaries_params_t *params = piece->data;
+  dt_iop_primaries_data_t *d = piece->data;
   dt_iop_primaries_global_data_t *gd = self->global_data;
 
   const int devid = piece->pipe->devid;
@@ -173,7 +190,7 @@ int process_cl(struct dt_iop_module_t *self,
   const dt_iop_order_iccprofile_info_t *pipe_work_profile =
     dt_ioppr_get_pipe_work_profile_info(piece->pipe);
   dt_colormatrix_t transposed_matrix, matrix;
-  _calculate_adjustment_matrix(params, pipe_work_profile, transposed_matrix);
+  _calculate_adjustment_matrix(&d->params, pipe_work_profile, transposed_matrix);
   transpose_3xSSE(transposed_matrix, matrix);
 
   cl_mem dev_matrix = dt_opencl_copy_host_to_device_constant(devid, sizeof(matrix), matrix);
@@ -424,6 +441,26 @@ void gui_cleanup(struct dt_iop_module_t *self)
   IOP_GUI_FREE;
 }
 
+void commit_params(dt_iop_module_t *self,
+                   dt_iop_params_t *p1,
+                   dt_dev_pixelpipe_t *pipe,
+                   dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_primaries_data_t *d = piece->data;
+  memcpy(&d->params, p1, sizeof(dt_iop_primaries_params_t));
+}
+
+void init_pipe(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  piece->data = dt_calloc1_align_type(dt_iop_primaries_data_t);
+}
+
+void cleanup_pipe(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_free_align(piece->data);
+  piece->data = NULL;
+}
+
 void init_global(dt_iop_module_so_t *module)
 {
   const int program = 8; // extended.cl, from programs.conf
@@ -2254,6 +2254,19 @@ void gui_focus(struct dt_iop_module_t *self,
   }
 }
 
+// the wavelet scale returned by the decomposition, 0 for the recomposed image
+static int _get_return_layer(dt_iop_module_t *self,
+                             dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_iop_retouch_params_t *p = piece->data;
+  const dt_iop_retouch_gui_data_t *g = self->gui_data;
+  const gboolean gui_active = self->dev && self == self->dev->gui_module;
+  const gboolean display_wavelet_scale = g && gui_active && g->display_wavelet_scale;
+  return (display_wavelet_scale && (piece->pipe->type & DT_DEV_PIXELPIPE_FULL))
+    ? p->curr_scale
+    : 0;
+}
+
 void tiling_callback(struct dt_iop_module_t *self,
                      struct dt_dev_pixelpipe_iop_t *piece,
                      const dt_iop_roi_t *roi_in,
@@ -2261,7 +2274,10 @@ void tiling_callback(struct dt_iop_module_t *self,
                      struct dt_develop_tiling_t *tiling)
 {
   dt_iop_retouch_params_t *p = self->params;
-  const float require = 2.0f;
+  // in_retouch and the buffers of the wavelet decomposition
+  const float require = 1.0f + dwt_get_buffer_count(p->num_scales,
+                                                    _get_return_layer(self, piece),
+                                                    p->merge_from_scale);
   const float require_cl = 1.0f  // in_retouch
      + ((p->num_scales > 0) ? 4.0f : 2.0f); // dwt_wavelet_decompose_cl
                                             // requires 4 buffers,
@@ -3899,10 +3915,7 @@ void process(struct dt_iop_module_t *self,
 
   // init the decompose routine
   dwt_p = dt_dwt_init(in_retouch, roi_rt->width, roi_rt->height, 4, p->num_scales,
-                      (!display_wavelet_scale
-                       || !(piece->pipe->type & DT_DEV_PIXELPIPE_FULL))
-                      ? 0
-                      : p->curr_scale,
+                      _get_return_layer(self, piece),
                       p->merge_from_scale, &usr_data,
                       roi_in->scale / piece->iscale);
   if(dwt_p == NULL) goto cleanup;
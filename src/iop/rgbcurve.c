@@ -109,9 +109,6 @@ typedef struct dt_iop_rgbcurve_data_t
   char filename_work[DT_IOP_COLOR_ICC_LEN];
 } dt_iop_rgbcurve_data_t;
 
-typedef float (*_curve_table_ptr)[0x10000];
-typedef float (*_coeffs_table_ptr)[3];
-
 typedef struct dt_iop_rgbcurve_global_data_t
 {
   int kernel_rgbcurve;
@@ -1886,80 +1883,98 @@ cleanup:
 }
 #endif
 
-void process(struct dt_iop_module_t *self,
-             dt_dev_pixelpipe_iop_t *piece,
-             const void *const ivoid,
-             void *const ovoid,
-             const dt_iop_roi_t *const roi_in,
-             const dt_iop_roi_t *const roi_out)
+static inline void _apply_curve(const dt_iop_rgbcurve_data_t *const d,
+                                const dt_iop_order_iccprofile_info_t *const work_profile,
+                                const float xm_L,
+                                const float xm_g,
+                                const float xm_b,
+                                const float *const in,
+                                float *const out)
 {
-  const dt_iop_order_iccprofile_info_t *const work_profile =
-    dt_ioppr_get_pipe_work_profile_info(piece->pipe);
-
-  const float *const restrict in = (float*)ivoid;
-  float *const restrict out = (float*)ovoid;
-  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/,
-                                        self, piece->colors,
-                                        in, out, roi_in, roi_out))
-    return; // image has been copied through to output and module's
-            // trouble flag has been updated
-
-  dt_iop_rgbcurve_data_t *const restrict d = piece->data;
-  _generate_curve_lut(piece->pipe, d);
-
-  const float xm_L = 1.0f / d->unbounded_coeffs[DT_IOP_RGBCURVE_R][0];
-  const float xm_g = 1.0f / d->unbounded_coeffs[DT_IOP_RGBCURVE_G][0];
-  const float xm_b = 1.0f / d->unbounded_coeffs[DT_IOP_RGBCURVE_B][0];
-
-  const int width = roi_out->width;
-  const int height = roi_out->height;
-  const size_t npixels = (size_t)width * height;
+  const float (*const table)[0x10000] = d->table;
+  const float (*const unbounded_coeffs)[3] = d->unbounded_coeffs;
   const int autoscale = d->params.curve_autoscale;
-  const _curve_table_ptr restrict table = d->table;
-  const _coeffs_table_ptr restrict unbounded_coeffs = d->unbounded_coeffs;
 
-  DT_OMP_FOR()
-  for(int y = 0; y < 4*npixels; y += 4)
+  if(autoscale == DT_S_SCALE_MANUAL_RGB)
   {
-    if(autoscale == DT_S_SCALE_MANUAL_RGB)
+    out[0] = (in[0] < xm_L) ? table[DT_IOP_RGBCURVE_R][CLAMP((int)(in[0] * 0x10000ul), 0, 0xffff)]
+                            : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_R], in[0]);
+    out[1] = (in[1] < xm_g) ? table[DT_IOP_RGBCURVE_G][CLAMP((int)(in[1] * 0x10000ul), 0, 0xffff)]
+                            : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_G], in[1]);
+    out[2] = (in[2] < xm_b) ? table[DT_IOP_RGBCURVE_B][CLAMP((int)(in[2] * 0x10000ul), 0, 0xffff)]
+                            : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_B], in[2]);
+  }
+  else if(autoscale == DT_S_SCALE_AUTOMATIC_RGB)
+  {
+    if(d->params.preserve_colors == DT_RGB_NORM_NONE)
     {
-      out[y+0] = (in[y+0] < xm_L) ? table[DT_IOP_RGBCURVE_R][CLAMP((int)(in[y+0] * 0x10000ul), 0, 0xffff)]
-                                  : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_R], in[y+0]);
-      out[y+1] = (in[y+1] < xm_g) ? table[DT_IOP_RGBCURVE_G][CLAMP((int)(in[y+1] * 0x10000ul), 0, 0xffff)]
-                                  : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_G], in[y+1]);
-      out[y+2] = (in[y+2] < xm_b) ? table[DT_IOP_RGBCURVE_B][CLAMP((int)(in[y+2] * 0x10000ul), 0, 0xffff)]
-                                  : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_B], in[y+2]);
+      for(int c = 0; c < 3; c++)
+      {
+        out[c] = (in[c] < xm_L)
+          ? table[DT_IOP_RGBCURVE_R][CLAMP((int)(in[c] * 0x10000ul), 0, 0xffff)]
+          : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_R], in[c]);
+      }
     }
-    else if(autoscale == DT_S_SCALE_AUTOMATIC_RGB)
+    else
     {
-      if(d->params.preserve_colors == DT_RGB_NORM_NONE)
+      float ratio = 1.f;
+      const float lum = dt_rgb_norm(in, d->params.preserve_colors, work_profile);
+      if(lum > 0.f)
       {
-        for(int c = 0; c < 3; c++)
-        {
-          out[y+c] = (in[y+c] < xm_L)
-            ? table[DT_IOP_RGBCURVE_R][CLAMP((int)(in[y+c] * 0x10000ul), 0, 0xffff)]
-            : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_R], in[y+c]);
-        }
+        const float curve_lum = (lum < xm_L)
+          ? table[DT_IOP_RGBCURVE_R][CLAMP((int)(lum * 0x10000ul), 0, 0xffff)]
+          : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_R], lum);
+        ratio = curve_lum / lum;
       }
-      else
+      for(size_t c = 0; c < 3; c++)
       {
-        float ratio = 1.f;
-        const float lum = dt_rgb_norm(in + y, d->params.preserve_colors, work_profile);
-        if(lum > 0.f)
-        {
-          const float curve_lum = (lum < xm_L)
-            ? table[DT_IOP_RGBCURVE_R][CLAMP((int)(lum * 0x10000ul), 0, 0xffff)]
-            : dt_iop_eval_exp(unbounded_coeffs[DT_IOP_RGBCURVE_R], lum);
-          ratio = curve_lum / lum;
-        }
-        for(size_t c = 0; c < 3; c++)
-        {
-          out[y+c] = (ratio * in[y+c]);
-        }
+        out[c] = (ratio * in[c]);
       }
     }
-    out[y+3] = in[y+3];
   }
+  out[3] = in[3];
+}
+
+gboolean process_pixels_prepare(struct dt_iop_module_t *self,
+                                dt_dev_pixelpipe_iop_t *piece)
+{
+  _generate_curve_lut(piece->pipe, piece->data);
+  return FALSE;
+}
+
+void process_pixels(struct dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const float *const in,
+                    float *const out,
+                    const size_t npixels)
+{
+  const dt_iop_order_iccprofile_info_t *const work_profile =
+    dt_ioppr_get_pipe_work_profile_info(piece->pipe);
+  const dt_iop_rgbcurve_data_t *const d = piece->data;
+
+  const float xm_L = 1.0f / d->unbounded_coeffs[DT_IOP_RGBCURVE_R][0];
+  const float xm_g = 1.0f / d->unbounded_coeffs[DT_IOP_RGBCURVE_G][0];
+  const float xm_b = 1.0f / d->unbounded_coeffs[DT_IOP_RGBCURVE_B][0];
+
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+    _apply_curve(d, work_profile, xm_L, xm_g, xm_b, in + k, out + k);
+}
+
+void process(struct dt_iop_module_t *self,
+             dt_dev_pixelpipe_iop_t *piece,
+             const void *const ivoid,
+             void *const ovoid,
+             const dt_iop_roi_t *const roi_in,
+             const dt_iop_roi_t *const roi_out)
+{
+  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/,
+                                        self, piece->colors,
+                                        ivoid, ovoid, roi_in, roi_out))
+    return; // image has been copied through to output and module's
+            // trouble flag has been updated
+
+  process_pixels_prepare(self, piece);
+  dt_iop_process_pixels(self, piece, (const float *)ivoid, (float *)ovoid, roi_out);
 }
 
 #undef DT_GUI_CURVE_EDITOR_INSET
@@ -1282,60 +1282,21 @@ static void _auto_levels(const float *const img,
   p->levels[channel][1] = (p->levels[channel][2] + p->levels[channel][0]) / 2.f;
 }
 
-void process(dt_iop_module_t *self,
-             dt_dev_pixelpipe_iop_t *piece,
-             const void *const ivoid,
-             void *const ovoid,
-             const dt_iop_roi_t *const roi_in,
-             const dt_iop_roi_t *const roi_out)
+void process_pixels(dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const float *const in,
+                    float *const out,
+                    const size_t npixels)
 {
-  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/,
-                                        self, piece->colors,
-                                        ivoid, ovoid, roi_in, roi_out))
-    return; // image has been copied through to output and module's
-            // trouble flag has been updated
-
   const dt_iop_rgblevels_data_t *const d = (dt_iop_rgblevels_data_t *)piece->data;
-  dt_iop_rgblevels_params_t *p = (dt_iop_rgblevels_params_t *)&d->params;
-  dt_iop_rgblevels_gui_data_t *g = self->gui_data;
   const dt_iop_order_iccprofile_info_t *const work_profile =
     dt_ioppr_get_pipe_work_profile_info(piece->pipe);
 
-  // process auto levels
-  if(g && (piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW))
-  {
-    dt_iop_gui_enter_critical_section(self);
-    if(g->call_auto_levels == 1 && !darktable.gui->reset)
-    {
-      g->call_auto_levels = -1;
-
-      dt_iop_gui_leave_critical_section(self);
-
-      memcpy(&g->params, p, sizeof(dt_iop_rgblevels_params_t));
-
-      int box[4] = { 0 };
-      _get_selected_area(self, piece, g, roi_in, box);
-      _auto_levels((const float *const)ivoid, roi_in->width, roi_in->height, box,
-                   &(g->params), g->channel, work_profile);
-
-      dt_iop_gui_enter_critical_section(self);
-      g->call_auto_levels = 2;
-      dt_iop_gui_leave_critical_section(self);
-    }
-    else
-    {
-      dt_iop_gui_leave_critical_section(self);
-    }
-  }
-
   const dt_aligned_pixel_t mult =
     { 1.f / (d->params.levels[0][2] - d->params.levels[0][0]),
       1.f / (d->params.levels[1][2] - d->params.levels[1][0]),
       1.f / (d->params.levels[2][2] - d->params.levels[2][0]) };
 
-  const size_t npixels = (size_t)roi_out->width * roi_out->height;
-  const float *const restrict in = (const float*)ivoid;
-  float *const restrict out = (float*)ovoid;
   if(d->params.autoscale == DT_IOP_RGBLEVELS_INDEPENDENT_CHANNELS
      || d->params.preserve_colors == DT_RGB_NORM_NONE)
   {
@@ -1343,8 +1304,7 @@ void process(dt_iop_module_t *self,
       = { d->params.levels[0][0], d->params.levels[1][0], d->params.levels[2][0], 0.0f };
     const dt_aligned_pixel_t max_levels
       = { d->params.levels[0][2], d->params.levels[1][2], d->params.levels[2][2], 1.0f };
-    DT_OMP_FOR()
-    for(int k = 0; k < 4U*npixels; k += 4)
+    for(size_t k = 0; k < 4 * npixels; k += 4)
     {
       for(int c = 0; c < 3; c++)
       {
@@ -1368,18 +1328,18 @@ void process(dt_iop_module_t *self,
           out[k+c] = d->lut[c][CLAMP((int)(percentage * 0x10000ul), 0, 0xffff)];
         }
       }
+      out[k+3] = in[k+3];
     }
   }
   else
   {
     const int ch_levels = 0;
     const float mult_ch = mult[ch_levels];
-    const float *const restrict levels = d->params.levels[ch_levels];
+    const float *const levels = d->params.levels[ch_levels];
     const float min_level = levels[0];
     const float max_level = levels[2];
     static const dt_aligned_pixel_t zero = { 0.0f, 0.0f, 0.0f, 0.0f };
-    DT_OMP_FOR()
-    for(int k = 0; k < 4U*npixels; k += 4)
+    for(size_t k = 0; k < 4 * npixels; k += 4)
     {
       const float lum = dt_rgb_norm(in+k, d->params.preserve_colors, work_profile);
       if(lum > min_level)
@@ -1399,21 +1359,69 @@ void process(dt_iop_module_t *self,
         const float ratio = curve_lum / lum;
         dt_aligned_pixel_t res;
 
-        for_each_channel(c,aligned(in,out:16))
+        for_each_channel(c)
         {
           res[c] = (ratio * in[k+c]);
         }
-        copy_pixel_nontemporal(out + k, res);
+        copy_pixel(out + k, res);
       }
       else
       {
-        copy_pixel_nontemporal(out + k, zero);
+        copy_pixel(out + k, zero);
       }
     }
-    dt_omploop_sfence(); // ensure nontemporal writes are flushed before continuing
   }
 }
 
+void process(dt_iop_module_t *self,
+             dt_dev_pixelpipe_iop_t *piece,
+             const void *const ivoid,
+             void *const ovoid,
+             const dt_iop_roi_t *const roi_in,
+             const dt_iop_roi_t *const roi_out)
+{
+  if(!dt_iop_have_required_input_format(4 /*we need full-color pixels*/,
+                                        self, piece->colors,
+                                        ivoid, ovoid, roi_in, roi_out))
+    return; // image has been copied through to output and module's
+            // trouble flag has been updated
+
+  const dt_iop_rgblevels_data_t *const d = (dt_iop_rgblevels_data_t *)piece->data;
+  dt_iop_rgblevels_params_t *p = (dt_iop_rgblevels_params_t *)&d->params;
+  dt_iop_rgblevels_gui_data_t *g = self->gui_data;
+  const dt_iop_order_iccprofile_info_t *const work_profile =
+    dt_ioppr_get_pipe_work_profile_info(piece->pipe);
+
+  // process auto levels
+  if(g && (piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW))
+  {
+    dt_iop_gui_enter_critical_section(self);
+    if(g->call_auto_levels == 1 && !darktable.gui->reset)
+    {
+      g->call_auto_levels = -1;
+
+      dt_iop_gui_leave_critical_section(self);
+
+      memcpy(&g->params, p, sizeof(dt_iop_rgblevels_params_t));
+
+      int box[4] = { 0 };
+      _get_selected_area(self, piece, g, roi_in, box);
+      _auto_levels((const float *const)ivoid, roi_in->width, roi_in->height, box,
+                   &(g->params), g->channel, work_profile);
+
+      dt_iop_gui_enter_critical_section(self);
+      g->call_auto_levels = 2;
+      dt_iop_gui_leave_critical_section(self);
+    }
+    else
+    {
+      dt_iop_gui_leave_critical_section(self);
+    }
+  }
+
+  dt_iop_process_pixels(self, piece, (const float *)ivoid, (float *)ovoid, roi_out);
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(dt_iop_module_t *self,
                dt_dev_pixelpipe_iop_t *piece,
@@ -174,6 +174,10 @@ typedef struct dt_iop_sigmoid_data_t
   float rotation[3];
   float purity;
   dt_iop_sigmoid_base_primaries_t base_primaries;
+  // per-channel processing, set up by process_pixels_prepare() for the pipe's work profile
+  dt_colormatrix_t pipe_to_base;
+  dt_colormatrix_t base_to_rendering;
+  dt_colormatrix_t rendering_to_pipe;
 } dt_iop_sigmoid_data_t;
 
 typedef struct dt_iop_sigmoid_gui_data_t
@@ -568,17 +572,11 @@ static void _pixel_channel_order(const dt_aligned_pixel_t pix_in, dt_iop_sigmoid
   }
 }
 
-void process_loglogistic_rgb_ratio(dt_dev_pixelpipe_iop_t *piece,
-                                   const void *const ivoid,
-                                   void *const ovoid,
-                                   const dt_iop_roi_t *const roi_in,
-                                   const dt_iop_roi_t *const roi_out)
+static inline void _loglogistic_rgb_ratio(const dt_iop_sigmoid_data_t *const module_data,
+                                          const float *const in,
+                                          float *const out,
+                                          const size_t npixels)
 {
-  const dt_iop_sigmoid_data_t *module_data = piece->data;
-  const float *const in = (const float *)ivoid;
-  float *const out = (float *)ovoid;
-  const size_t npixels = (size_t)roi_in->width * roi_in->height;
-
   const float white_target = module_data->white_target;
   const float black_target = module_data->black_target;
   const float paper_exp = module_data->paper_exposure;
@@ -586,11 +584,10 @@ void process_loglogistic_rgb_ratio(dt_dev_pixelpipe_iop_t *piece,
   const float contrast_power = module_data->film_power;
   const float skew_power = module_data->paper_power;
 
-  DT_OMP_FOR()
   for(size_t k = 0; k < 4 * npixels; k += 4)
   {
-    const float *const restrict pix_in = in + k;
-    float *const restrict pix_out = out + k;
+    const float *const pix_in = in + k;
+    dt_aligned_pixel_t pix_out;
     dt_aligned_pixel_t pre_out;
     dt_aligned_pixel_t pix_in_strict_positive;
 
@@ -655,6 +652,7 @@ void process_loglogistic_rgb_ratio(dt_dev_pixelpipe_iop_t *piece,
 
     // Copy over the alpha channel
     pix_out[3] = pix_in[3];
+    copy_pixel(out + k, pix_out);
   }
 }
 
@@ -705,18 +703,11 @@ static inline void _preserve_hue_and_energy(const dt_aligned_pixel_t pix_in,
   }
 }
 
-void process_loglogistic_per_channel(struct dt_develop_t *dev,
-                                     dt_dev_pixelpipe_iop_t *piece,
-                                     const void *const ivoid, void *const ovoid,
-                                     const dt_iop_roi_t *const roi_in,
-                                     const dt_iop_roi_t *const roi_out)
+static inline void _loglogistic_per_channel(const dt_iop_sigmoid_data_t *const module_data,
+                                            const float *const in,
+                                            float *const out,
+                                            const size_t npixels)
 {
-  const dt_iop_sigmoid_data_t *module_data = piece->data;
-
-  const float *const in = (const float *)ivoid;
-  float *const out = (float *)ovoid;
-  const size_t npixels = (size_t)roi_in->width * roi_in->height;
-
   const float white_target = module_data->white_target;
   const float paper_exp = module_data->paper_exposure;
   const float film_fog = module_data->film_fog;
@@ -724,27 +715,21 @@ void process_loglogistic_per_channel(struct dt_develop_t *dev,
   const float skew_power = module_data->paper_power;
   const float hue_preservation = module_data->hue_preservation;
 
-  const dt_iop_order_iccprofile_info_t *pipe_work_profile = dt_ioppr_get_pipe_work_profile_info(piece->pipe);
-  const dt_iop_order_iccprofile_info_t *base_profile = _get_base_profile(dev, pipe_work_profile, module_data->base_primaries);
-  dt_colormatrix_t pipe_to_base, base_to_rendering, rendering_to_pipe;
-  _calculate_adjusted_primaries(module_data, pipe_work_profile, base_profile, pipe_to_base, base_to_rendering, rendering_to_pipe);
-
-  DT_OMP_FOR()
   for(size_t k = 0; k < 4 * npixels; k += 4)
   {
-    const float *const restrict pix_in = in + k;
-    float *const restrict pix_out = out + k;
+    const float *const pix_in = in + k;
+    dt_aligned_pixel_t pix_out;
     dt_aligned_pixel_t pix_in_base, pix_in_strict_positive;
     dt_aligned_pixel_t per_channel;
 
     // Convert to "base primaries"
-    dt_apply_transposed_color_matrix(pix_in, pipe_to_base, pix_in_base);
+    dt_apply_transposed_color_matrix(pix_in, module_data->pipe_to_base, pix_in_base);
 
     // Force negative values to zero
     _desaturate_negative_values(pix_in_base, pix_in_strict_positive);
 
     dt_aligned_pixel_t rendering_RGB;
-    dt_apply_transposed_color_matrix(pix_in_strict_positive, base_to_rendering, rendering_RGB);
+    dt_apply_transposed_color_matrix(pix_in_strict_positive, module_data->base_to_rendering, rendering_RGB);
 
     for_each_channel(c, aligned(rendering_RGB, per_channel))
     {
@@ -758,13 +743,41 @@ void process_loglogistic_per_channel(struct dt_develop_t *dev,
     _pixel_channel_order(rendering_RGB, &pixel_value_order);
     _preserve_hue_and_energy(rendering_RGB, per_channel, per_channel_hue_corrected, pixel_value_order,
                              hue_preservation);
-    dt_apply_transposed_color_matrix(per_channel_hue_corrected, rendering_to_pipe, pix_out);
+    dt_apply_transposed_color_matrix(per_channel_hue_corrected, module_data->rendering_to_pipe, pix_out);
 
     // Copy over the alpha channel
     pix_out[3] = pix_in[3];
+    copy_pixel(out + k, pix_out);
   }
 }
 
+gboolean process_pixels_prepare(struct dt_iop_module_t *self,
+                                dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_sigmoid_data_t *module_data = piece->data;
+  if(module_data->color_processing != DT_SIGMOID_METHOD_PER_CHANNEL) return FALSE;
+
+  const dt_iop_order_iccprofile_info_t *pipe_work_profile = dt_ioppr_get_pipe_work_profile_info(piece->pipe);
+  const dt_iop_order_iccprofile_info_t *base_profile = _get_base_profile(self->dev, pipe_work_profile, module_data->base_primaries);
+  _calculate_adjusted_primaries(module_data, pipe_work_profile, base_profile, module_data->pipe_to_base,
+                                module_data->base_to_rendering, module_data->rendering_to_pipe);
+  return FALSE;
+}
+
+void process_pixels(struct dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const float *const in,
+                    float *const out,
+                    const size_t npixels)
+{
+  const dt_iop_sigmoid_data_t *module_data = piece->data;
+
+  if(module_data->color_processing == DT_SIGMOID_METHOD_PER_CHANNEL)
+    _loglogistic_per_channel(module_data, in, out, npixels);
+  else // DT_SIGMOID_METHOD_RGB_RATIO
+    _loglogistic_rgb_ratio(module_data, in, out, npixels);
+}
+
 /** process, all real work is done here. */
 void process(struct dt_iop_module_t *self,
              dt_dev_pixelpipe_iop_t *piece,
@@ -774,16 +787,8 @@ void process(struct dt_iop_module_t *self,
              const dt_iop_roi_t *const roi_out)
 {
   // this is called for preview and full pipe separately, each with its own pixelpipe piece.
-  dt_iop_sigmoid_data_t *module_data = piece->data;
-
-  if(module_data->color_processing == DT_SIGMOID_METHOD_PER_CHANNEL)
-  {
-    process_loglogistic_per_channel(self->dev, piece, ivoid, ovoid, roi_in, roi_out);
-  }
-  else // DT_SIGMOID_METHOD_RGB_RATIO
-  {
-    process_loglogistic_rgb_ratio(piece, ivoid, ovoid, roi_in, roi_out);
-  }
+  process_pixels_prepare(self, piece);
+  dt_iop_process_pixels(self, piece, (const float *)ivoid, (float *)ovoid, roi_out);
 }
 
 #ifdef HAVE_OPENCL
@@ -875,7 +880,13 @@ void cleanup_global(dt_iop_module_so_t *module)
 
 void init_pipe(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = calloc(1, sizeof(dt_iop_sigmoid_data_t));
+  piece->data = dt_calloc1_align_type(dt_iop_sigmoid_data_t);
+}
+
+void cleanup_pipe(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_free_align(piece->data);
+  piece->data = NULL;
 }
 
 void gui_changed(dt_iop_module_t *self, GtkWidget *w, void *previous)
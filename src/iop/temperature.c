@@ -641,6 +641,46 @@ void process(struct dt_iop_module_t *self,
   _publish_chroma(piece);
 }
 
+void process_mosaic_prepare(struct dt_iop_module_t *self,
+                            dt_dev_pixelpipe_iop_t *piece)
+{
+  _publish_chroma(piece);
+}
+
+void process_mosaic(struct dt_iop_module_t *self,
+                    dt_dev_pixelpipe_iop_t *piece,
+                    const void *const ivoid,
+                    float *const out,
+                    const dt_iop_roi_t *const roi_in,
+                    const dt_iop_roi_t *const roi_out,
+                    const int row,
+                    const int rows)
+{
+  const uint32_t filters = piece->dsc_in.filters;
+  const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])piece->dsc_in.xtrans;
+  const dt_iop_temperature_data_t *const d = piece->data;
+  const float *const in = (const float *const)ivoid;
+
+  for(int j = row; j < row + rows; j++)
+  {
+    const size_t p = (size_t)j * roi_out->width;
+    if(filters == 9u)
+    {
+      for(int i = 0; i < roi_out->width; i++)
+        out[p + i] = in[p + i] * d->coeffs[FCxtrans(j, i, roi_out, xtrans)];
+    }
+    else
+    {
+      // the bayer pattern repeats every other sensel
+      const float c0 = d->coeffs[FC(j + roi_out->y, roi_out->x, filters)];
+      const float c1 = d->coeffs[FC(j + roi_out->y, roi_out->x + 1, filters)];
+      DT_OMP_SIMD()
+      for(int i = 0; i < roi_out->width; i++)
+        out[p + i] = in[p + i] * ((i & 1) ? c1 : c0);
+    }
+  }
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(struct dt_iop_module_t *self,
                dt_dev_pixelpipe_iop_t *piece,
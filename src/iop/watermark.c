@@ -34,6 +34,8 @@
 #include "gui/gtkentry.h"
 #include "iop/iop_api.h"
 #include <assert.h>
+#include <float.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <inttypes.h>
 #include <math.h>
@@ -126,6 +128,25 @@ typedef struct dt_iop_watermark_data_t
   char font[64];
 } dt_iop_watermark_data_t;
 
+// a marker rendered for a given scale, shared by all pipes
+typedef struct dt_iop_watermark_raster_t
+{
+  dt_hash_t hash;              // of the expanded svg text or the png path, mtime and size
+  float scale;                 // the svg is rendered for, 0 for png
+  RsvgDimensionData dimension; // of the svg document or png image
+  cairo_surface_t *surface;
+} dt_iop_watermark_raster_t;
+
+typedef struct dt_iop_watermark_global_data_t
+{
+  dt_pthread_mutex_t lock;
+  GList *rasters; // dt_iop_watermark_raster_t, most recently used first
+} dt_iop_watermark_global_data_t;
+
+// keep the markers of a batch export, but not too many of the full image size
+#define DT_WATERMARK_MAX_RASTERS 4
+#define DT_WATERMARK_MAX_RASTER_BYTES ((size_t)128 << 20)
+
 typedef struct dt_iop_watermark_gui_data_t
 {
   GtkWidget *watermarks;                             // watermark
@@ -423,7 +444,7 @@ const char **description(struct dt_iop_module_t *self)
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ROI_EXACT;
 }
 
 int default_group()
@@ -567,161 +588,31 @@ static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data
   return svgdata;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+// the layout of the marker in the image: scale of the rendered marker, its size in
+// image dimension and the base of the offsets
+static float _watermark_layout(const dt_iop_watermark_data_t *data,
+                               const RsvgDimensionData *dimension,
+                               const float iw,
+                               const float ih,
+                               const float roi_scale,
+                               float *wbase,
+                               float *hbase,
+                               float *svg_width,
+                               float *svg_height)
 {
-  dt_iop_watermark_data_t *data = piece->data;
-  float *in = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
-  const float angle = (M_PI / 180) * (-data->rotate);
-
-  gchar configdir[PATH_MAX] = { 0 };
-  gchar datadir[PATH_MAX] = { 0 };
-  gchar *filename;
-  dt_loc_get_datadir(datadir, sizeof(datadir));
-  dt_loc_get_user_config_dir(configdir, sizeof(configdir));
-  g_strlcat(datadir, "/watermarks/", sizeof(datadir));
-  g_strlcat(configdir, "/watermarks/", sizeof(configdir));
-  g_strlcat(datadir, data->filename, sizeof(datadir));
-  g_strlcat(configdir, data->filename, sizeof(configdir));
-
-  if(g_file_test(configdir, G_FILE_TEST_EXISTS))
-    filename = configdir;
-  else if(g_file_test(datadir, G_FILE_TEST_EXISTS))
-    filename = datadir;
-  else
-  {
-    dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-    return;
-  }
-
-  // find out the watermark type
-  dt_iop_watermark_type_t type;
-  const gchar *extension = strrchr(data->filename, '.');
-  if(extension)
-  {
-    if(!g_ascii_strcasecmp(extension, ".svg"))
-      type = DT_WTM_SVG;
-    else if(!g_ascii_strcasecmp(extension, ".png"))
-      type = DT_WTM_PNG;
-    else // this should not happen
-    {
-      dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-      return;
-    }
-  }
-  else
-  {
-    dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-    return;
-  }
-
-  /* Load svg if not loaded */
-  gchar *svgdoc = NULL;
-  if(type == DT_WTM_SVG)
-  {
-    svgdoc = _watermark_get_svgdoc(self, data, &piece->pipe->image, filename);
-    if(!svgdoc)
-    {
-      dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-      return;
-    }
-  }
-
-  /* setup stride for performance */
-  const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, roi_out->width);
-  if(stride == -1)
-  {
-    dt_print(DT_DEBUG_ALWAYS, "[watermark] cairo stride error\n");
-    dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-    return;
-  }
-
-  /* create a cairo memory surface that is later used for reading watermark overlay data */
-  guint8 *image = (guint8 *)g_malloc0_n(roi_out->height, stride);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data(image, CAIRO_FORMAT_ARGB32, roi_out->width,
-                                                                 roi_out->height, stride);
-  if((cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) || (image == NULL))
-  {
-    dt_print(DT_DEBUG_ALWAYS, "[watermark] cairo surface error: %s\n",
-             cairo_status_to_string(cairo_surface_status(surface)));
-    g_free(image);
-    dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-    return;
-  }
-
-  // rsvg (or some part of cairo which is used underneath) isn't thread safe, for example when handling fonts
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-
-  RsvgHandle *svg = NULL;
-  if(type == DT_WTM_SVG)
-  {
-    /* create the rsvghandle from parsed svg data */
-    GError *error = NULL;
-    svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
-    g_free(svgdoc);
-    if(!svg || error)
-    {
-      cairo_surface_destroy(surface);
-      g_free(image);
-      dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-      dt_print(DT_DEBUG_ALWAYS, "[watermark] error processing svg file: %s\n", error->message);
-      g_error_free(error);
-      return;
-    }
-  }
-
-  // we use a second surface
-  guint8 *image_two = NULL;
-  cairo_surface_t *surface_two = NULL;
-
-  /* get the dimension of svg or png */
-  RsvgDimensionData dimension;
-  switch(type)
-  {
-    case DT_WTM_SVG:
-      dimension = dt_get_svg_dimension(svg);
-      break;
-    case DT_WTM_PNG:
-      // load png into surface 2
-      surface_two = cairo_image_surface_create_from_png(filename);
-      if((cairo_surface_status(surface_two) != CAIRO_STATUS_SUCCESS))
-      {
-        dt_print(DT_DEBUG_ALWAYS, "[watermark] cairo png surface 2 error: %s\n",
-                 cairo_status_to_string(cairo_surface_status(surface_two)));
-        cairo_surface_destroy(surface);
-        g_free(image);
-        dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-        dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-        return;
-      }
-      dimension.width = cairo_image_surface_get_width(surface_two);
-      dimension.height = cairo_image_surface_get_height(surface_two);
-      break;
-  }
-
-  // if no text is given dimensions are null
-  if(!dimension.width) dimension.width = 1;
-  if(!dimension.height) dimension.height = 1;
-
-  //  width/height of current (possibly cropped) image
-  const float iw = piece->buf_in.width;
-  const float ih = piece->buf_in.height;
   const float uscale = data->scale / 100.0f; // user scale, from GUI in percent
 
   // wbase, hbase are the base width and height, this is the
   // multiplicator used for the offset computing scale is the scale of
   // the watermark itself and is used only to render it.
   // sbase is used for scale calculation in the larger/smaller modes
-  float wbase, hbase, scale, sbase;
+  float scale, sbase;
 
   // in larger/smaller (legacy) side mode, set wbase and hbase to the largest
   // or smallest side of the image
-  const float larger = dimension.width > dimension.height
-    ? (float)dimension.width
-    : (float)dimension.height;
+  const float larger = dimension->width > dimension->height
+    ? (float)dimension->width
+    : (float)dimension->height;
 
   // set the base width and height to either large or smaller
   // border of current image and calculate scale using either
@@ -729,64 +620,51 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   switch (data->scale_base)
   {
     case DT_SCALE_MAINMENU_LARGER_BORDER:
-      sbase = wbase = hbase = (iw > ih) ? iw : ih;
+      sbase = *wbase = *hbase = (iw > ih) ? iw : ih;
       scale = sbase / larger;
       break;
     case DT_SCALE_MAINMENU_SMALLER_BORDER:
-      sbase = wbase = hbase = (iw < ih) ? iw : ih;
+      sbase = *wbase = *hbase = (iw < ih) ? iw : ih;
       scale = sbase / larger;
       break;
     case DT_SCALE_MAINMENU_MARKERHEIGHT:
-      wbase = iw;
-      sbase = hbase = ih;
-      scale = sbase / dimension.height;
+      *wbase = iw;
+      sbase = *hbase = ih;
+      scale = sbase / dimension->height;
       break;
     case DT_SCALE_MAINMENU_ADVANCED:
-      wbase = iw;
-      hbase = ih;
+      *wbase = iw;
+      *hbase = ih;
       if (data->scale_img == DT_SCALE_IMG_WIDTH)
-      {
         sbase = iw;
-        scale = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? sbase / dimension.width : sbase / dimension.height;
-      }
       else if (data->scale_img == DT_SCALE_IMG_HEIGHT)
-      {
         sbase = ih;
-        scale = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? sbase / dimension.width : sbase / dimension.height;
-      }
       else if (data->scale_img == DT_SCALE_IMG_LARGER)
-      {
         sbase = (iw > ih) ? iw : ih;
-        scale = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? sbase / dimension.width : sbase / dimension.height;
-      }
       else // data->scale_img == DT_SCALE_IMG_SMALLER
-      {
         sbase = (iw < ih) ? iw : ih;
-        scale = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? sbase / dimension.width : sbase / dimension.height;
-      }
+      scale = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? sbase / dimension->width : sbase / dimension->height;
       break;
 
     // default to "image" mode
     case DT_SCALE_MAINMENU_IMAGE:
     default:
       // in image mode, the wbase and hbase are just the image width and height
-      wbase = iw;
-      hbase = ih;
-      if(dimension.width > dimension.height)
-        scale = iw / dimension.width;
+      *wbase = iw;
+      *hbase = ih;
+      if(dimension->width > dimension->height)
+        scale = iw / dimension->width;
       else
-        scale = ih / dimension.height;
+        scale = ih / dimension->height;
   }
 
-  scale *= roi_out->scale;
+  scale *= roi_scale;
   scale *= uscale;
 
   // compute the width and height of the SVG object in image
   // dimension. This is only used to properly layout the watermark
   // based on the alignment.
 
-  float svg_width, svg_height;
-
   // help to reduce the number of if clauses
   gboolean svg_calc_heightfromwidth;   // calculate svg_height from svg_width if TRUE
                                        // calculate svg_width from svg_height if FALSE
@@ -797,11 +675,11 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   {
     case DT_SCALE_MAINMENU_LARGER_BORDER:
       svg_calc_base = ((iw > ih) ? iw : ih) * uscale;
-      svg_calc_heightfromwidth = (dimension.width > dimension.height) ? TRUE : FALSE;
+      svg_calc_heightfromwidth = (dimension->width > dimension->height) ? TRUE : FALSE;
       break;
     case DT_SCALE_MAINMENU_SMALLER_BORDER:
       svg_calc_base = ((iw < ih) ? iw : ih) * uscale;
-      svg_calc_heightfromwidth = (dimension.width > dimension.height) ? TRUE : FALSE;
+      svg_calc_heightfromwidth = (dimension->width > dimension->height) ? TRUE : FALSE;
       break;
     case DT_SCALE_MAINMENU_MARKERHEIGHT:
       svg_calc_base = ih * uscale;
@@ -809,31 +687,20 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       break;
     case DT_SCALE_MAINMENU_ADVANCED:
       if (data->scale_img == DT_SCALE_IMG_WIDTH)
-      {
         svg_calc_base = iw * uscale;
-        svg_calc_heightfromwidth = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? TRUE : FALSE;
-      }
       else if (data->scale_img == DT_SCALE_IMG_HEIGHT)
-      {
         svg_calc_base = ih * uscale;
-        svg_calc_heightfromwidth = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? TRUE : FALSE;
-      }
       else if (data->scale_img == DT_SCALE_IMG_LARGER)
-      {
         svg_calc_base = ((iw > ih) ? iw : ih) * uscale;
-        svg_calc_heightfromwidth = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? TRUE : FALSE;
-      }
       else // data->scale_img == DT_SCALE_IMG_SMALLER
-      {
         svg_calc_base = ((iw < ih) ? iw : ih) * uscale;
-        svg_calc_heightfromwidth = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? TRUE : FALSE;
-      }
+      svg_calc_heightfromwidth = (data->scale_svg == DT_SCALE_SVG_WIDTH) ? TRUE : FALSE;
       break;
 
     // default to "image" mode
     case DT_SCALE_MAINMENU_IMAGE:
     default:
-      if(dimension.width > dimension.height)
+      if(dimension->width > dimension->height)
       {
         svg_calc_base = iw * uscale;
         svg_calc_heightfromwidth = TRUE;
@@ -848,16 +715,267 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(svg_calc_heightfromwidth)
   {
     // calculate svg_height from svg_width
-    svg_width = svg_calc_base;
-    svg_height = dimension.height * (svg_width / dimension.width);
+    *svg_width = svg_calc_base;
+    *svg_height = dimension->height * (*svg_width / dimension->width);
   }
   else
   {
     // calculate svg_width from svg_height
-    svg_height = svg_calc_base;
-    svg_width = dimension.width * (svg_height / dimension.height);
+    *svg_height = svg_calc_base;
+    *svg_width = dimension->width * (*svg_height / dimension->height);
+  }
+  return scale;
+}
+
+// look up the marker with the given hash in the raster cache. Returns FALSE if
+// it has never been loaded, else its dimension and, if there is one rendered at
+// this scale, a new reference to its surface.
+static gboolean _raster_find(dt_iop_watermark_global_data_t *gd,
+                             const dt_hash_t hash,
+                             const float scale,
+                             RsvgDimensionData *dimension,
+                             cairo_surface_t **surface)
+{
+  gboolean found = FALSE;
+  dt_pthread_mutex_lock(&gd->lock);
+  for(GList *iter = gd->rasters; iter; iter = g_list_next(iter))
+  {
+    dt_iop_watermark_raster_t *r = iter->data;
+    if(r->hash != hash) continue;
+    *dimension = r->dimension;
+    found = TRUE;
+    if(surface && r->scale == scale)
+    {
+      *surface = cairo_surface_reference(r->surface);
+      // most recently used first
+      gd->rasters = g_list_remove_link(gd->rasters, iter);
+      gd->rasters = g_list_concat(iter, gd->rasters);
+      break;
+    }
   }
+  dt_pthread_mutex_unlock(&gd->lock);
+  return found;
+}
+
+static void _raster_free(gpointer data)
+{
+  dt_iop_watermark_raster_t *r = data;
+  cairo_surface_destroy(r->surface);
+  free(r);
+}
 
+static size_t _raster_bytes(cairo_surface_t *surface)
+{
+  return (size_t)cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+}
+
+// cache a new marker. One bigger than the whole cache is not kept, the caller
+// still holds its own reference.
+static void _raster_insert(dt_iop_watermark_global_data_t *gd,
+                           const dt_hash_t hash,
+                           const float scale,
+                           const RsvgDimensionData *dimension,
+                           cairo_surface_t *surface)
+{
+  if(_raster_bytes(surface) > DT_WATERMARK_MAX_RASTER_BYTES) return;
+
+  dt_iop_watermark_raster_t *r = malloc(sizeof(dt_iop_watermark_raster_t));
+  if(!r) return;
+  r->hash = hash;
+  r->scale = scale;
+  r->dimension = *dimension;
+  r->surface = cairo_surface_reference(surface);
+
+  dt_pthread_mutex_lock(&gd->lock);
+  gd->rasters = g_list_prepend(gd->rasters, r);
+  // drop the least recently used markers, the new one always fits
+  size_t bytes = 0;
+  int count = 0;
+  for(GList *iter = gd->rasters; iter; )
+  {
+    dt_iop_watermark_raster_t *e = iter->data;
+    GList *next = g_list_next(iter);
+    bytes += _raster_bytes(e->surface);
+    if(++count > DT_WATERMARK_MAX_RASTERS || bytes > DT_WATERMARK_MAX_RASTER_BYTES)
+    {
+      gd->rasters = g_list_delete_link(gd->rasters, iter);
+      _raster_free(e);
+    }
+    iter = next;
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+// blend the premultiplied marker, of size w x h at x0, y0, over the input
+__DT_CLONE_TARGETS__
+static void _watermark_blend(float *const restrict out,
+                             const float *const restrict in,
+                             const int width,
+                             const guint8 *const restrict mark,
+                             const int stride,
+                             const int x0,
+                             const int y0,
+                             const int w,
+                             const int h,
+                             const float opacity)
+{
+  /* svg uses a premultiplied alpha, so only use opacity for the blending */
+  const float norm = opacity / 255.0f;
+  DT_OMP_FOR()
+  for(int j = 0; j < h; j++)
+  {
+    const size_t offset = 4 * ((size_t)(y0 + j) * width + x0);
+    const float *const restrict i = in + offset;
+    float *const restrict o = out + offset;
+    const guint8 *const restrict s = mark + (size_t)j * stride;
+    DT_OMP_SIMD()
+    for(int k = 0; k < w; k++)
+    {
+      const float alpha = s[4 * k + 3] * norm;
+      o[4 * k + 0] = ((1.0f - alpha) * i[4 * k + 0]) + (norm * s[4 * k + 2]);
+      o[4 * k + 1] = ((1.0f - alpha) * i[4 * k + 1]) + (norm * s[4 * k + 1]);
+      o[4 * k + 2] = ((1.0f - alpha) * i[4 * k + 2]) + (norm * s[4 * k + 0]);
+      o[4 * k + 3] = i[4 * k + 3];
+    }
+  }
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_watermark_data_t *data = piece->data;
+  dt_iop_watermark_global_data_t *gd = self->global_data;
+  float *in = (float *)ivoid;
+  float *out = (float *)ovoid;
+  const int ch = piece->colors;
+  const float angle = (M_PI / 180) * (-data->rotate);
+
+  gchar configdir[PATH_MAX] = { 0 };
+  gchar datadir[PATH_MAX] = { 0 };
+  gchar *filename;
+  dt_loc_get_datadir(datadir, sizeof(datadir));
+  dt_loc_get_user_config_dir(configdir, sizeof(configdir));
+  g_strlcat(datadir, "/watermarks/", sizeof(datadir));
+  g_strlcat(configdir, "/watermarks/", sizeof(configdir));
+  g_strlcat(datadir, data->filename, sizeof(datadir));
+  g_strlcat(configdir, data->filename, sizeof(configdir));
+
+  if(g_file_test(configdir, G_FILE_TEST_EXISTS))
+    filename = configdir;
+  else if(g_file_test(datadir, G_FILE_TEST_EXISTS))
+    filename = datadir;
+  else
+  {
+    dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+    return;
+  }
+
+  // find out the watermark type
+  dt_iop_watermark_type_t type;
+  const gchar *extension = strrchr(data->filename, '.');
+  if(extension)
+  {
+    if(!g_ascii_strcasecmp(extension, ".svg"))
+      type = DT_WTM_SVG;
+    else if(!g_ascii_strcasecmp(extension, ".png"))
+      type = DT_WTM_PNG;
+    else // this should not happen
+    {
+      dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+      return;
+    }
+  }
+  else
+  {
+    dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+    return;
+  }
+
+  /* the marker is identified by the expanded svg or the png path, modification time
+     and size, so it only has to be rendered again if the variables of this image
+     change its text or the png is replaced */
+  gchar *svgdoc = NULL;
+  dt_hash_t hash = dt_hash(DT_INITHASH, &type, sizeof(type));
+  if(type == DT_WTM_SVG)
+  {
+    svgdoc = _watermark_get_svgdoc(self, data, &piece->pipe->image, filename);
+    if(!svgdoc)
+    {
+      dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+      return;
+    }
+    hash = dt_hash(hash, svgdoc, strlen(svgdoc));
+  }
+  else
+  {
+    GStatBuf pngstat;
+    if(g_stat(filename, &pngstat))
+    {
+      dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+      return;
+    }
+    const int64_t mtime = pngstat.st_mtime;
+    const int64_t size = pngstat.st_size;
+    hash = dt_hash(hash, filename, strlen(filename));
+    hash = dt_hash(hash, &mtime, sizeof(mtime));
+    hash = dt_hash(hash, &size, sizeof(size));
+  }
+
+  RsvgHandle *svg = NULL;
+  // we use a second surface for the marker
+  cairo_surface_t *surface_two = NULL;
+
+  /* get the dimension of svg or png, known if the marker is in the cache */
+  RsvgDimensionData dimension;
+  if(!_raster_find(gd, hash, -1.0f, &dimension, NULL))
+  {
+    // rsvg (or some part of cairo which is used underneath) isn't thread safe, for example when handling fonts
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    if(type == DT_WTM_SVG)
+    {
+      /* create the rsvghandle from parsed svg data */
+      GError *error = NULL;
+      svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
+      if(!svg || error)
+      {
+        dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+        g_free(svgdoc);
+        dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+        dt_print(DT_DEBUG_ALWAYS, "[watermark] error processing svg file: %s\n", error->message);
+        g_error_free(error);
+        return;
+      }
+      dimension = dt_get_svg_dimension(svg);
+    }
+    else
+    {
+      // load png into surface 2
+      surface_two = cairo_image_surface_create_from_png(filename);
+      if((cairo_surface_status(surface_two) != CAIRO_STATUS_SUCCESS))
+      {
+        dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+        dt_print(DT_DEBUG_ALWAYS, "[watermark] cairo png surface 2 error: %s\n",
+                 cairo_status_to_string(cairo_surface_status(surface_two)));
+        cairo_surface_destroy(surface_two);
+        dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+        return;
+      }
+      dimension.width = cairo_image_surface_get_width(surface_two);
+      dimension.height = cairo_image_surface_get_height(surface_two);
+    }
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  }
+
+  // if no text is given dimensions are null
+  if(!dimension.width) dimension.width = 1;
+  if(!dimension.height) dimension.height = 1;
+
+  //  width/height of current (possibly cropped) image
+  const float iw = piece->buf_in.width;
+  const float ih = piece->buf_in.height;
+  float wbase, hbase, svg_width, svg_height;
+  const float scale = _watermark_layout(data, &dimension, iw, ih, roi_out->scale,
+                                        &wbase, &hbase, &svg_width, &svg_height);
 
   /* For the rotation we need an extra cairo image as rotations are
      buggy via rsvg_handle_render_cairo.  distortions and blurred
@@ -871,32 +989,56 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     /* the svg_offsets allow safe text boxes as they might render out of the dimensions */
     svg_offset_x = ceilf(3.0f * scale);
     svg_offset_y = ceilf(3.0f * scale);
+  }
 
+  // the png is always scaled while painting, the svg is rendered at the right scale
+  const float raster_scale = type == DT_WTM_SVG ? scale : 0.0f;
+  if(surface_two)
+  {
+    // a freshly loaded png
+    _raster_insert(gd, hash, raster_scale, &dimension, surface_two);
+  }
+  else if(_raster_find(gd, hash, raster_scale, &dimension, &surface_two) && surface_two)
+  {
+    g_free(svgdoc);
+  }
+  else
+  {
     const int watermark_width  = (int)((dimension.width  * scale) + 3* svg_offset_x);
     const int watermark_height = (int)((dimension.height * scale) + 3* svg_offset_y) ;
-
-    const int stride_two = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, watermark_width);
-    image_two = (guint8 *)g_malloc0_n(watermark_height, stride_two);
-    surface_two = cairo_image_surface_create_for_data(image_two, CAIRO_FORMAT_ARGB32, watermark_width,
-                                                                   watermark_height, stride_two);
-    if((cairo_surface_status(surface_two) != CAIRO_STATUS_SUCCESS) || (image_two == NULL))
+    surface_two = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, watermark_width, watermark_height);
+    if(cairo_surface_status(surface_two) != CAIRO_STATUS_SUCCESS)
     {
       dt_print(DT_DEBUG_ALWAYS, "[watermark] cairo surface 2 error: %s\n",
                cairo_status_to_string(cairo_surface_status(surface_two)));
-      cairo_surface_destroy(surface);
-      g_object_unref(svg);
-      g_free(image);
-      g_free(image_two);
+      cairo_surface_destroy(surface_two);
+      if(svg) g_object_unref(svg);
+      g_free(svgdoc);
       dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
       return;
     }
-  }
 
-  /* create cairo context and setup transformation/scale */
-  cairo_t *cr = cairo_create(surface);
-  /* create cairo context for the scaled watermark */
-  cairo_t *cr_two = cairo_create(surface_two);
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    // a cached dimension means we didn't parse the document yet
+    if(!svg) svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), NULL);
+    if(svg)
+    {
+      /* create cairo context for the scaled watermark */
+      cairo_t *cr_two = cairo_create(surface_two);
+      // now set proper scale and translation for the watermark itself
+      cairo_translate(cr_two, svg_offset_x, svg_offset_y);
+      cairo_scale(cr_two, scale, scale);
+      /* render svg into surface*/
+      dt_render_svg(svg, cr_two, dimension.width, dimension.height, 0, 0);
+      cairo_destroy(cr_two);
+      g_object_unref(svg);
+    }
+    // no more non-thread safe rsvg usage
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+    g_free(svgdoc);
+    cairo_surface_flush(surface_two);
+    _raster_insert(gd, hash, raster_scale, &dimension, surface_two);
+  }
 
   // compute bounding box of rotated watermark
   const float bb_width = fabsf(svg_width * cosf(angle)) + fabsf(svg_height * sinf(angle));
@@ -921,79 +1063,80 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   else if(data->alignment == 2 || data->alignment == 5 || data->alignment == 8)
     tx = iw - svg_width - bX;
 
-  // translate to position
-  cairo_translate(cr, -roi_in->x, -roi_in->y);
-
   // add translation for the given value in GUI (xoffset,yoffset)
   tx += data->xoffset * wbase;
   ty += data->yoffset * hbase;
 
-  cairo_translate(cr, tx * roi_out->scale, ty * roi_out->scale);
-
   // compute the center of the svg to rotate from the center
   const float cX = svg_width / 2.0f * roi_out->scale;
   const float cY = svg_height / 2.0f * roi_out->scale;
 
-  cairo_translate(cr, cX, cY);
-  cairo_rotate(cr, angle);
-  cairo_translate(cr, -cX, -cY);
+  // transformation of the marker into the output
+  cairo_matrix_t m;
+  cairo_matrix_init_translate(&m, -roi_in->x, -roi_in->y);
+  cairo_matrix_translate(&m, tx * roi_out->scale, ty * roi_out->scale);
+  cairo_matrix_translate(&m, cX, cY);
+  cairo_matrix_rotate(&m, angle);
+  cairo_matrix_translate(&m, -cX, -cY);
+  if(type == DT_WTM_PNG) cairo_matrix_scale(&m, scale, scale);
+
+  // only the bounding box of the marker in the output has to be painted and blended
+  const double mw = cairo_image_surface_get_width(surface_two);
+  const double mh = cairo_image_surface_get_height(surface_two);
+  const double corners[4][2] = { { 0, 0 }, { mw, 0 }, { 0, mh }, { mw, mh } };
+  double x_min = DBL_MAX, y_min = DBL_MAX, x_max = -DBL_MAX, y_max = -DBL_MAX;
+  for(int k = 0; k < 4; k++)
+  {
+    double x = corners[k][0] - svg_offset_x;
+    double y = corners[k][1] - svg_offset_y;
+    cairo_matrix_transform_point(&m, &x, &y);
+    x_min = MIN(x_min, x);
+    x_max = MAX(x_max, x);
+    y_min = MIN(y_min, y);
+    y_max = MAX(y_max, y);
+  }
+  const int x0 = CLAMP((int)floor(x_min) - 1, 0, roi_out->width);
+  const int y0 = CLAMP((int)floor(y_min) - 1, 0, roi_out->height);
+  const int x1 = CLAMP((int)ceil(x_max) + 1, 0, roi_out->width);
+  const int y1 = CLAMP((int)ceil(y_max) + 1, 0, roi_out->height);
 
-  // now set proper scale and translationfor the watermark itself
-  cairo_translate(cr_two, svg_offset_x, svg_offset_y);
+  dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+  if(x1 <= x0 || y1 <= y0)
+  {
+    cairo_surface_destroy(surface_two);
+    return;
+  }
 
-  switch(type)
+  /* create a cairo memory surface that is later used for reading watermark overlay data */
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, x1 - x0, y1 - y0);
+  if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
   {
-    case DT_WTM_SVG:
-      cairo_scale(cr_two, scale, scale);
-      /* render svg into surface*/
-      dt_render_svg(svg, cr_two, dimension.width, dimension.height, 0, 0);
-      break;
-    case DT_WTM_PNG:
-      cairo_scale(cr, scale, scale);
-      break;
+    dt_print(DT_DEBUG_ALWAYS, "[watermark] cairo surface error: %s\n",
+             cairo_status_to_string(cairo_surface_status(surface)));
+    cairo_surface_destroy(surface);
+    cairo_surface_destroy(surface_two);
+    return;
   }
-  cairo_surface_flush(surface_two);
 
-  // paint the watermark
+  // painting raster images doesn't need the rsvg lock
+  cairo_t *cr = cairo_create(surface);
+  cairo_translate(cr, -x0, -y0);
+  cairo_transform(cr, &m);
   cairo_set_source_surface(cr, surface_two, -svg_offset_x, -svg_offset_y);
   cairo_paint(cr);
-
-  // no more non-thread safe rsvg usage
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-
   cairo_destroy(cr);
-  cairo_destroy(cr_two);
 
   /* ensure that all operations on surface finishing up */
   cairo_surface_flush(surface);
 
   /* render surface on output */
-  guint8 *sd = image;
-  const float opacity = data->opacity / 100.0f;
-  DT_OMP_FOR()
-  for(int j = 0; j < roi_out->height * roi_out->width; j++)
-  {
-    float *const i = in + ch*j;
-    float *const o = out + ch*j;
-    guint8 *const s = sd + 4*j;
-    const float alpha = (s[3] / 255.0f) * opacity;
-    /* svg uses a premultiplied alpha, so only use opacity for the blending */
-    o[0] = ((1.0f - alpha) * i[0]) + (opacity * (s[2] / 255.0f));
-    o[1] = ((1.0f - alpha) * i[1]) + (opacity * (s[1] / 255.0f));
-    o[2] = ((1.0f - alpha) * i[2]) + (opacity * (s[0] / 255.0f));
-    o[3] = in[3];
-    }
+  _watermark_blend(out, in, roi_out->width, cairo_image_surface_get_data(surface),
+                   cairo_image_surface_get_stride(surface), x0, y0, x1 - x0, y1 - y0,
+                   data->opacity / 100.0f);
 
   /* clean up */
   cairo_surface_destroy(surface);
   cairo_surface_destroy(surface_two);
-  g_free(image);
-  if(type == DT_WTM_SVG)
-  {
-    g_free(image_two);
-    g_object_unref(svg);
-  }
-
 }
 
 static void _watermark_callback(GtkWidget *tb, dt_iop_module_t *self)
@@ -1205,6 +1348,22 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
   piece->data = malloc(sizeof(dt_iop_watermark_data_t));
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = calloc(1, sizeof(dt_iop_watermark_global_data_t));
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  module->data = gd;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = module->data;
+  g_list_free_full(gd->rasters, _raster_free);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   free(piece->data);
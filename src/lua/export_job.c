@@ -0,0 +1,403 @@
+/*
+   This file is part of darktable,
+   Copyright (C) 2024 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lua/export_job.h"
+#include "common/darktable.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs.h"
+#include "imageio/imageio_common.h"
+#include "imageio/imageio_module.h"
+#include "lua/call.h"
+#include "lua/image.h"
+#include "lua/types.h"
+
+/*
+   ASYNCHRONOUS EXPORT JOBS
+
+   * format:write_image_async() creates a dt_lua_export_job_t and returns it as a handle
+   * the export itself runs as a control job in the DT_JOB_QUEUE_USER_BG queue, so
+     several exports can be in flight at the same time (the export queue only ever
+     runs one job at a time)
+   * the number of jobs running at once is limited by the host memory limit, every
+     pipe may take up to dt_get_available_mem() before tiling kicks in. Jobs over that
+     limit wait in a pending queue and are started as soon as a slot is released
+   * while the job is not finished, the lua object is pinned in the registry table
+     "dt_lua_export_jobs" so the completion callback always sees the same object
+   * the C struct is refcounted: one reference for the control job, one for the lua object
+ */
+
+typedef enum dt_lua_export_job_state_t
+{
+  DT_LUA_EXPORT_JOB_QUEUED = 0,
+  DT_LUA_EXPORT_JOB_RUNNING,
+  DT_LUA_EXPORT_JOB_DONE,
+  DT_LUA_EXPORT_JOB_FAILED,
+  DT_LUA_EXPORT_JOB_CANCELLED
+} dt_lua_export_job_state_t;
+
+typedef struct dt_lua_export_job_data_t
+{
+  dt_imgid_t imgid;
+  gchar *filename;
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_data_t *fdata;
+  gboolean upscale;
+  gboolean high_quality;
+  gboolean export_masks;
+  dt_colorspaces_color_profile_type_t icc_type;
+  gchar *icc_filename;
+
+  dt_job_t *job;
+  dt_lua_export_job_state_t state; // protected by _export_jobs.lock
+  gint refcount;
+} dt_lua_export_job_data_t;
+
+typedef dt_lua_export_job_data_t *dt_lua_export_job_t;
+
+static struct
+{
+  GMutex lock;
+  GCond finished;
+  GQueue pending;
+  int running;
+  int max_running;
+} _export_jobs;
+
+static void _export_job_unref(void *data)
+{
+  dt_lua_export_job_data_t *d = data;
+  if(!g_atomic_int_dec_and_test(&d->refcount)) return;
+
+  d->format->free_params(d->format, d->fdata);
+  g_free(d->filename);
+  g_free(d->icc_filename);
+  free(d);
+}
+
+static int _max_running_jobs()
+{
+  // every pipe is allowed to use dt_get_available_mem() before it tiles, keep half of
+  // the host memory for everything else and never block all the background workers
+  const size_t per_pipe = MAX(dt_get_available_mem(), 1);
+  const int by_memory = darktable.dtresources.total_memory / 2 / per_pipe;
+  return CLAMP(by_memory, 1, MAX(dt_worker_threads() - 1, 1));
+}
+
+static int _export_job_finished(lua_State *L)
+{
+  dt_lua_export_job_t d;
+  luaA_to(L, dt_lua_export_job_t, &d, 1);
+
+  // the job is done, the object doesn't need to stay alive any longer than lua wants it to
+  lua_getfield(L, LUA_REGISTRYINDEX, "dt_lua_export_jobs");
+  lua_pushlightuserdata(L, d);
+  lua_pushnil(L);
+  lua_settable(L, -3);
+  lua_pop(L, 1);
+
+  lua_getiuservalue(L, 1, 1);
+  lua_getfield(L, -1, "callback");
+  if(lua_isfunction(L, -1))
+  {
+    lua_pushvalue(L, 1);
+    lua_pushboolean(L, d->state == DT_LUA_EXPORT_JOB_DONE);
+    lua_call(L, 2, 0);
+    lua_pop(L, 1);
+  }
+  else
+    lua_pop(L, 2);
+  return 0;
+}
+
+static void _notify_finished(dt_lua_export_job_data_t *d)
+{
+  dt_lua_async_call_alien(_export_job_finished,
+      0, NULL, NULL,
+      LUA_ASYNC_TYPENAME, "dt_lua_export_job_t", d,
+      LUA_ASYNC_DONE);
+}
+
+static void _start_pending()
+{
+  // jobs are added outside of the lock, dt_control_add_job() runs them synchronously
+  // when the control system isn't running
+  GList *to_start = NULL;
+  g_mutex_lock(&_export_jobs.lock);
+  while(_export_jobs.running < _export_jobs.max_running && !g_queue_is_empty(&_export_jobs.pending))
+  {
+    dt_lua_export_job_data_t *d = g_queue_pop_head(&_export_jobs.pending);
+    _export_jobs.running++;
+    to_start = g_list_append(to_start, d->job);
+  }
+  g_mutex_unlock(&_export_jobs.lock);
+
+  for(GList *iter = to_start; iter; iter = g_list_next(iter))
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, iter->data);
+  g_list_free(to_start);
+}
+
+static int32_t _export_job_run(dt_job_t *job)
+{
+  dt_lua_export_job_data_t *d = dt_control_job_get_params(job);
+
+  g_mutex_lock(&_export_jobs.lock);
+  d->state = DT_LUA_EXPORT_JOB_RUNNING;
+  g_mutex_unlock(&_export_jobs.lock);
+
+  dt_control_job_set_progress(job, 0.0);
+  dt_imageio_export_set_progress_job(job);
+  const gboolean failed = dt_imageio_export(d->imgid, d->filename, d->format, d->fdata,
+                                            d->high_quality, d->upscale, FALSE, d->export_masks,
+                                            d->icc_type, d->icc_filename, DT_INTENT_LAST,
+                                            NULL, NULL, 1, 1, NULL);
+  dt_imageio_export_set_progress_job(NULL);
+  dt_control_job_set_progress(job, 1.0);
+
+  if(failed)
+    dt_print(DT_DEBUG_LUA, "[lua] could not export image %d to `%s'\n", d->imgid, d->filename);
+
+  g_mutex_lock(&_export_jobs.lock);
+  d->state = failed ? DT_LUA_EXPORT_JOB_FAILED : DT_LUA_EXPORT_JOB_DONE;
+  _export_jobs.running--;
+  g_cond_broadcast(&_export_jobs.finished);
+  g_mutex_unlock(&_export_jobs.lock);
+
+  _notify_finished(d);
+  _start_pending();
+  return 0;
+}
+
+int dt_lua_export_job_submit(lua_State *L,
+                             dt_imageio_module_format_t *format,
+                             dt_imageio_module_data_t *fdata,
+                             const dt_imgid_t imgid,
+                             const char *filename,
+                             const gboolean upscale,
+                             const int callback_index,
+                             const int options_index)
+{
+  const gboolean has_callback = callback_index > 0 && !lua_isnoneornil(L, callback_index);
+  if(has_callback && !lua_isfunction(L, callback_index))
+  {
+    format->free_params(format, fdata);
+    return luaL_argerror(L, callback_index, "function expected");
+  }
+  const gboolean has_options = options_index > 0 && !lua_isnoneornil(L, options_index);
+  if(has_options && !lua_istable(L, options_index))
+  {
+    format->free_params(format, fdata);
+    return luaL_argerror(L, options_index, "table expected");
+  }
+
+  dt_lua_export_job_data_t *d = calloc(1, sizeof(dt_lua_export_job_data_t));
+  d->imgid = imgid;
+  d->filename = g_strdup(filename);
+  d->format = format;
+  d->fdata = fdata;
+  d->upscale = upscale;
+  // the export module settings, unless the options table overrides them
+  d->high_quality = dt_conf_get_bool("plugins/lighttable/export/high_quality_processing");
+  d->export_masks = dt_conf_get_bool("plugins/lighttable/export/export_masks");
+  d->icc_type = dt_conf_get_int("plugins/lighttable/export/icctype");
+  d->icc_filename = dt_conf_get_string("plugins/lighttable/export/iccprofile");
+  if(has_options)
+  {
+    lua_getfield(L, options_index, "high_quality");
+    if(!lua_isnil(L, -1)) d->high_quality = lua_toboolean(L, -1);
+    lua_getfield(L, options_index, "export_masks");
+    if(!lua_isnil(L, -1)) d->export_masks = lua_toboolean(L, -1);
+    lua_getfield(L, options_index, "icc_filename");
+    if(lua_isstring(L, -1))
+    {
+      g_free(d->icc_filename);
+      d->icc_filename = g_strdup(lua_tostring(L, -1));
+      d->icc_type = DT_COLORSPACE_FILE;
+    }
+    lua_pop(L, 3);
+  }
+  d->state = DT_LUA_EXPORT_JOB_QUEUED;
+  d->refcount = 2;
+
+  d->job = dt_control_job_create(&_export_job_run, "lua export %d", imgid);
+  if(!d->job)
+  {
+    d->refcount = 1;
+    _export_job_unref(d);
+    return luaL_error(L, "could not create export job");
+  }
+  dt_control_job_set_params(d->job, d, _export_job_unref);
+
+  luaA_push(L, dt_lua_export_job_t, &d);
+  if(has_callback)
+  {
+    lua_getiuservalue(L, -1, 1);
+    lua_pushvalue(L, callback_index);
+    lua_setfield(L, -2, "callback");
+    lua_pop(L, 1);
+  }
+
+  lua_getfield(L, LUA_REGISTRYINDEX, "dt_lua_export_jobs");
+  lua_pushlightuserdata(L, d);
+  lua_pushvalue(L, -3);
+  lua_settable(L, -3);
+  lua_pop(L, 1);
+
+  g_mutex_lock(&_export_jobs.lock);
+  g_queue_push_tail(&_export_jobs.pending, d);
+  g_mutex_unlock(&_export_jobs.lock);
+  _start_pending();
+
+  return 1;
+}
+
+static int _job_gc(lua_State *L)
+{
+  dt_lua_export_job_t d;
+  luaA_to(L, dt_lua_export_job_t, &d, 1);
+  _export_job_unref(d);
+  return 0;
+}
+
+static int _job_state_member(lua_State *L)
+{
+  dt_lua_export_job_t d;
+  luaA_to(L, dt_lua_export_job_t, &d, 1);
+  g_mutex_lock(&_export_jobs.lock);
+  dt_lua_export_job_state_t state = d->state;
+  g_mutex_unlock(&_export_jobs.lock);
+  luaA_push(L, dt_lua_export_job_state_t, &state);
+  return 1;
+}
+
+static int _job_progress_member(lua_State *L)
+{
+  dt_lua_export_job_t d;
+  luaA_to(L, dt_lua_export_job_t, &d, 1);
+  g_mutex_lock(&_export_jobs.lock);
+  const gboolean finished = d->state > DT_LUA_EXPORT_JOB_RUNNING;
+  const double progress = finished ? 1.0 : d->state == DT_LUA_EXPORT_JOB_RUNNING
+                                                ? dt_control_job_get_progress(d->job) : 0.0;
+  g_mutex_unlock(&_export_jobs.lock);
+  lua_pushnumber(L, progress);
+  return 1;
+}
+
+static int _job_image_member(lua_State *L)
+{
+  dt_lua_export_job_t d;
+  luaA_to(L, dt_lua_export_job_t, &d, 1);
+  luaA_push(L, dt_lua_image_t, &d->imgid);
+  return 1;
+}
+
+static int _job_filename_member(lua_State *L)
+{
+  dt_lua_export_job_t d;
+  luaA_to(L, dt_lua_export_job_t, &d, 1);
+  lua_pushstring(L, d->filename);
+  return 1;
+}
+
+static int _job_cancel(lua_State *L)
+{
+  dt_lua_export_job_t d;
+  luaA_to(L, dt_lua_export_job_t, &d, 1);
+
+  // only jobs that have not been started yet can be cancelled, a running pipe runs to its end
+  g_mutex_lock(&_export_jobs.lock);
+  const gboolean cancelled = g_queue_remove(&_export_jobs.pending, d);
+  if(cancelled)
+  {
+    d->state = DT_LUA_EXPORT_JOB_CANCELLED;
+    g_cond_broadcast(&_export_jobs.finished);
+  }
+  g_mutex_unlock(&_export_jobs.lock);
+
+  if(cancelled)
+  {
+    // drops the reference held by the control job
+    dt_control_job_dispose(d->job);
+    _notify_finished(d);
+  }
+  lua_pushboolean(L, cancelled);
+  return 1;
+}
+
+static int _job_wait(lua_State *L)
+{
+  dt_lua_export_job_t d;
+  luaA_to(L, dt_lua_export_job_t, &d, 1);
+
+  dt_lua_unlock();
+  g_mutex_lock(&_export_jobs.lock);
+  while(d->state <= DT_LUA_EXPORT_JOB_RUNNING)
+    g_cond_wait(&_export_jobs.finished, &_export_jobs.lock);
+  const gboolean success = d->state == DT_LUA_EXPORT_JOB_DONE;
+  g_mutex_unlock(&_export_jobs.lock);
+  dt_lua_lock();
+
+  lua_pushboolean(L, success);
+  return 1;
+}
+
+int dt_lua_init_export_job(lua_State *L)
+{
+  g_mutex_init(&_export_jobs.lock);
+  g_cond_init(&_export_jobs.finished);
+  g_queue_init(&_export_jobs.pending);
+  _export_jobs.running = 0;
+  _export_jobs.max_running = _max_running_jobs();
+  dt_print(DT_DEBUG_LUA, "[lua] up to %d asynchronous exports will run in parallel\n",
+           _export_jobs.max_running);
+
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, "dt_lua_export_jobs");
+
+  luaA_enum(L, dt_lua_export_job_state_t);
+  luaA_enum_value_name(L, dt_lua_export_job_state_t, DT_LUA_EXPORT_JOB_QUEUED, "queued");
+  luaA_enum_value_name(L, dt_lua_export_job_state_t, DT_LUA_EXPORT_JOB_RUNNING, "running");
+  luaA_enum_value_name(L, dt_lua_export_job_state_t, DT_LUA_EXPORT_JOB_DONE, "done");
+  luaA_enum_value_name(L, dt_lua_export_job_state_t, DT_LUA_EXPORT_JOB_FAILED, "failed");
+  luaA_enum_value_name(L, dt_lua_export_job_state_t, DT_LUA_EXPORT_JOB_CANCELLED, "cancelled");
+
+  dt_lua_init_gpointer_type(L, dt_lua_export_job_t);
+  lua_pushcfunction(L, _job_state_member);
+  dt_lua_type_register_const(L, dt_lua_export_job_t, "state");
+  lua_pushcfunction(L, _job_progress_member);
+  dt_lua_type_register_const(L, dt_lua_export_job_t, "progress");
+  lua_pushcfunction(L, _job_image_member);
+  dt_lua_type_register_const(L, dt_lua_export_job_t, "image");
+  lua_pushcfunction(L, _job_filename_member);
+  dt_lua_type_register_const(L, dt_lua_export_job_t, "filename");
+  lua_pushcfunction(L, _job_cancel);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_lua_export_job_t, "cancel");
+  lua_pushcfunction(L, _job_wait);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_lua_export_job_t, "wait");
+  lua_pushcfunction(L, _job_gc);
+  dt_lua_type_setmetafield(L, dt_lua_export_job_t, "__gc");
+  return 0;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,50 @@
+/*
+   This file is part of darktable,
+   Copyright (C) 2024 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "common/darktable.h"
+#include "lua/lua.h"
+
+struct dt_imageio_module_format_t;
+struct dt_imageio_module_data_t;
+
+/*
+   queue an export of imgid to filename in the background and push a dt_lua_export_job_t
+   handle on the stack. ownership of fdata is transferred to the job.
+   if callback_index is a valid stack index holding a function, it will be called with
+   (job, success) once the export is finished or cancelled.
+   if options_index is a valid stack index holding a table, its high_quality, export_masks
+   and icc_filename fields replace the settings of the export module
+   */
+int dt_lua_export_job_submit(lua_State *L,
+                             struct dt_imageio_module_format_t *format,
+                             struct dt_imageio_module_data_t *fdata,
+                             const dt_imgid_t imgid,
+                             const char *filename,
+                             const gboolean upscale,
+                             const int callback_index,
+                             const int options_index);
+
+int dt_lua_init_export_job(lua_State *L);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
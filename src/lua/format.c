@@ -18,6 +18,7 @@
 
 #include "control/conf.h"
 #include "imageio/imageio_common.h"
+#include "lua/export_job.h"
 #include "lua/image.h"
 #include "lua/modules.h"
 #include "lua/types.h"
@@ -172,6 +173,38 @@ static int write_image(lua_State *L)
   return 1;
 }
 
+static int write_image_async(lua_State *L)
+{
+  /* check that param 1 is a module_format_t */
+  luaL_argcheck(L, dt_lua_isa(L, 1, dt_imageio_module_format_t), -1, "dt_imageio_module_format_t expected");
+
+  lua_getmetatable(L, 1);
+  lua_getfield(L, -1, "__luaA_Type");
+  luaA_Type format_type = luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+  lua_getfield(L, -1, "__associated_object");
+  dt_imageio_module_format_t *format = lua_touserdata(L, -1);
+  lua_pop(L, 2);
+
+  /* check that param 2 is an image */
+  dt_lua_image_t imgid;
+  luaA_to(L, dt_lua_image_t, &imgid, 2);
+
+  /* check that param 3 is a string (filename) */
+  const char *filename = luaL_checkstring(L, 3);
+
+  /* treat param 4 as an optional boolean */
+  const gboolean upscale = lua_toboolean(L, 4);
+
+  /* param 5 is an optional completion callback and param 6 an optional table
+     of export options, both checked by the job */
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  luaA_to_type(L, format_type, fdata, 1);
+
+  // the job owns fdata from now on
+  return dt_lua_export_job_submit(L, format, fdata, imgid, filename, upscale, 5, 6);
+}
+
 void dt_lua_register_format_type(lua_State *L, dt_imageio_module_format_t *module, luaA_Type type_id)
 {
   dt_lua_type_register_parent_type(L, type_id, luaA_type_find(L, "dt_imageio_module_format_t"));
@@ -211,6 +244,9 @@ int dt_lua_init_early_format(lua_State *L)
   lua_pushcfunction(L, write_image);
   lua_pushcclosure(L, dt_lua_type_member_common, 1);
   dt_lua_type_register_const(L, dt_imageio_module_format_t, "write_image");
+  lua_pushcfunction(L, write_image_async);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_imageio_module_format_t, "write_image_async");
 
   dt_lua_module_new(L, "format");
 
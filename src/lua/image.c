@@ -147,6 +147,68 @@ static int generate_cache(lua_State *L)
   return 0;
 }
 
+// the colour space of a thumbnail, as a name that doesn't depend on the locale
+static const char *_thumbnail_color_space(const dt_colorspaces_color_profile_type_t color_space)
+{
+  switch(color_space)
+  {
+    case DT_COLORSPACE_SRGB:
+      return "srgb";
+    case DT_COLORSPACE_ADOBERGB:
+      return "adobergb";
+    case DT_COLORSPACE_DISPLAY:
+    case DT_COLORSPACE_DISPLAY2:
+      return "display";
+    default:
+      // embedded thumbnails are not tagged
+      return NULL;
+  }
+}
+
+static int get_pixels(lua_State *L)
+{
+  dt_lua_image_t imgid = NO_IMGID;
+  luaA_to(L, dt_lua_image_t, &imgid, 1);
+  const int width = luaL_checkinteger(L, 2);
+  const int height = luaL_checkinteger(L, 3);
+  const dt_mipmap_size_t mip =
+    MIN(dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, width, height), DT_MIPMAP_8);
+
+  // blocking get straight from the cache, nothing is signalled to the gui
+  dt_lua_unlock();
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BLOCKING, 'r');
+  dt_lua_lock();
+
+  if(!buf.buf || buf.width <= 0 || buf.height <= 0)
+  {
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    lua_pushnil(L);
+    return 1;
+  }
+
+  // thumbnails are stored as 8 bit RGBA, hand out packed RGB
+  const size_t npixels = (size_t)buf.width * buf.height;
+  luaL_Buffer b;
+  char *out = luaL_buffinitsize(L, &b, npixels * 3);
+  for(size_t k = 0; k < npixels; k++)
+  {
+    out[3 * k + 0] = buf.buf[4 * k + 0];
+    out[3 * k + 1] = buf.buf[4 * k + 1];
+    out[3 * k + 2] = buf.buf[4 * k + 2];
+  }
+  luaL_pushresultsize(&b, npixels * 3);
+  lua_pushinteger(L, buf.width);
+  lua_pushinteger(L, buf.height);
+  const char *color_space = _thumbnail_color_space(buf.color_space);
+  if(color_space)
+    lua_pushstring(L, color_space);
+  else
+    lua_pushnil(L);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  return 4;
+}
+
 
 static int path_member(lua_State *L)
 {
@@ -663,6 +725,9 @@ int dt_lua_init_image(lua_State *L)
   lua_pushcfunction(L, generate_cache);
   lua_pushcclosure(L, dt_lua_type_member_common, 1);
   dt_lua_type_register_const(L, dt_lua_image_t, "generate_cache");
+  lua_pushcfunction(L, get_pixels);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_lua_image_t, "get_pixels");
   lua_pushcfunction(L, image_tostring);
   dt_lua_type_setmetafield(L,dt_lua_image_t,"__tostring");
 
@@ -24,6 +24,7 @@
 #include "lua/configuration.h"
 #include "lua/database.h"
 #include "lua/events.h"
+#include "lua/export_job.h"
 #include "lua/film.h"
 #include "lua/format.h"
 #include "lua/gettext.h"
@@ -139,7 +140,8 @@ static lua_CFunction init_funcs[]
         dt_lua_init_luastorages,   dt_lua_init_tags,        dt_lua_init_film,     dt_lua_init_call,
         dt_lua_init_view,          dt_lua_init_events,      dt_lua_init_init,     dt_lua_init_widget,
         dt_lua_init_lualib,        dt_lua_init_gettext,     dt_lua_init_guides,   dt_lua_init_cairo,
-        dt_lua_init_password,      dt_lua_init_util,        NULL };
+        dt_lua_init_password,      dt_lua_init_util,        dt_lua_init_export_job,
+        NULL };
 
 
 void dt_lua_init(lua_State *L, const char *lua_command)
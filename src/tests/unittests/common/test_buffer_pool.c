@@ -0,0 +1,201 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the pool of large buffers in common/buffer_pool.c
+ *
+ * Blocks must be recognised without touching memory in front of foreign
+ * pointers, idle blocks must be given back by the background thread, by a
+ * trim from any thread and before a fresh block exceeds the memory budget.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+// short enough for the background thread to be seen at work
+#define DT_BUFFER_POOL_MAX_IDLE 1.0
+
+#include "common/buffer_pool.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+#define MB ((size_t)1 << 20)
+
+// the memory darktable may use in the tests, in MB
+static int refresource[4] = { 64, 16, 0, 0 };
+
+/*
+ * HELPERS
+ */
+
+static gpointer trim_thread(gpointer data)
+{
+  dt_buffer_pool_trim();
+  return NULL;
+}
+
+static int setup(void **state)
+{
+  darktable.dtresources.total_memory = 1;
+  darktable.dtresources.refresource = refresource;
+  darktable.dtresources.level = -1;
+  return dt_get_available_mem() == 64 * MB ? 0 : 1;
+}
+
+static int teardown(void **state)
+{
+  dt_buffer_pool_cleanup();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_foreign(void **state)
+{
+  TR_STEP("pointers not allocated by the pool are not taken");
+  assert_false(dt_buffer_pool_free(NULL));
+
+  void *small = malloc(64);
+  assert_false(dt_buffer_pool_free(small));
+  free(small);
+
+#ifndef _WIN32
+  // aligned like a pool block, with nothing readable in front of it
+  void *aligned = NULL;
+  assert_int_equal(posix_memalign(&aligned, DT_BUFFER_POOL_ALIGN, DT_BUFFER_POOL_MIN_SIZE), 0);
+  assert_false(dt_buffer_pool_free(aligned));
+  free(aligned);
+#endif
+
+  TR_STEP("small allocations are left to malloc");
+  assert_null(dt_buffer_pool_alloc(DT_BUFFER_POOL_MIN_SIZE - 1));
+}
+
+static void test_reuse(void **state)
+{
+  TR_STEP("a freed block is reused for the same size class");
+  void *a = dt_buffer_pool_alloc(10 * MB);
+  assert_non_null(a);
+  assert_true(dt_buffer_pool_free(a));
+  assert_int_equal(_get(&_idle_bytes), 10 * MB);
+  void *b = dt_buffer_pool_alloc(10 * MB - 1000);
+  assert_ptr_equal(a, b);
+  assert_int_equal(_get(&_idle_bytes), 0);
+
+  TR_STEP("blocks over the idle cap are given back at once");
+  void *c = dt_buffer_pool_alloc(20 * MB);
+  assert_true(dt_buffer_pool_free(c));
+  assert_int_equal(_get(&_idle_bytes), 0);
+
+  assert_true(dt_buffer_pool_free(b));
+  dt_buffer_pool_trim();
+  assert_int_equal(_get(&_idle_bytes), 0);
+  assert_int_equal(g_hash_table_size(_blocks), 0);
+}
+
+static void test_trim_other_thread(void **state)
+{
+  void *a = dt_buffer_pool_alloc(10 * MB);
+  assert_true(dt_buffer_pool_free(a));
+  assert_ptr_equal(_get_slot()->block->mem, a);
+
+  TR_STEP("a trim from another thread empties the slot of this one");
+  GThread *thread = g_thread_new("trim", trim_thread, NULL);
+  g_thread_join(thread);
+  assert_null(_get_slot()->block);
+  assert_int_equal(_get(&_idle_bytes), 0);
+  assert_int_equal(g_hash_table_size(_blocks), 0);
+
+  TR_STEP("the pool still works afterwards");
+  void *b = dt_buffer_pool_alloc(10 * MB);
+  assert_non_null(b);
+  assert_true(dt_buffer_pool_free(b));
+  dt_buffer_pool_trim();
+}
+
+static void test_expire(void **state)
+{
+  TR_STEP("idle blocks are given back without further allocations");
+  // one goes to the shared lists, the other one stays in the slot of this thread
+  void *a = dt_buffer_pool_alloc(8 * MB);
+  void *b = dt_buffer_pool_alloc(8 * MB);
+  assert_true(dt_buffer_pool_free(a));
+  assert_true(dt_buffer_pool_free(b));
+  assert_int_equal(_get(&_idle_bytes), 16 * MB);
+
+  for(int k = 0; k < 50 && _get(&_idle_bytes); k++) g_usleep(G_USEC_PER_SEC / 10);
+  assert_int_equal(_get(&_idle_bytes), 0);
+  assert_int_equal(g_hash_table_size(_blocks), 0);
+}
+
+static void test_budget(void **state)
+{
+  TR_STEP("idle blocks are given back before a fresh one exceeds the budget");
+  void *a = dt_buffer_pool_alloc(10 * MB);
+  assert_true(dt_buffer_pool_free(a));
+  void *b = dt_buffer_pool_alloc(24 * MB);
+  assert_int_equal(_get(&_idle_bytes), 10 * MB);
+  assert_int_equal(_get(&_live_bytes), 24 * MB);
+
+  // 24 MB live, 10 MB idle and 32 MB fresh are more than 64 MB
+  void *c = dt_buffer_pool_alloc(32 * MB);
+  assert_non_null(c);
+  assert_int_equal(_get(&_idle_bytes), 0);
+  assert_int_equal(_get(&_live_bytes), 56 * MB);
+
+  assert_true(dt_buffer_pool_free(b));
+  assert_true(dt_buffer_pool_free(c));
+  dt_buffer_pool_trim();
+  assert_int_equal(_get(&_live_bytes), 0);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_foreign),
+    cmocka_unit_test(test_reuse),
+    cmocka_unit_test(test_trim_other_thread),
+    cmocka_unit_test(test_expire),
+    cmocka_unit_test(test_budget)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,310 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the a-trous wavelet decomposition in common/dwt.c
+ *
+ * The decomposition runs the vertical and horizontal passes of a scale in one
+ * sweep over chains of rows, these tests compare the layers it hands to the
+ * callback against separate full image passes, check that merging and the
+ * returned layers still add up to the input and that the denoiser keeps flat
+ * images flat on sizes smaller than its scales. The benchmark build times both
+ * users.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "common/dwt.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// absolute tolerance against the reference, only the order of the sums differs
+#define E_REF 1e-5f
+
+#define MAX_LAYERS 12
+
+// copies of the layers passed to the callback, indexed by scale
+static float *layers[MAX_LAYERS];
+
+/*
+ * HELPERS
+ */
+
+// noise on top of diagonal stripes, alpha is left at zero
+static float *gen_image(const int width, const int height)
+{
+  float *img = dt_calloc_align_float((size_t)4 * width * height);
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+      for(int c = 0; c < 3; c++)
+        img[4 * ((size_t)j * width + i) + c] = 0.5f * testimg_noise() + (((i + j) / 8 + c) & 1);
+  return img;
+}
+
+static void free_layers(void)
+{
+  for(int k = 0; k < MAX_LAYERS; k++)
+  {
+    dt_free_align(layers[k]);
+    layers[k] = NULL;
+  }
+}
+
+static void record_layer(float *layer, dwt_params_t *const p, const int scale)
+{
+  const size_t n = (size_t)4 * p->width * p->height;
+  if(scale >= MAX_LAYERS) return;
+  dt_free_align(layers[scale]);
+  layers[scale] = dt_alloc_align_float(n);
+  memcpy(layers[scale], layer, n * sizeof(float));
+}
+
+static int reflect(const int i, const int n)
+{
+  if(i < 0) return -i;
+  if(i >= n) return 2 * (n - 1) - i;
+  return i;
+}
+
+// the decomposition with one full image pass per direction and scale, the
+// detail layers go to ref[1..scales] and the residue to ref[scales + 1]
+static void ref_decompose(const float *in, float **ref, const int width, const int height,
+                          const int scales)
+{
+  const size_t n = (size_t)4 * width * height;
+  float *cur = dt_alloc_align_float(n);
+  float *temp = dt_alloc_align_float(n);
+  float *coarse = dt_alloc_align_float(n);
+  memcpy(cur, in, n * sizeof(float));
+  for(int lev = 0; lev < scales; lev++)
+  {
+    const int vscale = MIN(1 << lev, height - 1);
+    const int hscale = MIN(1 << lev, width - 1);
+    for(int j = 0; j < height; j++)
+      for(int i = 0; i < width; i++)
+        for(int c = 0; c < 4; c++)
+        {
+          const size_t k = 4 * ((size_t)j * width + i) + c;
+          temp[k] = 2.f * cur[k] + cur[4 * ((size_t)reflect(j - vscale, height) * width + i) + c]
+                    + cur[4 * ((size_t)reflect(j + vscale, height) * width + i) + c];
+        }
+    ref[lev + 1] = dt_alloc_align_float(n);
+    for(int j = 0; j < height; j++)
+      for(int i = 0; i < width; i++)
+        for(int c = 0; c < 4; c++)
+        {
+          const size_t k = 4 * ((size_t)j * width + i) + c;
+          coarse[k] = (2.f * temp[k] + temp[4 * ((size_t)j * width + reflect(i - hscale, width)) + c]
+                       + temp[4 * ((size_t)j * width + reflect(i + hscale, width)) + c]) / 16.f;
+          ref[lev + 1][k] = cur[k] - coarse[k];
+        }
+    memcpy(cur, coarse, n * sizeof(float));
+  }
+  ref[scales + 1] = cur;
+  dt_free_align(temp);
+  dt_free_align(coarse);
+}
+
+static float max_abs_diff(const float *a, const float *b, const size_t n)
+{
+  float diff = 0.0f;
+  for(size_t k = 0; k < n; k++)
+    diff = fmaxf(diff, fabsf(a[k] - b[k]));
+  return diff;
+}
+
+// runs the decomposition in place and returns the number of scales used
+static int decompose(float *img, const int width, const int height, const int scales,
+                     const int return_layer, const int merge_from_scale, _dwt_layer_func layer_func)
+{
+  dwt_params_t *p = dt_dwt_init(img, width, height, 4, scales, return_layer, merge_from_scale, NULL, 1.0f);
+  assert_non_null(p);
+  dwt_decompose(p, layer_func);
+  const int used = p->scales;
+  dt_dwt_free(p);
+  return used;
+}
+
+static int setup(void **state)
+{
+  darktable.num_openmp_threads = dt_get_num_procs();
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free_layers();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_layers(void **state)
+{
+  testimg_noise_seed(1);
+  // narrow images reflect at both edges on the larger scales
+  const int sizes[][2] = { { 300, 200 }, { 41, 700 }, { 900, 23 }, { 64, 64 } };
+
+  TR_STEP("verify that the layers match separate vertical and horizontal passes");
+  for(int s = 0; s < 4; s++)
+    for(int scales = 1; scales <= 6; scales++)
+    {
+      const int width = sizes[s][0];
+      const int height = sizes[s][1];
+      const size_t n = (size_t)4 * width * height;
+      float *in = gen_image(width, height);
+      float *img = dt_alloc_align_float(n);
+      memcpy(img, in, n * sizeof(float));
+      const int used = decompose(img, width, height, scales, scales + 1, 0, record_layer);
+      assert_true(used <= scales);
+
+      float *ref[MAX_LAYERS] = { NULL };
+      ref_decompose(in, ref, width, height, used);
+      for(int k = 1; k <= used + 1; k++)
+      {
+        assert_non_null(layers[k]);
+        const float diff = max_abs_diff(ref[k], layers[k], n);
+        if(diff >= E_REF)
+          TR_DEBUG("%dx%d, %d scales, layer %d: difference %e", width, height, used, k, diff);
+        assert_true(diff < E_REF);
+        dt_free_align(ref[k]);
+      }
+      // the residue is returned for return_layer = scales + 1
+      assert_true(max_abs_diff(layers[used + 1], img, n) == 0.0f);
+
+      free_layers();
+      dt_free_align(in);
+      dt_free_align(img);
+    }
+}
+
+static void test_reconstruction(void **state)
+{
+  testimg_noise_seed(2);
+  const int width = 333, height = 222, scales = 5;
+  const size_t n = (size_t)4 * width * height;
+  float *in = gen_image(width, height);
+  float *img = dt_alloc_align_float(n);
+
+  TR_STEP("verify that the layers add up to the input, with and without merging");
+  for(int merge_from_scale = 0; merge_from_scale <= scales; merge_from_scale += 2)
+  {
+    memcpy(img, in, n * sizeof(float));
+    decompose(img, width, height, scales, 0, merge_from_scale, NULL);
+    const float diff = max_abs_diff(in, img, n);
+    TR_DEBUG("merge from scale %d: difference %e", merge_from_scale, diff);
+    assert_true(diff < E_REF);
+  }
+
+  TR_STEP("verify that a single returned layer is the one passed to the callback");
+  memcpy(img, in, n * sizeof(float));
+  decompose(img, width, height, scales, 3, 0, record_layer);
+  assert_non_null(layers[3]);
+  assert_memory_equal(layers[3], img, n * sizeof(float));
+
+  free_layers();
+  dt_free_align(in);
+  dt_free_align(img);
+}
+
+static void test_denoise_flat(void **state)
+{
+  const float noise[8] = { 0.1f, 0.1f, 0.1f, 0.1f, 0.1f, 0.1f, 0.1f, 0.1f };
+  // the larger scales do not fit into the small sizes
+  const int sizes[][2] = { { 1, 1 }, { 2, 3 }, { 5, 7 }, { 37, 19 }, { 3, 100 } };
+
+  TR_STEP("verify that the denoiser keeps flat images flat on any size");
+  for(int s = 0; s < 5; s++)
+    for(int bands = 1; bands <= 7; bands++)
+    {
+      const int width = sizes[s][0];
+      const int height = sizes[s][1];
+      const size_t n = (size_t)4 * width * height;
+      float *img = dt_alloc_align_float(n);
+      for(size_t k = 0; k < n; k++) img[k] = 0.3f;
+      dwt_denoise(img, width, height, bands, noise);
+      for(size_t k = 0; k < n; k++)
+        assert_float_equal(img[k], 0.3f, E_REF);
+      dt_free_align(img);
+    }
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_benchmark(void **state)
+{
+  testimg_noise_seed(3);
+  const int width = 4096, height = 2730;
+  const size_t n = (size_t)4 * width * height;
+  const float noise[8] = { 0.05f, 0.03f, 0.02f, 0.01f, 0.01f, 0.01f, 0.01f, 0.01f };
+  float *img = gen_image(width, height);
+
+  for(int scales = 2; scales <= 8; scales += 3)
+  {
+    double start = dt_get_wtime();
+    decompose(img, width, height, scales, 0, 0, NULL);
+    const double decompose_time = dt_get_wtime() - start;
+    start = dt_get_wtime();
+    dwt_denoise(img, width, height, MIN(scales, 5), noise);
+    const double denoise_time = dt_get_wtime() - start;
+    TR_DEBUG("%d scales: decompose %.1f Mpx/s, denoise %.1f Mpx/s",
+             scales, 1e-6 * n / 4 / decompose_time, 1e-6 * n / 4 / denoise_time);
+  }
+
+  dt_free_align(img);
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_layers),
+    cmocka_unit_test(test_reconstruction),
+    cmocka_unit_test(test_denoise_flat),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,238 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the half float conversion in common/float16.c
+ *
+ * The pixelpipe cache may keep old lines as half floats, these tests make
+ * sure the conversion is precise enough for scene-referred images, i.e. that
+ * the difference is invisible after a typical display transform.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/float16.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+#define WIDTH 1024
+#define HEIGHT 768
+
+// relative error of a rounded half float
+#define E_REL (1.0f / 2048.0f)
+// largest difference after the display transform, 1/20 of an 8 bit step
+#define E_DISPLAY 2e-4f
+// mean difference after the display transform
+#define E_DISPLAY_MEAN 5e-5f
+
+/*
+ * HELPERS
+ */
+
+static float *alloc_image(void)
+{
+  return dt_alloc_align_float((size_t)4 * WIDTH * HEIGHT);
+}
+
+// scene-referred test pattern, 20 EV of exposure ramp with varying colours
+static float *gen_image(void)
+{
+  float *img = alloc_image();
+  for(int y = 0; y < HEIGHT; y++)
+    for(int x = 0; x < WIDTH; x++)
+    {
+      const float ev = -14.0f + 20.0f * x / (WIDTH - 1);
+      for(int c = 0; c < 3; c++)
+        img[4 * ((size_t)y * WIDTH + x) + c] =
+          exp2f(ev) * (0.6f + 0.4f * sinf(2.0f * M_PI * y / 97.0f + 2.0f * c));
+      img[4 * ((size_t)y * WIDTH + x) + 3] = 1.0f;
+    }
+  return img;
+}
+
+// filmic-like tone mapping followed by the sRGB transfer function
+static float display(const float v)
+{
+  const float t = fmaxf(v, 0.0f) / (1.0f + fmaxf(v, 0.0f));
+  return t <= 0.0031308f ? 12.92f * t : 1.055f * powf(t, 1.0f / 2.4f) - 0.055f;
+}
+
+static void roundtrip(float *const out, const float *const in, const size_t n)
+{
+  uint16_t *half = dt_alloc_aligned(n * sizeof(uint16_t));
+  dt_float16_from_float(half, in, n);
+  dt_float16_to_float(out, half, n);
+  dt_free_align(half);
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_precision(void **state)
+{
+  TR_STEP("verify the relative error over the normal half float range");
+  for(float ev = -14.0f; ev < 15.9f; ev += 0.01f)
+    for(int s = -1; s <= 1; s += 2)
+    {
+      const float v = s * exp2f(ev);
+      float r;
+      roundtrip(&r, &v, 1);
+      assert_true(fabsf(r - v) <= E_REL * fabsf(v));
+    }
+
+  TR_STEP("verify that half float values convert back unchanged");
+  for(int h = 0; h < 0x7c00; h++)
+  {
+    const uint16_t in = h;
+    float f;
+    uint16_t out;
+    dt_float16_to_float(&f, &in, 1);
+    dt_float16_from_float(&out, &f, 1);
+    assert_int_equal(out, in);
+  }
+}
+
+static void test_special_values(void **state)
+{
+  TR_STEP("verify saturation, NaN, zero and denormals");
+  const float in[7] = { 1e9f, -INFINITY, NAN, 0.0f, -0.0f, 1e-6f, 65519.0f };
+  float out[7];
+  roundtrip(out, in, 7);
+
+  assert_float_equal(out[0], DT_FLOAT16_MAX, 0.0f);
+  assert_float_equal(out[1], -DT_FLOAT16_MAX, 0.0f);
+  assert_true(isnan(out[2]));
+  assert_float_equal(out[3], 0.0f, 0.0f);
+  assert_true(out[4] == 0.0f && signbit(out[4]));
+  // denormal halves have a fixed step of 2^-24
+  assert_float_equal(out[5], 1e-6f, 0.5f * exp2f(-24.0f));
+  assert_float_equal(out[6], DT_FLOAT16_MAX, 0.0f);
+}
+
+static void test_buffer_vs_single(void **state)
+{
+  TR_STEP("verify that buffers convert like single values, including the tails");
+  const size_t n = 100003;
+  float *in = dt_alloc_align_float(n);
+  uint16_t *half = dt_alloc_aligned(n * sizeof(uint16_t));
+  for(size_t k = 0; k < n; k++)
+    in[k] = (k % 2 ? -1.0f : 1.0f) * exp2f(-20.0f + 40.0f * k / n);
+  dt_float16_from_float(half, in, n);
+
+  for(size_t k = 0; k < n; k++)
+  {
+    uint16_t h;
+    dt_float16_from_float(&h, in + k, 1);
+    assert_int_equal(half[k], h);
+  }
+
+  dt_free_align(in);
+  dt_free_align(half);
+}
+
+static void test_image_difference(void **state)
+{
+  TR_STEP("verify that a packed image is visually identical after display transform");
+  const size_t n = (size_t)4 * WIDTH * HEIGHT;
+  float *in = gen_image();
+  float *out = alloc_image();
+  uint16_t *half = dt_alloc_aligned(n * sizeof(uint16_t));
+
+  dt_float16_from_float(half, in, n);
+  dt_float16_to_float(out, half, n);
+
+  double sum = 0.0;
+  float diff = 0.0f;
+  for(size_t k = 0; k < n; k++)
+  {
+    const float d = fabsf(display(in[k]) - display(out[k]));
+    diff = fmaxf(diff, d);
+    sum += d;
+  }
+  const float mean = sum / n;
+  TR_DEBUG("display difference max = %e (%.3f 8 bit steps), mean = %e", diff, diff * 255.0f, mean);
+  assert_true(diff < E_DISPLAY);
+  assert_true(mean < E_DISPLAY_MEAN);
+
+  dt_free_align(in);
+  dt_free_align(out);
+  dt_free_align(half);
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_benchmark(void **state)
+{
+  const size_t n = (size_t)4 * WIDTH * HEIGHT;
+  float *in = gen_image();
+  float *out = alloc_image();
+  uint16_t *half = dt_alloc_aligned(n * sizeof(uint16_t));
+
+  const double start = dt_get_wtime();
+  dt_float16_from_float(half, in, n);
+  const double packed = dt_get_wtime();
+  dt_float16_to_float(out, half, n);
+  const double unpacked = dt_get_wtime();
+  TR_DEBUG("pack %.0f MB/s, unpack %.0f MB/s (float side)",
+           1e-6 * n * sizeof(float) / fmax(1e-9, packed - start),
+           1e-6 * n * sizeof(float) / fmax(1e-9, unpacked - packed));
+
+  dt_free_align(in);
+  dt_free_align(out);
+  dt_free_align(half);
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_precision),
+    cmocka_unit_test(test_special_values),
+    cmocka_unit_test(test_buffer_vs_single),
+    cmocka_unit_test(test_image_difference),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,260 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the recursive gaussian blur in common/gaussian.c
+ *
+ * The blur filters strips of columns and transposed bands of rows, these tests
+ * compare it against filtering one pixel column and row at a time with the
+ * same coefficients, for all orders, channel counts and sizes that leave
+ * partial strips and bands. The benchmark build sweeps sigma and width.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "common/gaussian.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// relative tolerance against the reference, only the order of the sums differs
+#define E_REF 1e-5f
+
+/*
+ * HELPERS
+ */
+
+// noise on top of vertical bars, partly outside of the clamping range
+static float *gen_image(const int width, const int height, const int ch)
+{
+  float *img = dt_alloc_align_float((size_t)width * height * ch);
+  for(size_t k = 0; k < (size_t)width * height * ch; k++)
+    img[k] = testimg_noise() + (((k / ch) % width / 16) & 1) - 0.2f;
+  return img;
+}
+
+// one sample of the filter along a line of n samples, stride floats apart
+static void ref_line(const float *in, float *out, const int n, const size_t stride,
+                     const float lo, const float hi, const float *c)
+{
+  const float a0 = c[0], a1 = c[1], a2 = c[2], a3 = c[3], b1 = c[4], b2 = c[5];
+  float xp = CLAMPF(in[0], lo, hi);
+  float yb = xp * c[6];
+  float yp = yb;
+  for(int j = 0; j < n; j++)
+  {
+    const float xc = CLAMPF(in[j * stride], lo, hi);
+    const float yc = (a0 * xc) + (a1 * xp) - (b1 * yp) - (b2 * yb);
+    out[j * stride] = yc;
+    xp = xc;
+    yb = yp;
+    yp = yc;
+  }
+  float xn = CLAMPF(in[(n - 1) * stride], lo, hi);
+  float xa = xn;
+  float yn = xn * c[7];
+  float ya = yn;
+  for(int j = n - 1; j >= 0; j--)
+  {
+    const float xc = CLAMPF(in[j * stride], lo, hi);
+    const float yc = (a2 * xn) + (a3 * xa) - (b1 * yn) - (b2 * ya);
+    xa = xn;
+    xn = xc;
+    ya = yn;
+    yn = yc;
+    out[j * stride] += yc;
+  }
+}
+
+// the blur one pixel column and row at a time
+static void ref_blur(const float *in, float *out, const int width, const int height,
+                     const int ch, const float *min, const float *max,
+                     const float sigma, const int order)
+{
+  float c[8];
+  _compute_gauss_params(sigma, order, c, c + 1, c + 2, c + 3, c + 4, c + 5, c + 6, c + 7);
+  float *temp = dt_alloc_align_float((size_t)width * height * ch);
+  for(int i = 0; i < width; i++)
+    for(int k = 0; k < ch; k++)
+      ref_line(in + i * ch + k, temp + i * ch + k, height, (size_t)width * ch, min[k], max[k], c);
+  for(int j = 0; j < height; j++)
+    for(int k = 0; k < ch; k++)
+      ref_line(temp + (size_t)j * width * ch + k, out + (size_t)j * width * ch + k, width, ch,
+               min[k], max[k], c);
+  dt_free_align(temp);
+}
+
+static void blur(const float *in, float *out, const int width, const int height,
+                 const int ch, const float *min, const float *max,
+                 const float sigma, const int order)
+{
+  dt_gaussian_t *g = dt_gaussian_init(width, height, ch, max, min, sigma, order);
+  assert_non_null(g);
+  if(ch == 4)
+    dt_gaussian_blur_4c(g, in, out);
+  else
+    dt_gaussian_blur(g, in, out);
+  dt_gaussian_free(g);
+}
+
+static float max_rel_diff(const float *a, const float *b, const size_t n)
+{
+  float diff = 0.0f;
+  float range = 1e-6f;
+  for(size_t k = 0; k < n; k++)
+  {
+    diff = fmaxf(diff, fabsf(a[k] - b[k]));
+    range = fmaxf(range, fabsf(a[k]));
+  }
+  return diff / range;
+}
+
+static int setup(void **state)
+{
+  darktable.num_openmp_threads = dt_get_num_procs();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_reference(void **state)
+{
+  testimg_noise_seed(1);
+  const float min[4] = { 0.0f, -0.1f, 0.0f, 0.0f };
+  const float max[4] = { 1.0f, 1.5f, 2.0f, 0.5f };
+  // 1 and 37 columns leave a single partial strip, 301 rows a partial band
+  const int sizes[][2] = { { 1, 50 }, { 37, 5 }, { 301, 301 }, { 1200, 64 } };
+  const float sigmas[] = { 0.8f, 4.0f, 60.0f };
+
+  TR_STEP("verify that the blocked blur matches the column by column reference");
+  for(int s = 0; s < 4; s++)
+    for(int ch = 1; ch <= 4; ch++)
+      for(int order = 0; order < 3; order++)
+        for(int k = 0; k < 3; k++)
+        {
+          const int width = sizes[s][0];
+          const int height = sizes[s][1];
+          const size_t n = (size_t)width * height * ch;
+          float *in = gen_image(width, height, ch);
+          float *ref = dt_alloc_align_float(n);
+          float *out = dt_alloc_align_float(n);
+          ref_blur(in, ref, width, height, ch, min, max, sigmas[k], order);
+          blur(in, out, width, height, ch, min, max, sigmas[k], order);
+          const float diff = max_rel_diff(ref, out, n);
+          if(diff >= E_REF)
+            TR_DEBUG("%dx%d, %d channels, order %d, sigma %.1f: relative difference %e",
+                     width, height, ch, order, sigmas[k], diff);
+          assert_true(diff < E_REF);
+          dt_free_align(in);
+          dt_free_align(ref);
+          dt_free_align(out);
+        }
+}
+
+static void test_in_place(void **state)
+{
+  testimg_noise_seed(2);
+  const float min[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  const float max[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  const int width = 333, height = 222;
+
+  TR_STEP("verify that blurring in place gives the same result");
+  for(int ch = 1; ch <= 4; ch *= 2)
+  {
+    const size_t n = (size_t)width * height * ch;
+    float *in = gen_image(width, height, ch);
+    float *out = dt_alloc_align_float(n);
+    blur(in, out, width, height, ch, min, max, 5.0f, 0);
+    blur(in, in, width, height, ch, min, max, 5.0f, 0);
+    assert_memory_equal(in, out, n * sizeof(float));
+    dt_free_align(in);
+    dt_free_align(out);
+  }
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_benchmark(void **state)
+{
+  testimg_noise_seed(3);
+  const float min[4] = { -INFINITY, -INFINITY, -INFINITY, -INFINITY };
+  const float max[4] = { INFINITY, INFINITY, INFINITY, INFINITY };
+  const int height = 1024;
+  const int widths[] = { 512, 2048, 6144 };
+  const float sigmas[] = { 2.0f, 20.0f, 200.0f };
+
+  for(int ch = 1; ch <= 4; ch *= 4)
+    for(int w = 0; w < 3; w++)
+    {
+      const int width = widths[w];
+      const size_t n = (size_t)width * height * ch;
+      float *in = gen_image(width, height, ch);
+      float *out = dt_alloc_align_float(n);
+      for(int k = 0; k < 3; k++)
+      {
+        double start = dt_get_wtime();
+        ref_blur(in, out, width, height, ch, min, max, sigmas[k], 0);
+        const double ref = dt_get_wtime() - start;
+        start = dt_get_wtime();
+        blur(in, out, width, height, ch, min, max, sigmas[k], 0);
+        const double blocked = dt_get_wtime() - start;
+        TR_DEBUG("%d channels, width %d, sigma %.0f: reference %.1f Mpx/s, blocked %.1f Mpx/s",
+                 ch, width, sigmas[k], 1e-6 * width * height / ref, 1e-6 * width * height / blocked);
+      }
+      dt_free_align(in);
+      dt_free_align(out);
+    }
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_reference),
+    cmocka_unit_test(test_in_place),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, setup, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,329 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the warping resampler in common/interpolation.c
+ *
+ * The pixelpipe resamples runs of geometry modules in one step by composing
+ * their backtransforms, these tests compare that against resampling once per
+ * transform. Strong downscales average blocks of pixels before the filter,
+ * they must still follow the original image.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "common/interpolation.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+#define WIDTH 96
+#define HEIGHT 96
+// pixels close to the border depend on the border handling, skip them
+#define MARGIN 16
+
+// tolerance for fused vs. chained resampling of a smooth image
+#define E_CHAIN 3e-3f
+// tolerance for resampling at integer positions
+#define E_EXACT 1e-5f
+// tolerance for downscaling a smooth image
+#define E_DOWNSCALE 1e-3f
+// from 1/32 on the kernels are wide enough to attenuate the pattern a bit
+#define E_DOWNSCALE_WIDE 2e-3f
+
+// input of the downscale tests
+#define DOWN_WIDTH 1536
+#define DOWN_HEIGHT 1024
+
+typedef struct transform_t
+{
+  float dx, dy;    // translation
+  float angle;     // rotation around the image centre, in degrees
+} transform_t;
+
+typedef struct chain_t
+{
+  int count;
+  const transform_t *t[2]; // top (last applied to the image) first
+} chain_t;
+
+/*
+ * HELPERS
+ */
+
+static float *alloc_image(void)
+{
+  return dt_alloc_align_float((size_t)4 * WIDTH * HEIGHT);
+}
+
+// smooth test pattern, well below the Nyquist frequency
+static float *gen_image(void)
+{
+  float *img = alloc_image();
+  for(int y = 0; y < HEIGHT; y++)
+    for(int x = 0; x < WIDTH; x++)
+      for(int c = 0; c < 4; c++)
+        img[4 * (y * WIDTH + x) + c] =
+          0.5f + 0.25f * sinf(2.0f * M_PI * x / 29.0f + c)
+                       * cosf(2.0f * M_PI * y / 37.0f - c);
+  return img;
+}
+
+// the same kind of pattern with longer periods, sampled at any position
+static float down_pattern(const float x, const float y, const int c)
+{
+  return 0.5f + 0.25f * sinf(2.0f * M_PI * x / 331.0f + c)
+                      * cosf(2.0f * M_PI * y / 257.0f - c);
+}
+
+static float *gen_down_image(void)
+{
+  float *img = dt_alloc_align_float((size_t)4 * DOWN_WIDTH * DOWN_HEIGHT);
+  for(int y = 0; y < DOWN_HEIGHT; y++)
+    for(int x = 0; x < DOWN_WIDTH; x++)
+      for(int c = 0; c < 4; c++)
+        img[4 * ((size_t)y * DOWN_WIDTH + x) + c] = down_pattern(x, y, c);
+  return img;
+}
+
+static void backtransform_one(const transform_t *t, float *const points, const size_t count)
+{
+  const float a = t->angle * M_PI / 180.0f;
+  const float cx = WIDTH / 2.0f, cy = HEIGHT / 2.0f;
+  for(size_t i = 0; i < 2 * count; i += 2)
+  {
+    const float x = points[i] - cx;
+    const float y = points[i + 1] - cy;
+    points[i] = cosf(a) * x - sinf(a) * y + cx + t->dx;
+    points[i + 1] = sinf(a) * x + cosf(a) * y + cy + t->dy;
+  }
+}
+
+static void backtransform_chain(float *const points, const size_t count, void *data)
+{
+  const chain_t *chain = data;
+  for(int k = 0; k < chain->count; k++)
+    backtransform_one(chain->t[k], points, count);
+}
+
+static void backtransform_nan(float *const points, const size_t count, void *data)
+{
+  for(size_t i = 0; i < 2 * count; i += 2)
+    if(points[i] < WIDTH / 2) points[i] = NAN;
+}
+
+static void resample(const float *in, float *out, const int count, const transform_t **t)
+{
+  const dt_iop_roi_t roi = { 0, 0, WIDTH, HEIGHT, 1.0f };
+  chain_t chain = { count, { NULL, NULL } };
+  for(int k = 0; k < count; k++) chain.t[k] = t[k];
+  dt_interpolation_resample_backtransform(dt_interpolation_new(DT_INTERPOLATION_LANCZOS3),
+                                          out, &roi, in, &roi, backtransform_chain, &chain);
+}
+
+// largest difference of a downscale of gen_down_image() to the pattern, the
+// kernels reach 3 output pixels into the border
+static float downscale_diff(const float *out, const dt_iop_roi_t *const roi_out)
+{
+  float diff = 0.0f;
+  for(int y = 4; y < roi_out->height - 4; y++)
+    for(int x = 4; x < roi_out->width - 4; x++)
+      for(int c = 0; c < 4; c++)
+        diff = fmaxf(diff, fabsf(out[4 * (y * roi_out->width + x) + c]
+                                 - down_pattern(x / roi_out->scale, y / roi_out->scale, c)));
+  return diff;
+}
+
+static float max_diff(const float *a, const float *b)
+{
+  float diff = 0.0f;
+  for(int y = MARGIN; y < HEIGHT - MARGIN; y++)
+    for(int x = MARGIN; x < WIDTH - MARGIN; x++)
+      for(int c = 0; c < 4; c++)
+      {
+        const size_t k = 4 * (y * WIDTH + x) + c;
+        diff = fmaxf(diff, fabsf(a[k] - b[k]));
+      }
+  return diff;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_fused_vs_chain(void **state)
+{
+  const transform_t shift = { 1.3f, -0.7f, 0.0f };
+  const transform_t rotate = { 0.0f, 0.0f, 10.0f };
+
+  TR_STEP("verify that one resampling along the composed backtransforms "
+    "matches resampling once per transform");
+  float *in = gen_image();
+  float *tmp = alloc_image();
+  float *chained = alloc_image();
+  float *fused = alloc_image();
+
+  // shift is the bottom module, rotate the top one
+  const transform_t *bottom[] = { &shift };
+  const transform_t *top[] = { &rotate };
+  resample(in, tmp, 1, bottom);
+  resample(tmp, chained, 1, top);
+
+  const transform_t *both[] = { &rotate, &shift };
+  resample(in, fused, 2, both);
+
+  const float diff = max_diff(chained, fused);
+  TR_DEBUG("max difference fused vs. chained = %e", diff);
+  assert_true(diff < E_CHAIN);
+
+  TR_STEP("verify that the composition order matters, i.e. the test can fail");
+  const transform_t *swapped[] = { &shift, &rotate };
+  resample(in, fused, 2, swapped);
+  const float diff_swapped = max_diff(chained, fused);
+  TR_DEBUG("max difference with swapped order = %e", diff_swapped);
+  assert_true(diff_swapped > E_CHAIN);
+
+  dt_free_align(in);
+  dt_free_align(tmp);
+  dt_free_align(chained);
+  dt_free_align(fused);
+}
+
+static void test_integer_shifts(void **state)
+{
+  const transform_t a = { 3.0f, -2.0f, 0.0f };
+  const transform_t b = { -1.0f, 4.0f, 0.0f };
+
+  TR_STEP("verify that composed integer shifts copy pixels exactly");
+  float *in = gen_image();
+  float *out = alloc_image();
+  const transform_t *both[] = { &b, &a };
+  resample(in, out, 2, both);
+
+  for(int y = MARGIN; y < HEIGHT - MARGIN; y++)
+    for(int x = MARGIN; x < WIDTH - MARGIN; x++)
+      for(int c = 0; c < 4; c++)
+        assert_float_equal(out[4 * (y * WIDTH + x) + c],
+                           in[4 * ((y + 2) * WIDTH + x + 2) + c], E_EXACT);
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+
+static void test_non_finite(void **state)
+{
+  TR_STEP("verify that points without a mapping give zero pixels");
+  const dt_iop_roi_t roi = { 0, 0, WIDTH, HEIGHT, 1.0f };
+  float *in = gen_image();
+  float *out = alloc_image();
+  dt_interpolation_resample_backtransform(dt_interpolation_new(DT_INTERPOLATION_BICUBIC),
+                                          out, &roi, in, &roi, backtransform_nan, NULL);
+
+  for(int y = 0; y < HEIGHT; y++)
+    for(int x = 0; x < WIDTH / 2; x++)
+      for(int c = 0; c < 4; c++)
+        assert_float_equal(out[4 * (y * WIDTH + x) + c], 0.0f, 0.0f);
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+
+static void test_downscale(void **state)
+{
+  TR_STEP("verify that strong downscales follow a smooth image");
+  const dt_iop_roi_t roi_in = { 0, 0, DOWN_WIDTH, DOWN_HEIGHT, 1.0f };
+  float *in = gen_down_image();
+  float *out = dt_alloc_align_float((size_t)4 * DOWN_WIDTH * DOWN_HEIGHT);
+
+  for(int factor = 2; factor <= 32; factor *= 2)
+  {
+    const float scale = 1.0f / factor;
+    const dt_iop_roi_t roi_out = { 0, 0, DOWN_WIDTH / factor, DOWN_HEIGHT / factor, scale };
+    dt_interpolation_resample(dt_interpolation_new(DT_INTERPOLATION_LANCZOS3),
+                              out, &roi_out, in, &roi_in);
+
+    const float diff = downscale_diff(out, &roi_out);
+    TR_DEBUG("max difference at 1/%d = %e", factor, diff);
+    assert_true(diff < (factor < 32 ? E_DOWNSCALE : E_DOWNSCALE_WIDE));
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_downscale_benchmark(void **state)
+{
+  const dt_iop_roi_t roi_in = { 0, 0, DOWN_WIDTH, DOWN_HEIGHT, 1.0f };
+  float *in = gen_down_image();
+  float *out = dt_alloc_align_float((size_t)4 * DOWN_WIDTH * DOWN_HEIGHT);
+
+  for(int factor = 2; factor <= 32; factor *= 2)
+  {
+    const dt_iop_roi_t roi_out = { 0, 0, DOWN_WIDTH / factor, DOWN_HEIGHT / factor, 1.0f / factor };
+    const double start = dt_get_wtime();
+    dt_interpolation_resample(dt_interpolation_new(DT_INTERPOLATION_LANCZOS3),
+                              out, &roi_out, in, &roi_in);
+    const double time = dt_get_wtime() - start;
+    const float diff = downscale_diff(out, &roi_out);
+    TR_DEBUG("1/%d: %.1f input Mpx/s, max difference %e",
+             factor, 1e-6 * DOWN_WIDTH * DOWN_HEIGHT / time, diff);
+    assert_true(diff < (factor < 32 ? E_DOWNSCALE : E_DOWNSCALE_WIDE));
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_fused_vs_chain),
+    cmocka_unit_test(test_integer_shifts),
+    cmocka_unit_test(test_non_finite),
+    cmocka_unit_test(test_downscale),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_downscale_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
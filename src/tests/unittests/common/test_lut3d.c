@@ -0,0 +1,226 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the baked 3D LUTs in common/colorspaces_lut3d.c
+ *
+ * The accuracy probes must sit between the LUT nodes, otherwise the measured
+ * error is zero for any transform and the tolerance never rejects a LUT. The
+ * tests bake analytic transforms whose interpolation error is known.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "common/colorspaces_lut3d.c"
+#include "common/math.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+static dt_colorspaces_t profiles;
+static int eval_calls;
+
+static const dt_aligned_pixel_t domain_min = { 0.0f, 0.0f, 0.0f, 0.0f };
+static const dt_aligned_pixel_t domain_max = { 1.0f, 1.0f, 1.0f, 0.0f };
+
+/*
+ * HELPERS
+ */
+
+// interpolated exactly by the LUT
+static void eval_affine(const float *const in, float *const out, const size_t npixels, void *data)
+{
+  eval_calls++;
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const float *const p = in + 4 * k;
+    out[4 * k + 0] = 0.5f * p[0] + 0.25f * p[1] + 0.1f;
+    out[4 * k + 1] = 0.3f * p[1] - 0.2f * p[2];
+    out[4 * k + 2] = p[2] + 0.1f * p[0];
+  }
+}
+
+// every channel squared, linear interpolation misses by h^2/4 in the middle of a cell
+static void eval_square(const float *const in, float *const out, const size_t npixels, void *data)
+{
+  eval_calls++;
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++)
+      out[4 * k + c] = in[4 * k + c] * in[4 * k + c];
+}
+
+// too much detail for 65 nodes per axis
+static void eval_wave(const float *const in, float *const out, const size_t npixels, void *data)
+{
+  eval_calls++;
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++)
+      out[4 * k + c] = sinf(2.0f * M_PI_F * 12.0f * in[4 * k + c]);
+}
+
+static float bake_error(dt_colorspaces_lut3d_eval_t eval)
+{
+  dt_colorspaces_lut3d_t lut = { .level = DT_COLORSPACES_LUT3D_LEVEL,
+                                 .shaper = DT_COLORSPACES_LUT3D_SHAPER_LINEAR };
+  for(int c = 0; c < 3; c++)
+  {
+    lut.domain_min[c] = domain_min[c];
+    lut.domain_inv_range[c] = 1.0f / (domain_max[c] - domain_min[c]);
+  }
+  _bake(&lut, domain_min, domain_max, eval, NULL);
+  assert_non_null(lut.clut);
+  dt_free_align(lut.clut);
+  return lut.max_error;
+}
+
+static int setup(void **state)
+{
+  dt_pthread_mutex_init(&profiles.lut3d_lock, NULL);
+  darktable.color_profiles = &profiles;
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  dt_colorspaces_lut3d_cleanup(&profiles);
+  dt_pthread_mutex_destroy(&profiles.lut3d_lock);
+  darktable.color_profiles = NULL;
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_bake_error(void **state)
+{
+  const float h = 1.0f / (DT_COLORSPACES_LUT3D_LEVEL - 1);
+
+  TR_STEP("affine transforms are interpolated without error");
+  const float affine = bake_error(eval_affine);
+  TR_DEBUG("affine: %e", affine);
+  assert_true(affine < 1e-5f);
+
+  TR_STEP("the probes measure the interpolation error between the nodes");
+  const float expected = sqrtf(3.0f) * h * h / 4.0f;
+  const float square = bake_error(eval_square);
+  TR_DEBUG("square: %e, expected %e", square, expected);
+  assert_float_equal(square, expected, 0.1f * expected);
+}
+
+static void test_tolerance(void **state)
+{
+  TR_STEP("a LUT missing the tolerance is rejected");
+  eval_calls = 0;
+  const dt_hash_t hash = dt_hash(DT_INITHASH, "wave", 4);
+  assert_null(dt_colorspaces_lut3d_get(hash, domain_min, domain_max,
+                                       DT_COLORSPACES_LUT3D_SHAPER_LINEAR, 0.01f, eval_wave, NULL));
+  assert_true(eval_calls > 0);
+
+  TR_STEP("the rejected LUT is not baked again");
+  eval_calls = 0;
+  assert_null(dt_colorspaces_lut3d_get(hash, domain_min, domain_max,
+                                       DT_COLORSPACES_LUT3D_SHAPER_LINEAR, 0.01f, eval_wave, NULL));
+  assert_int_equal(eval_calls, 0);
+
+  TR_STEP("a LUT within the tolerance is kept and shared");
+  const dt_hash_t square_hash = dt_hash(DT_INITHASH, "square", 6);
+  dt_colorspaces_lut3d_t *lut = dt_colorspaces_lut3d_get(square_hash, domain_min, domain_max,
+                                                         DT_COLORSPACES_LUT3D_SHAPER_LINEAR,
+                                                         1e-3f, eval_square, NULL);
+  assert_non_null(lut);
+  dt_colorspaces_lut3d_t *again = dt_colorspaces_lut3d_get(square_hash, domain_min, domain_max,
+                                                           DT_COLORSPACES_LUT3D_SHAPER_LINEAR,
+                                                           1e-3f, eval_square, NULL);
+  assert_ptr_equal(lut, again);
+  dt_colorspaces_lut3d_release(again);
+  dt_colorspaces_lut3d_release(lut);
+}
+
+static void test_apply(void **state)
+{
+  testimg_noise_seed(1);
+  const dt_hash_t hash = dt_hash(DT_INITHASH, "square", 6);
+  dt_colorspaces_lut3d_t *lut = dt_colorspaces_lut3d_get(hash, domain_min, domain_max,
+                                                         DT_COLORSPACES_LUT3D_SHAPER_LINEAR,
+                                                         1e-3f, eval_square, NULL);
+  assert_non_null(lut);
+
+  const size_t npixels = 10000;
+  float *in = dt_alloc_align_float(4 * npixels);
+  float *exact = dt_alloc_align_float(4 * npixels);
+  float *baked = dt_alloc_align_float(4 * npixels);
+  // every second pixel is outside of the domain
+  for(size_t k = 0; k < npixels; k++)
+  {
+    for(int c = 0; c < 3; c++) in[4 * k + c] = testimg_noise() + (k & 1 ? 1.5f : 0.0f);
+    in[4 * k + 3] = testimg_noise();
+  }
+  eval_square(in, exact, npixels, NULL);
+  dt_colorspaces_lut3d_apply(lut, in, baked, npixels, eval_square, NULL);
+
+  TR_STEP("pixels inside of the domain stay within the bake error");
+  for(size_t k = 0; k < npixels; k += 2)
+    for(int c = 0; c < 3; c++)
+      assert_float_equal(baked[4 * k + c], exact[4 * k + c], lut->max_error);
+
+  TR_STEP("pixels outside of the domain are exact and alpha is kept");
+  for(size_t k = 1; k < npixels; k += 2)
+    assert_memory_equal(exact + 4 * k, baked + 4 * k, 3 * sizeof(float));
+  for(size_t k = 0; k < npixels; k++)
+    assert_true(baked[4 * k + 3] == in[4 * k + 3]);
+
+  dt_free_align(in);
+  dt_free_align(exact);
+  dt_free_align(baked);
+  dt_colorspaces_lut3d_release(lut);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_bake_error),
+    cmocka_unit_test(test_tolerance),
+    cmocka_unit_test(test_apply)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,147 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the batch read-ahead in common/readahead.c
+ *
+ * Files are remembered for a while after being queued, so that calling the
+ * read-ahead once per processed image doesn't read them again, but a later
+ * batch does. Files that could not be read are forgotten at once.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "common/readahead.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// more than two read chunks and a bit
+#define FILE_SIZE (2 * DT_READAHEAD_CHUNK + 12345)
+
+static gchar *tmp_file = NULL;
+
+/*
+ * HELPERS
+ */
+
+static int setup(void **state)
+{
+  dt_pthread_mutex_init(&darktable.readFile_mutex, NULL);
+
+  GError *error = NULL;
+  const gint fd = g_file_open_tmp("dt_readahead_XXXXXX", &tmp_file, &error);
+  if(fd < 0) return 1;
+  g_close(fd, NULL);
+
+  gchar *data = g_malloc0(FILE_SIZE);
+  const gboolean ok = g_file_set_contents(tmp_file, data, FILE_SIZE, &error);
+  g_free(data);
+  return ok ? 0 : 1;
+}
+
+static int teardown(void **state)
+{
+  dt_readahead_cleanup();
+  g_unlink(tmp_file);
+  g_free(tmp_file);
+  dt_pthread_mutex_destroy(&darktable.readFile_mutex);
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_remember(void **state)
+{
+  g_mutex_lock(&_lock);
+
+  TR_STEP("a file is queued once");
+  assert_true(_remember(tmp_file, 0));
+  assert_false(_remember(tmp_file, DT_READAHEAD_FORGET / 2));
+
+  TR_STEP("a file queued a while ago is queued again");
+  assert_true(_remember(tmp_file, 2 * DT_READAHEAD_FORGET));
+
+  TR_STEP("old entries are dropped");
+  assert_true(_remember("other", 2 * DT_READAHEAD_FORGET));
+  assert_true(_remember("another", 4 * DT_READAHEAD_FORGET));
+  assert_int_equal(g_hash_table_size(_queued), 1);
+
+  g_hash_table_remove_all(_queued);
+  g_mutex_unlock(&_lock);
+}
+
+static void test_read(void **state)
+{
+  TR_STEP("the whole file is read");
+  assert_int_equal(_read_into_cache(tmp_file), FILE_SIZE);
+
+  TR_STEP("a file that was read stays queued");
+  g_mutex_lock(&_lock);
+  assert_true(_remember(tmp_file, g_get_monotonic_time()));
+  g_mutex_unlock(&_lock);
+  _read_file(g_strdup(tmp_file), NULL);
+  g_mutex_lock(&_lock);
+  assert_true(g_hash_table_contains(_queued, tmp_file));
+  g_mutex_unlock(&_lock);
+
+  TR_STEP("a missing file is forgotten so that it is tried again");
+  gchar *missing = g_strconcat(tmp_file, ".missing", NULL);
+  assert_int_equal(_read_into_cache(missing), 0);
+  g_mutex_lock(&_lock);
+  assert_true(_remember(missing, g_get_monotonic_time()));
+  g_mutex_unlock(&_lock);
+  _read_file(g_strdup(missing), NULL);
+  g_mutex_lock(&_lock);
+  assert_false(g_hash_table_contains(_queued, missing));
+  g_mutex_unlock(&_lock);
+  g_free(missing);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_remember),
+    cmocka_unit_test(test_read)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,207 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the bilateral grid
+ *
+ * A grid kept for the darkroom pipes must be handed out again only for the same
+ * input and sigmas, and slice exactly like a fresh one. The benchmark build
+ * reports the speed of the single steps and of a run reusing the grid.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "common/bilateral.h"
+#include "common/darktable.h"
+#include "develop/pixelpipe.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+#define WIDTH 1536
+#define HEIGHT 1024
+
+/*
+ * HELPERS
+ */
+
+// Lab checkerboard of 128 pixel squares with some noise on top
+static float *make_image(const size_t width, const size_t height)
+{
+  float *img = dt_alloc_align_float(4 * width * height);
+  for(size_t j = 0; j < height; j++)
+    for(size_t i = 0; i < width; i++)
+    {
+      float *pixel = img + 4 * (j * width + i);
+      pixel[0] = (((i / 128 + j / 128) & 1) ? 70.0f : 30.0f) + 10.0f * (testimg_noise() - 0.5f);
+      pixel[1] = 20.0f * (testimg_noise() - 0.5f);
+      pixel[2] = 20.0f * (testimg_noise() - 0.5f);
+      pixel[3] = 1.0f;
+    }
+  return img;
+}
+
+// a pipe with a single module, the one using the grid
+static void init_piece(dt_dev_pixelpipe_t *pipe,
+                       dt_dev_pixelpipe_iop_t *piece,
+                       const dt_dev_pixelpipe_type_t type)
+{
+  memset(pipe, 0, sizeof(*pipe));
+  memset(piece, 0, sizeof(*piece));
+  pipe->type = type;
+  pipe->image.id = 1;
+  pipe->nodes = g_list_append(NULL, piece);
+  piece->pipe = pipe;
+}
+
+static int setup(void **state)
+{
+  darktable.num_openmp_threads = dt_get_num_procs();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_reuse(void **state)
+{
+  testimg_noise_seed(1);
+  const size_t npixels = WIDTH * HEIGHT;
+  float *in = make_image(WIDTH, HEIGHT);
+  float *fresh = dt_alloc_align_float(4 * npixels);
+  float *reused = dt_alloc_align_float(4 * npixels);
+  const dt_iop_roi_t roi = { 0, 0, WIDTH, HEIGHT, 1.0f };
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_iop_t piece;
+  dt_bilateral_t *cache = NULL;
+
+  TR_STEP("the darkroom keeps the grid");
+  init_piece(&pipe, &piece, DT_DEV_PIXELPIPE_FULL);
+  dt_bilateral_t *b = dt_bilateral_init_cached(&cache, &piece, in, &roi, 20.0f, 10.0f);
+  assert_non_null(b);
+  assert_ptr_equal(b, cache);
+
+  TR_STEP("another detail slices the same grid like a fresh one");
+  dt_bilateral_t *again = dt_bilateral_init_cached(&cache, &piece, in, &roi, 20.0f, 10.0f);
+  assert_ptr_equal(again, b);
+  dt_bilateral_slice(again, in, reused, 0.5f);
+  dt_bilateral_t *ref = dt_bilateral_init(WIDTH, HEIGHT, 20.0f, 10.0f);
+  dt_bilateral_splat(ref, in);
+  dt_bilateral_blur(ref);
+  dt_bilateral_slice(ref, in, fresh, 0.5f);
+  assert_memory_equal(fresh, reused, 4 * npixels * sizeof(float));
+  dt_bilateral_free(ref);
+
+  TR_STEP("other sigmas need a new grid");
+  b = dt_bilateral_init_cached(&cache, &piece, in, &roi, 20.0f, 5.0f);
+  assert_ptr_equal(b, cache);
+  assert_true(b->sigma_r < 6.0f);
+  dt_bilateral_free(cache);
+  cache = NULL;
+  g_list_free(pipe.nodes);
+
+  TR_STEP("the export doesn't keep it");
+  init_piece(&pipe, &piece, DT_DEV_PIXELPIPE_EXPORT);
+  b = dt_bilateral_init_cached(&cache, &piece, in, &roi, 20.0f, 10.0f);
+  assert_non_null(b);
+  assert_null(cache);
+  dt_bilateral_free(b);
+  g_list_free(pipe.nodes);
+
+  dt_free_align(in);
+  dt_free_align(fresh);
+  dt_free_align(reused);
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_benchmark(void **state)
+{
+  testimg_noise_seed(2);
+  const size_t width = 3 * WIDTH;
+  const size_t height = 3 * HEIGHT;
+  const size_t npixels = width * height;
+  float *in = make_image(width, height);
+  float *out = dt_alloc_align_float(4 * npixels);
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.0f };
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_iop_t piece;
+  dt_bilateral_t *cache = NULL;
+  init_piece(&pipe, &piece, DT_DEV_PIXELPIPE_FULL);
+
+  const double start = dt_get_wtime();
+  dt_bilateral_t *b = dt_bilateral_init(width, height, 30.0f, 8.0f);
+  dt_bilateral_splat(b, in);
+  const double splat = dt_get_wtime();
+  dt_bilateral_blur(b);
+  const double blur = dt_get_wtime();
+  dt_bilateral_slice(b, in, out, 0.5f);
+  const double slice = dt_get_wtime();
+  TR_DEBUG("%zux%zux%zu grid: splat %.1f Mpx/s, blur %.2f ms, slice %.1f Mpx/s",
+           b->size_x, b->size_y, b->size_z, 1e-6 * npixels / (splat - start),
+           1e3 * (blur - splat), 1e-6 * npixels / (slice - blur));
+  dt_bilateral_free(b);
+
+  dt_bilateral_init_cached(&cache, &piece, in, &roi, 30.0f, 8.0f);
+  const double reuse = dt_get_wtime();
+  b = dt_bilateral_init_cached(&cache, &piece, in, &roi, 30.0f, 8.0f);
+  dt_bilateral_slice(b, in, out, 0.25f);
+  TR_DEBUG("full run %.1f ms, reusing the grid %.1f ms",
+           1e3 * (slice - start), 1e3 * (dt_get_wtime() - reuse));
+
+  dt_bilateral_free(cache);
+  g_list_free(pipe.nodes);
+  dt_free_align(in);
+  dt_free_align(out);
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_reuse),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, setup, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,218 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the baked LUT of the color look up table module
+ *
+ * The LUT must stay close to the thin plate spline it replaces, pixels outside
+ * of its domain must get the exact result. The benchmark build compares both
+ * paths.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "iop/colorchecker.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// the bake tolerance is 0.5, it is only measured in a subset of the LUT cells
+#define MAX_DELTA_E 1.0f
+
+static dt_colorspaces_t profiles;
+
+/*
+ * HELPERS
+ */
+
+// the colorchecker patches with targets moved by up to +-4 delta E per channel
+static void init_params(dt_iop_colorchecker_params_t *p)
+{
+  memset(p, 0, sizeof(*p));
+  p->num_patches = colorchecker_patches;
+  for(int k = 0; k < colorchecker_patches; k++)
+  {
+    p->source_L[k] = colorchecker_Lab[3 * k];
+    p->source_a[k] = colorchecker_Lab[3 * k + 1];
+    p->source_b[k] = colorchecker_Lab[3 * k + 2];
+    p->target_L[k] = p->source_L[k] + 8.0f * (testimg_noise() - 0.5f);
+    p->target_a[k] = p->source_a[k] + 8.0f * (testimg_noise() - 0.5f);
+    p->target_b[k] = p->source_b[k] + 8.0f * (testimg_noise() - 0.5f);
+  }
+}
+
+static float delta_e(const float *const a, const float *const b)
+{
+  return sqrtf(sqrf(a[0] - b[0]) + sqrf(a[1] - b[1]) + sqrf(a[2] - b[2]));
+}
+
+static int setup(void **state)
+{
+  dt_pthread_mutex_init(&profiles.lut3d_lock, NULL);
+  darktable.color_profiles = &profiles;
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  dt_colorspaces_lut3d_cleanup(&profiles);
+  dt_pthread_mutex_destroy(&profiles.lut3d_lock);
+  darktable.color_profiles = NULL;
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_lut_accuracy(void **state)
+{
+  testimg_noise_seed(1);
+  dt_iop_colorchecker_params_t p;
+  init_params(&p);
+  dt_dev_pixelpipe_iop_t piece = { 0 };
+  init_pipe(NULL, NULL, &piece);
+  commit_params(NULL, (dt_iop_params_t *)&p, NULL, &piece);
+  dt_iop_colorchecker_data_t *d = piece.data;
+
+  TR_STEP("LUT is baked for 24 patches");
+  assert_non_null(d->lut3d);
+
+  TR_STEP("LUT follows the spline");
+  const size_t npixels = 100000;
+  float *in = dt_alloc_align_float(4 * npixels);
+  float *exact = dt_alloc_align_float(4 * npixels);
+  float *baked = dt_alloc_align_float(4 * npixels);
+  for(size_t k = 0; k < npixels; k++)
+  {
+    in[4 * k + 0] = 100.0f * testimg_noise();
+    in[4 * k + 1] = 256.0f * testimg_noise() - 128.0f;
+    in[4 * k + 2] = 256.0f * testimg_noise() - 128.0f;
+    in[4 * k + 3] = 0.0f;
+  }
+  _colorchecker_eval(in, exact, npixels, d);
+  dt_colorspaces_lut3d_apply(d->lut3d, in, baked, npixels, _colorchecker_eval, d);
+  float max_error = 0.0f;
+  for(size_t k = 0; k < npixels; k++)
+    max_error = fmaxf(max_error, delta_e(exact + 4 * k, baked + 4 * k));
+  TR_DEBUG("max delta E %.4f, bake estimate %.4f", max_error, d->lut3d->max_error);
+  assert_true(max_error < MAX_DELTA_E);
+
+  TR_STEP("pixels outside of the LUT are exact");
+  for(size_t k = 0; k < npixels; k++) in[4 * k] += 101.0f;
+  _colorchecker_eval(in, exact, npixels, d);
+  dt_colorspaces_lut3d_apply(d->lut3d, in, baked, npixels, _colorchecker_eval, d);
+  for(size_t k = 0; k < npixels; k++)
+    assert_memory_equal(exact + 4 * k, baked + 4 * k, 3 * sizeof(float));
+
+  dt_free_align(in);
+  dt_free_align(exact);
+  dt_free_align(baked);
+  cleanup_pipe(NULL, NULL, &piece);
+}
+
+static void test_few_patches(void **state)
+{
+  testimg_noise_seed(2);
+  dt_iop_colorchecker_params_t p;
+  init_params(&p);
+  p.num_patches = 4;
+  dt_dev_pixelpipe_iop_t piece = { 0 };
+  init_pipe(NULL, NULL, &piece);
+  commit_params(NULL, (dt_iop_params_t *)&p, NULL, &piece);
+  dt_iop_colorchecker_data_t *d = piece.data;
+
+  TR_STEP("no LUT for the polynomial mapping of 4 patches");
+  assert_null(d->lut3d);
+  cleanup_pipe(NULL, NULL, &piece);
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_benchmark(void **state)
+{
+  testimg_noise_seed(3);
+  dt_iop_colorchecker_params_t p;
+  init_params(&p);
+  dt_dev_pixelpipe_iop_t piece = { 0 };
+  init_pipe(NULL, NULL, &piece);
+  // bake outside of the timing, like a second pipe would find it in the cache
+  commit_params(NULL, (dt_iop_params_t *)&p, NULL, &piece);
+  dt_iop_colorchecker_data_t *d = piece.data;
+  assert_non_null(d->lut3d);
+
+  const size_t npixels = (size_t)2 << 20;
+  float *in = dt_alloc_align_float(4 * npixels);
+  float *out = dt_alloc_align_float(4 * npixels);
+  for(size_t k = 0; k < npixels; k++)
+  {
+    in[4 * k + 0] = 100.0f * testimg_noise();
+    in[4 * k + 1] = 100.0f * testimg_noise() - 50.0f;
+    in[4 * k + 2] = 100.0f * testimg_noise() - 50.0f;
+    in[4 * k + 3] = 0.0f;
+  }
+
+  double start = dt_get_wtime();
+  _colorchecker_eval(in, out, npixels, d);
+  const double direct = dt_get_wtime() - start;
+  start = dt_get_wtime();
+  dt_colorspaces_lut3d_apply(d->lut3d, in, out, npixels, _colorchecker_eval, d);
+  const double lut = dt_get_wtime() - start;
+  TR_DEBUG("%d patches, one thread: direct %.1f Mpx/s, LUT %.1f Mpx/s",
+           d->num_patches, 1e-6 * npixels / direct, 1e-6 * npixels / lut);
+
+  dt_free_align(in);
+  dt_free_align(out);
+  cleanup_pipe(NULL, NULL, &piece);
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_lut_accuracy),
+    cmocka_unit_test(test_few_patches),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
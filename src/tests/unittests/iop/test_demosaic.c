@@ -0,0 +1,366 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the vectorized passes of the Markesteijn and AMaZE demosaicers
+ *
+ * The row-wise passes of Markesteijn must give the same results as the per-pixel
+ * loops they replaced and its result must not depend on the tile size, both
+ * demosaicers must reproduce a flat field. The benchmark build reports the
+ * throughput in Mpx/s.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "iop/demosaic.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+#define E 1e-5f
+
+// tile size for the Markesteijn passes, the former fixed size
+#define TS 122
+
+static const uint8_t xtrans[6][6] = { { 1, 1, 0, 1, 1, 2 },
+                                      { 1, 1, 2, 1, 1, 0 },
+                                      { 2, 0, 1, 0, 2, 1 },
+                                      { 1, 1, 2, 1, 1, 0 },
+                                      { 1, 1, 0, 1, 1, 2 },
+                                      { 0, 2, 1, 2, 0, 1 } };
+
+/*
+ * HELPERS
+ */
+
+static void assert_close(const float a, const float b)
+{
+  assert_true(fabsf(a - b) <= E * fmaxf(1.0f, fabsf(a)));
+}
+
+/* the per-pixel passes as they were before being split into row loops */
+
+static void ref_derivatives(const float (*const rgb)[TS][TS][3], float (*const yuv)[TS][TS],
+                            float (*const drv)[TS][TS], const unsigned ndir, const int mrow,
+                            const int mcol, const int passes)
+{
+  static const short dir[4] = { 1, TS, TS + 1, TS - 1 };
+  for(unsigned d = 0; d < ndir; ++d)
+  {
+    const int pad_yuv = (passes == 1) ? 8 : 13;
+    for(int row = pad_yuv; row < mrow - pad_yuv; row++)
+      for(int col = pad_yuv; col < mcol - pad_yuv; col++)
+      {
+        const float *rx = rgb[d][row][col];
+        const float y = 0.2627f * rx[0] + 0.6780f * rx[1] + 0.0593f * rx[2];
+        yuv[0][row][col] = y;
+        yuv[1][row][col] = (rx[2] - y) * 0.56433f;
+        yuv[2][row][col] = (rx[0] - y) * 0.67815f;
+      }
+    const int f = dir[d & 3];
+    const int pad_drv = (passes == 1) ? 9 : 14;
+    for(int row = pad_drv; row < mrow - pad_drv; row++)
+      for(int col = pad_drv; col < mcol - pad_drv; col++)
+      {
+        const float(*yfx)[TS][TS] = (float(*)[TS][TS]) & yuv[0][row][col];
+        drv[d][row][col] = sqrf(2 * yfx[0][0][0] - yfx[0][0][f] - yfx[0][0][-f])
+                           + sqrf(2 * yfx[1][0][0] - yfx[1][0][f] - yfx[1][0][-f])
+                           + sqrf(2 * yfx[2][0][0] - yfx[2][0][f] - yfx[2][0][-f]);
+      }
+  }
+}
+
+static void ref_homogeneity(const float (*const drv)[TS][TS], uint8_t (*const homo)[TS][TS],
+                            const unsigned ndir, const int mrow, const int mcol, const int passes)
+{
+  memset(homo, 0, sizeof(uint8_t) * ndir * TS * TS);
+  const int pad_homo = (passes == 1) ? 10 : 15;
+  for(int row = pad_homo; row < mrow - pad_homo; row++)
+    for(int col = pad_homo; col < mcol - pad_homo; col++)
+    {
+      float tr = FLT_MAX;
+      for(unsigned d = 0; d < ndir; ++d)
+        if(tr > drv[d][row][col]) tr = drv[d][row][col];
+      tr *= 8;
+      for(unsigned d = 0; d < ndir; ++d)
+        for(int v = -1; v <= 1; v++)
+          for(int h = -1; h <= 1; h++)
+            homo[d][row][col] += ((drv[d][row + v][col + h] <= tr) ? 1 : 0);
+    }
+}
+
+static void ref_homosum(const uint8_t (*const homo)[TS][TS], uint8_t (*const homosum)[TS][TS],
+                        const unsigned ndir, const int mrow, const int mcol, const int pad_tile)
+{
+  for(unsigned d = 0; d < ndir; ++d)
+    for(int row = pad_tile; row < mrow - pad_tile; row++)
+    {
+      int col = pad_tile - 5;
+      uint8_t v5sum[5] = { 0 };
+      homosum[d][row][col] = 0;
+      for(col++; col < mcol - pad_tile; col++)
+      {
+        uint8_t colsum = 0;
+        for(int v = -2; v <= 2; v++) colsum += homo[d][row + v][col + 2];
+        homosum[d][row][col] = homosum[d][row][col - 1] - v5sum[col % 5] + colsum;
+        v5sum[col % 5] = colsum;
+      }
+    }
+}
+
+static void ref_select(float *const out, const float (*const rgb)[TS][TS][3],
+                       const uint8_t (*const homosum)[TS][TS], const unsigned ndir, const int width,
+                       const int mrow, const int mcol, const int pad_tile)
+{
+  for(int row = pad_tile; row < mrow - pad_tile; row++)
+    for(int col = pad_tile; col < mcol - pad_tile; col++)
+    {
+      uint8_t hm[8] = { 0 };
+      uint8_t maxval = 0;
+      for(unsigned d = 0; d < ndir; ++d)
+      {
+        hm[d] = homosum[d][row][col];
+        maxval = (maxval < hm[d] ? hm[d] : maxval);
+      }
+      maxval -= maxval >> 3;
+      for(unsigned d = 0; d < ndir - 4; ++d)
+      {
+        if(hm[d] < hm[d + 4])
+          hm[d] = 0;
+        else if(hm[d] > hm[d + 4])
+          hm[d + 4] = 0;
+      }
+      dt_aligned_pixel_t avg = { 0.0f };
+      for(unsigned d = 0; d < ndir; ++d)
+      {
+        if(hm[d] >= maxval)
+        {
+          for(int c = 0; c < 3; c++) avg[c] += rgb[d][row][col][c];
+          avg[3]++;
+        }
+      }
+      for(int c = 0; c < 3; c++)
+        out[4 * (width * row + col) + c] = avg[c] / avg[3];
+    }
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_markesteijn_passes(void **state)
+{
+  for(int passes = 1; passes <= 3; passes += 2)
+  {
+    TR_STEP("%d pass%s", passes, passes == 1 ? "" : "es");
+    testimg_noise_seed(42 + passes);
+    const unsigned ndir = 4 << (passes > 1);
+    const int pad_tile = (passes == 1) ? 12 : 17;
+    // a partial tile at the image border as well as a full one
+    const int sizes[2][2] = { { TS, TS }, { TS - 37, TS - 11 } };
+
+    float (*rgb)[TS][TS][3] = dt_calloc_aligned(sizeof(float) * ndir * TS * TS * 3);
+    float (*yuv)[TS][TS] = dt_calloc_aligned(sizeof(float) * 3 * TS * TS);
+    float (*yuv_ref)[TS][TS] = dt_calloc_aligned(sizeof(float) * 3 * TS * TS);
+    float (*drv)[TS][TS] = dt_calloc_aligned(sizeof(float) * ndir * TS * TS);
+    float (*drv_ref)[TS][TS] = dt_calloc_aligned(sizeof(float) * ndir * TS * TS);
+    uint8_t (*homo)[TS][TS] = calloc(ndir * TS * TS, sizeof(uint8_t));
+    uint8_t (*homo_ref)[TS][TS] = calloc(ndir * TS * TS, sizeof(uint8_t));
+    uint8_t (*homosum)[TS][TS] = calloc(ndir * TS * TS, sizeof(uint8_t));
+    uint8_t (*homosum_ref)[TS][TS] = calloc(ndir * TS * TS, sizeof(uint8_t));
+    float *out = dt_calloc_align_float((size_t)4 * TS * TS);
+    float *out_ref = dt_calloc_align_float((size_t)4 * TS * TS);
+
+    for(int s = 0; s < 2; s++)
+    {
+      const int mrow = sizes[s][0];
+      const int mcol = sizes[s][1];
+      for(size_t k = 0; k < (size_t)ndir * TS * TS * 3; k++)
+        ((float *)rgb)[k] = testimg_noise();
+
+      _markesteijn_derivatives((const float(*)[3])rgb, (float *)yuv, (float *)drv, TS, ndir, mrow, mcol,
+                               passes);
+      ref_derivatives((const float(*)[TS][TS][3])rgb, yuv_ref, drv_ref, ndir, mrow, mcol, passes);
+      for(size_t k = 0; k < (size_t)ndir * TS * TS; k++)
+        assert_close(((float *)drv)[k], ((float *)drv_ref)[k]);
+
+      // the maps count comparisons, feed both the same derivatives
+      _markesteijn_homogeneity((const float *)drv_ref, (uint8_t *)homo, TS, ndir, mrow, mcol, passes);
+      ref_homogeneity((const float(*)[TS][TS])drv_ref, homo_ref, ndir, mrow, mcol, passes);
+      assert_memory_equal(homo, homo_ref, ndir * TS * TS);
+
+      _markesteijn_homosum((const uint8_t *)homo_ref, (uint8_t *)homosum, TS, ndir, mrow, mcol, pad_tile);
+      ref_homosum((const uint8_t(*)[TS][TS])homo_ref, homosum_ref, ndir, mrow, mcol, pad_tile);
+      for(unsigned d = 0; d < ndir; d++)
+        for(int row = pad_tile; row < mrow - pad_tile; row++)
+          assert_memory_equal(&homosum[d][row][pad_tile], &homosum_ref[d][row][pad_tile],
+                              mcol - 2 * pad_tile);
+
+      _markesteijn_select(out, (const float(*)[3])rgb, (const uint8_t *)homosum_ref, TS, ndir, TS, 0, 0,
+                          mrow, mcol, pad_tile);
+      ref_select(out_ref, (const float(*)[TS][TS][3])rgb, (const uint8_t(*)[TS][TS])homosum_ref,
+                 ndir, TS, mrow, mcol, pad_tile);
+      for(int row = pad_tile; row < mrow - pad_tile; row++)
+        for(int col = pad_tile; col < mcol - pad_tile; col++)
+          for(int c = 0; c < 3; c++)
+            assert_close(out[4 * (TS * row + col) + c], out_ref[4 * (TS * row + col) + c]);
+    }
+
+    dt_free_align(rgb);
+    dt_free_align(yuv);
+    dt_free_align(yuv_ref);
+    dt_free_align(drv);
+    dt_free_align(drv_ref);
+    free(homo);
+    free(homo_ref);
+    free(homosum);
+    free(homosum_ref);
+    dt_free_align(out);
+    dt_free_align(out_ref);
+  }
+}
+
+static void test_markesteijn_tiles(void **state)
+{
+  const int width = 431, height = 297;
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.0f };
+  // the limits of the tile size, compared to the former fixed size
+  const int sizes[2] = { 96, 256 };
+  float *in = dt_alloc_align_float((size_t)width * height);
+  float *out = dt_alloc_align_float((size_t)4 * width * height);
+  float *out_ref = dt_alloc_align_float((size_t)4 * width * height);
+  testimg_noise_seed(11);
+  for(size_t k = 0; k < (size_t)width * height; k++) in[k] = testimg_noise();
+
+  for(int passes = 1; passes <= 3; passes += 2)
+  {
+    TR_STEP("verify that Markesteijn %d pass%s gives the same bits for all tile sizes",
+            passes, passes == 1 ? "" : "es");
+    _xtrans_markesteijn_interpolate(out_ref, in, &roi, &roi, xtrans, passes, TS);
+    for(int s = 0; s < 2; s++)
+    {
+      TR_DEBUG("tile size %d", sizes[s]);
+      _xtrans_markesteijn_interpolate(out, in, &roi, &roi, xtrans, passes, sizes[s]);
+      for(size_t k = 0; k < (size_t)width * height; k++)
+        assert_memory_equal(out + 4 * k, out_ref + 4 * k, 3 * sizeof(float));
+    }
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+  dt_free_align(out_ref);
+}
+
+static void test_flat_field(void **state)
+{
+  const int width = 617, height = 411;
+  const float grey = 0.4f;
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.0f };
+  float *in = dt_alloc_align_float((size_t)width * height);
+  float *out = dt_alloc_align_float((size_t)4 * width * height);
+  for(size_t k = 0; k < (size_t)width * height; k++) in[k] = grey;
+
+  for(int passes = 1; passes <= 3; passes += 2)
+  {
+    TR_STEP("Markesteijn %d pass%s", passes, passes == 1 ? "" : "es");
+    xtrans_markesteijn_interpolate(out, in, &roi, &roi, xtrans, passes);
+    for(size_t k = 0; k < (size_t)width * height; k++)
+      for(int c = 0; c < 3; c++)
+        assert_close(out[4 * k + c], grey);
+  }
+
+  TR_STEP("AMaZE");
+  dt_dev_pixelpipe_t pipe = { 0 };
+  for(int c = 0; c < 3; c++) pipe.dsc.processed_maximum[c] = 1.0f;
+  dt_dev_pixelpipe_iop_t piece = { .pipe = &pipe };
+  amaze_demosaic(&piece, in, out, &roi, &roi, 0x94949494);
+  for(size_t k = 0; k < (size_t)width * height; k++)
+    for(int c = 0; c < 3; c++)
+      assert_close(out[4 * k + c], grey);
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_benchmark(void **state)
+{
+  const int width = 3000, height = 2000;
+  const double mpx = 1e-6 * width * height;
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.0f };
+  float *in = dt_alloc_align_float((size_t)width * height);
+  float *out = dt_alloc_align_float((size_t)4 * width * height);
+  testimg_noise_seed(7);
+  for(size_t k = 0; k < (size_t)width * height; k++) in[k] = testimg_noise();
+
+  for(int passes = 1; passes <= 3; passes += 2)
+  {
+    const double start = dt_get_wtime();
+    xtrans_markesteijn_interpolate(out, in, &roi, &roi, xtrans, passes);
+    TR_DEBUG("Markesteijn %d pass%s: %.1f Mpx/s", passes, passes == 1 ? "" : "es",
+             mpx / (dt_get_wtime() - start));
+  }
+
+  dt_dev_pixelpipe_t pipe = { 0 };
+  for(int c = 0; c < 3; c++) pipe.dsc.processed_maximum[c] = 1.0f;
+  dt_dev_pixelpipe_iop_t piece = { .pipe = &pipe };
+  const double start = dt_get_wtime();
+  amaze_demosaic(&piece, in, out, &roi, &roi, 0x94949494);
+  TR_DEBUG("AMaZE: %.1f Mpx/s", mpx / (dt_get_wtime() - start));
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_markesteijn_passes),
+    cmocka_unit_test(test_markesteijn_tiles),
+    cmocka_unit_test(test_flat_field),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,308 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for fusing runs of geometry modules in the pixelpipe
+ *
+ * A run of flips and crops is done by the pipe as one copy along the chained
+ * permutations of the pieces, this must give the same bits as running the flip
+ * module twice. Runs mixing in a real warp are resampled once along the composed
+ * backtransforms, which must follow the unfused chain closely.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "iop/flip.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// full resolution size of the pipe input
+#define WIDTH 74
+#define HEIGHT 46
+
+// tolerance for the mixed chain, only the rounding of the coordinates differs
+#define E_MIXED 1e-4f
+
+typedef struct flip_t
+{
+  dt_iop_flip_data_t data;
+  dt_dev_pixelpipe_iop_t piece;
+} flip_t;
+
+typedef struct rotate_t
+{
+  float angle;     // around the centre of a WIDTH x HEIGHT image, in degrees
+  float cx, cy;
+} rotate_t;
+
+typedef struct shift_t
+{
+  float dx, dy;
+} shift_t;
+
+typedef struct mixed_t
+{
+  rotate_t *rotate;
+  flip_t *flip;
+} mixed_t;
+
+/*
+ * HELPERS
+ */
+
+static float *gen_image(const int width, const int height)
+{
+  float *img = dt_alloc_align_float((size_t)4 * width * height);
+  for(size_t k = 0; k < (size_t)4 * width * height; k++) img[k] = (float)k;
+  return img;
+}
+
+// the flip is applied to a full buffer of width x height pixels
+static void init_flip(flip_t *f, const dt_image_orientation_t orientation,
+                      const int width, const int height)
+{
+  memset(f, 0, sizeof(flip_t));
+  f->data.orientation = orientation;
+  f->piece.data = &f->data;
+  f->piece.colors = 4;
+  f->piece.buf_in = (dt_iop_roi_t){ 0, 0, width, height, 1.0f };
+  f->piece.buf_out = f->piece.buf_in;
+  if(orientation & ORIENTATION_SWAP_XY)
+  {
+    f->piece.buf_out.width = height;
+    f->piece.buf_out.height = width;
+  }
+}
+
+static void flip_backtransform(float *const points, const size_t count, void *data)
+{
+  flip_t *f = data;
+  distort_backtransform(NULL, &f->piece, points, count);
+}
+
+static void rotate_backtransform(float *const points, const size_t count, void *data)
+{
+  const rotate_t *r = data;
+  const float a = r->angle * M_PI / 180.0f;
+  for(size_t i = 0; i < 2 * count; i += 2)
+  {
+    const float x = points[i] - r->cx;
+    const float y = points[i + 1] - r->cy;
+    points[i] = cosf(a) * x - sinf(a) * y + r->cx;
+    points[i + 1] = sinf(a) * x + cosf(a) * y + r->cy;
+  }
+}
+
+static void shift_backtransform(float *const points, const size_t count, void *data)
+{
+  const shift_t *s = data;
+  for(size_t i = 0; i < 2 * count; i += 2)
+  {
+    points[i] += s->dx;
+    points[i + 1] += s->dy;
+  }
+}
+
+static void mixed_backtransform(float *const points, const size_t count, void *data)
+{
+  const mixed_t *m = data;
+  rotate_backtransform(points, count, m->rotate);
+  flip_backtransform(points, count, m->flip);
+}
+
+static float *crop_image(const float *img, const dt_iop_roi_t *const roi, const int width)
+{
+  float *out = dt_alloc_align_float((size_t)4 * roi->width * roi->height);
+  for(int j = 0; j < roi->height; j++)
+    memcpy(out + (size_t)4 * j * roi->width, img + 4 * ((size_t)(roi->y + j) * width + roi->x),
+           sizeof(float) * 4 * roi->width);
+  return out;
+}
+
+// runs flip a on the image and flip b on its output for roi_out of b, then
+// does the same with one permutation of the chained pieces
+static void check_flip_chain(const dt_image_orientation_t oa, const dt_image_orientation_t ob,
+                             const dt_iop_roi_t *const roi_out, const float scale)
+{
+  const int width = WIDTH * scale;
+  const int height = HEIGHT * scale;
+  float *img = gen_image(width, height);
+
+  flip_t a, b;
+  init_flip(&a, oa, WIDTH, HEIGHT);
+  init_flip(&b, ob, a.piece.buf_out.width, a.piece.buf_out.height);
+
+  dt_iop_roi_t roi_b, roi_a;
+  modify_roi_in(NULL, &b.piece, roi_out, &roi_b);
+  modify_roi_in(NULL, &a.piece, &roi_b, &roi_a);
+  float *in = crop_image(img, &roi_a, width);
+
+  float *mid = dt_alloc_align_float((size_t)4 * roi_b.width * roi_b.height);
+  float *unfused = dt_alloc_align_float((size_t)4 * roi_out->width * roi_out->height);
+  float *fused = dt_alloc_align_float((size_t)4 * roi_out->width * roi_out->height);
+  process(NULL, &a.piece, in, mid, &roi_a, &roi_b);
+  process(NULL, &b.piece, mid, unfused, &roi_b, roi_out);
+
+  dt_interpolation_permutation_t pa, pb;
+  assert_true(dt_interpolation_permutation_probe(&pb, roi_out, &roi_b, flip_backtransform, &b));
+  assert_true(dt_interpolation_permutation_probe(&pa, &roi_b, &roi_a, flip_backtransform, &a));
+  dt_interpolation_permutation_chain(&pb, &pa);
+  dt_interpolation_permute(&pb, fused, in);
+
+  assert_memory_equal(fused, unfused, sizeof(float) * 4 * roi_out->width * roi_out->height);
+
+  dt_free_align(img);
+  dt_free_align(in);
+  dt_free_align(mid);
+  dt_free_align(unfused);
+  dt_free_align(fused);
+}
+
+static int setup(void **state)
+{
+  darktable.num_openmp_threads = dt_get_num_procs();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_flip_chain(void **state)
+{
+  const dt_image_orientation_t orientations[] =
+    { ORIENTATION_FLIP_Y, ORIENTATION_FLIP_X, ORIENTATION_FLIP_X | ORIENTATION_FLIP_Y,
+      ORIENTATION_SWAP_XY, ORIENTATION_SWAP_XY | ORIENTATION_FLIP_X,
+      ORIENTATION_SWAP_XY | ORIENTATION_FLIP_Y,
+      ORIENTATION_SWAP_XY | ORIENTATION_FLIP_X | ORIENTATION_FLIP_Y };
+  const int n = sizeof(orientations) / sizeof(orientations[0]);
+
+  TR_STEP("verify that two fused flips give the same bits as running the module twice");
+  for(int a = 0; a < n; a++)
+    for(int b = 0; b < n; b++)
+    {
+      TR_DEBUG("orientation %d then %d", orientations[a], orientations[b]);
+      const gboolean swap = (orientations[a] ^ orientations[b]) & ORIENTATION_SWAP_XY;
+      const int width = swap ? HEIGHT : WIDTH;
+      const int height = swap ? WIDTH : HEIGHT;
+
+      const dt_iop_roi_t full = { 0, 0, width, height, 1.0f };
+      check_flip_chain(orientations[a], orientations[b], &full, 1.0f);
+
+      const dt_iop_roi_t part = { 3, 5, width - 10, height - 9, 1.0f };
+      check_flip_chain(orientations[a], orientations[b], &part, 1.0f);
+
+      const dt_iop_roi_t half = { 0, 0, width / 2, height / 2, 0.5f };
+      check_flip_chain(orientations[a], orientations[b], &half, 0.5f);
+    }
+}
+
+static void test_mixed_chain(void **state)
+{
+  const dt_iop_roi_t roi = { 0, 0, WIDTH, HEIGHT, 1.0f };
+  const dt_iop_roi_t roi_in = roi;
+  float *in = gen_image(WIDTH, HEIGHT);
+  for(size_t k = 0; k < (size_t)4 * WIDTH * HEIGHT; k++) in[k] /= 4 * WIDTH * HEIGHT;
+  flip_t flip;
+  init_flip(&flip, ORIENTATION_FLIP_X | ORIENTATION_FLIP_Y, WIDTH, HEIGHT);
+  rotate_t rotate = { 10.0f, WIDTH / 2.0f, HEIGHT / 2.0f };
+
+  TR_STEP("verify that a rotation is not taken for a permutation");
+  dt_interpolation_permutation_t perm;
+  assert_false(dt_interpolation_permutation_probe(&perm, &roi, &roi, rotate_backtransform, &rotate));
+
+  TR_STEP("verify that a flip and a rotation fused follow the unfused chain");
+  const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_BILINEAR);
+  float *mid = dt_alloc_align_float((size_t)4 * WIDTH * HEIGHT);
+  float *unfused = dt_alloc_align_float((size_t)4 * WIDTH * HEIGHT);
+  float *fused = dt_alloc_align_float((size_t)4 * WIDTH * HEIGHT);
+  process(NULL, &flip.piece, in, mid, &roi_in, &roi);
+  dt_interpolation_resample_backtransform(itor, unfused, &roi, mid, &roi,
+                                          rotate_backtransform, &rotate);
+  mixed_t mixed = { &rotate, &flip };
+  dt_interpolation_resample_backtransform(itor, fused, &roi, in, &roi_in,
+                                          mixed_backtransform, &mixed);
+
+  float diff = 0.0f;
+  for(size_t k = 0; k < (size_t)4 * WIDTH * HEIGHT; k++)
+    diff = fmaxf(diff, fabsf(fused[k] - unfused[k]));
+  TR_DEBUG("max difference fused vs. unfused = %e", diff);
+  assert_true(diff < E_MIXED);
+
+  dt_free_align(in);
+  dt_free_align(mid);
+  dt_free_align(unfused);
+  dt_free_align(fused);
+}
+
+static void test_fractional_shift(void **state)
+{
+  // like crop, the rois are shifted by whole pixels and the backtransform by a bit more
+  const dt_iop_roi_t roi_out = { 0, 0, 40, 30, 1.0f };
+  const dt_iop_roi_t roi_in = { 3, 2, 40, 30, 1.0f };
+  float *in = gen_image(roi_in.width, roi_in.height);
+  float *out = dt_alloc_align_float((size_t)4 * roi_out.width * roi_out.height);
+
+  TR_STEP("verify that a fractional offset still copies roi_in exactly");
+  shift_t shift = { 3.4f, 2.3f };
+  dt_interpolation_permutation_t perm;
+  assert_true(dt_interpolation_permutation_probe(&perm, &roi_out, &roi_in, shift_backtransform, &shift));
+  dt_interpolation_permute(&perm, out, in);
+  assert_memory_equal(out, in, sizeof(float) * 4 * roi_out.width * roi_out.height);
+
+  TR_STEP("verify that an offset of more than a pixel is not taken for the rois' one");
+  shift.dx = 4.6f;
+  assert_false(dt_interpolation_permutation_probe(&perm, &roi_out, &roi_in, shift_backtransform, &shift));
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_flip_chain),
+    cmocka_unit_test(test_mixed_chain),
+    cmocka_unit_test(test_fractional_shift)
+  };
+
+  return cmocka_run_group_tests(tests, setup, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
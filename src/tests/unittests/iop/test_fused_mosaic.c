@@ -0,0 +1,217 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for fusing the raw front-end in the pixelpipe
+ *
+ * The pipe runs a chain of modules with process_mosaic() on bands of rows, the
+ * first module reading the uncropped sensor data and all others working in place
+ * on the output. This must give the same bits as running process() of every
+ * module on the full mosaic, with crops, gain maps and a last partial band.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "iop/rawprepare.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// size of the sensor data
+#define WIDTH 123
+#define HEIGHT 91
+
+// rows per band, the last band is partial
+#define BAND_ROWS 8
+
+// RGGB
+#define FILTERS 0x94949494u
+
+// gain map nodes per axis
+#define MAP_POINTS 3
+
+typedef struct rawprepare_t
+{
+  dt_iop_module_t module;
+  dt_iop_rawprepare_data_t data;
+  dt_dev_pixelpipe_iop_t piece;
+} rawprepare_t;
+
+static dt_develop_t dev;
+static dt_dev_pixelpipe_t mosaic_pipe;
+
+/*
+ * HELPERS
+ */
+
+static uint16_t *gen_sensor(const int width, const int height)
+{
+  testimg_noise_seed(1);
+  uint16_t *img = dt_alloc_align_type(uint16_t, (size_t)width * height);
+  for(size_t k = 0; k < (size_t)width * height; k++)
+    img[k] = testimg_noise_int(1 << 14);
+  return img;
+}
+
+static dt_dng_gain_map_t *gen_gainmap(const int plane)
+{
+  dt_dng_gain_map_t *map =
+    calloc(1, sizeof(dt_dng_gain_map_t) + sizeof(float) * MAP_POINTS * MAP_POINTS);
+  map->map_points_v = map->map_points_h = MAP_POINTS;
+  map->map_spacing_v = map->map_spacing_h = 1.0 / (MAP_POINTS - 1);
+  for(int k = 0; k < MAP_POINTS * MAP_POINTS; k++)
+    map->map_gain[k] = 1.0f + 0.05f * plane + 0.02f * k;
+  return map;
+}
+
+// crops left/top/right/bottom off a mosaic of width x height
+static void init_rawprepare(rawprepare_t *r, const int left, const int top,
+                            const int right, const int bottom,
+                            const float black, const float white,
+                            const int width, const int height,
+                            const dt_iop_buffer_type_t datatype)
+{
+  memset(r, 0, sizeof(rawprepare_t));
+  r->module.dev = &dev;
+  r->data.left = left;
+  r->data.top = top;
+  r->data.right = right;
+  r->data.bottom = bottom;
+  for(int k = 0; k < 4; k++)
+  {
+    r->data.sub[k] = black + k;
+    r->data.div[k] = white - black - 3.0f * k;
+  }
+  r->piece.data = &r->data;
+  r->piece.pipe = &mosaic_pipe;
+  r->piece.colors = 1;
+  r->piece.iscale = 1.0f;
+  r->piece.buf_in = (dt_iop_roi_t){ 0, 0, width, height, 1.0f };
+  r->piece.dsc_in.channels = 1;
+  r->piece.dsc_in.datatype = datatype;
+  r->piece.process_mosaic_ready = TRUE;
+}
+
+static void init_pipe_filters(void)
+{
+  dev.image_storage.buf_dsc.filters = FILTERS;
+  mosaic_pipe.image.buf_dsc.filters = FILTERS;
+  mosaic_pipe.dsc.filters = FILTERS;
+}
+
+static int setup(void **state)
+{
+  darktable.num_openmp_threads = dt_get_num_procs();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_fused_vs_unfused(void **state)
+{
+  for(int gainmaps = 0; gainmaps < 2; gainmaps++)
+  {
+    rawprepare_t a, b;
+    init_rawprepare(&a, 3, 2, 1, 4, 256.0f, 16383.0f, WIDTH, HEIGHT, TYPE_UINT16);
+    const dt_iop_roi_t roi_in = { 0, 0, WIDTH, HEIGHT, 1.0f };
+    const dt_iop_roi_t roi_out = { 0, 0, WIDTH - 4, HEIGHT - 6, 1.0f };
+    // a second normalisation of the cropped float mosaic, in place
+    init_rawprepare(&b, 0, 0, 0, 0, 0.01f, 1.2f, roi_out.width, roi_out.height, TYPE_FLOAT);
+    a.piece.processed_roi_in = roi_in;
+    b.piece.processed_roi_in = roi_out;
+
+    if(gainmaps)
+    {
+      a.data.apply_gainmaps = TRUE;
+      for(int f = 0; f < 4; f++) a.data.gainmaps[f] = gen_gainmap(f);
+    }
+
+    const size_t nout = (size_t)roi_out.width * roi_out.height;
+    uint16_t *in = gen_sensor(WIDTH, HEIGHT);
+    float *mid = dt_alloc_align_float(nout);
+    float *unfused = dt_alloc_align_float(nout);
+    float *fused = dt_alloc_align_float(nout);
+
+    TR_STEP("verify that the fused raw front-end gives the same bits as the modules one by one");
+    TR_DEBUG("gain maps %d", gainmaps);
+    init_pipe_filters();
+    process(&a.module, &a.piece, in, mid, &roi_in, &roi_out);
+    const uint32_t unfused_filters = mosaic_pipe.dsc.filters;
+    init_pipe_filters();
+    process(&b.module, &b.piece, mid, unfused, &roi_out, &roi_out);
+
+    // same as _dev_pixelpipe_process_bands() does for a run of raw modules
+    init_pipe_filters();
+    process_mosaic_prepare(&a.module, &a.piece);
+    assert_int_equal(mosaic_pipe.dsc.filters, unfused_filters);
+    init_pipe_filters();
+    process_mosaic_prepare(&b.module, &b.piece);
+    const int nbands = (roi_out.height + BAND_ROWS - 1) / BAND_ROWS;
+    assert_true(roi_out.height % BAND_ROWS);
+    DT_OMP_FOR()
+    for(int band = 0; band < nbands; band++)
+    {
+      const int row = band * BAND_ROWS;
+      const int rows = MIN(BAND_ROWS, roi_out.height - row);
+      process_mosaic(&a.module, &a.piece, in, fused, &roi_in, &roi_out, row, rows);
+      process_mosaic(&b.module, &b.piece, fused, fused, &roi_out, &roi_out, row, rows);
+    }
+
+    assert_memory_equal(fused, unfused, sizeof(float) * nout);
+
+    for(int f = 0; f < 4; f++) free(a.data.gainmaps[f]);
+    dt_free_align(in);
+    dt_free_align(mid);
+    dt_free_align(unfused);
+    dt_free_align(fused);
+  }
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_fused_vs_unfused)
+  };
+
+  return cmocka_run_group_tests(tests, setup, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,178 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for fusing runs of point-wise modules in the pixelpipe
+ *
+ * The pipe runs a chain of modules with process_pixels() band by band, the first
+ * module reading the input and all others working in place on the output. This
+ * must give the same bits as running process() of every module on the full
+ * buffer, including a last band that is only partially filled.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "iop/exposure.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// more than two bands, the last one partial
+#define WIDTH 211
+#define HEIGHT 97
+
+typedef struct exposure_t
+{
+  dt_iop_module_t module;
+  dt_iop_exposure_data_t data;
+  dt_dev_pixelpipe_iop_t piece;
+} exposure_t;
+
+static dt_dev_pixelpipe_t fused_pipe;
+
+/*
+ * HELPERS
+ */
+
+static float *gen_image(const int width, const int height)
+{
+  testimg_noise_seed(1);
+  float *img = dt_alloc_align_float((size_t)4 * width * height);
+  for(size_t k = 0; k < (size_t)4 * width * height; k++)
+    img[k] = 2.0f * testimg_noise() - 0.25f;
+  return img;
+}
+
+static void init_exposure(exposure_t *e, const float exposure, const float black)
+{
+  memset(e, 0, sizeof(exposure_t));
+  e->module.process_pixels = process_pixels;
+  e->module.process_pixels_prepare = process_pixels_prepare;
+  e->data.params.mode = EXPOSURE_MODE_MANUAL;
+  e->data.params.exposure = exposure;
+  e->data.params.black = black;
+  e->piece.data = &e->data;
+  e->piece.pipe = &fused_pipe;
+  e->piece.colors = 4;
+  e->piece.process_pixels_ready = TRUE;
+}
+
+// same as _dev_pixelpipe_process_pointwise() does for a run of modules
+static void fused_run(exposure_t **run, const int count,
+                      const float *const in, float *const out, const size_t npixels)
+{
+  for(int k = 0; k < count; k++)
+    run[k]->module.process_pixels_prepare(&run[k]->module, &run[k]->piece);
+
+  const size_t nbands = (npixels + DT_IOP_PIXELS_BAND - 1) / DT_IOP_PIXELS_BAND;
+  DT_OMP_FOR()
+  for(size_t b = 0; b < nbands; b++)
+  {
+    const size_t offset = 4 * b * DT_IOP_PIXELS_BAND;
+    const size_t n = MIN(DT_IOP_PIXELS_BAND, npixels - b * DT_IOP_PIXELS_BAND);
+    run[0]->module.process_pixels(&run[0]->module, &run[0]->piece, in + offset, out + offset, n);
+    for(int k = 1; k < count; k++)
+      run[k]->module.process_pixels(&run[k]->module, &run[k]->piece,
+                                    out + offset, out + offset, n);
+  }
+}
+
+static int setup(void **state)
+{
+  darktable.num_openmp_threads = dt_get_num_procs();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_fused_vs_unfused(void **state)
+{
+  const dt_iop_roi_t roi = { 0, 0, WIDTH, HEIGHT, 1.0f };
+  const size_t npixels = (size_t)WIDTH * HEIGHT;
+  float *in = gen_image(WIDTH, HEIGHT);
+  float *mid = dt_alloc_align_float(4 * npixels);
+  float *unfused = dt_alloc_align_float(4 * npixels);
+  float *fused = dt_alloc_align_float(4 * npixels);
+
+  exposure_t a, b, c;
+  init_exposure(&a, 0.7f, 0.01f);
+  init_exposure(&b, -1.3f, -0.02f);
+  init_exposure(&c, 2.1f, 0.0f);
+  exposure_t *run[] = { &a, &b, &c };
+
+  TR_STEP("verify that a fused run gives the same bits as the modules one by one");
+  assert_true(npixels > 2 * DT_IOP_PIXELS_BAND && npixels % DT_IOP_PIXELS_BAND);
+  for(int k = 0; k < 3; k++) fused_pipe.dsc.processed_maximum[k] = 1.0f;
+  process(&a.module, &a.piece, in, unfused, &roi, &roi);
+  process(&b.module, &b.piece, unfused, mid, &roi, &roi);
+  process(&c.module, &c.piece, mid, unfused, &roi, &roi);
+  const float unfused_maximum = fused_pipe.dsc.processed_maximum[0];
+
+  for(int k = 0; k < 3; k++) fused_pipe.dsc.processed_maximum[k] = 1.0f;
+  fused_run(run, 3, in, fused, npixels);
+  assert_memory_equal(fused, unfused, sizeof(float) * 4 * npixels);
+
+  TR_STEP("verify that the per-image setup is done once per module");
+  TR_DEBUG("processed maximum fused %e, unfused %e", fused_pipe.dsc.processed_maximum[0], unfused_maximum);
+  assert_true(fused_pipe.dsc.processed_maximum[0] == unfused_maximum);
+
+  TR_STEP("verify that a single module in place gives the same bits as out of place");
+  process(&a.module, &a.piece, in, unfused, &roi, &roi);
+  memcpy(fused, in, sizeof(float) * 4 * npixels);
+  fused_run(run, 1, fused, fused, npixels);
+  assert_memory_equal(fused, unfused, sizeof(float) * 4 * npixels);
+
+  dt_free_align(in);
+  dt_free_align(mid);
+  dt_free_align(unfused);
+  dt_free_align(fused);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_fused_vs_unfused)
+  };
+
+  return cmocka_run_group_tests(tests, setup, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
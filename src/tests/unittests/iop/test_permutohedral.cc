@@ -0,0 +1,281 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the permutohedral lattice of the surface blur module
+ *
+ * The splat into the shared hash table must not depend on thread timing, it
+ * has to recover from a too small table and the downsampled splat has to stay
+ * close to the full one. The benchmark build reports the speed for growing
+ * thread counts.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+extern "C" {
+#include <cmocka.h>
+}
+
+#include "../util/tracing.h"
+extern "C" {
+#include "../util/testimg.h"
+}
+
+#include "common/darktable.h"
+#include "iop/Permutohedral.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+#define WIDTH 768
+#define HEIGHT 512
+
+/*
+ * HELPERS
+ */
+
+// a checkerboard of 64 pixel squares with some noise on top
+static float *make_image(const size_t width, const size_t height, const float noise)
+{
+  float *img = dt_alloc_align_float(4 * width * height);
+  for(size_t j = 0; j < height; j++)
+    for(size_t i = 0; i < width; i++)
+    {
+      const float base = ((i / 64 + j / 64) & 1) ? 0.7f : 0.2f;
+      for(int c = 0; c < 3; c++)
+        img[4 * (j * width + i) + c] = base + 0.02f * c + noise * (testimg_noise() - 0.5f);
+      img[4 * (j * width + i) + 3] = 0.0f;
+    }
+  return img;
+}
+
+// the bilateral filter of the surface blur module, splatting one pixel per
+// stride x stride block, with a given number of chunks and grid points
+static void bilateral(const float *const in,
+                      float *const out,
+                      const size_t width,
+                      const size_t height,
+                      const float sigma_s,
+                      const float sigma_r,
+                      const int stride,
+                      const size_t chunks,
+                      const size_t grid_points)
+{
+  const float sigma[5] = { 1.0f / sigma_s, 1.0f / sigma_s, 1.0f / sigma_r, 1.0f / sigma_r, 1.0f / sigma_r };
+  const size_t splat_width = (width + stride - 1) / stride;
+  const size_t splat_height = (height + stride - 1) / stride;
+  PermutohedralLattice<5, 4> lattice(splat_width * splat_height, chunks, grid_points);
+  lattice.splat([&](const size_t index, float *pos, float *val)
+  {
+    const size_t j = MIN(stride * (index / splat_width) + stride / 2, height - 1);
+    const size_t i = MIN(stride * (index % splat_width) + stride / 2, width - 1);
+    const float *pixel = in + 4 * (j * width + i);
+    pos[0] = i * sigma[0];
+    pos[1] = j * sigma[1];
+    for(int c = 0; c < 3; c++)
+    {
+      pos[2 + c] = pixel[c] * sigma[2 + c];
+      val[c] = pixel[c];
+    }
+    val[3] = 1.0f;
+  });
+  lattice.blur();
+
+  if(stride == 1)
+  {
+    for(size_t k = 0; k < width * height; k++)
+      lattice.slice(out + 4 * k, k);
+  }
+  else
+  {
+    float *pos = dt_alloc_align_float(5 * width * height);
+    for(size_t k = 0; k < width * height; k++)
+    {
+      pos[5 * k + 0] = (k % width) * sigma[0];
+      pos[5 * k + 1] = (k / width) * sigma[1];
+      for(int c = 0; c < 3; c++)
+        pos[5 * k + 2 + c] = in[4 * k + c] * sigma[2 + c];
+    }
+    lattice.slice(out, pos, width * height);
+    dt_free_align(pos);
+  }
+  for(size_t k = 0; k < width * height; k++)
+    for(int c = 0; c < 4; c++)
+      out[4 * k + c] /= out[4 * k + 3];
+}
+
+static size_t grid_points(const float sigma_s, const float sigma_r)
+{
+  return (size_t)((HEIGHT / sigma_s) * (WIDTH / sigma_s) / (sigma_r * sigma_r * sigma_r));
+}
+
+static void set_threads(const int threads)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+}
+
+static int setup(void **state)
+{
+  darktable.num_openmp_threads = dt_get_num_procs();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_flat(void **state)
+{
+  testimg_noise_seed(1);
+  const size_t npixels = WIDTH * HEIGHT;
+  float *in = make_image(WIDTH, HEIGHT, 0.0f);
+  float *out = dt_alloc_align_float(4 * npixels);
+  for(size_t k = 0; k < 4 * npixels; k++) in[k] = 0.5f;
+
+  TR_STEP("a flat image stays flat");
+  bilateral(in, out, WIDTH, HEIGHT, 8.0f, 0.1f, 1, 4, grid_points(8.0f, 0.1f));
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++)
+      assert_float_equal(out[4 * k + c], 0.5f, 1e-5f);
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+
+static void test_chunks(void **state)
+{
+  testimg_noise_seed(2);
+  const size_t npixels = WIDTH * HEIGHT;
+  float *in = make_image(WIDTH, HEIGHT, 0.05f);
+  float *single = dt_alloc_align_float(4 * npixels);
+  float *first = dt_alloc_align_float(4 * npixels);
+  float *second = dt_alloc_align_float(4 * npixels);
+  const size_t points = grid_points(8.0f, 0.1f);
+
+  set_threads(dt_get_num_threads());
+  TR_STEP("splatting from several threads gives the same result every time");
+  bilateral(in, first, WIDTH, HEIGHT, 8.0f, 0.1f, 1, 7, points);
+  bilateral(in, second, WIDTH, HEIGHT, 8.0f, 0.1f, 1, 7, points);
+  assert_memory_equal(first, second, 4 * npixels * sizeof(float));
+
+  TR_STEP("chunks only change the order of the sums");
+  bilateral(in, single, WIDTH, HEIGHT, 8.0f, 0.1f, 1, 1, points);
+  for(size_t k = 0; k < 4 * npixels; k++)
+    assert_float_equal(single[k], first[k], 1e-5f);
+
+  TR_STEP("a too small table is grown without changing the result");
+  // a small range sigma needs far more lattice points than estimated from one grid point
+  bilateral(in, first, WIDTH, HEIGHT, 2.0f, 0.02f, 1, 7, grid_points(2.0f, 0.02f));
+  bilateral(in, second, WIDTH, HEIGHT, 2.0f, 0.02f, 1, 7, 1);
+  assert_memory_equal(first, second, 4 * npixels * sizeof(float));
+
+  dt_free_align(in);
+  dt_free_align(single);
+  dt_free_align(first);
+  dt_free_align(second);
+}
+
+static void test_stride(void **state)
+{
+  testimg_noise_seed(3);
+  const size_t npixels = WIDTH * HEIGHT;
+  float *in = make_image(WIDTH, HEIGHT, 0.05f);
+  float *full = dt_alloc_align_float(4 * npixels);
+  float *down = dt_alloc_align_float(4 * npixels);
+  const size_t points = grid_points(8.0f, 0.1f);
+
+  TR_STEP("splatting every second pixel stays close to the full splat");
+  bilateral(in, full, WIDTH, HEIGHT, 8.0f, 0.1f, 1, 4, points);
+  bilateral(in, down, WIDTH, HEIGHT, 8.0f, 0.1f, 2, 4, points);
+  double error = 0.0;
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++)
+      error += fabsf(full[4 * k + c] - down[4 * k + c]);
+  error /= 3 * npixels;
+  TR_DEBUG("mean error %.6f", error);
+  assert_true(error < 2e-3);
+
+  dt_free_align(in);
+  dt_free_align(full);
+  dt_free_align(down);
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_benchmark(void **state)
+{
+  testimg_noise_seed(4);
+  const size_t width = 4 * WIDTH;
+  const size_t height = 4 * HEIGHT;
+  const size_t npixels = width * height;
+  float *in = make_image(width, height, 0.05f);
+  float *out = dt_alloc_align_float(4 * npixels);
+  const size_t points = (size_t)((height / 16.0f) * (width / 16.0f) / (0.1f * 0.1f * 0.1f));
+
+  TR_DEBUG("%.1f MB estimated for the table", 1e-6 * PermutohedralLattice<5, 4>::estimatedBytes(points, npixels));
+  const int maxthreads = dt_get_num_threads();
+  for(int threads = 1; ; threads = MIN(2 * threads, maxthreads))
+  {
+    set_threads(threads);
+    const double start = dt_get_wtime();
+    bilateral(in, out, width, height, 16.0f, 0.1f, 1, threads, points);
+    const double full = dt_get_wtime() - start;
+    bilateral(in, out, width, height, 16.0f, 0.1f, 4, threads, points);
+    const double down = dt_get_wtime() - start - full;
+    TR_DEBUG("%d threads: %.1f Mpx/s, downsampled splat %.1f Mpx/s",
+             threads, 1e-6 * npixels / full, 1e-6 * npixels / down);
+    if(threads == maxthreads) break;
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_flat),
+    cmocka_unit_test(test_chunks),
+    cmocka_unit_test(test_stride),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, setup, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,272 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2024 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the segmentation used by the highlights reconstruction
+ *
+ * The parallel labeling must find the same segments as the floodfill it replaced,
+ * the bit-packed morphological closing must give the same result as a per-location
+ * test of the structuring elements.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "common/darktable.h"
+#include "iop/hlreconstruct/segmentation.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+#define BORDER 9
+
+/*
+ * HELPERS
+ */
+
+static gboolean inside(const int x, const int y, const int w, const int h, const int margin)
+{
+  return x >= BORDER + margin && x < w - BORDER - margin
+      && y >= BORDER + margin && y < h - BORDER - margin;
+}
+
+/* synthetic clipping mask of ellipses, staircase lines crossing many rows and isolated
+   specks of 1-4 locations. Everything keeps away from the frame border by `margin` */
+static void gen_mask(uint32_t *d, const int w, const int h, const int blobs, const int lines,
+                     const int specks, const int margin)
+{
+  memset(d, 0, sizeof(uint32_t) * w * h);
+  for(int b = 0; b < blobs; b++)
+  {
+    const int cx = testimg_noise_int(w), cy = testimg_noise_int(h);
+    const int rx = 1 + testimg_noise_int(25), ry = 1 + testimg_noise_int(25);
+    for(int y = cy - ry; y <= cy + ry; y++)
+      for(int x = cx - rx; x <= cx + rx; x++)
+      {
+        const float u = (float)(x - cx) / rx, v = (float)(y - cy) / ry;
+        if(inside(x, y, w, h, margin) && u * u + v * v <= 1.0f)
+          d[(size_t)y * w + x] = 1;
+      }
+  }
+  for(int l = 0; l < lines; l++)
+  {
+    int x = testimg_noise_int(w), y = BORDER + margin;
+    while(inside(x, y, w, h, margin))
+    {
+      d[(size_t)y * w + x] = 1;
+      if(testimg_noise_int(2)) y++;
+      else x += (l & 1) ? 1 : -1;
+    }
+  }
+  for(int s = 0; s < specks; s++)
+  {
+    const int x = testimg_noise_int(w), y = testimg_noise_int(h);
+    gboolean free = inside(x - 2, y - 2, w, h, margin) && inside(x + 3, y + 3, w, h, margin);
+    for(int yy = y - 2; free && yy <= y + 3; yy++)
+      for(int xx = x - 2; xx <= x + 3; xx++)
+        free &= d[(size_t)yy * w + xx] == 0;
+    if(!free) continue;
+    const int n = 1 + testimg_noise_int(4);
+    d[(size_t)y * w + x] = 1;
+    if(n > 1) d[(size_t)y * w + x + 1] = 1;
+    if(n > 2) d[(size_t)(y + 1) * w + x] = 1;
+    if(n > 3) d[(size_t)(y + 1) * w + x + 1] = 1;
+  }
+}
+
+static void init_pair(dt_iop_segmentation_t *ref, dt_iop_segmentation_t *seg,
+                      const int w, const int h, const int slots)
+{
+  assert_false(dt_segmentation_init_struct(ref, w, h, BORDER, slots));
+  assert_false(dt_segmentation_init_struct(seg, w, h, BORDER, slots));
+}
+
+static void assert_same_segments(const dt_iop_segmentation_t *ref, const dt_iop_segmentation_t *seg)
+{
+  assert_int_equal(seg->nr, ref->nr);
+  for(int id = 2; id < ref->nr; id++)
+  {
+    assert_int_equal(seg->size[id], ref->size[id]);
+    assert_int_equal(seg->xmin[id], ref->xmin[id]);
+    assert_int_equal(seg->xmax[id], ref->xmax[id]);
+    assert_int_equal(seg->ymin[id], ref->ymin[id]);
+    assert_int_equal(seg->ymax[id], ref->ymax[id]);
+  }
+  assert_memory_equal(seg->data, ref->data, sizeof(uint32_t) * seg->width * seg->height);
+}
+
+static void segmentize_both(dt_iop_segmentation_t *ref, dt_iop_segmentation_t *seg)
+{
+  memcpy(seg->data, ref->data, sizeof(uint32_t) * ref->width * ref->height);
+  _segmentize_floodfill(ref);
+  dt_segmentize_plane(seg);
+}
+
+// closing by testing the structuring element at every location
+static void reference_closing(uint32_t *img, const int w, const int h, const int radius)
+{
+  uint32_t *tmp = dt_calloc_align_type(uint32_t, (size_t)w * h);
+  _intimage_borderfill(img, w, h, 0, BORDER);
+  for(int pass = 0; pass < (radius > 3 ? 2 : 1); pass++)
+  {
+    const uint32_t *in = pass ? tmp : img;
+    uint32_t *out = pass ? img : tmp;
+    const int r = pass ? radius - 3 : radius;
+    if(pass) _intimage_borderfill(tmp, w, h, 1, BORDER);
+    for(int y = BORDER; y < h - BORDER; y++)
+      for(int x = BORDER; x < w - BORDER; x++)
+      {
+        int any = 0, all = 1;
+        for(int dy = -r; dy <= r; dy++)
+          for(int dx = _morph_extent[r-1][dy+8][0]; dx <= _morph_extent[r-1][dy+8][1]; dx++)
+          {
+            const uint32_t v = in[(size_t)(y + dy) * w + x + dx];
+            any |= v != 0;
+            all &= v != 0;
+          }
+        out[(size_t)y * w + x] = pass ? all : any;
+      }
+  }
+  if(radius <= 3)
+    memcpy(img, tmp, sizeof(uint32_t) * w * h);
+  _intimage_borderfill(img, w, h, 0, BORDER);
+  dt_free_align(tmp);
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_segmentize(void **state)
+{
+  TR_STEP("verify the labeling finds the floodfill segments");
+  const int sizes[4][2] = { { 200, 150 }, { 641, 427 }, { 1027, 700 }, { 2000, 1337 } };
+  testimg_noise_seed(1);
+  for(int s = 0; s < 4; s++)
+  {
+    const int w = sizes[s][0], h = sizes[s][1];
+    for(int density = 0; density < 3; density++)
+    {
+      dt_iop_segmentation_t ref, seg;
+      init_pair(&ref, &seg, w, h, w * h / 16);
+      gen_mask(ref.data, w, h, w * h / (4000 >> (2 * density)), density * 3, w * h / 300, 3);
+      segmentize_both(&ref, &seg);
+      assert_same_segments(&ref, &seg);
+      dt_segmentation_free_struct(&ref);
+      dt_segmentation_free_struct(&seg);
+    }
+  }
+}
+
+static void test_segment_limit(void **state)
+{
+  TR_STEP("verify segments beyond the available ids are left as they are");
+  const int w = 400, h = 300;
+  dt_iop_segmentation_t ref, seg;
+  init_pair(&ref, &seg, w, h, 256);
+  for(int y = BORDER + 3; y < h - BORDER - 4; y += 3)
+    for(int x = BORDER + 3; x < w - BORDER - 4; x += 3)
+      ref.data[(size_t)y * w + x] = ref.data[(size_t)y * w + x + 1] =
+      ref.data[(size_t)(y + 1) * w + x] = ref.data[(size_t)(y + 1) * w + x + 1] = 1;
+  segmentize_both(&ref, &seg);
+  assert_int_equal(seg.nr, seg.slots - 2);
+  assert_same_segments(&ref, &seg);
+  dt_segmentation_free_struct(&ref);
+  dt_segmentation_free_struct(&seg);
+}
+
+static void test_combine(void **state)
+{
+  TR_STEP("verify the bit-packed closing for all radii");
+  const int w = 331, h = 205;
+  testimg_noise_seed(2);
+  for(int radius = 1; radius <= 8; radius++)
+  {
+    dt_iop_segmentation_t ref, seg;
+    init_pair(&ref, &seg, w, h, 256);
+    gen_mask(ref.data, w, h, 60, 2, 100, 0);
+    memcpy(seg.data, ref.data, sizeof(uint32_t) * w * h);
+    reference_closing(ref.data, w, h, radius);
+    dt_segments_combine(&seg, radius);
+    assert_memory_equal(seg.data, ref.data, sizeof(uint32_t) * w * h);
+    dt_segmentation_free_struct(&ref);
+    dt_segmentation_free_struct(&seg);
+  }
+}
+
+#ifdef DT_UNITTEST_BENCHMARK
+static void test_benchmark(void **state)
+{
+  TR_STEP("compare the timings for a large plane");
+  const int w = 4000, h = 2700;
+  dt_iop_segmentation_t ref, seg;
+  init_pair(&ref, &seg, w, h, 0x10000);
+  testimg_noise_seed(3);
+  gen_mask(ref.data, w, h, w * h / 2000, 4, w * h / 300, 12);
+  const double start = dt_get_wtime();
+  dt_segments_combine(&ref, 4);
+  const double closed = dt_get_wtime();
+  memcpy(seg.data, ref.data, sizeof(uint32_t) * w * h);
+  const double copied = dt_get_wtime();
+  _segmentize_floodfill(&ref);
+  const double flooded = dt_get_wtime();
+  dt_segmentize_plane(&seg);
+  const double labeled = dt_get_wtime();
+  TR_DEBUG("%ix%i, %i segments: closing %.1fms, floodfill %.1fms, labeling %.1fms",
+           w, h, ref.nr - 2, 1e3 * (closed - start), 1e3 * (flooded - copied), 1e3 * (labeled - flooded));
+  assert_same_segments(&ref, &seg);
+  dt_segmentation_free_struct(&ref);
+  dt_segmentation_free_struct(&seg);
+}
+#endif
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_segmentize),
+    cmocka_unit_test(test_segment_limit),
+    cmocka_unit_test(test_combine),
+#ifdef DT_UNITTEST_BENCHMARK
+    cmocka_unit_test(test_benchmark),
+#endif
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
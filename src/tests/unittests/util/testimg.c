@@ -278,6 +278,31 @@ Testimg *testimg_gen_grey_with_rgb_clipping(const int width)
   }
   return ti;
 }
+
+// linear congruential generator, good enough for test data and the same on
+// all platforms
+static uint32_t noise_state = 1;
+
+void testimg_noise_seed(const uint32_t seed)
+{
+  noise_state = seed;
+}
+
+static uint32_t noise_next()
+{
+  noise_state = noise_state * 1664525u + 1013904223u;
+  return noise_state >> 8;
+}
+
+float testimg_noise()
+{
+  return (float)noise_next() / (float)(1 << 24);
+}
+
+uint32_t testimg_noise_int(const uint32_t range)
+{
+  return noise_next() % range;
+}
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
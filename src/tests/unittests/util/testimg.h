@@ -22,6 +22,8 @@
  * Please see ../README.md for more detailed documentation.
  */
 
+#include <stdint.h>
+
 typedef struct Testimg
 {
   int width;
@@ -161,6 +163,21 @@ Testimg *testimg_gen_grey_max_dr_neg();
 // create 3 "grey'ish" gradients where in each one a color dominates and clips:
 // height: 3, y=0 => red clips, y=1 => green clips, y=2 => blue clips
 Testimg *testimg_gen_grey_with_rgb_clipping(const int width);
+
+
+/*
+ * Noise generation
+ */
+
+// restart the noise with the given seed, the same seed always gives the same
+// sequence:
+void testimg_noise_seed(const uint32_t seed);
+
+// next uniform noise value in [0.0; 1.0[:
+float testimg_noise();
+
+// next uniform integer noise value in [0; range[:
+uint32_t testimg_noise_int(const uint32_t range);
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
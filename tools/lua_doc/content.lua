@@ -654,6 +654,16 @@ darktable.debug.type:set_text([[Similar to the system function type() but it wil
 	"This function should be called if an image is modified out of darktable to force DT to regenerate the thumbnail"..para()..
 	"darktable will regenerate the thumbnail by itself when it is needed")
 	types.dt_lua_image_t.drop_cache:add_parameter("self",types.dt_lua_image_t,[[The image whose cache must be dropped.]]):set_attribute("is_self",true)
+	types.dt_lua_image_t.get_pixels:set_text([[Returns the pixels of the thumbnail best matching the requested size, taken from the mipmap cache.]]..para()..
+	[[The thumbnail is generated if needed, this does not trigger any redraw of the user interface.]])
+	types.dt_lua_image_t.get_pixels:set_attribute("implicit_yield",true)
+	types.dt_lua_image_t.get_pixels:add_parameter("self",types.dt_lua_image_t,[[The image to read.]]):set_attribute("is_self",true)
+	types.dt_lua_image_t.get_pixels:add_parameter("width","integer",[[The requested width.]])
+	types.dt_lua_image_t.get_pixels:add_parameter("height","integer",[[The requested height.]])
+	types.dt_lua_image_t.get_pixels:add_return("string",[[The pixels as packed 8 bit RGB, row by row, or nil if no thumbnail could be obtained.]])
+	types.dt_lua_image_t.get_pixels:add_return("integer",[[The actual width of the thumbnail.]])
+	types.dt_lua_image_t.get_pixels:add_return("integer",[[The actual height of the thumbnail.]])
+	types.dt_lua_image_t.get_pixels:add_return("string",[[The colour space of the pixels: "srgb", "adobergb" or "display" for the display profile of darktable, following the thumbnail settings. nil if the thumbnail was taken untagged from the file, these are usually sRGB.]])
 
 	types.dt_imageio_module_format_t:set_text([[A virtual type representing all format types.]])
 	types.dt_imageio_module_format_t.plugin_name:set_text([[A unique name for the plugin.]])
@@ -669,6 +679,33 @@ darktable.debug.type:set_text([[Similar to the system function type() but it wil
 	types.dt_imageio_module_format_t.write_image:add_parameter("filename","string",[[The filename to export to.]])
 	types.dt_imageio_module_format_t.write_image:add_parameter("allow_upscale","boolean",[[Set to true to allow upscaling of the image.]]):set_attribute("optional",true)
 	types.dt_imageio_module_format_t.write_image:add_return("boolean",[[Returns false on success.]])
+	types.dt_imageio_module_format_t.write_image_async:set_text([[Queues the export of an image to a file and returns immediately.]]..para()..
+	[[Several exports run in parallel, the number of simultaneous exports is limited by the memory available to darktable.]])
+	types.dt_imageio_module_format_t.write_image_async:add_parameter("self",types.dt_imageio_module_format_t,[[The format that will be used to export.]]):set_attribute("is_self",true)
+	types.dt_imageio_module_format_t.write_image_async:add_parameter("image",types.dt_lua_image_t,[[The image object to export.]])
+	types.dt_imageio_module_format_t.write_image_async:add_parameter("filename","string",[[The filename to export to.]])
+	types.dt_imageio_module_format_t.write_image_async:add_parameter("allow_upscale","boolean",[[Set to true to allow upscaling of the image.]]):set_attribute("optional",true)
+	tmp = types.dt_imageio_module_format_t.write_image_async:add_parameter("callback","function",[[A function called once the export is finished, failed or was cancelled.]])
+	tmp:set_attribute("optional",true)
+	tmp:add_parameter("job",types.dt_lua_export_job_t,[[The job that finished.]])
+	tmp:add_parameter("success","boolean",[[True if the image was exported.]])
+	types.dt_imageio_module_format_t.write_image_async:add_parameter("options","table",[[Overrides the settings of the export module: a boolean high_quality to process at full resolution before downscaling, a boolean export_masks to add the masks to formats supporting them and an icc_filename string naming the output profile.]]):set_attribute("optional",true)
+	types.dt_imageio_module_format_t.write_image_async:add_return(types.dt_lua_export_job_t,[[A handle on the queued export.]])
+
+	types.dt_lua_export_job_t:set_text([[A handle on an export queued with ]]..my_tostring(types.dt_imageio_module_format_t.write_image_async))
+	types.dt_lua_export_job_t.state:set_text([[The state of the export.]])
+	types.dt_lua_export_job_t.state:set_reported_type(types.dt_lua_export_job_state_t)
+	types.dt_lua_export_job_t.progress:set_text([[The progress of the export, between 0 and 1. It moves as the modules of the pipe get processed.]])
+	types.dt_lua_export_job_t.image:set_text([[The image being exported.]])
+	types.dt_lua_export_job_t.filename:set_text([[The file the image is exported to.]])
+	types.dt_lua_export_job_t.cancel:set_text([[Cancels the export if it has not started yet.]])
+	types.dt_lua_export_job_t.cancel:add_parameter("self",types.dt_lua_export_job_t,[[The job to cancel.]]):set_attribute("is_self",true)
+	types.dt_lua_export_job_t.cancel:add_return("boolean",[[True if the job was cancelled.]])
+	types.dt_lua_export_job_t.wait:set_text([[Blocks until the export is finished.]])
+	types.dt_lua_export_job_t.wait:set_attribute("implicit_yield",true)
+	types.dt_lua_export_job_t.wait:add_parameter("self",types.dt_lua_export_job_t,[[The job to wait for.]]):set_attribute("is_self",true)
+	types.dt_lua_export_job_t.wait:add_return("boolean",[[True if the image was exported.]])
+	types.dt_lua_export_job_state_t:set_text([[The state of an asynchronous export.]])
 
 	types.dt_imageio_module_format_data_png:set_text([[Type object describing parameters to export to png.]])
 	types.dt_imageio_module_format_data_png.bpp:set_text([[The bpp parameter to use when exporting.]])